@@ -3,7 +3,9 @@ message(Added CORE module)
 SOURCES += \
     $$ROBOCONTROLLERSDKPATH/mod_CORE/src/robocontrollersdk.cpp \
     $$ROBOCONTROLLERSDKPATH/mod_CORE/src/exception.cpp \
-    $$ROBOCONTROLLERSDKPATH/mod_CORE/src/qwebcamclient.cpp
+    $$ROBOCONTROLLERSDKPATH/mod_CORE/src/qwebcamclient.cpp \
+    $$ROBOCONTROLLERSDKPATH/mod_CORE/src/qserverfinder.cpp \
+    $$ROBOCONTROLLERSDKPATH/mod_CORE/src/qrecordingreader.cpp
 
 INCLUDEPATH += $$ROBOCONTROLLERSDKPATH/mod_CORE/include/
 
@@ -12,7 +14,10 @@ HEADERS += \
         $$ROBOCONTROLLERSDKPATH/mod_CORE/include/RoboControllerSDK_global.h \
         $$ROBOCONTROLLERSDKPATH/mod_CORE/include/exception.h \
         $$ROBOCONTROLLERSDKPATH/mod_CORE/include/network_msg.h \
-        $$ROBOCONTROLLERSDKPATH/mod_CORE/include/qwebcamclient.h
+        $$ROBOCONTROLLERSDKPATH/mod_CORE/include/qwebcamclient.h \
+        $$ROBOCONTROLLERSDKPATH/mod_CORE/include/qtriplebuffer.h \
+        $$ROBOCONTROLLERSDKPATH/mod_CORE/include/qserverfinder.h \
+        $$ROBOCONTROLLERSDKPATH/mod_CORE/include/qrecordingreader.h
 
 win32 {
 #to avoid error with qdatetime.h
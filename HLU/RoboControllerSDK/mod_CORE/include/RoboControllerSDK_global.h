@@ -129,6 +129,55 @@ typedef struct _RobotConfiguration
     // <<<<< Battery
 } RobotConfiguration;
 
+/**
+  * @struct _SpeedSetPoint
+  * @brief A point of a speed trajectory played by the server
+  *        (see @ref RoboControllerSDK::setMotorSpeedsTrajectory)
+  */
+typedef struct _SpeedSetPoint
+{
+    quint16 timeOffsetMsec; /**< Time of the point (msec) relative to the reception of the trajectory by the server */
+    double speed0;          /**< The speed of motor 0 in m/sec */
+    double speed1;          /**< The speed of motor 1 in m/sec */
+} SpeedSetPoint;
+
+/**
+  * @struct _ControlLinkStats
+  * @brief Statistics of the redundant control link evaluated by the server
+  *        (see @ref RoboControllerSDK::setControlRedundancy)
+  */
+typedef struct _ControlLinkStats
+{
+    quint32 received;   /**< Control datagrams received by the server */
+    quint32 lost;       /**< Control datagrams never received by the server */
+    quint32 recovered;  /**< Lost datagrams whose setpoint was carried by a following datagram */
+    quint32 stale;      /**< Duplicated or out of order datagrams ignored by the server */
+} ControlLinkStats;
+
+/**
+  * @struct _RobotOdometry
+  * @brief Motion of the robot estimated by the server fusing the wheel
+  *        encoders with the camera (see @ref RoboControllerSDK::getOdometry)
+  */
+typedef struct _RobotOdometry
+{
+    double speed0;              /**< Speed of motor 0 read from the board (m/sec) */
+    double speed1;              /**< Speed of motor 1 read from the board (m/sec) */
+
+    bool valid;                 /**< The server is estimating the motion */
+    double linearSpeed;         /**< Fused forward speed (m/sec) */
+    double angularSpeed;        /**< Fused yaw rate (rad/sec, counterclockwise) */
+
+    bool visionValid;           /**< The camera measured the motion of the last frame */
+    double visionLinearSpeed;   /**< Forward speed measured by the camera (m/sec) */
+    double visionAngularSpeed;  /**< Yaw rate measured by the camera (rad/sec) */
+
+    bool slipping;              /**< Encoders and camera disagree: the estimate follows the camera */
+    quint16 inliers;            /**< Floor features agreeing with the motion measured by the camera */
+    double processMsec;         /**< Vision compute time of the last frame on the server (msec) */
+    quint16 ageMsec;            /**< Time elapsed since the estimate (msec) */
+} RobotOdometry;
+
 }
 
 #endif // ROBOCONTROLLERSDK_GLOBAL_H
@@ -1,6 +1,8 @@
 #ifndef NETWORK_MSG_H
 #define NETWORK_MSG_H
 
+#include <QtCore/qglobal.h>
+
 #define TCP_START_VAL 0x55AA /*!< Start word for TCP data block */
 #define UDP_START_VAL 0xAA55 /*!< Start word for UDP data block */
 
@@ -15,6 +17,10 @@
 #define     MSG_SERVER_PING_OK      (MESSAGES + 7)  ///< Is received in reply to PING_REQ if everything is fine
 #define     MSG_ROBOT_CTRL_OK       (MESSAGES + 8)  ///< Received if the client takes the Motion Control of the robot successfully with @ref CMD_GET_ROBOT_CTRL message
 #define     MSG_ROBOT_CTRL_KO       (MESSAGES + 9)  ///< Received if the client tries to take the Motion Control of the Robot, but there is another one controlling it
+#define     MSG_TRAJ_UNDERRUN       (MESSAGES + 10) ///< Sent on UDP Status to the controlling client when the server played the whole speed trajectory (followed by the total underrun count)
+#define     MSG_CTRL_LINK_STATS     (MESSAGES + 11) ///< Sent on UDP Status to the controlling client with the statistics of the redundant control link (followed by received, lost, recovered and stale datagrams as [high word][low word])
+#define     MSG_CONFIG_HASH         (MESSAGES + 12) ///< Reply to @ref CMD_GET_CONFIG_HASH (followed by the hash, see @ref configHash)
+#define     MSG_ODOMETRY            (MESSAGES + 13) ///< Reply to @ref CMD_GET_ODOMETRY on UDP Status (followed by [speed0][speed1][flags][linear][angular][vision linear][vision angular][inliers][process usec][age msec]. Speeds in mm/sec and mrad/sec, 2-complement. Flags ODOM_FLAG_*)
 #define     MSG_ROBOT_CTRL_RELEASED (MESSAGES + 19) ///< Received if the client released the Motion Control of the robot successfully
 
 #define     COMMANDS                200
@@ -22,7 +28,82 @@
 #define     CMD_REL_ROBOT_CTRL      (COMMANDS + 2) ///< Release the motion control of the robot
 #define     CMD_RD_MULTI_REG        (COMMANDS + 3) ///< Asks the values of "n" consequtive modbus registers on the RoboController board
 #define     CMD_WR_MULTI_REG        (COMMANDS + 4) ///< Sends the values of "n" consequtive modbus registers on the RoboController board
-#define     CMD_SERVER_PING_REQ     (COMMANDS + 5) ///< Client sends this message to verify that server is running
+#define     CMD_SERVER_PING_REQ     (COMMANDS + 5) ///< Client sends this message to verify that server is running (optionally followed by a sequence number: the reply on UDP Status will then contain [board idx][capabilities][sequence number])
+#define     CMD_SET_SPEED_TRAJ      (COMMANDS + 6) ///< Uploads a time-stamped speed trajectory (followed by the number of points and by [time offset msec][speed0][speed1] for each point)
+#define     CMD_SET_SPEED_REDUNDANT (COMMANDS + 7) ///< Sets the motor speeds carrying also the previous setpoints (followed by the sequence number of the newest setpoint, the number of setpoints and by [speed0][speed1] for each setpoint, from the newest with consecutive decreasing sequence numbers)
+#define     CMD_GET_CONFIG_HASH     (COMMANDS + 8) ///< Asks the hash of the robot configuration stored on the board (the reply is @ref MSG_CONFIG_HASH)
+#define     CMD_GET_ODOMETRY        (COMMANDS + 9) ///< Asks the speeds of the motors with the motion estimated fusing encoders and camera (the reply is @ref MSG_ODOMETRY)
 // <--- TCP Commands and Messages
 
+#define     TRAJ_MAX_POINTS         32  ///< Max number of points of a speed trajectory sent with @ref CMD_SET_SPEED_TRAJ
+#define     CTRL_MAX_REDUNDANCY     8   ///< Max number of previous setpoints carried by @ref CMD_SET_SPEED_REDUNDANT
+#define     CONFIG_HASH_NREG        19  ///< Number of consecutive robot configuration registers covered by @ref configHash
+
+#define     ODOM_FLAG_VALID         0x0001 ///< @ref MSG_ODOMETRY flag: the server is estimating the motion
+#define     ODOM_FLAG_VISION        0x0002 ///< @ref MSG_ODOMETRY flag: the camera measured the motion of the last frame
+#define     ODOM_FLAG_SLIP          0x0004 ///< @ref MSG_ODOMETRY flag: encoders and camera disagree, the wheels are slipping
+
+// ---> Server capabilities (returned by MSG_SERVER_PING_OK)
+#define     SRV_CAP_SPEED_TRAJ      0x0001 ///< The server plays speed trajectories (@ref CMD_SET_SPEED_TRAJ)
+#define     SRV_CAP_REDUNDANT_CTRL  0x0002 ///< The server accepts redundant speed setpoints (@ref CMD_SET_SPEED_REDUNDANT)
+#define     SRV_CAP_CONFIG_HASH     0x0004 ///< The server replies to @ref CMD_GET_CONFIG_HASH
+#define     SRV_CAP_ODOMETRY        0x0008 ///< The server replies to @ref CMD_GET_ODOMETRY
+// <--- Server capabilities
+
+// ---> Webcam stream
+#define     WEBCAM_PROTO_V1             1       ///< 9 byte header with 8 bit frame ids (clients sending only the command byte)
+#define     WEBCAM_PROTO_V2             2       ///< 32 byte header with 32 bit frame ids, capture timestamp and frame format
+#define     WEBCAM_PROTO_V3             3       ///< 33 byte header: the v2 header followed by the camera of the frame
+#define     WEBCAM_PROTO_V4             4       ///< 46 byte header: the v3 header followed by the robot telemetry at capture time
+#define     WEBCAM_PROTO_VERSION        WEBCAM_PROTO_V4 ///< Newest stream version, sent by the clients after CMD_ADD_CLIENT and echoed by the server after "@A"
+
+#define     WEBCAM_FRAG_HEADER_SIZE     9       ///< v1: [quint8 fragID][quint16 packetSize][quint16 numFrag][quint16 tailSize][quint16 fragIdx]
+#define     WEBCAM_FRAG_HEADER_SIZE_V2  32      ///< v2: [quint8 marker][quint8 version][quint8 encoder][quint8 fecGroup][quint32 frameId][quint64 captureUsec][quint32 serverDelayUsec][quint16 width][quint16 height][quint16 packetSize][quint16 numFrag][quint16 tailSize][quint16 fragIdx]
+                                                // v2: when fecGroup>0 the fragments with fragIdx>=numFrag carry the XOR of the data fragments [g*fecGroup, (g+1)*fecGroup), g=fragIdx-numFrag
+#define     WEBCAM_FRAG_HEADER_SIZE_V3  33      ///< v3: [v2 header][quint8 camera]. Frame ids are counted separately for each camera
+#define     WEBCAM_FRAG_HEADER_SIZE_V4  46      ///< v4: [v3 header][quint8 telemetryFlags][qint16 speed0][qint16 speed1][quint32 boardTimeMsec][quint32 telemetryAgeUsec]. Speeds in mm/sec, age measured at capture time
+#define     WEBCAM_TELEMETRY_VALID      0x01    ///< Telemetry flag: the speeds have been read from the board (the server has a telemetry source)
+#define     WEBCAM_V2_MARKER            0xFF    ///< First byte of a v2 header. v1 fragIDs are frameIdx%255, so they are never 0xFF
+
+#define     WEBCAM_ENC_JPEG             1       ///< Frame encoded as JPEG
+#define     WEBCAM_ENC_JPEG_TILES       2       ///< Tiles changed since the reference frame: [quint32 refFrameId][quint16 tileSize][quint16 tileCount][quint16 tileIdx]*tileCount
+                                                // followed by a JPEG with the tiles side by side, ceil(width/tileSize) tiles for each row. tileIdx=row*ceil(width/tileSize)+col
+                                                // The tiles are copied over the reference frame. No JPEG if tileCount is 0
+#define     WEBCAM_TILES_HEADER_SIZE    8       ///< Size of the tile list before the tile indexes
+
+#define     WEBCAM_STREAM_PREVIEW       0       ///< Downscaled stream, always produced. Default of the v2 clients
+#define     WEBCAM_STREAM_FULL          1       ///< Full resolution stream, produced only if a client selects it. Default of the v1 clients
+#define     WEBCAM_PREVIEW_MAX_WIDTH    320     ///< Width of the preview of a 640x480 camera: larger views need the full stream
+
+#define     WEBCAM_MAX_CAMERAS          4       ///< Cameras of a server, each with its own frame ids. The v1 and v2 clients receive only the camera 0
+
+#define     WEBCAM_ADD_FLAG_MULTICAST   0x01    ///< Sent after the version in CMD_ADD_CLIENT: the client can join a multicast group. If the server streams on a group, "@A" and the version are followed by the IPv4 address of the group (quint32)
+                                                // v3: "@A" and the version are followed by the number of cameras (quint8), then by the multicast group
+#define     WEBCAM_ADD_FLAG_TILES       0x02    ///< Sent after the version in CMD_ADD_CLIENT: the client decodes WEBCAM_ENC_JPEG_TILES and asks for a keyframe with CMD_REQUEST_KEYFRAME when it loses the reference
+// <--- Webcam stream
+
+/** @brief Fletcher-16 hash of the robot configuration, used by client and server
+ *         to verify that a cached configuration is still valid
+ *
+ * @param regs the @ref CONFIG_HASH_NREG configuration registers
+ * @param statusBits2 the EEPROM flags of WORD_STATUSBIT2 (encoder position and driver enable polarity)
+ */
+inline quint16 configHash( const quint16* regs, quint16 statusBits2 )
+{
+    quint16 sum1 = 0;
+    quint16 sum2 = 0;
+
+    for( int i=0; i<=CONFIG_HASH_NREG; i++ )
+    {
+        quint16 word = (i<CONFIG_HASH_NREG)?regs[i]:statusBits2;
+
+        sum1 = (sum1 + (word>>8)) % 255;
+        sum2 = (sum2 + sum1) % 255;
+        sum1 = (sum1 + (word&0x00FF)) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+
+    return (sum2<<8) | sum1;
+}
+
 #endif // NETWORK_MSG_H
@@ -0,0 +1,162 @@
+#ifndef QRECORDINGREADER_H
+#define QRECORDINGREADER_H
+
+#include <RoboControllerSDK_global.h>
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QFile>
+
+#include <vector>
+
+// ---> Webcam recording segments
+// A segment is [file header][frame]*[index][trailer], all the fields are little endian.
+// Each frame is a frame header followed by the JPEG data, padded to REC_ALIGN bytes.
+// Index and trailer are written when the segment is closed: a segment without them
+// (e.g. power loss) is recovered scanning its frames
+#define REC_FILE_SUFFIX         ".rcrec"
+#define REC_VERSION             1
+#define REC_ALIGN               8           // Alignment of the frame headers in the file
+
+#define REC_FILE_MAGIC          0x43524352  // "RCRC"
+#define REC_FILE_HEADER_SIZE    32          // [quint32 magic][quint16 version][quint16 header size][quint32 segment idx][quint32 reserved][qint64 clock offset usec][qint64 creation msec since epoch]
+
+#define REC_FRAME_MAGIC         0x52464352  // "RCFR"
+#define REC_FRAME_HEADER_SIZE   40          // [quint32 magic][quint32 data size][quint64 capture usec][quint32 frame idx][quint8 camera][quint8 encoder][quint16 width][quint16 height]
+                                            // [quint8 flags][quint8 reserved][qint16 speed0][qint16 speed1][quint32 board time msec][quint32 telemetry age usec]
+#define REC_FRAME_FLAG_TELEMETRY 0x01       // The frame carries the wheel speeds
+
+#define REC_INDEX_ENTRY_SIZE    24          // [quint64 capture usec][quint64 offset of the frame header][quint32 frame idx][quint8 camera][quint8 encoder][quint16 reserved]
+
+#define REC_TRAILER_MAGIC       0x58494352  // "RCIX"
+#define REC_TRAILER_SIZE        32          // [quint32 magic][quint32 entry count][quint64 index offset][quint64 first capture usec][quint64 last capture usec]
+// <--- Webcam recording segments
+
+namespace roboctrl
+{
+
+/**
+  * @struct _RecordedFrame
+  * @brief Frame of a webcam recording
+  */
+typedef struct _RecordedFrame
+{
+    quint8 camera;          /**< Camera of the frame */
+    quint32 frameIdx;       /**< Index of the frame in the camera stream */
+    quint64 captureUsec;    /**< Capture time on the monotonic clock of the server */
+    qint64 wallClockMsec;   /**< Capture time, msec since epoch (UTC) */
+    quint8 encoder;         /**< Encoding of the data (WEBCAM_ENC_*) */
+    quint16 width;          /**< Width of the frame */
+    quint16 height;         /**< Height of the frame */
+    bool telemetryValid;    /**< The frame carries the wheel speeds */
+    qint16 speed0;          /**< Speed of motor 0 at capture time (mm/sec) */
+    qint16 speed1;          /**< Speed of motor 1 at capture time (mm/sec) */
+    quint32 boardTimeMsec;  /**< Time of the board reading on the clock of the telemetry (msec) */
+    quint32 telemetryAgeUsec; /**< Time elapsed from the board reading to the capture */
+    QByteArray data;        /**< JPEG data, a view on the mapped file valid until @ref QRecordingReader::close */
+} RecordedFrame;
+
+/** @brief Random access to a segment of a webcam recording
+ *         (@ref REC_FILE_SUFFIX files written by QWebcamRecorder).
+ *
+ * The file is memory mapped: opening it reads only header and index,
+ * the frames are never copied. The frames are looked up by capture time
+ * with a binary search on the index, which is sorted by capture time.
+ * A segment not closed by the recorder is recovered scanning its frames
+ * up to the last complete one
+ */
+class ROBOCONTROLLERSDKSHARED_EXPORT QRecordingReader
+{
+public:
+    QRecordingReader();
+    virtual ~QRecordingReader();
+
+    /** @brief Maps a segment and loads its index
+     *
+     * @returns false if the file cannot be mapped or it is not a recording
+     */
+    bool open( const QString& fileName );
+
+    /** @brief Unmaps the segment: the data of the frames read become invalid
+     */
+    void close();
+
+    bool isOpen(){return mMap!=NULL;}
+
+    /** @brief The segment had no index and has been recovered scanning the frames
+     */
+    bool isRecovered(){return mRecovered;}
+
+    QString getFileName(){return mFile.fileName();}
+    quint32 getSegmentIdx(){return mSegmentIdx;}
+
+    /** @brief Returns the number of frames of the segment, all the cameras
+     */
+    int getFrameCount(){return (int)mIndex.size();}
+
+    /** @brief Capture time of the first and of the last frame (usec)
+     */
+    quint64 getFirstUsec();
+    quint64 getLastUsec();
+
+    /** @brief Converts a capture time to msec since epoch (UTC)
+     */
+    qint64 toWallClockMsec( quint64 captureUsec ){return (qint64)(captureUsec+mClockOffsetUsec)/1000;}
+
+    /** @brief Returns the position in the index of the last frame captured
+     *         at or before a time
+     *
+     * @param camera camera of the frame, -1 for any camera
+     * @returns -1 if there are no such frames
+     */
+    int findFrame( quint64 captureUsec, int camera=-1 );
+
+    /** @brief Reads a frame without copying its data
+     *
+     * @param pos position in the index, in order of capture time
+     * @returns false if the position is not valid
+     */
+    bool getFrame( int pos, RecordedFrame& frame );
+
+    /** @brief Returns the paths of the segments of a recording directory in order of creation
+     */
+    static QStringList listSegments( const QString& directory );
+
+private:
+    /** @brief Frame of the index
+     */
+    typedef struct _IndexEntry
+    {
+        quint64 captureUsec;
+        quint64 offset;
+        quint32 frameIdx;
+        quint8 camera;
+    } IndexEntry;
+
+    /** @brief Loads the index written by the recorder
+     *
+     * @returns false if the segment has no valid index
+     */
+    bool loadIndex();
+
+    /** @brief Rebuilds the index scanning the frames up to the last complete one
+     */
+    void recoverIndex();
+
+    static bool entryBefore( const IndexEntry& a, const IndexEntry& b ){return a.captureUsec<b.captureUsec;}
+
+private:
+    QFile mFile;
+    uchar* mMap;                        ///< Mapping of the whole file, NULL if closed
+    qint64 mSize;                       ///< Size of the mapping
+
+    quint32 mSegmentIdx;                ///< Position of the segment in the recording
+    qint64 mClockOffsetUsec;            ///< Capture time to usec since epoch
+    bool mRecovered;                    ///< The index has been rebuilt
+    std::vector<IndexEntry> mIndex;     ///< Frames sorted by capture time
+};
+
+}
+
+#endif // QRECORDINGREADER_H
@@ -0,0 +1,101 @@
+#ifndef QSERVERFINDER_H
+#define QSERVERFINDER_H
+
+#include <RoboControllerSDK_global.h>
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QtNetwork/QUdpSocket>
+
+#define DISCOVERY_FIRST_RETRY_MSEC  200     // The interval between pings is doubled at each retransmission
+#define DISCOVERY_TIMEOUT_MSEC      3000    // Default duration of a search
+
+namespace roboctrl
+{
+
+/**
+  * @struct _ServerInfo
+  * @brief Information about a server replying to a discovery request
+  */
+typedef struct _ServerInfo
+{
+    QString address;        /**< IP of the server */
+    quint16 boardIdx;       /**< Id of the board connected to the server */
+    int rttMsec;            /**< Round trip time of the discovery ping (msec), -1 if unknown */
+    quint16 capabilities;   /**< Bitmask of the capabilities of the server (SRV_CAP_* in network_msg.h) */
+} ServerInfo;
+
+/** @brief Non blocking search of the RoboController servers on the local network.
+ *
+ * A ping is broadcasted on every active network interface and
+ * retransmitted with exponential backoff until the timeout expires.
+ * Every server replying is notified only once with @ref serverFound
+ */
+class ROBOCONTROLLERSDKSHARED_EXPORT QServerFinder : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QServerFinder( quint16 udpSendPort=14550,
+                            quint16 udpListenPort=14555,
+                            QObject *parent = 0 );
+    virtual ~QServerFinder();
+
+    /** @brief Starts a new search. The result of the previous search is cleared
+     *
+     * @param timeoutMsec duration of the search
+     * @returns false if the listening socket cannot be opened
+     */
+    bool start( int timeoutMsec=DISCOVERY_TIMEOUT_MSEC );
+
+    /** @brief Stops the current search without emitting @ref finished
+     */
+    void stop();
+
+    bool isRunning(){return mRunning;}
+
+    /** @brief Returns the servers found by the last search
+     */
+    QList<ServerInfo> getServers(){return mServers;}
+
+signals:
+    /** @brief Emitted the first time a server replies to the discovery ping
+     */
+    void serverFound( QString serverAddr, quint16 boardIdx, int rttMsec, quint16 capabilities );
+
+    /** @brief Emitted when the search timeout expires
+     */
+    void finished( int serverCount );
+
+private slots:
+    void onReadyRead();
+    void onRetryTimerTimeout();
+    void onTimeoutTimerTimeout();
+
+private:
+    void sendPing();
+    void closeSocket();
+
+private:
+    QUdpSocket* mUdpSocket;     /**< Socket used to send pings and to receive replies */
+    quint16 mUdpSendPort;       /**< Port where the servers listen for UDP Status commands */
+    quint16 mUdpListenPort;     /**< Port where the servers send the replies */
+
+    QTimer mRetryTimer;         /**< Timer for ping retransmission */
+    QTimer mTimeoutTimer;       /**< Timer for the end of the search */
+    int mRetryIntervalMsec;     /**< Current retransmission interval */
+
+    quint16 mPingCounter;                   /**< Sequence number of the next ping */
+    QElapsedTimer mClock;                   /**< Clock used to evaluate RTT */
+    QHash<quint16,qint64> mPingSentTime;    /**< Sending time of each ping */
+
+    QList<ServerInfo> mServers; /**< Servers found */
+    bool mRunning;
+};
+
+}
+
+#endif // QSERVERFINDER_H
@@ -0,0 +1,77 @@
+#ifndef QTRIPLEBUFFER_H
+#define QTRIPLEBUFFER_H
+
+#include <QAtomicInt>
+
+namespace roboctrl
+{
+
+/** @brief Lock free handoff of the newest element from a producer thread
+ *         to a consumer thread.
+ *
+ * The producer fills @ref back and publishes it, the consumer acquires the
+ * last element published and reads @ref front. Neither side ever waits:
+ * an element published and never acquired is simply overwritten
+ */
+template <typename T>
+class QTripleBuffer
+{
+public:
+    QTripleBuffer() :
+        mState(1),
+        mBack(0),
+        mFront(2)
+    {}
+
+    /** @brief Element owned by the producer
+     */
+    T& back(){return mBuffers[mBack];}
+
+    /** @brief Makes @ref back available to the consumer and gives the
+     *         producer a new @ref back
+     *
+     * @returns true if the previous element published was never acquired
+     */
+    bool publish()
+    {
+        int old = mState.fetchAndStoreOrdered( mBack | FreshFlag );
+        mBack = old & IndexMask;
+
+        return (old & FreshFlag)!=0;
+    }
+
+    /** @brief Moves the last element published to @ref front
+     *
+     * @returns false if nothing has been published since the last call
+     */
+    bool acquire()
+    {
+        if( !(mState.loadAcquire() & FreshFlag) )
+            return false;
+
+        int old = mState.fetchAndStoreOrdered( mFront );
+        mFront = old & IndexMask;
+
+        return true;
+    }
+
+    /** @brief Element owned by the consumer
+     */
+    T& front(){return mBuffers[mFront];}
+
+private:
+    enum
+    {
+        IndexMask = 0x03,   ///< Index of the middle element in @ref mState
+        FreshFlag = 0x04    ///< The middle element has been published and not acquired
+    };
+
+    T mBuffers[3];
+    QAtomicInt mState;      ///< Middle element and fresh flag
+    int mBack;              ///< Index of the element owned by the producer
+    int mFront;             ///< Index of the element owned by the consumer
+};
+
+}
+
+#endif // QTRIPLEBUFFER_H
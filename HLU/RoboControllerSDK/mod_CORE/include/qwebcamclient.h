@@ -4,21 +4,170 @@
 #include <QThread>
 #include <QUdpSocket>
 #include <QMutex>
+#include <QBitArray>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QWaitCondition>
+#include <QAtomicInt>
 #include <vector>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
+#include <network_msg.h>
+#include "qtriplebuffer.h"
+
 // >>>> Server Command
 #define CMD_ADD_CLIENT      ((quint8)0)
 #define CMD_REMOVE_CLIENT   ((quint8)1)
+#define CMD_CLIENT_FEEDBACK ((quint8)2)
+#define CMD_SELECT_STREAM   ((quint8)3)
+#define CMD_REQUEST_KEYFRAME ((quint8)4)
+#define CMD_SELECT_CAMERAS  ((quint8)5)
 // <<<< Server Command
 
+#define WEBCAM_REASM_SLOTS          4       // Frames reassembled at the same time
+#define WEBCAM_REASM_DEADLINE_MSEC  250     // An incomplete frame is dropped after this time
+#define WEBCAM_FEEDBACK_PERIOD_MSEC 1000    // Period of the frame counters sent to the server for rate adaptation
+#define WEBCAM_MCAST_FALLBACK_MSEC  3000    // Time without frames from the multicast group before asking for unicast
+#define WEBCAM_DECODE_WAIT_MSEC     100     // Max wait of the decoder for a frame before checking for stop
+#define WEBCAM_KEYFRAME_REQ_MSEC    500     // Min interval between two keyframe requests, the keyframe can be on its way
+
 using namespace std;
 
 namespace roboctrl
 {
 
+/**
+  * @struct _WebcamTelemetry
+  * @brief State of the robot when the frame has been captured, read by the
+  *        server from the board (v4 only)
+  */
+typedef struct _WebcamTelemetry
+{
+    bool valid;                 /**< The server stamped the frame with the robot state */
+    double speed0;              /**< Speed of motor 0 (m/sec) */
+    double speed1;              /**< Speed of motor 1 (m/sec) */
+    quint32 boardTimeMsec;      /**< Time of the board reading on the clock of the server (msec) */
+    quint32 ageUsec;            /**< Time elapsed from the board reading to the capture of the frame (usec) */
+} WebcamTelemetry;
+
+/**
+  * @struct _WebcamFragHeader
+  * @brief Header of a fragment of the webcam stream. The fields not
+  *        available in the v1 header are zero
+  */
+typedef struct _WebcamFragHeader
+{
+    quint8 version;             /**< Version of the header (WEBCAM_PROTO_V*) */
+    int headerSize;             /**< Size of the header */
+    quint8 camera;              /**< Camera of the frame (v3 only) */
+    quint32 frameId;            /**< Id of the frame (8 bit on v1) */
+    quint64 captureUsec;        /**< Capture time on the monotonic clock of the server (usec) */
+    quint32 serverDelayUsec;    /**< Time from capture to sending on the server (usec) */
+    quint8 encoder;             /**< Encoding of the frame (WEBCAM_ENC_*) */
+    quint8 fecGroup;            /**< Data fragments for each parity fragment, 0 without FEC */
+    quint16 numParity;          /**< Number of parity fragments */
+    quint16 width;              /**< Width of the frame */
+    quint16 height;             /**< Height of the frame */
+    quint16 packetSize;         /**< Size of the fragments, header included */
+    quint16 numFrag;            /**< Number of fragments of the frame */
+    quint16 tailSize;           /**< Data size of the last fragment */
+    quint16 fragIdx;            /**< Index of the fragment */
+    WebcamTelemetry telemetry;  /**< Robot state at capture time (v4 only) */
+} WebcamFragHeader;
+
+/**
+  * @struct _WebcamLatencyStats
+  * @brief End to end latency of the frames received with the v2 header.
+  *
+  * The clocks of server and client are not synchronized: the network
+  * delay is measured above the fastest frame received, so the latency
+  * does not include the minimum transit time of the network
+  */
+typedef struct _WebcamLatencyStats
+{
+    quint32 frameCount;         /**< Frames evaluated */
+    quint32 lastFrameId;        /**< Id of the last frame */
+    double serverDelayMsec;     /**< Capture to sending on the server, last frame */
+    double networkDelayMsec;    /**< Network delay above the fastest frame, last frame */
+    double decodeMsec;          /**< Completion to decoded image (handoff and decoding), last frame */
+    double latencyMsec;         /**< Capture to decoded image, last frame */
+    double avgLatencyMsec;      /**< Average latency */
+    double jitterMsec;          /**< Interarrival jitter (RFC 3550) */
+} WebcamLatencyStats;
+
+/**
+  * @struct _FrameSlot
+  * @brief Frame being reassembled from its fragments
+  */
+typedef struct _FrameSlot
+{
+    bool inUse;                 /**< The slot contains a frame */
+    quint32 id;                 /**< Id of the frame */
+    quint16 packetSize;         /**< Size of the fragments, header included */
+    quint16 numFrag;            /**< Number of fragments of the frame */
+    quint16 tailSize;           /**< Data size of the last fragment */
+    quint64 captureUsec;        /**< Capture time on the server clock (v2 only) */
+    quint32 serverDelayUsec;    /**< Capture to sending on the server (v2 only) */
+    quint8 encoder;             /**< Encoding of the frame */
+    quint16 width;              /**< Width of the frame (v2 only) */
+    quint16 height;             /**< Height of the frame (v2 only) */
+    WebcamTelemetry telemetry;  /**< Robot state at capture time (v4 only) */
+    quint8 fecGroup;            /**< Data fragments for each parity fragment, 0 without FEC */
+    quint16 numParity;          /**< Number of parity fragments */
+    int fragDataSize;           /**< Data size of a fragment */
+    int dataSize;               /**< Size of the whole frame */
+    int fragCount;              /**< Number of data fragments received or recovered */
+    QBitArray received;         /**< Fragments received, data fragments first and then parity fragments */
+    vector<uchar> buffer;       /**< Frame data, never shrinked to avoid reallocations */
+    vector<uchar> parity;       /**< Parity fragments, never shrinked to avoid reallocations */
+    QElapsedTimer started;      /**< Started when the first fragment has been received */
+} FrameSlot;
+
+/**
+  * @struct _WebcamCompressedFrame
+  * @brief Complete frame waiting for decoding
+  */
+typedef struct _WebcamCompressedFrame
+{
+    vector<uchar> data;         /**< Encoded frame, swapped with the buffer of the reassembly slot */
+    int dataSize;               /**< Size of the encoded frame */
+    quint32 id;                 /**< Id of the frame */
+    quint8 version;             /**< Version of the header of the frame */
+    quint8 camera;              /**< Camera of the frame */
+    quint8 encoder;             /**< Encoding of the frame (WEBCAM_ENC_*) */
+    quint16 width;              /**< Width of the frame (v2 only) */
+    quint16 height;             /**< Height of the frame (v2 only) */
+    quint64 captureUsec;        /**< Capture time on the server clock (v2 only) */
+    quint32 serverDelayUsec;    /**< Capture to sending on the server (v2 only) */
+    qint64 completedUsec;       /**< Completion time on the client clock */
+    WebcamTelemetry telemetry;  /**< Robot state at capture time (v4 only) */
+} WebcamCompressedFrame;
+
+/**
+  * @struct _WebcamDecodedFrame
+  * @brief Decoded frame ready for the consumer
+  */
+typedef struct _WebcamDecodedFrame
+{
+    cv::Mat image;              /**< Decoded image */
+    quint32 seq;                /**< Progressive number of the decoded frames, starting from 1 */
+    quint32 id;                 /**< Id of the frame in the stream */
+    quint8 camera;              /**< Camera of the frame */
+    WebcamTelemetry telemetry;  /**< Robot state at capture time (v4 only) */
+} WebcamDecodedFrame;
+
+/** @brief Receives the webcam stream of a @ref QWebcamServer.
+ *
+ * The fragments are reassembled in the thread owning the object, the
+ * frames are decoded in the thread of the client. Only the newest frame
+ * moves between the threads, through triple buffers: a slow decoder or a
+ * slow consumer skips frames and never blocks the network.
+ * With static scenes the server can send only the changed tiles
+ * (@ref WEBCAM_ENC_JPEG_TILES): they are composited over the last image and
+ * a keyframe is requested when a frame of the chain is missing
+ */
 class QWebcamClient : public QThread
 {
     Q_OBJECT
@@ -34,14 +183,164 @@ public:
     bool connectToServer(int sendPort,int listenPort);
     void disconnectServer();
 
-    cv::Mat getLastFrame();
+    /** @brief Returns the newest decoded frame without locks and without
+     *         copies: the image is shared with the client until a new frame
+     *         is decoded. To be called by a single consumer thread
+     *
+     * @param seq if not NULL receives the sequence number of the frame, 0 if no frame has been decoded
+     * @param telemetry if not NULL receives the wheel speeds of the robot when
+     *        the frame has been captured (valid only if the server has a telemetry source)
+     */
+    cv::Mat getLastFrame( quint32* seq=NULL, WebcamTelemetry* telemetry=NULL );
+
+    /** @brief Returns the number of frames dropped because incomplete
+     */
+    quint32 getLostFrameCount(){return mLostFrameCount;}
+
+    /** @brief Returns the number of data fragments rebuilt using the parity fragments
+     */
+    quint32 getRecoveredFragmentCount(){return mRecoveredFragCount;}
+
+    /** @brief Drops randomly the received fragments to measure the effect of
+     *         the forward error correction (e.g. server and client on loopback)
+     *
+     * @param probability probability to drop a fragment [0,1], 0 to disable
+     */
+    void setLossInjection( double probability ){mLossInjection=probability;}
+
+    /** @brief Returns true if the stream is received from a multicast group
+     */
+    bool isMulticast(){return mMulticastJoined;}
+
+    /** @brief Returns the stream version accepted by the server
+     */
+    quint8 getProtocolVersion(){return mProtoVersion;}
+
+    /** @brief Selects the stream sent by the server: the preview (default) or
+     *         the full resolution. Available only with servers supporting
+     *         @ref WEBCAM_PROTO_V2, the others always send the full resolution
+     *
+     * @param stream WEBCAM_STREAM_PREVIEW or WEBCAM_STREAM_FULL
+     */
+    void selectStream( quint8 stream );
+    quint8 getSelectedStream(){return mSelectedStream;}
+
+    /** @brief Selects the camera received (e.g. front or rear). Available only with
+     *         servers supporting @ref WEBCAM_PROTO_V3, the others send only the camera 0
+     *
+     * @param camera index of the camera [0, @ref getCameraCount)
+     */
+    void selectCamera( quint8 camera );
+    quint8 getSelectedCamera(){return mSelectedCamera;}
+
+    /** @brief Returns the number of cameras of the server, 1 for the servers not supporting v3
+     */
+    int getCameraCount(){return mCameraCount;}
+
+    /** @brief Returns the number of complete frames replaced by a newer one before decoding
+     */
+    quint32 getSkippedFrameCount(){return (quint32)mSkippedFrameCount.loadAcquire();}
+
+    /** @brief Returns the number of keyframes requested because the tiles had no valid reference
+     */
+    quint32 getKeyframeRequestCount(){return mKeyframeRequestCount;}
+
+    /** @brief Returns the latency statistics. Available only with
+     *         servers supporting @ref WEBCAM_PROTO_V2
+     */
+    WebcamLatencyStats getLatencyStats();
 
 signals:
-    void newImageReceived();
+    /** @brief Emitted by the thread of the client when a frame has been decoded
+     *
+     * @param seq sequence number of the frame. If the consumer is late more
+     *        notifications can refer to the frame returned by @ref getLastFrame
+     */
+    void newImageReceived( quint32 seq );
 
 public slots:
     void processPendingDatagrams();
 
+protected:
+    void run(); ///< Decodes the newest complete frame
+
+private slots:
+    /** @brief Sends the frame counters to the server, that adapts
+     *         the quality of the stream to the frame loss
+     */
+    void sendFeedback();
+
+private:
+    /** @brief Returns the slot of the frame, or a new slot if the frame is new.
+     *         The oldest frame is dropped if all the slots are in use
+     *
+     * @returns NULL if the fragment belongs to an already completed or too old frame
+     */
+    FrameSlot* getFrameSlot( const WebcamFragHeader& header );
+
+    /** @brief Parses the header of a fragment (v1 or v2)
+     *
+     * @returns false if the datagram is not a valid fragment
+     */
+    bool parseFragHeader( const uchar* data, int size, WebcamFragHeader& header );
+
+    /** @brief Updates the latency statistics with a frame received with the v2 header
+     */
+    void updateLatencyStats( const WebcamCompressedFrame& frame, double decodeMsec );
+
+    /** @brief Drops the incomplete frames older than @ref WEBCAM_REASM_DEADLINE_MSEC
+     */
+    void expireFrameSlots();
+
+    /** @brief Rebuilds the missing data fragment of a group if only one is missing
+     *         and the parity fragment of the group has been received
+     */
+    void recoverFragment( FrameSlot* slot, int group );
+
+    /** @brief Sends CMD_ADD_CLIENT with the stream version and the request of multicast
+     */
+    bool requestStream( bool multicast );
+
+    /** @brief Sends CMD_SELECT_STREAM with @ref mSelectedStream
+     */
+    void sendStreamSelection();
+
+    /** @brief Sends CMD_SELECT_CAMERAS with @ref mSelectedCamera
+     */
+    void sendCameraSelection();
+
+    /** @brief Sends CMD_REQUEST_KEYFRAME if the decoder lost the reference of the
+     *         tiles, at most every @ref WEBCAM_KEYFRAME_REQ_MSEC
+     */
+    void requestKeyframe();
+
+    /** @brief Copies the tiles of a frame over the last image. Called by the decoder
+     *
+     * @param updated set to false if the frame contains no tiles
+     * @returns false if the frame cannot be composited
+     */
+    bool decodeTiles( const WebcamCompressedFrame& frame, bool& updated );
+
+    /** @brief Joins the multicast group received from the server.
+     *         Falls back to unicast if the group cannot be joined
+     */
+    void joinMulticastGroup( QHostAddress group );
+
+    void leaveMulticastGroup();
+
+    /** @brief Hands a complete frame to the decoder and drops the older incomplete ones
+     */
+    void completeFrame( FrameSlot* slot );
+
+    /** @brief Stops the decoder thread
+     */
+    void stopDecoder();
+
+    /** @brief Returns true if the id @ref a is newer than @ref b.
+     *         Ids wrap around at 8 bit with the v1 header and at 32 bit with v2
+     */
+    bool isNewerFrame( quint32 a, quint32 b );
+
 private:
     QUdpSocket *mUdpSocketSend;
     QUdpSocket *mUdpSocketListen;
@@ -51,17 +350,61 @@ private:
 
     bool mConnected;
 
-    quint8 mCurrentId;
-    int mCurrentFragmentCount;
-    vector<uchar> mCurrentBuffer;
+    // >>>>> Reassembly
+    FrameSlot mFrameSlots[WEBCAM_REASM_SLOTS];  ///< Frames being reassembled
+    bool mFrameDelivered;                       ///< At least a frame has been completed
+    quint32 mLastDeliveredId;                   ///< Id of the last frame completed
+    quint32 mLostFrameCount;                    ///< Frames dropped because incomplete
+    quint32 mCompletedFrameCount;               ///< Frames completely received
+    quint32 mRecoveredFragCount;                ///< Data fragments rebuilt with FEC
+    double mLossInjection;                      ///< Probability to drop a received fragment (test only)
+    QTimer mFeedbackTimer;                      ///< Timer for @ref sendFeedback
+
+    // >>>>> Multicast
+    bool mMulticastAllowed;                     ///< The client asks for the multicast stream
+    bool mMulticastJoined;                      ///< The listening socket joined the group
+    QHostAddress mMulticastGroup;               ///< Group of the stream
+    QElapsedTimer mJoinTime;                    ///< Started when the group has been joined
+    quint32 mCompletedAtJoin;                   ///< Frames completed when the group has been joined
+    // <<<<< Multicast
+    quint8 mStreamVersion;                      ///< Version of the last header received
+    quint8 mSelectedStream;                     ///< Stream requested to the server (WEBCAM_STREAM_*)
+    quint8 mSelectedCamera;                     ///< Camera requested to the server, the fragments of the others are ignored
+    int mCameraCount;                           ///< Cameras of the server
+    // <<<<< Reassembly
+
+    // >>>>> Latency
+    quint8 mProtoVersion;                       ///< Version accepted by the server
+    QElapsedTimer mClock;                       ///< Monotonic clock of the client
+    bool mTransitValid;                         ///< At least a frame evaluated
+    qint64 mMinTransitUsec;                     ///< Min (client clock - server clock) at frame arrival
+    qint64 mLastTransitUsec;                    ///< (client clock - server clock) of the last frame
+    double mLatencySumMsec;                     ///< Sum of the latencies for the average
+    WebcamLatencyStats mLatencyStats;           ///< Latency of the last frames
+    // <<<<< Latency
+
+    QMutex mStatsMutex;                         ///< Protects the latency statistics
 
-    quint16 mPacketSize;
-    quint16 mNumFrag;
-    quint16 mTailSize;
+    // >>>>> Decoding
+    QTripleBuffer<WebcamCompressedFrame> mCompressed;   ///< Newest complete frame, from network to decoder
+    QTripleBuffer<WebcamDecodedFrame> mDecoded;         ///< Newest decoded frame, from decoder to consumer
+    QMutex mDecodeMutex;                        ///< Used only to sleep waiting for a frame
+    QWaitCondition mFrameCompleted;
+    QAtomicInt mDecoderStopped;
+    QAtomicInt mSkippedFrameCount;              ///< Complete frames never decoded
+    quint32 mDecodedSeq;                        ///< Sequence number of the last decoded frame
+    // <<<<< Decoding
 
-    QMutex mImgMutex;
-    cv::Mat mLastCompleteFrame;
-    bool mLastImageState;
+    // >>>>> Tiles
+    cv::Mat mComposite;                         ///< Last image, reference of the tiles. Never modified in place
+    cv::Mat mTiles;                             ///< Decoded tiles side by side
+    bool mCompositeValid;                       ///< At least a whole frame decoded
+    quint32 mCompositeId;                       ///< Id of the last frame composited
+    quint8 mCompositeCamera;                    ///< Camera of the last frame composited
+    QAtomicInt mKeyframeNeeded;                 ///< Set by the decoder, the request is sent by the network thread
+    QElapsedTimer mKeyframeRequestTime;         ///< Started when the last keyframe request has been sent
+    quint32 mKeyframeRequestCount;              ///< Keyframes requested since creation
+    // <<<<< Tiles
 };
 
 }
@@ -7,6 +7,9 @@
 #include <QTimer>
 #include <QMutex>
 #include <QString>
+#include <QVector>
+#include <QQueue>
+#include <QElapsedTimer>
 #include <QtNetwork/QUdpSocket>
 #include <QtNetwork/QTcpSocket>
 
@@ -16,9 +19,23 @@
 
 #define UDP_PING_TIME_MSEC 1000
 
+#define RECONNECT_FIRST_DELAY_MSEC 100      // Delay before the second reconnection attempt, doubled at each failure
+#define RECONNECT_MAX_DELAY_MSEC 3000       // Max delay between reconnection attempts
+#define RECONNECT_CONNECT_TIMEOUT_MSEC 1000 // Timeout of the connection of each reconnection attempt (not waited)
+
 namespace roboctrl
 {
 
+/**
+  * @struct _TcpPendingReply
+  * @brief Command of a TCP transaction waiting for its reply
+  */
+typedef struct _TcpPendingReply
+{
+    quint16 cmdCode;    /**< Command sent (CMD_*) */
+    quint16 startReg;   /**< First register of the command, 0 if it has none */
+} TcpPendingReply;
+
 class ROBOCONTROLLERSDKSHARED_EXPORT RoboControllerSDK : public QThread
 {
     Q_OBJECT
@@ -32,8 +49,9 @@ public:
 
     virtual ~RoboControllerSDK();
 
-    /** @brief Searches for the server on the local network
-     *
+    /** @brief Searches for the server on the local network.
+     *         Blocks until the first server replies or the search times out.
+     *         Use @ref QServerFinder to find all the servers without blocking
      *
      * @returns IP of the server or an empty QString
      */
@@ -53,6 +71,20 @@ public:
      */
     void getMotorSpeeds( );
 
+    /** @brief Send a request for the motion of the robot: the speeds of the
+     *         motors with the estimate of the server fusing them with the
+     *         camera (visual odometry), robust to slipping wheels.
+     *         The reply is received with @ref newOdometry signal, the
+     *         speeds also with @ref newMotorSpeedValues signal
+     *
+     * @note The server must support @ref SRV_CAP_ODOMETRY
+     */
+    void getOdometry( );
+
+    /** @brief Returns the last motion of the robot received from the server
+     */
+    RobotOdometry getLastOdometry(){return mOdometry;}
+
     /** @brief Sets the speed of the motor in m/sec
      *
      * @param motorIdx Index of the motor (0 or 1)
@@ -73,6 +105,48 @@ public:
      */
     void setMotorSpeeds( double speed0, double speed1 );
 
+    /** @brief Uploads a speed trajectory to be played by the server
+     *         at a fixed rate with linear interpolation between points.
+     *         A new trajectory replaces the part of the previous one not
+     *         yet played. When the trajectory ends before a new one is
+     *         received the @ref trajectoryUnderrun signal is emitted
+     *
+     * @param trajectory The points of the trajectory sorted by time.
+     *                   Only the first @ref TRAJ_MAX_POINTS are sent
+     *
+     * @note This function works only when @ref mMotorCtrlMode is
+     *       equal to @ref mcPid, else it does nothing
+     */
+    void setMotorSpeedsTrajectory( QVector<SpeedSetPoint>& trajectory );
+
+    /** @brief Enables the redundant control mode: every datagram sent by
+     *         @ref setMotorSpeeds carries also the previous setpoints, so the
+     *         server absorbs lost datagrams without waiting for the next one.
+     *         The statistics of the link are received with
+     *         @ref newControlLinkStats signal
+     *
+     * @param nPrevSetPoints Number of previous setpoints carried by each datagram
+     *                       [0-@ref CTRL_MAX_REDUNDANCY]. 0 disables the mode
+     *
+     * @note The server must support @ref SRV_CAP_REDUNDANT_CTRL
+     */
+    void setControlRedundancy( int nPrevSetPoints );
+
+    /** @brief Returns the last statistics of the control link received from the server
+     */
+    ControlLinkStats getControlLinkStats(){return mCtrlLinkStats;}
+
+    /** @brief Enables/disables the automatic reconnection when the TCP connection is lost.
+     *         On reconnection the cached configuration is verified with the hash
+     *         stored on the server (reloaded only if changed), the board status is
+     *         updated and the control of the robot is taken again if it was held.
+     *         The attempts do not block the thread of the SDK while the server is down.
+     *         The end of the procedure is notified with @ref tcpReconnected signal
+     *
+     * @param enable true by default
+     */
+    void setAutoReconnect( bool enable ){mAutoReconnect=enable;}
+
     /** @brief Send a request for motor pwm.
      *         The reply is received with /ref newMotorPwmValue
      *         signal
@@ -146,7 +220,9 @@ public:
     bool getRobotConfigurationFromIni( QString iniFile = ROBOT_CONFIG_INI_FILE );
 
     /** @brief Load the Robot Configuration from Robot EEPROM
-     *         The Robot configuration is retrieved from Robot
+     *         The Robot configuration is retrieved from Robot.
+     *         All the requests are sent in a single transaction,
+     *         the reply is received with @ref newRobotConfiguration
      */
     void getRobotConfigurationFromEeprom( );
 
@@ -158,7 +234,8 @@ public:
     void saveRobotConfigurationToIni( QString iniFile = ROBOT_CONFIG_INI_FILE );
 
     /** @brief Save the Robot Configuration to Robot EEPROM
-     *         The Robot configuration is saved on the Robot
+     *         The Robot configuration is saved on the Robot.
+     *         Returns when all the writes have been confirmed by the server
      */
     void saveRobotConfigurationToEeprom( );
 
@@ -184,6 +261,8 @@ public:
      *
      * @param valueType the type of value to be set (see @ref AnalogCalibValue)
      * @param curChargeVal Current value of charge read with a tester connected to the battery
+     *
+     * Returns when both the writes have been confirmed by the server
      */
     void setBatteryCalibrationParams( AnalogCalibValue valueType, double curChargeVal);
 
@@ -208,7 +287,7 @@ private:
     //void commThread();
 
     /// TCP Connection
-    void connectToTcpServer();
+    void connectToTcpServer( int timeoutMsec=5000 );
     /// TCP Disconnection
     void disconnectTcpServer();
 
@@ -217,8 +296,8 @@ private:
     /// UDP Disconnection
     void disconnectUdpServers();
 
-    /// Processes a reply message
-    void processReplyMsg(QDataStream *inStream );
+    /// Processes a reply message, returns the first register of the reply
+    quint16 processReplyMsg(QDataStream *inStream );
 
     /// Updates Robot Configuration from data stream
     void updateRobotConfigurationFromDataStream( QDataStream* inStream );
@@ -226,6 +305,24 @@ private:
     /// Sends a command to TCP server
     void sendBlockTCP( quint16 msgCode, QVector<quint16> &data );
 
+    /// Starts a TCP transaction: the following commands are queued and sent together by @ref commitTcpTransaction
+    void beginTcpTransaction();
+    /// Sends the queued commands and waits for all the replies
+    void commitTcpTransaction();
+    /// Removes the first pending command of the transaction if the reply belongs to it.
+    /// The server replies in order: any other reply (e.g. of a ping still in flight) is not counted
+    void matchPendingReply( quint16 msgCode, quint16 cmdCode, quint16 startReg );
+
+    /// Restores the state of the session after a reconnection
+    void resyncState();
+    /// Closes the failed reconnection attempt and schedules the next one
+    void reconnectFailed();
+    /// Hash of the cached Robot Configuration (see @ref configHash)
+    quint16 robotConfigurationHash();
+
+    /// Converts a speed in m/sec to the 2-complement register value
+    static quint16 speedToRegister( double speed );
+
     /// Sends a command to UDP server
     void sendBlockUDP( QUdpSocket *socket, QHostAddress addr, quint16 port, quint16 msgCode, QVector<quint16> &data, bool waitReply=false );
 
@@ -252,11 +349,20 @@ protected slots:
     /// Ping Timer handler
     void onPingTimerTimeout();
 
+    /// Reconnection attempt
+    void onReconnectTimerTimeout();
+    /// Restores the session when the socket of the reconnection attempt is connected
+    void onTcpSocketConnected();
+    /// The reconnection attempt did not connect in time
+    void onReconnectAttemptTimeout();
+
 signals:
     /// Signal emitted when TCP Socket is connected
     void tcpConnected();
     /// Signal emitted when TCP Socket is disconnected
     void tcpDisconnected();
+    /// Signal emitted when the session has been restored after a TCP disconnection
+    void tcpReconnected( int reconnectTimeMsec );
     /// Signal emitted when UDP Socket is connected
     void udpConnected();
     /// Signal emitted when UDP Socket is disconnected
@@ -288,6 +394,15 @@ signals:
     /// Signal emitted when client releases the Robot Control
     void robotControlReleased();
 
+    /// Signal emitted when the server played the whole speed trajectory without receiving a new one
+    void trajectoryUnderrun( quint16 underrunCount );
+
+    /// Signal emitted when new statistics of the redundant control link are received
+    void newControlLinkStats( ControlLinkStats& stats );
+
+    /// Signal emitted when the motion of the robot is received (see @ref getOdometry)
+    void newOdometry( RobotOdometry& odometry );
+
 private:
     qint64 mLastServerReqTime; /**< Information about last connection time */
 
@@ -341,6 +456,28 @@ private:
                                   are true a @ref newRobotConfiguration signal can be emitted. */
 
     QTimer mUdpPingTimer; /**< Timer of Udp Servers testing */
+
+    bool mTcpTransactionOpen;       /**< Indicates that TCP commands are queued in @ref mTcpTransactionBuffer */
+    QByteArray mTcpTransactionBuffer; /**< Commands of the current TCP transaction */
+    QQueue<TcpPendingReply> mTcpPendingReplies; /**< Commands of the current TCP transaction still waiting for their reply, in order */
+
+    int mCtrlRedundancy;            /**< Number of previous setpoints carried by each control datagram (0: not active) */
+    quint16 mCtrlSeq;               /**< Sequence number of the last speed setpoint */
+    QVector<quint16> mCtrlHistory;  /**< Last speed setpoints sent, newest first ([speed0][speed1] pairs) */
+    ControlLinkStats mCtrlLinkStats; /**< Last statistics of the control link */
+    RobotOdometry mOdometry;        /**< Last motion of the robot received from the server */
+
+    bool mAutoReconnect;            /**< Indicates if TCP connection is restored automatically */
+    QTimer mReconnectTimer;         /**< Timer for reconnection attempts */
+    int mReconnectDelayMsec;        /**< Delay of the next reconnection attempt */
+    bool mReconnecting;             /**< Indicates that a reconnection attempt is in progress */
+    QTimer mReconnectAttemptTimer;  /**< Timeout of the connection of the reconnection attempt */
+    QElapsedTimer mDisconnectedTime; /**< Time elapsed since the TCP connection has been lost */
+    bool mRobotControlHeld;         /**< Indicates that the client has the control of the robot */
+    bool mBoardConfigHashValid;     /**< Indicates that @ref mBoardConfigHash is valid */
+    quint16 mBoardConfigHash;       /**< Hash of the last configuration read from/saved to the board */
+    bool mServerConfigHashValid;    /**< Indicates that @ref mServerConfigHash has been received */
+    quint16 mServerConfigHash;      /**< Hash of the configuration received with MSG_CONFIG_HASH */
 };
 
 }
@@ -0,0 +1,228 @@
+#include <qrecordingreader.h>
+
+#include <QDir>
+#include <QFileInfo>
+#include <QDebug>
+#include <QObject>
+#include <QtEndian>
+
+#include <algorithm>
+
+namespace roboctrl
+{
+
+QRecordingReader::QRecordingReader() :
+    mMap(NULL),
+    mSize(0),
+    mSegmentIdx(0),
+    mClockOffsetUsec(0),
+    mRecovered(false)
+{
+}
+
+QRecordingReader::~QRecordingReader()
+{
+    close();
+}
+
+bool QRecordingReader::open( const QString& fileName )
+{
+    close();
+
+    mFile.setFileName( fileName );
+    if( !mFile.open( QIODevice::ReadOnly ) )
+    {
+        qDebug() << QObject::tr("Recording %1 cannot be opened: %2").arg(fileName).arg(mFile.errorString());
+        return false;
+    }
+
+    mSize = mFile.size();
+    if( mSize < REC_FILE_HEADER_SIZE )
+    {
+        qDebug() << QObject::tr("Recording %1 is not valid: the header is missing").arg(fileName);
+        mFile.close();
+        return false;
+    }
+
+    mMap = mFile.map( 0, mSize );
+    if( !mMap )
+    {
+        qDebug() << QObject::tr("Recording %1 cannot be mapped: %2").arg(fileName).arg(mFile.errorString());
+        mFile.close();
+        return false;
+    }
+
+    // >>>>> File header
+    if( qFromLittleEndian<quint32>( mMap )!=REC_FILE_MAGIC ||
+            qFromLittleEndian<quint16>( mMap+4 )!=REC_VERSION ||
+            qFromLittleEndian<quint16>( mMap+6 )!=REC_FILE_HEADER_SIZE )
+    {
+        qDebug() << QObject::tr("Recording %1 is not valid: unknown header").arg(fileName);
+        close();
+        return false;
+    }
+
+    mSegmentIdx = qFromLittleEndian<quint32>( mMap+8 );
+    mClockOffsetUsec = qFromLittleEndian<qint64>( mMap+16 );
+    // <<<<< File header
+
+    if( !loadIndex() )
+    {
+        recoverIndex();
+        qDebug() << QObject::tr("Recording %1 was not closed: %2 frames recovered").arg(fileName).arg(mIndex.size());
+    }
+
+    return true;
+}
+
+void QRecordingReader::close()
+{
+    if( mMap )
+        mFile.unmap( mMap );
+    mMap = NULL;
+    mSize = 0;
+
+    if( mFile.isOpen() )
+        mFile.close();
+
+    mIndex.clear();
+    mRecovered = false;
+}
+
+bool QRecordingReader::loadIndex()
+{
+    if( mSize < REC_FILE_HEADER_SIZE+REC_TRAILER_SIZE )
+        return false;
+
+    const uchar* trailer = mMap + mSize - REC_TRAILER_SIZE;
+    if( qFromLittleEndian<quint32>( trailer )!=REC_TRAILER_MAGIC )
+        return false;
+
+    quint32 count = qFromLittleEndian<quint32>( trailer+4 );
+    quint64 indexOffset = qFromLittleEndian<quint64>( trailer+8 );
+    if( indexOffset < REC_FILE_HEADER_SIZE ||
+            indexOffset + (quint64)count*REC_INDEX_ENTRY_SIZE + REC_TRAILER_SIZE != (quint64)mSize )
+        return false;
+
+    mIndex.resize( count );
+    const uchar* entry = mMap + indexOffset;
+    for( quint32 i=0; i<count; i++, entry+=REC_INDEX_ENTRY_SIZE )
+    {
+        mIndex[i].captureUsec = qFromLittleEndian<quint64>( entry );
+        mIndex[i].offset = qFromLittleEndian<quint64>( entry+8 );
+        mIndex[i].frameIdx = qFromLittleEndian<quint32>( entry+16 );
+        mIndex[i].camera = entry[20];
+
+        // An entry out of the frames makes the whole index unreliable
+        if( mIndex[i].offset < REC_FILE_HEADER_SIZE || mIndex[i].offset+REC_FRAME_HEADER_SIZE > indexOffset )
+        {
+            mIndex.clear();
+            return false;
+        }
+    }
+
+    mRecovered = false;
+    return true;
+}
+
+void QRecordingReader::recoverIndex()
+{
+    mIndex.clear();
+
+    // The frames are appended in order: the scan stops at the first frame not complete
+    qint64 offset = REC_FILE_HEADER_SIZE;
+    while( offset+REC_FRAME_HEADER_SIZE <= mSize )
+    {
+        const uchar* header = mMap + offset;
+        if( qFromLittleEndian<quint32>( header )!=REC_FRAME_MAGIC )
+            break;
+
+        qint64 dataSize = qFromLittleEndian<quint32>( header+4 );
+        if( offset+REC_FRAME_HEADER_SIZE+dataSize > mSize )
+            break;
+
+        IndexEntry entry;
+        entry.captureUsec = qFromLittleEndian<quint64>( header+8 );
+        entry.offset = (quint64)offset;
+        entry.frameIdx = qFromLittleEndian<quint32>( header+16 );
+        entry.camera = header[20];
+        mIndex.push_back( entry );
+
+        offset += REC_FRAME_HEADER_SIZE + ((dataSize+REC_ALIGN-1)/REC_ALIGN)*REC_ALIGN;
+    }
+
+    // Frames encoded in parallel are written in order of completion
+    std::stable_sort( mIndex.begin(), mIndex.end(), entryBefore );
+
+    mRecovered = true;
+}
+
+quint64 QRecordingReader::getFirstUsec()
+{
+    return mIndex.empty()?0:mIndex.front().captureUsec;
+}
+
+quint64 QRecordingReader::getLastUsec()
+{
+    return mIndex.empty()?0:mIndex.back().captureUsec;
+}
+
+int QRecordingReader::findFrame( quint64 captureUsec, int camera/*=-1*/ )
+{
+    IndexEntry key;
+    key.captureUsec = captureUsec;
+
+    // First frame after the time, then back to the camera requested
+    std::vector<IndexEntry>::const_iterator it = std::upper_bound( mIndex.begin(), mIndex.end(), key, entryBefore );
+    int pos = (int)(it-mIndex.begin()) - 1;
+
+    while( pos>=0 && camera>=0 && mIndex[pos].camera!=camera )
+        pos--;
+
+    return pos;
+}
+
+bool QRecordingReader::getFrame( int pos, RecordedFrame& frame )
+{
+    if( !mMap || pos<0 || pos>=(int)mIndex.size() )
+        return false;
+
+    const uchar* header = mMap + mIndex[pos].offset;
+    if( qFromLittleEndian<quint32>( header )!=REC_FRAME_MAGIC )
+        return false;
+
+    quint32 dataSize = qFromLittleEndian<quint32>( header+4 );
+    if( (qint64)mIndex[pos].offset+REC_FRAME_HEADER_SIZE+dataSize > mSize )
+        return false;
+
+    frame.captureUsec = qFromLittleEndian<quint64>( header+8 );
+    frame.wallClockMsec = toWallClockMsec( frame.captureUsec );
+    frame.frameIdx = qFromLittleEndian<quint32>( header+16 );
+    frame.camera = header[20];
+    frame.encoder = header[21];
+    frame.width = qFromLittleEndian<quint16>( header+22 );
+    frame.height = qFromLittleEndian<quint16>( header+24 );
+    frame.telemetryValid = (header[26] & REC_FRAME_FLAG_TELEMETRY)!=0;
+    frame.speed0 = qFromLittleEndian<qint16>( header+28 );
+    frame.speed1 = qFromLittleEndian<qint16>( header+30 );
+    frame.boardTimeMsec = qFromLittleEndian<quint32>( header+32 );
+    frame.telemetryAgeUsec = qFromLittleEndian<quint32>( header+36 );
+
+    // No copy: the array refers to the mapping
+    frame.data = QByteArray::fromRawData( (const char*)header+REC_FRAME_HEADER_SIZE, (int)dataSize );
+
+    return true;
+}
+
+QStringList QRecordingReader::listSegments( const QString& directory )
+{
+    // The names start with the creation time and the segment index
+    QDir dir( directory );
+    QStringList segments;
+    foreach( const QFileInfo& info, dir.entryInfoList( QStringList() << QString("*%1").arg(REC_FILE_SUFFIX), QDir::Files, QDir::Name ) )
+        segments << info.absoluteFilePath();
+
+    return segments;
+}
+
+}
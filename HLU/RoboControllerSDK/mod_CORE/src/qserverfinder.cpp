@@ -0,0 +1,226 @@
+#include <qserverfinder.h>
+#include <network_msg.h>
+
+#include <QDataStream>
+#include <QNetworkInterface>
+#include <QHostAddress>
+#include <QDebug>
+
+namespace roboctrl
+{
+
+QServerFinder::QServerFinder( quint16 udpSendPort/*=14550*/,
+                              quint16 udpListenPort/*=14555*/,
+                              QObject *parent/*=0*/) :
+    QObject(parent),
+    mUdpSocket(NULL),
+    mUdpSendPort(udpSendPort),
+    mUdpListenPort(udpListenPort),
+    mRetryIntervalMsec(DISCOVERY_FIRST_RETRY_MSEC),
+    mPingCounter(0),
+    mRunning(false)
+{
+    mRetryTimer.setSingleShot( true );
+    mTimeoutTimer.setSingleShot( true );
+
+    connect( &mRetryTimer, SIGNAL(timeout()),
+             this, SLOT(onRetryTimerTimeout()) );
+    connect( &mTimeoutTimer, SIGNAL(timeout()),
+             this, SLOT(onTimeoutTimerTimeout()) );
+}
+
+QServerFinder::~QServerFinder()
+{
+    stop();
+}
+
+bool QServerFinder::start( int timeoutMsec/*=DISCOVERY_TIMEOUT_MSEC*/ )
+{
+    stop();
+
+    mServers.clear();
+    mPingSentTime.clear();
+
+    mUdpSocket = new QUdpSocket(this);
+    if( !mUdpSocket->bind( mUdpListenPort, QAbstractSocket::ShareAddress ) )
+    {
+        qDebug() << tr("UDP error: %1").arg(mUdpSocket->errorString() );
+        closeSocket();
+        return false;
+    }
+
+    connect( mUdpSocket, SIGNAL(readyRead()),
+             this, SLOT(onReadyRead()) );
+
+    mRunning = true;
+    mClock.start();
+
+    sendPing();
+
+    mRetryIntervalMsec = DISCOVERY_FIRST_RETRY_MSEC;
+    mRetryTimer.start( mRetryIntervalMsec );
+    mTimeoutTimer.start( timeoutMsec );
+
+    return true;
+}
+
+void QServerFinder::stop()
+{
+    mRetryTimer.stop();
+    mTimeoutTimer.stop();
+
+    closeSocket();
+
+    mRunning = false;
+}
+
+void QServerFinder::closeSocket()
+{
+    if( mUdpSocket )
+    {
+        mUdpSocket->abort();
+        mUdpSocket->deleteLater();
+        mUdpSocket = NULL;
+    }
+}
+
+void QServerFinder::sendPing()
+{
+    if( !mUdpSocket )
+        return;
+
+    quint16 seq = mPingCounter++;
+
+    QByteArray block;
+    QDataStream out(&block, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_2);
+    out << (quint16)UDP_START_VAL; // Start word
+    out << (quint16)0;    // Block size
+    out << seq;           // Message counter
+    out << (quint16)CMD_SERVER_PING_REQ;       // Message Code
+    out << seq;           // Discovery sequence number, echoed by the server
+
+    out.device()->seek(0);          // Back to the beginning to set block size
+    int blockSize = (block.size() - 2*sizeof(quint16));
+    out << (quint16)UDP_START_VAL; // Start word again
+    out << (quint16)blockSize;
+
+    mPingSentTime[seq] = mClock.elapsed();
+
+    // >>>>> Broadcast on every active interface
+    int sentCount = 0;
+    foreach( QNetworkInterface iface, QNetworkInterface::allInterfaces() )
+    {
+        QNetworkInterface::InterfaceFlags flags = iface.flags();
+
+        if( !(flags & QNetworkInterface::IsUp) ||
+                !(flags & QNetworkInterface::IsRunning) ||
+                !(flags & QNetworkInterface::CanBroadcast) ||
+                (flags & QNetworkInterface::IsLoopBack) )
+            continue;
+
+        foreach( QNetworkAddressEntry entry, iface.addressEntries() )
+        {
+            if( entry.ip().protocol() != QAbstractSocket::IPv4Protocol ||
+                    entry.broadcast().isNull() )
+                continue;
+
+            if( mUdpSocket->writeDatagram( block, entry.broadcast(), mUdpSendPort ) == block.size() )
+                sentCount++;
+        }
+    }
+
+    if( sentCount==0 ) // No interface with a broadcast address
+        mUdpSocket->writeDatagram( block, QHostAddress::Broadcast, mUdpSendPort );
+    // <<<<< Broadcast on every active interface
+}
+
+void QServerFinder::onRetryTimerTimeout()
+{
+    if( !mRunning )
+        return;
+
+    sendPing();
+
+    mRetryIntervalMsec *= 2;
+    mRetryTimer.start( mRetryIntervalMsec );
+}
+
+void QServerFinder::onTimeoutTimerTimeout()
+{
+    stop();
+
+    emit finished( mServers.size() );
+}
+
+void QServerFinder::onReadyRead()
+{
+    while( mUdpSocket && mUdpSocket->hasPendingDatagrams() )
+    {
+        QByteArray datagram;
+        datagram.resize( mUdpSocket->pendingDatagramSize() );
+
+        QHostAddress addr;
+        quint16 port;
+
+        qint64 readCount = mUdpSocket->readDatagram( datagram.data(), datagram.size(), &addr, &port );
+        if( readCount < (qint64)(4*sizeof(quint16)) )
+            continue;
+
+        QDataStream in( datagram );
+        in.setVersion(QDataStream::Qt_5_2);
+
+        quint16 startWord;
+        quint16 blockSize;
+        quint16 msgIdx;
+        quint16 msgCode;
+
+        in >> startWord;
+        in >> blockSize;
+        in >> msgIdx;
+        in >> msgCode;
+
+        if( startWord!=UDP_START_VAL || msgCode!=MSG_SERVER_PING_OK )
+            continue; // Not a discovery reply (e.g. status data for a connected SDK)
+
+        ServerInfo info;
+        info.address = addr.toString();
+        info.boardIdx = 0;
+        info.rttMsec = -1;
+        info.capabilities = 0;
+
+        if( blockSize >= 5*sizeof(quint16) && readCount >= blockSize + 2*(qint64)sizeof(quint16) )
+        {
+            quint16 seq;
+            in >> info.boardIdx;
+            in >> info.capabilities;
+            in >> seq;
+
+            if( mPingSentTime.contains(seq) )
+                info.rttMsec = (int)(mClock.elapsed() - mPingSentTime.value(seq));
+        }
+
+        bool known = false;
+        for( int i=0; i<mServers.size(); i++ )
+        {
+            if( mServers[i].address == info.address )
+            {
+                known = true;
+                break;
+            }
+        }
+
+        if( known )
+            continue;
+
+        mServers.append( info );
+
+        qDebug() << tr("Found server %1 - Board: %2 - RTT: %3 msec - Capabilities: 0x%4")
+                    .arg(info.address).arg(info.boardIdx).arg(info.rttMsec)
+                    .arg(info.capabilities, 4, 16, QChar('0'));
+
+        emit serverFound( info.address, info.boardIdx, info.rttMsec, info.capabilities );
+    }
+}
+
+}
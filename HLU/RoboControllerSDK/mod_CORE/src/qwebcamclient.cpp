@@ -2,6 +2,8 @@
 
 #include <vector>
 #include <QCoreApplication>
+#include <QtEndian>
+#include <string.h>
 
 using namespace std;
 
@@ -12,10 +14,48 @@ QWebcamClient::QWebcamClient(QString serverIp, int listenPort, int sendPort, QOb
     QThread(parent),
     mUdpSocketSend(NULL)
 {
-    mCurrentId = 0;
-    mCurrentFragmentCount = 0;
+    for( int i=0; i<WEBCAM_REASM_SLOTS; i++ )
+    {
+        mFrameSlots[i].inUse = false;
+        mFrameSlots[i].fragCount = 0;
+    }
+    mFrameDelivered = false;
+    mLastDeliveredId = 0;
+    mLostFrameCount = 0;
+    mCompletedFrameCount = 0;
+    mRecoveredFragCount = 0;
+    mLossInjection = 0.0;
+
+    mMulticastAllowed = true;
+    mMulticastJoined = false;
+    mCompletedAtJoin = 0;
+    mStreamVersion = WEBCAM_PROTO_V1;
+    mSelectedStream = WEBCAM_STREAM_PREVIEW;
+    mSelectedCamera = 0;
+    mCameraCount = 1;
+
+    connect( &mFeedbackTimer, SIGNAL(timeout()),
+             this, SLOT(sendFeedback()) );
+
+    mProtoVersion = WEBCAM_PROTO_V1;
+    mClock.start();
+    mTransitValid = false;
+    mMinTransitUsec = 0;
+    mLastTransitUsec = 0;
+    mLatencySumMsec = 0.0;
+    memset( &mLatencyStats, 0, sizeof(WebcamLatencyStats) );
+
+    mDecodedSeq = 0;
+    mDecoded.front().seq = 0;
+    mDecoded.front().id = 0;
+    mDecoded.front().camera = 0;
+    mDecoded.front().telemetry = WebcamTelemetry();
+
+    mCompositeValid = false;
+    mCompositeId = 0;
+    mCompositeCamera = 0;
+    mKeyframeRequestCount = 0;
 
-    mLastImageState=true;
     mListenPort = listenPort;
     mSendPort = sendPort;
     mServerIp = serverIp;
@@ -25,10 +65,13 @@ QWebcamClient::QWebcamClient(QString serverIp, int listenPort, int sendPort, QOb
 
 QWebcamClient::~QWebcamClient()
 {
+    stopDecoder();
+    leaveMulticastGroup();
+
     if(mUdpSocketSend)
     {
-        char cmd = CMD_REMOVE_CLIENT;
-        mUdpSocketSend->writeDatagram( &cmd,
+        QByteArray cmd( 1, (char)CMD_REMOVE_CLIENT );
+        mUdpSocketSend->writeDatagram( cmd,
                                        QHostAddress(mServerIp),
                                        mSendPort );
 
@@ -43,16 +86,19 @@ QWebcamClient::~QWebcamClient()
 
 void QWebcamClient::disconnectServer()
 {
+    leaveMulticastGroup();
+
     if(mUdpSocketSend)
     {
-        char cmd = CMD_REMOVE_CLIENT;
-        mUdpSocketSend->writeDatagram( &cmd,
+        QByteArray cmd( 1, (char)CMD_REMOVE_CLIENT );
+        mUdpSocketSend->writeDatagram( cmd,
                                        QHostAddress(mServerIp),
                                        mListenPort );
 
         delete mUdpSocketSend;
         mUdpSocketSend = NULL;
     }
+    mFeedbackTimer.stop();
     mConnected = false;
 }
 
@@ -73,7 +119,8 @@ bool QWebcamClient::connectToServer(int sendPort,int listenPort)
 //                                   QUdpSocket::ShareAddress );
 
     mUdpSocketListen = new QUdpSocket();
-    bool binded = mUdpSocketListen->bind( //QHostAddress(mServerIp),
+    // IPv4 socket: required to join an IPv4 multicast group
+    bool binded = mUdpSocketListen->bind( QHostAddress::AnyIPv4,
                                         mListenPort,
                                         QUdpSocket::ShareAddress );
    // mUdpSocketListen->
@@ -87,11 +134,7 @@ bool QWebcamClient::connectToServer(int sendPort,int listenPort)
     }
     else
     {
-        char cmd = CMD_ADD_CLIENT;
-        if( -1==mUdpSocketSend->writeDatagram( &cmd,
-                                               QHostAddress(mServerIp),
-                                               //QHostAddress::Broadcast,
-                                               mSendPort ) )
+        if( !requestStream( mMulticastAllowed ) )
         {
             qDebug() << tr("Connection to server failed on port %2")
                         .arg(mSendPort);
@@ -106,12 +149,17 @@ bool QWebcamClient::connectToServer(int sendPort,int listenPort)
 
             connect(mUdpSocketListen, SIGNAL(readyRead()),
                     this, SLOT(processPendingDatagrams()));
+
+            mFeedbackTimer.start( WEBCAM_FEEDBACK_PERIOD_MSEC );
         }
     }
     // <<<< Trying connection
 
-    if(mConnected)
+    if(mConnected && !isRunning())
+    {
+        mDecoderStopped.storeRelease(0);
         start();
+    }
 
     return mConnected;
 }
@@ -123,121 +171,745 @@ void QWebcamClient::processPendingDatagrams()
         QByteArray datagram;
         datagram.resize( mUdpSocketListen->pendingDatagramSize() );
 
-        QDataStream stream( &datagram, QIODevice::ReadOnly );
-        stream.setVersion( QDataStream::Qt_4_0 );
-
         QHostAddress serverAddr;
-        mUdpSocketListen->readDatagram( datagram.data(), datagram.size(),
-                                        &serverAddr );
+        qint64 readCount = mUdpSocketListen->readDatagram( datagram.data(), datagram.size(),
+                                                           &serverAddr );
 
         mServerIp = serverAddr.toString();
         //qDebug() << mServerIp;
 
-        quint8 id;
-        stream >> id;
+        const uchar* data = (const uchar*)datagram.constData();
 
-        int infoSize = 9; // Packet info header size
+        if( readCount < WEBCAM_FRAG_HEADER_SIZE )
+        {
+            // >>>> Connection replies ("@A" followed by the stream version, by the number of cameras (v3) and by the multicast group, "@R")
+            if( readCount>=3 && data[0]=='@' && data[1]=='A' )
+            {
+                mProtoVersion = data[2];
+
+                int groupOffset = 3;
+                mCameraCount = 1;
+                if( mProtoVersion>=WEBCAM_PROTO_V3 && readCount>=4 )
+                {
+                    mCameraCount = qMax( 1, (int)data[3] );
+                    groupOffset = 4;
+                }
+
+                qDebug() << tr("Server accepted stream version %1 - Cameras: %2").arg(mProtoVersion).arg(mCameraCount);
+
+                // The server starts with the preview of the camera 0
+                if( mSelectedStream!=WEBCAM_STREAM_PREVIEW )
+                    sendStreamSelection();
+                if( mSelectedCamera!=0 )
+                    sendCameraSelection();
+
+                if( readCount>=groupOffset+4 )
+                    joinMulticastGroup( QHostAddress( qFromBigEndian<quint32>( data+groupOffset ) ) );
+                else
+                    leaveMulticastGroup(); // Unicast stream
+            }
+            // <<<< Connection replies
+            continue;
+        }
+
+        if( mLossInjection>0.0 && qrand() < mLossInjection*RAND_MAX )
+            continue;
 
-        if( id != mCurrentId )
+        WebcamFragHeader header;
+        if( !parseFragHeader( data, (int)readCount, header ) )
         {
-            if(!mLastImageState)
-                qDebug() << tr("Frame #%1 lost").arg(mCurrentId);
-            mLastImageState = false;
+            qDebug() << tr( "Packet error" );
+            continue;
+        }
 
-            mCurrentId = id;
+        // The multicast group carries the cameras of all its members
+        if( header.camera!=mSelectedCamera )
+            continue;
 
-            //qDebug() << tr( "New frame id: %1").arg(mCurrentId);
+        mStreamVersion = header.version;
 
-            stream >> mPacketSize;
-            stream >> mNumFrag;
+        int fragDataSize = header.packetSize-header.headerSize;
 
-            //qDebug() << tr(" Received frag #%1").arg((unsigned int)mNumFrag);
+        FrameSlot* slot = getFrameSlot( header );
+        if( !slot )
+            continue; // Late fragment of a frame already completed or dropped
 
-            stream >> mTailSize;
+        if( slot->received.testBit( header.fragIdx ) )
+            continue; // Duplicated
 
-            int dataSize;
-            if( mTailSize==0 )
-                dataSize = mNumFrag*mPacketSize;
+        int group;
+        if( header.fragIdx<header.numFrag )
+        {
+            uchar* dst = &slot->buffer[header.fragIdx*fragDataSize];
+
+            if( header.fragIdx==header.numFrag-1 && header.tailSize>0 )
+            {
+                memcpy( dst, data+header.headerSize, header.tailSize );
+                memset( dst+header.tailSize, 0, fragDataSize-header.tailSize ); // Padding used by the parity
+            }
             else
-                dataSize = (mNumFrag-1)*(mPacketSize-infoSize)+mTailSize;
+                memcpy( dst, data+header.headerSize, fragDataSize );
+
+            slot->fragCount++;
+            group = (slot->fecGroup>0)?header.fragIdx/slot->fecGroup:-1;
+        }
+        else
+        {
+            group = header.fragIdx-header.numFrag;
+            memcpy( &slot->parity[group*fragDataSize], data+header.headerSize, fragDataSize );
+        }
+        slot->received.setBit( header.fragIdx );
+
+        if( group>=0 && slot->fragCount<slot->numFrag )
+            recoverFragment( slot, group );
+
+        if( slot->fragCount==slot->numFrag ) // Image is ready
+            completeFrame( slot );
+    }
+
+    expireFrameSlots();
+
+    if( mKeyframeNeeded.loadAcquire() )
+        requestKeyframe();
+}
+
+bool QWebcamClient::parseFragHeader( const uchar* data, int size, WebcamFragHeader& header )
+{
+    header.telemetry = WebcamTelemetry(); // Not valid
 
-            mCurrentFragmentCount = 0;
-            mCurrentBuffer.clear();
-            mCurrentBuffer.resize(dataSize);
+    // Big endian, as written by QDataStream::Qt_4_0
+    if( data[0]==WEBCAM_V2_MARKER )
+    {
+        if( size < WEBCAM_FRAG_HEADER_SIZE_V2 || data[1]<WEBCAM_PROTO_V2 )
+            return false;
+
+        // Newer versions must extend the v4 header
+        if( data[1]>=WEBCAM_PROTO_V4 )
+        {
+            if( size < WEBCAM_FRAG_HEADER_SIZE_V4 )
+                return false;
+
+            header.version = WEBCAM_PROTO_V4;
+            header.headerSize = WEBCAM_FRAG_HEADER_SIZE_V4;
+            header.camera = data[32];
+
+            // >>>>> Robot state at capture time
+            header.telemetry.valid = (data[33] & WEBCAM_TELEMETRY_VALID)!=0;
+            header.telemetry.speed0 = qFromBigEndian<qint16>( data+34 )/1000.0; // mm/sec -> m/sec
+            header.telemetry.speed1 = qFromBigEndian<qint16>( data+36 )/1000.0;
+            header.telemetry.boardTimeMsec = qFromBigEndian<quint32>( data+38 );
+            header.telemetry.ageUsec = qFromBigEndian<quint32>( data+42 );
+            // <<<<< Robot state at capture time
+        }
+        else if( data[1]>=WEBCAM_PROTO_V3 )
+        {
+            if( size < WEBCAM_FRAG_HEADER_SIZE_V3 )
+                return false;
 
-            //            qDebug() << tr( "Fragment count: %1 - Tail Size: %2 - Full Data Size: %3")
-            //                        .arg(mNumFrag).arg(mTailSize).arg(dataSize);
+            header.version = WEBCAM_PROTO_V3;
+            header.headerSize = WEBCAM_FRAG_HEADER_SIZE_V3;
+            header.camera = data[32];
         }
         else
         {
-            // >>>> Removing info data from stream and verifying of correctness
-            quint16 packetSize;
-            stream >> packetSize;
-            quint16 numFrag;
-            stream >> numFrag;
-            quint16 tailSize;
-            stream >> tailSize;
+            header.version = WEBCAM_PROTO_V2;
+            header.headerSize = WEBCAM_FRAG_HEADER_SIZE_V2;
+            header.camera = 0;
+        }
+        header.encoder = data[2];
+        header.fecGroup = data[3];
+        header.frameId = qFromBigEndian<quint32>( data+4 );
+        header.captureUsec = qFromBigEndian<quint64>( data+8 );
+        header.serverDelayUsec = qFromBigEndian<quint32>( data+16 );
+        header.width = qFromBigEndian<quint16>( data+20 );
+        header.height = qFromBigEndian<quint16>( data+22 );
+        header.packetSize = qFromBigEndian<quint16>( data+24 );
+        header.numFrag = qFromBigEndian<quint16>( data+26 );
+        header.tailSize = qFromBigEndian<quint16>( data+28 );
+        header.fragIdx = qFromBigEndian<quint16>( data+30 );
+    }
+    else
+    {
+        header.version = WEBCAM_PROTO_V1;
+        header.headerSize = WEBCAM_FRAG_HEADER_SIZE;
+        header.camera = 0;
+        header.encoder = WEBCAM_ENC_JPEG;
+        header.fecGroup = 0;
+        header.frameId = data[0];
+        header.captureUsec = 0;
+        header.serverDelayUsec = 0;
+        header.width = 0;
+        header.height = 0;
+        header.packetSize = qFromBigEndian<quint16>( data+1 );
+        header.numFrag = qFromBigEndian<quint16>( data+3 );
+        header.tailSize = qFromBigEndian<quint16>( data+5 );
+        header.fragIdx = qFromBigEndian<quint16>( data+7 );
+    }
+
+    header.numParity = (header.fecGroup>0)?(header.numFrag+header.fecGroup-1)/header.fecGroup:0;
+
+    int fragDataSize = header.packetSize-header.headerSize;
+    if( fragDataSize<=0 || header.numFrag==0 ||
+            header.fragIdx>=header.numFrag+header.numParity || header.tailSize>fragDataSize )
+        return false;
+
+    // Parity fragments are always full
+    int dataSize = (header.fragIdx==header.numFrag-1 && header.tailSize>0)?header.tailSize:fragDataSize;
+    if( size < header.headerSize+dataSize )
+    {
+        qDebug() << tr( "Frame #%1: fragment %2 truncated" ).arg(header.frameId).arg(header.fragIdx);
+        return false;
+    }
+
+    return true;
+}
+
+bool QWebcamClient::isNewerFrame( quint32 a, quint32 b )
+{
+    if( mStreamVersion==WEBCAM_PROTO_V1 )
+        return (quint8)(a-b)>0 && (quint8)(a-b)<128;
+
+    return (qint32)(a-b)>0;
+}
+
+FrameSlot* QWebcamClient::getFrameSlot( const WebcamFragHeader& header )
+{
+    quint32 id = header.frameId;
+    quint16 packetSize = header.packetSize;
+    quint16 numFrag = header.numFrag;
+    quint16 tailSize = header.tailSize;
+    quint8 fecGroup = header.fecGroup;
+
+    FrameSlot* freeSlot = NULL;
+    FrameSlot* oldestSlot = NULL;
+
+    for( int i=0; i<WEBCAM_REASM_SLOTS; i++ )
+    {
+        FrameSlot* slot = &mFrameSlots[i];
+
+        if( !slot->inUse )
+        {
+            if( !freeSlot )
+                freeSlot = slot;
+            continue;
+        }
 
-            if( packetSize!=mPacketSize || numFrag!=mNumFrag || tailSize!=mTailSize )
+        if( slot->id == id )
+        {
+            if( slot->packetSize!=packetSize || slot->numFrag!=numFrag ||
+                    slot->tailSize!=tailSize || slot->fecGroup!=fecGroup )
             {
                 qDebug() << tr( "Packet error" );
-                continue;
-                //return;
+                return NULL;
             }
-            // <<<< Removing info data from stream and verifying of correctness
+            return slot;
+        }
+
+        if( !oldestSlot || isNewerFrame( oldestSlot->id, slot->id ) )
+            oldestSlot = slot;
+    }
+
+    // >>>>> New frame
+    if( mFrameDelivered && !isNewerFrame( id, mLastDeliveredId ) )
+        return NULL;
+
+    if( !freeSlot )
+    {
+        qDebug() << tr("Frame #%1 lost").arg(oldestSlot->id);
+        oldestSlot->inUse = false;
+        mLostFrameCount++;
+        freeSlot = oldestSlot;
+    }
+
+    int fragDataSize = packetSize-header.headerSize;
+
+    freeSlot->inUse = true;
+    freeSlot->id = id;
+    freeSlot->captureUsec = header.captureUsec;
+    freeSlot->serverDelayUsec = header.serverDelayUsec;
+    freeSlot->telemetry = header.telemetry;
+    freeSlot->encoder = header.encoder;
+    freeSlot->width = header.width;
+    freeSlot->height = header.height;
+    freeSlot->packetSize = packetSize;
+    freeSlot->numFrag = numFrag;
+    freeSlot->tailSize = tailSize;
+    freeSlot->fecGroup = fecGroup;
+    freeSlot->numParity = header.numParity;
+    freeSlot->fragDataSize = fragDataSize;
+    freeSlot->dataSize = (tailSize==0)?(numFrag*fragDataSize):((numFrag-1)*fragDataSize+tailSize);
+    freeSlot->fragCount = 0;
+    freeSlot->received.fill( false, numFrag+header.numParity );
+    if( (int)freeSlot->buffer.size() < numFrag*fragDataSize )
+        freeSlot->buffer.resize( numFrag*fragDataSize );
+    if( (int)freeSlot->parity.size() < header.numParity*fragDataSize )
+        freeSlot->parity.resize( header.numParity*fragDataSize );
+    freeSlot->started.start();
+    // <<<<< New frame
+
+    return freeSlot;
+}
+
+void QWebcamClient::recoverFragment( FrameSlot* slot, int group )
+{
+    if( !slot->received.testBit( slot->numFrag+group ) )
+        return; // Parity not yet received
+
+    int first = group*slot->fecGroup;
+    int last = qMin( first+slot->fecGroup, (int)slot->numFrag );
+
+    int missing = -1;
+    for( int i=first; i<last; i++ )
+    {
+        if( !slot->received.testBit( i ) )
+        {
+            if( missing>=0 )
+                return; // More than one fragment missing: the group cannot be rebuilt
+            missing = i;
         }
+    }
+
+    if( missing<0 )
+        return;
+
+    // >>>>> Missing fragment = parity XOR all the other fragments of the group
+    int size = slot->fragDataSize;
+    uchar* dst = &slot->buffer[missing*size];
+    memcpy( dst, &slot->parity[group*size], size );
+
+    for( int i=first; i<last; i++ )
+    {
+        if( i==missing )
+            continue;
 
-        quint16 fragIdx;
-        stream >> fragIdx;
-        int fragDataSize = mPacketSize-infoSize;
+        const uchar* src = &slot->buffer[i*size];
+        for( int b=0; b<size; b++ )
+            dst[b] ^= src[b];
+    }
+    // <<<<< Missing fragment = parity XOR all the other fragments of the group
 
-        int startIdx = fragIdx*fragDataSize;
-        int endIdx = (fragIdx==mNumFrag-1)?(startIdx+mTailSize):(startIdx+fragDataSize);
+    slot->received.setBit( missing );
+    slot->fragCount++;
+    mRecoveredFragCount++;
+}
 
-        for( int d=startIdx; d<endIdx; d++ )
+void QWebcamClient::expireFrameSlots()
+{
+    for( int i=0; i<WEBCAM_REASM_SLOTS; i++ )
+    {
+        FrameSlot* slot = &mFrameSlots[i];
+
+        if( slot->inUse && slot->started.elapsed() > WEBCAM_REASM_DEADLINE_MSEC )
         {
-            quint8 elem;
-            stream >> elem;
+            qDebug() << tr("Frame #%1 lost: %2/%3 fragments received")
+                        .arg(slot->id).arg(slot->fragCount).arg(slot->numFrag);
+            slot->inUse = false;
+            mLostFrameCount++;
+        }
+    }
+}
+
+void QWebcamClient::completeFrame( FrameSlot* slot )
+{
+    quint32 id = slot->id;
+    slot->inUse = false;
 
-            mCurrentBuffer[d] = elem;
+    // Frames older than the completed one are useless
+    for( int i=0; i<WEBCAM_REASM_SLOTS; i++ )
+    {
+        if( mFrameSlots[i].inUse && isNewerFrame( id, mFrameSlots[i].id ) )
+        {
+            qDebug() << tr("Frame #%1 lost").arg(mFrameSlots[i].id);
+            mFrameSlots[i].inUse = false;
+            mLostFrameCount++;
         }
+    }
+
+    mFrameDelivered = true;
+    mLastDeliveredId = id;
+    mCompletedFrameCount++;
 
-        mCurrentFragmentCount++;
+    if( slot->encoder!=WEBCAM_ENC_JPEG && slot->encoder!=WEBCAM_ENC_JPEG_TILES )
+    {
+        qDebug() << tr( "Frame #%1 error: Unknown encoder %2" ).arg(id).arg(slot->encoder);
+        return;
+    }
+
+    // >>>>> Handoff to the decoder: the buffers are swapped, not copied
+    WebcamCompressedFrame& frame = mCompressed.back();
+    frame.data.swap( slot->buffer );
+    frame.dataSize = slot->dataSize;
+    frame.id = id;
+    frame.version = mStreamVersion;
+    frame.camera = mSelectedCamera;
+    frame.encoder = slot->encoder;
+    frame.width = slot->width;
+    frame.height = slot->height;
+    frame.captureUsec = slot->captureUsec;
+    frame.serverDelayUsec = slot->serverDelayUsec;
+    frame.telemetry = slot->telemetry;
+    frame.completedUsec = mClock.nsecsElapsed()/1000;
+
+    if( mCompressed.publish() )
+        mSkippedFrameCount.ref(); // The decoder is late: only the newest frame is decoded
+
+    mDecodeMutex.lock();
+    mFrameCompleted.wakeOne();
+    mDecodeMutex.unlock();
+    // <<<<< Handoff to the decoder
+}
+
+void QWebcamClient::stopDecoder()
+{
+    mDecoderStopped.storeRelease(1);
+
+    mDecodeMutex.lock();
+    mFrameCompleted.wakeOne();
+    mDecodeMutex.unlock();
 
-        if(mCurrentFragmentCount==mNumFrag) // Image is ready
+    wait();
+}
+
+void QWebcamClient::run()
+{
+    while( !mDecoderStopped.loadAcquire() )
+    {
+        if( !mCompressed.acquire() )
         {
-            mImgMutex.lock();
+            mDecodeMutex.lock();
             {
-                mLastImageState = true;
-                mLastCompleteFrame = cv::imdecode( cv::Mat( mCurrentBuffer ), 1 );
+                // Checked again with the mutex locked to not miss the wake up
+                if( !mCompressed.acquire() )
+                {
+                    mFrameCompleted.wait( &mDecodeMutex, WEBCAM_DECODE_WAIT_MSEC );
+
+                    if( !mCompressed.acquire() )
+                    {
+                        mDecodeMutex.unlock();
+                        continue;
+                    }
+                }
             }
-            mImgMutex.unlock();
+            mDecodeMutex.unlock();
+        }
+
+        WebcamCompressedFrame& frame = mCompressed.front();
+
+        // A new image for each frame: the consumer can still be using the previous ones
+        WebcamDecodedFrame& decoded = mDecoded.back();
 
-            if(!mLastCompleteFrame.empty())
+        if( frame.encoder==WEBCAM_ENC_JPEG_TILES )
+        {
+            bool updated;
+            if( !decodeTiles( frame, updated ) )
             {
-                //cv::imshow( "Stream", mLastCompleteFrame );
-                emit newImageReceived();
+                mKeyframeNeeded.storeRelease(1);
+                qDebug() << tr( "Frame #%1 error: Tiles without reference" ).arg(frame.id);
+                continue;
+            }
+
+            if( !updated )
+                continue; // Static scene: nothing new for the consumer
+
+            decoded.image = mComposite;
+        }
+        else
+        {
+            decoded.image = cv::imdecode( cv::Mat( 1, frame.dataSize, CV_8UC1, &frame.data[0] ), 1 );
 
-                //cv::waitKey( 1 );
-                //QCoreApplication::processEvents( QEventLoop::AllEvents, 50 );
-                qDebug() << tr( "Frame #%1 ready" ).arg((int)id);
+            if( decoded.image.empty() )
+            {
+                qDebug() << tr( "Frame #%1 error: Wrong encoding" ).arg(frame.id);
+                continue;
             }
-            else
-                qDebug() << tr( "Frame #%1 error: Wrong encoding" ).arg((int)id);
+
+            // Keyframe: reference of the next tiles
+            mComposite = decoded.image;
+            mCompositeId = frame.id;
+            mCompositeCamera = frame.camera;
+            mCompositeValid = true;
         }
+
+        if( frame.version>=WEBCAM_PROTO_V2 )
+            updateLatencyStats( frame, (mClock.nsecsElapsed()/1000-frame.completedUsec)/1000.0 );
+
+        decoded.seq = ++mDecodedSeq;
+        decoded.id = frame.id;
+        decoded.camera = frame.camera;
+        decoded.telemetry = frame.telemetry;
+        quint32 seq = decoded.seq;
+
+        mDecoded.publish();
+
+        emit newImageReceived( seq );
+    }
+}
+
+bool QWebcamClient::decodeTiles( const WebcamCompressedFrame& frame, bool& updated )
+{
+    updated = false;
+
+    const uchar* data = &frame.data[0];
+    if( frame.dataSize < WEBCAM_TILES_HEADER_SIZE )
+        return false;
+
+    quint32 refId = qFromBigEndian<quint32>( data );
+    int tileSize = qFromBigEndian<quint16>( data+4 );
+    int tileCount = qFromBigEndian<quint16>( data+6 );
+
+    int jpegOffset = WEBCAM_TILES_HEADER_SIZE + 2*tileCount;
+    if( frame.dataSize < jpegOffset || tileSize==0 )
+        return false;
+
+    // >>>>> Reference check
+    if( !mCompositeValid || frame.camera!=mCompositeCamera ||
+            mComposite.cols!=frame.width || mComposite.rows!=frame.height )
+        return false;
+
+    // A frame of the chain has been lost or skipped: its tiles are missing until the next keyframe
+    if( refId!=mCompositeId )
+        mKeyframeNeeded.storeRelease(1);
+
+    mCompositeId = frame.id;
+    // <<<<< Reference check
+
+    if( tileCount==0 )
+        return true;
+
+    mTiles = cv::imdecode( cv::Mat( 1, frame.dataSize-jpegOffset, CV_8UC1, (void*)(data+jpegOffset) ), 1 );
+
+    int cols = (frame.width+tileSize-1)/tileSize;
+    int rows = (frame.height+tileSize-1)/tileSize;
+    int mosaicCols = qMin( tileCount, cols );
+    int mosaicRows = (tileCount+mosaicCols-1)/mosaicCols;
+
+    if( mTiles.type()!=mComposite.type() ||
+            mTiles.cols < mosaicCols*tileSize || mTiles.rows < mosaicRows*tileSize )
+        return false;
+
+    // >>>>> Compositing on a copy: the consumer can still be using the last image
+    cv::Mat composite = mComposite.clone();
+
+    for( int i=0; i<tileCount; i++ )
+    {
+        int tileIdx = qFromBigEndian<quint16>( data+WEBCAM_TILES_HEADER_SIZE+2*i );
+        if( tileIdx >= cols*rows )
+            return false;
+
+        int x = (tileIdx%cols)*tileSize;
+        int y = (tileIdx/cols)*tileSize;
+        cv::Rect r( x, y, qMin( tileSize, frame.width-x ), qMin( tileSize, frame.height-y ) );
+
+        cv::Rect cell( (i%mosaicCols)*tileSize, (i/mosaicCols)*tileSize, r.width, r.height );
+        mTiles( cell ).copyTo( composite( r ) );
     }
+
+    mComposite = composite;
+    // <<<<< Compositing
+
+    updated = true;
+    return true;
 }
 
-cv::Mat QWebcamClient::getLastFrame()
+void QWebcamClient::updateLatencyStats( const WebcamCompressedFrame& frame, double decodeMsec )
 {
-    qDebug() << Q_FUNC_INFO;
+    // Offset between the clocks of client and server plus network transit time
+    qint64 transitUsec = frame.completedUsec - (qint64)(frame.captureUsec + frame.serverDelayUsec);
 
-    //mImgMutex.lock();
+    mStatsMutex.lock();
     {
+        if( !mTransitValid || transitUsec < mMinTransitUsec )
+            mMinTransitUsec = transitUsec;
 
-        return mLastCompleteFrame;
+        // Interarrival jitter (RFC 3550): J += (|D| - J)/16
+        if( mTransitValid )
+        {
+            double d = qAbs( transitUsec - mLastTransitUsec )/1000.0;
+            mLatencyStats.jitterMsec += (d - mLatencyStats.jitterMsec)/16.0;
+        }
+        mLastTransitUsec = transitUsec;
+        mTransitValid = true;
+
+        mLatencyStats.frameCount++;
+        mLatencyStats.lastFrameId = frame.id;
+        mLatencyStats.serverDelayMsec = frame.serverDelayUsec/1000.0;
+        mLatencyStats.networkDelayMsec = (transitUsec-mMinTransitUsec)/1000.0;
+        mLatencyStats.decodeMsec = decodeMsec;
+        mLatencyStats.latencyMsec = mLatencyStats.serverDelayMsec +
+                mLatencyStats.networkDelayMsec + decodeMsec;
+
+        mLatencySumMsec += mLatencyStats.latencyMsec;
+        mLatencyStats.avgLatencyMsec = mLatencySumMsec/mLatencyStats.frameCount;
     }
-    //mImgMutex.unlock();
+    mStatsMutex.unlock();
+}
+
+bool QWebcamClient::requestStream( bool multicast )
+{
+    if( !mUdpSocketSend )
+        return false;
+
+    // Version and flags are ignored by the servers supporting only v1
+    QByteArray cmd;
+    cmd.append( (char)CMD_ADD_CLIENT );
+    cmd.append( (char)WEBCAM_PROTO_VERSION );
+    cmd.append( (char)((multicast?WEBCAM_ADD_FLAG_MULTICAST:0) | WEBCAM_ADD_FLAG_TILES) );
+
+    return -1!=mUdpSocketSend->writeDatagram( cmd,
+                                              QHostAddress(mServerIp),
+                                              //QHostAddress::Broadcast,
+                                              mSendPort );
+}
+
+void QWebcamClient::joinMulticastGroup( QHostAddress group )
+{
+    if( mMulticastJoined && group==mMulticastGroup )
+        return;
+
+    leaveMulticastGroup();
+
+    if( mUdpSocketListen && mUdpSocketListen->joinMulticastGroup( group ) )
+    {
+        mMulticastJoined = true;
+        mMulticastGroup = group;
+        mJoinTime.start();
+        mCompletedAtJoin = mCompletedFrameCount;
+
+        qDebug() << tr("Joined multicast group %1").arg(group.toString());
+    }
+    else
+    {
+        qDebug() << tr("Unable to join multicast group %1: falling back to unicast").arg(group.toString());
+
+        mMulticastAllowed = false;
+        requestStream( false );
+    }
+}
+
+void QWebcamClient::leaveMulticastGroup()
+{
+    if( !mMulticastJoined )
+        return;
+
+    if( mUdpSocketListen )
+        mUdpSocketListen->leaveMulticastGroup( mMulticastGroup );
+
+    mMulticastJoined = false;
+}
+
+void QWebcamClient::selectStream( quint8 stream )
+{
+    if( stream==mSelectedStream )
+        return;
+
+    mSelectedStream = stream;
+    sendStreamSelection();
+}
+
+void QWebcamClient::selectCamera( quint8 camera )
+{
+    if( camera==mSelectedCamera )
+        return;
+
+    mSelectedCamera = camera;
+
+    // >>>>> The frame ids of the new camera restart the reassembly
+    for( int i=0; i<WEBCAM_REASM_SLOTS; i++ )
+        mFrameSlots[i].inUse = false;
+    mFrameDelivered = false;
+    // <<<<< The frame ids of the new camera restart the reassembly
+
+    sendCameraSelection();
+}
+
+void QWebcamClient::sendCameraSelection()
+{
+    // Servers not supporting v3 send only the camera 0
+    if( !mUdpSocketSend || mProtoVersion<WEBCAM_PROTO_V3 )
+        return;
+
+    QByteArray cmd;
+    cmd.append( (char)CMD_SELECT_CAMERAS );
+    cmd.append( (char)(1<<mSelectedCamera) );
+
+    mUdpSocketSend->writeDatagram( cmd, QHostAddress(mServerIp), mSendPort );
+}
+
+void QWebcamClient::sendStreamSelection()
+{
+    // Servers not supporting v2 do not know the command
+    if( !mUdpSocketSend || mProtoVersion<WEBCAM_PROTO_V2 )
+        return;
+
+    QByteArray cmd;
+    cmd.append( (char)CMD_SELECT_STREAM );
+    cmd.append( (char)mSelectedStream );
+
+    mUdpSocketSend->writeDatagram( cmd, QHostAddress(mServerIp), mSendPort );
+}
+
+void QWebcamClient::requestKeyframe()
+{
+    // Servers not supporting v2 do not send tiles
+    if( !mUdpSocketSend || mProtoVersion<WEBCAM_PROTO_V2 )
+        return;
+
+    if( mKeyframeRequestTime.isValid() && mKeyframeRequestTime.elapsed() < WEBCAM_KEYFRAME_REQ_MSEC )
+        return;
+
+    mKeyframeNeeded.storeRelease(0);
+
+    QByteArray cmd( 1, (char)CMD_REQUEST_KEYFRAME );
+    mUdpSocketSend->writeDatagram( cmd, QHostAddress(mServerIp), mSendPort );
+
+    mKeyframeRequestTime.start();
+    mKeyframeRequestCount++;
+}
+
+void QWebcamClient::sendFeedback()
+{
+    // >>>>> Multicast fallback: the group is not routed to the client
+    if( mMulticastJoined && mCompletedFrameCount==mCompletedAtJoin &&
+            mJoinTime.elapsed() > WEBCAM_MCAST_FALLBACK_MSEC )
+    {
+        qDebug() << tr("No frames from multicast group %1: falling back to unicast").arg(mMulticastGroup.toString());
+
+        leaveMulticastGroup();
+        mMulticastAllowed = false;
+        requestStream( false );
+    }
+    // <<<<< Multicast fallback
+
+    // Servers not supporting v2 do not know the command
+    if( !mUdpSocketSend || mProtoVersion<WEBCAM_PROTO_V2 )
+        return;
+
+    QByteArray cmd;
+    QDataStream stream( &cmd, QIODevice::WriteOnly );
+    stream.setVersion( QDataStream::Qt_4_0 );
+
+    stream << CMD_CLIENT_FEEDBACK << mCompletedFrameCount << mLostFrameCount;
+
+    mUdpSocketSend->writeDatagram( cmd, QHostAddress(mServerIp), mSendPort );
+}
+
+WebcamLatencyStats QWebcamClient::getLatencyStats()
+{
+    QMutexLocker locker( &mStatsMutex );
+    return mLatencyStats;
+}
+
+cv::Mat QWebcamClient::getLastFrame( quint32* seq/*=NULL*/, WebcamTelemetry* telemetry/*=NULL*/ )
+{
+    mDecoded.acquire(); // If no new frame the last one is returned again
+
+    const WebcamDecodedFrame& frame = mDecoded.front();
+    if( seq )
+        *seq = frame.seq;
+    if( telemetry )
+        *telemetry = frame.telemetry;
+
+    return frame.image;
 }
 
 }
@@ -10,6 +10,9 @@
 #include <QFile>
 #include <QNetworkInterface>
 #include <QHostAddress>
+#include <QEventLoop>
+#include <QElapsedTimer>
+#include <qserverfinder.h>
 
 namespace roboctrl
 {
@@ -27,9 +30,32 @@ RoboControllerSDK::RoboControllerSDK(QString serverAddr/*=QString("127.0.0.1")*/
     mWatchDogTimeMsec = 1000;
     mMsgCounter = 0;
 
+    mTcpTransactionOpen = false;
+    mTcpPendingReplies.clear();
+
+    mCtrlRedundancy = 0;
+    mCtrlSeq = 0;
+    memset( &mCtrlLinkStats, 0, sizeof(ControlLinkStats) );
+    memset( &mOdometry, 0, sizeof(RobotOdometry) );
+
+    mAutoReconnect = true;
+    mReconnectDelayMsec = RECONNECT_FIRST_DELAY_MSEC;
+    mReconnecting = false;
+    mRobotControlHeld = false;
+    mBoardConfigHashValid = false;
+    mBoardConfigHash = 0;
+    mServerConfigHashValid = false;
+    mServerConfigHash = 0;
+
     // Ping Timer
     connect( &mPingTimer, SIGNAL(timeout()), this, SLOT(onPingTimerTimeout()));
 
+    // Reconnection Timer
+    mReconnectTimer.setSingleShot( true );
+    connect( &mReconnectTimer, SIGNAL(timeout()), this, SLOT(onReconnectTimerTimeout()));
+    mReconnectAttemptTimer.setSingleShot( true );
+    connect( &mReconnectAttemptTimer, SIGNAL(timeout()), this, SLOT(onReconnectAttemptTimeout()));
+
     // >>>>> TCP Socket
     mTcpSocket = new QTcpSocket(this);
 
@@ -42,6 +68,8 @@ RoboControllerSDK::RoboControllerSDK(QString serverAddr/*=QString("127.0.0.1")*/
             this, SLOT(onTcpReadyRead()));
     connect(mTcpSocket, SIGNAL(hostFound()),
             this, SLOT(onTcpHostFound()));
+    connect(mTcpSocket, SIGNAL(connected()),
+            this, SLOT(onTcpSocketConnected()));
     connect(mTcpSocket, SIGNAL(error(QAbstractSocket::SocketError)),
             this, SLOT(onTcpError(QAbstractSocket::SocketError)));
 
@@ -97,6 +125,11 @@ RoboControllerSDK::RoboControllerSDK(QString serverAddr/*=QString("127.0.0.1")*/
 
 RoboControllerSDK::~RoboControllerSDK()
 {
+    // The server keeps the control of the robot until it is released:
+    // a new instance on this IP would restart the sequence of the setpoints
+    if( mRobotControlHeld )
+        releaseRobotControl();
+
     this->terminate();
 
     while(this->isRunning());
@@ -106,90 +139,34 @@ RoboControllerSDK::~RoboControllerSDK()
 
 QString RoboControllerSDK::findServer(quint16 udpSendPort/*=14550*/ , quint64 udpListenPort/*=14555*/)
 {
-    /*if( mUdpConnected )
-        return mServerAddr;*/
-
-    QUdpSocket* udp = new QUdpSocket();
-    if( !udp->bind( udpListenPort, /*QAbstractSocket::ReuseAddressHint|*/QAbstractSocket::ShareAddress ) )
-    {
-        qDebug() << tr("UDP error: %1").arg(udp->errorString() );
-        udp->abort();
-        delete udp;
-        return QString();
-    }
-
-    QVector<quint16> vec;
-
-    // >>>>> sendCommand( udp, CMD_SERVER_PING_REQ, vec  );
-    QByteArray block;
-    QDataStream out(&block, QIODevice::WriteOnly);
-    out.setVersion(QDataStream::Qt_5_2);
-    out << (quint16)UDP_START_VAL; // Start word
-    out << (quint16)0;    // Block size
-    out << (quint16)1;    // Message counter
-    out << (quint16)CMD_SERVER_PING_REQ;       // Message Code
-
-    out.device()->seek(0);          // Back to the beginning to set block size
-    int blockSize = (block.size() - 2*sizeof(quint16));
-    out << (quint16)UDP_START_VAL; // Start word again
-    out << (quint16)blockSize;
-
-    udp->writeDatagram( block, QHostAddress::Broadcast, udpSendPort);
-    // <<<<< sendCommand( udp, CMD_SERVER_PING_REQ, vec  );
-
-    msleep( 500 );
-
-    if( udp->waitForReadyRead( 10000 ) )
-    {
-        QHostAddress addr;
-        quint16 port;
+    QServerFinder finder( udpSendPort, udpListenPort );
 
-        qint64 size = udp->pendingDatagramSize();
-        char* data = new char[size];
+    // The local loop ends at the first reply or when the search timeout expires
+    QEventLoop loop;
+    connect( &finder, SIGNAL(serverFound(QString,quint16,int,quint16)),
+             &loop, SLOT(quit()) );
+    connect( &finder, SIGNAL(finished(int)),
+             &loop, SLOT(quit()) );
 
-        qint64 readCount = udp->readDatagram( data, size, &addr, &port );
+    if( !finder.start() )
+        return QString();
 
-        if( readCount==0 || readCount!=size )
-        {
-            delete [] data;
-            udp->abort();
-            delete udp;
+    loop.exec();
 
-            return QString();
-        }
-
-        for( int i=0; i<readCount; i++ )
-        {
-            if( data[i]==MSG_SERVER_PING_OK )
-            {
-                if( i>2 && data[i-4]==4 ) // The block size must be 6
-                {
-                    delete [] data;
-                    udp->abort();
-                    delete udp;
-                    return addr.toString();
-                }
-            }
-        }
-
-        delete [] data;
-        udp->abort();
-        delete udp;
-        return QString(); // Correct MSG_SERVER_PING_OK not found!
-    }
-    else
-    {
-        udp->abort();
-        delete udp;
+    QList<ServerInfo> servers = finder.getServers();
+    if( servers.isEmpty() )
         return QString();
-    }
+
+    return servers.first().address;
 }
 
-void RoboControllerSDK::connectToTcpServer()
+void RoboControllerSDK::connectToTcpServer( int timeoutMsec/*=5000*/ )
 {
     mTcpConnected = false;
+    mNextTcpBlockSize = 0;
+
     mTcpSocket->connectToHost( QHostAddress(mServerAddr), mTcpPort );
-    if( !mTcpSocket->waitForConnected( 5000 ) )
+    if( !mTcpSocket->waitForConnected( timeoutMsec ) )
     {
         throw RcException( excTcpNotConnected, tr("It is not possible to connect to TCP server: %1")
                            .arg(mTcpSocket->errorString() ).toLocal8Bit() );
@@ -199,13 +176,18 @@ void RoboControllerSDK::connectToTcpServer()
     mTcpSocket->setSocketOption( QAbstractSocket::LowDelayOption, 1 );
     mTcpSocket->setSocketOption( QAbstractSocket::KeepAliveOption, 1 );
 
-    int count=0;
-    while( count < 5 && !mTcpConnected )
+    // >>>>> Waiting for MSG_CONNECTED
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    while( !mTcpConnected )
     {
-        sleep(1);
-        QCoreApplication::processEvents();
-        count ++;
+        qint64 remaining = timeoutMsec - elapsed.elapsed();
+
+        if( remaining<=0 || !mTcpSocket->waitForReadyRead( remaining ) )
+            break;
     }
+    // <<<<< Waiting for MSG_CONNECTED
 
     if( !mTcpConnected )
         throw RcException( excTcpNotConnected, tr("It is not possible to find a valid TCP server: %1")
@@ -269,6 +251,8 @@ void RoboControllerSDK::onTcpReadyRead()
 
     // mNextTcpBlockSize=0; WRONG!!!!!!!!
     quint16 msgCode;
+    quint16 replyCmd;   // Command of the reply, 0 if unknown
+    quint16 replyReg;   // First register of the reply
 
     forever // Receiving data while there is data available
     {
@@ -324,6 +308,9 @@ void RoboControllerSDK::onTcpReadyRead()
         // Datagram Code
         in >> msgCode;
 
+        replyCmd = 0;
+        replyReg = 0;
+
         switch(msgCode)
         {
         case MSG_CONNECTED:
@@ -349,14 +336,21 @@ void RoboControllerSDK::onTcpReadyRead()
 
         case MSG_FAILED:
         {
-            quint16 msg;
-            quint16 reg;
+            quint16 msg = 0;
+            quint16 reg = 0;
 
-            in>>msg;
-            in>>reg;
+            // The reply to an unknown command has no data
+            if( mNextTcpBlockSize >= 4*sizeof(quint16) )
+            {
+                in>>msg;
+                in>>reg;
+            }
 
             qDebug() << tr("TCP Received msg #%1: MSG_FAILED - Command: %2 - Reg: %3")
                         .arg(msgIdx).arg(msg).arg(reg);
+
+            replyCmd = msg;
+            replyReg = reg;
             break;
         }
 
@@ -370,13 +364,29 @@ void RoboControllerSDK::onTcpReadyRead()
 
             qDebug() << tr("TCP Received msg #%1: MSG_WRITE_OK - StartReg: %2 - Nreg: %3")
                         .arg(msgIdx).arg(reg).arg(nReg);
+
+            replyCmd = CMD_WR_MULTI_REG;
+            replyReg = reg;
             break;
         }
 
         case MSG_READ_REPLY:
         {
             qDebug() << tr("TCP Received msg #%1: MSG_READ_REPLY").arg(msgIdx);
-            processReplyMsg( &in );
+            replyCmd = CMD_RD_MULTI_REG;
+            replyReg = processReplyMsg( &in );
+            break;
+        }
+
+        case MSG_CONFIG_HASH:
+        {
+            in >> mServerConfigHash;
+            mServerConfigHashValid = true;
+
+            qDebug() << tr("TCP Received msg #%1: MSG_CONFIG_HASH - Hash: 0x%2")
+                        .arg(msgIdx).arg(mServerConfigHash, 4, 16, QChar('0'));
+
+            replyCmd = CMD_GET_CONFIG_HASH;
             break;
         }
 
@@ -396,6 +406,10 @@ void RoboControllerSDK::onTcpReadyRead()
             break;
         }
 
+        // >>>>> Transaction completion tracking
+        matchPendingReply( msgCode, replyCmd, replyReg );
+        // <<<<< Transaction completion tracking
+
         mNextTcpBlockSize = 0;
     }
 }
@@ -508,6 +522,8 @@ void RoboControllerSDK::onUdpStatusReadyRead()
             {
                 qDebug() << tr("UDP Received msg #%1: MSG_ROBOT_CTRL_OK").arg(msgIdx);
 
+                mRobotControlHeld = true;
+
                 emit robotControlTaken();
                 break;
             }
@@ -516,6 +532,8 @@ void RoboControllerSDK::onUdpStatusReadyRead()
             {
                 qDebug() << tr("UDP Received msg #%1: MSG_ROBOT_CTRL_KO").arg(msgIdx);
 
+                mRobotControlHeld = false;
+
                 emit robotControlNotTaken();
                 break;
             }
@@ -524,10 +542,72 @@ void RoboControllerSDK::onUdpStatusReadyRead()
             {
                 qDebug() << tr("UDP Received msg #%1: MSG_ROBOT_CTRL_RELEASED").arg(msgIdx);
 
+                mRobotControlHeld = false;
+
                 emit robotControlReleased();
                 break;
             }
 
+            case MSG_TRAJ_UNDERRUN:
+            {
+                quint16 underrunCount;
+                in >> underrunCount;
+
+                qDebug() << tr("UDP Received msg #%1: MSG_TRAJ_UNDERRUN - Count: %2").arg(msgIdx).arg(underrunCount);
+
+                emit trajectoryUnderrun( underrunCount );
+                break;
+            }
+
+            case MSG_CTRL_LINK_STATS:
+            {
+                quint32* counters[4] = { &mCtrlLinkStats.received, &mCtrlLinkStats.lost,
+                                         &mCtrlLinkStats.recovered, &mCtrlLinkStats.stale };
+
+                for( int i=0; i<4; i++ )
+                {
+                    quint16 hi, lo;
+                    in >> hi;
+                    in >> lo;
+                    *counters[i] = ((quint32)hi<<16) | lo;
+                }
+
+                qDebug() << tr("UDP Received msg #%1: MSG_CTRL_LINK_STATS - Received: %2 - Lost: %3 - Recovered: %4 - Stale: %5")
+                            .arg(msgIdx).arg(mCtrlLinkStats.received).arg(mCtrlLinkStats.lost)
+                            .arg(mCtrlLinkStats.recovered).arg(mCtrlLinkStats.stale);
+
+                emit newControlLinkStats( mCtrlLinkStats );
+                break;
+            }
+
+            case MSG_ODOMETRY:
+            {
+                quint16 words[10];
+                for( int i=0; i<10; i++ )
+                    in >> words[i];
+
+                // Speeds are 2-complement: mm/sec and mrad/sec
+                mOdometry.speed0 = ((qint16)words[0])/1000.0;
+                mOdometry.speed1 = ((qint16)words[1])/1000.0;
+                mOdometry.valid = (words[2] & ODOM_FLAG_VALID)!=0;
+                mOdometry.visionValid = (words[2] & ODOM_FLAG_VISION)!=0;
+                mOdometry.slipping = (words[2] & ODOM_FLAG_SLIP)!=0;
+                mOdometry.linearSpeed = ((qint16)words[3])/1000.0;
+                mOdometry.angularSpeed = ((qint16)words[4])/1000.0;
+                mOdometry.visionLinearSpeed = ((qint16)words[5])/1000.0;
+                mOdometry.visionAngularSpeed = ((qint16)words[6])/1000.0;
+                mOdometry.inliers = words[7];
+                mOdometry.processMsec = words[8]/1000.0;
+                mOdometry.ageMsec = words[9];
+
+                qDebug() << tr("UDP Received msg #%1: MSG_ODOMETRY - Linear: %2 m/sec - Angular: %3 rad/sec - Slipping: %4")
+                            .arg(msgIdx).arg(mOdometry.linearSpeed).arg(mOdometry.angularSpeed).arg(mOdometry.slipping?1:0);
+
+                emit newMotorSpeedValues( mOdometry.speed0, mOdometry.speed1 );
+                emit newOdometry( mOdometry );
+                break;
+            }
+
             case MSG_RC_NOT_FOUND:
             {
                 qDebug() << tr("UDP Received msg #%1: MSG_RC_NOT_FOUND").arg(msgIdx);
@@ -552,7 +632,7 @@ void RoboControllerSDK::onUdpStatusReadyRead()
     }
 }
 
-void RoboControllerSDK::processReplyMsg( QDataStream *inStream )
+quint16 RoboControllerSDK::processReplyMsg( QDataStream *inStream )
 {
     quint16 startAddr;
     quint16 nReg;
@@ -655,6 +735,10 @@ void RoboControllerSDK::processReplyMsg( QDataStream *inStream )
                 {
                     mReceivedRobConfig = false;
                     mReceivedStatus2 = false;
+
+                    mBoardConfigHash = robotConfigurationHash();
+                    mBoardConfigHashValid = true;
+
                     emit newRobotConfiguration( mRobotConfig );
                 }
             }
@@ -727,6 +811,10 @@ void RoboControllerSDK::processReplyMsg( QDataStream *inStream )
             {
                 mReceivedRobConfig = false;
                 mReceivedStatus2 = false;
+
+                mBoardConfigHash = robotConfigurationHash();
+                mBoardConfigHashValid = true;
+
                 emit newRobotConfiguration( mRobotConfig );
             }
         }
@@ -738,6 +826,8 @@ void RoboControllerSDK::processReplyMsg( QDataStream *inStream )
     {
         qDebug() << tr("Now nReg can be only 1, 3 or 19 (received: %1)").arg(nReg);
     }
+
+    return startAddr;
 }
 
 void RoboControllerSDK::updateRobotConfigurationFromDataStream( QDataStream* inStream )
@@ -770,16 +860,35 @@ void RoboControllerSDK::updateRobotConfigurationFromDataStream( QDataStream* inS
 
 void RoboControllerSDK::onTcpError(QAbstractSocket::SocketError err)
 {
-    if( err==QAbstractSocket::RemoteHostClosedError )
+    if( err==QAbstractSocket::RemoteHostClosedError || err==QAbstractSocket::NetworkError )
     {
+        bool wasConnected = mTcpConnected;
         mTcpConnected = false;
-        emit tcpDisconnected();
+
+        if( wasConnected && !mReconnecting )
+        {
+            emit tcpDisconnected();
+
+            if( mAutoReconnect && !mReconnectTimer.isActive() )
+            {
+                mPingTimer.stop();
+
+                mDisconnectedTime.start();
+                mReconnectDelayMsec = RECONNECT_FIRST_DELAY_MSEC;
+                mReconnectTimer.start( 0 ); // First attempt as soon as possible
+            }
+        }
     }
 
 
     mLastTcpErrorMsg = tr("%1 - %2").arg(err).arg(mTcpSocket->errorString());
 
     qDebug() << tr( "TCP Communication error: %1 - %2").arg(err).arg(mTcpSocket->errorString());
+
+    // The reconnection attempt failed before connecting (e.g. server still down).
+    // The errors during the restore of the session are handled by onTcpSocketConnected
+    if( mReconnecting && mReconnectAttemptTimer.isActive() )
+        reconnectFailed();
 }
 
 void RoboControllerSDK::onUdpStatusError( QAbstractSocket::SocketError err )
@@ -888,6 +997,17 @@ void RoboControllerSDK::sendBlockTCP(quint16 msgCode, QVector<quint16> &data )
     out << (quint16)TCP_START_VAL; // Start work again
     out << (quint16)blockSize;
 
+    if( mTcpTransactionOpen ) // The block will be sent by commitTcpTransaction
+    {
+        mTcpTransactionBuffer.append( block );
+
+        TcpPendingReply pending;
+        pending.cmdCode = msgCode;
+        pending.startReg = data.isEmpty()?0:data.first();
+        mTcpPendingReplies.enqueue( pending );
+        return;
+    }
+
     //QMutexLocker locker( &mConnMutex );
     mConnMutex.lock();
     {
@@ -913,6 +1033,253 @@ void RoboControllerSDK::sendBlockTCP(quint16 msgCode, QVector<quint16> &data )
     }
 }
 
+void RoboControllerSDK::beginTcpTransaction()
+{
+    mTcpTransactionBuffer.clear();
+    mTcpPendingReplies.clear();
+    mTcpTransactionOpen = true;
+}
+
+void RoboControllerSDK::matchPendingReply( quint16 msgCode, quint16 cmdCode, quint16 startReg )
+{
+    if( mTcpPendingReplies.isEmpty() )
+        return;
+
+    const TcpPendingReply& pending = mTcpPendingReplies.head();
+
+    bool match = false;
+    switch( msgCode )
+    {
+    case MSG_READ_REPLY:
+    case MSG_WRITE_OK:
+        match = ( cmdCode==pending.cmdCode && startReg==pending.startReg );
+        break;
+
+    case MSG_CONFIG_HASH:
+        match = ( pending.cmdCode==CMD_GET_CONFIG_HASH );
+        break;
+
+    case MSG_FAILED:
+        // Without a command the server did not know the command sent.
+        // The failure of the hash reports the first register of the configuration
+        match = ( cmdCode==0 ||
+                  ( cmdCode==pending.cmdCode &&
+                    ( cmdCode==CMD_GET_CONFIG_HASH || startReg==pending.startReg ) ) );
+        break;
+
+    case MSG_RC_NOT_FOUND: // The board is not connected: reply to any command
+        match = true;
+        break;
+
+    default:
+        break;
+    }
+
+    if( match )
+        mTcpPendingReplies.dequeue();
+    else
+        qDebug() << tr("TCP reply %1 (Command: %2 - Reg: %3) not part of the transaction").arg(msgCode).arg(cmdCode).arg(startReg);
+}
+
+void RoboControllerSDK::commitTcpTransaction()
+{
+    mTcpTransactionOpen = false;
+
+    if( mTcpTransactionBuffer.isEmpty() )
+        return;
+
+    mPingTimer.start( mWatchDogTimeMsec ); // Restart timer to avoid unuseful Ping
+
+    int nCmd = mTcpPendingReplies.size();
+
+    mConnMutex.lock();
+    {
+        mTcpSocket->write( mTcpTransactionBuffer );
+        mTcpSocket->flush();
+
+        mLastServerReqTime = QDateTime::currentDateTime().toMSecsSinceEpoch();
+
+        QString timeStr = QDateTime::currentDateTime().toString( "hh:mm:ss.zzz" );
+        qDebug() << tr("%1 - Sent transaction of %2 commands (%3 bytes) over TCP")
+                    .arg(timeStr).arg(nCmd).arg(mTcpTransactionBuffer.size());
+    }
+    mConnMutex.unlock();
+
+    mTcpTransactionBuffer.clear();
+
+    // >>>>> Waiting for all the replies
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    while( !mTcpPendingReplies.isEmpty() )
+    {
+        qint64 remaining = SERVER_REPLY_TIMEOUT_MSEC - elapsed.elapsed();
+
+        if( remaining<=0 || !mTcpSocket->waitForReadyRead( remaining ) )
+        {
+            int missing = mTcpPendingReplies.size();
+            mTcpPendingReplies.clear();
+
+            qDebug() << tr("The server does not reply. Communication lost");
+
+            throw RcException( excCommunicationLost, tr("The server did not reply to %1 of %2 requests (Timeout: %3 msec). Last error: %4")
+                               .arg(missing).arg(nCmd)
+                               .arg(SERVER_REPLY_TIMEOUT_MSEC)
+                               .arg(mTcpSocket->errorString() ).toLocal8Bit() );
+        }
+    }
+    // <<<<< Waiting for all the replies
+
+    qDebug() << tr("TCP transaction of %1 commands completed in %2 msec").arg(nCmd).arg(elapsed.elapsed());
+}
+
+void RoboControllerSDK::onReconnectTimerTimeout()
+{
+    qDebug() << tr("Trying TCP reconnection to %1:%2").arg(mServerAddr).arg(mTcpPort);
+
+    mTcpSocket->abort();
+    mTcpConnected = false;
+    mNextTcpBlockSize = 0;
+
+    // The connection is not waited: the thread of the SDK (usually the GUI one)
+    // keeps running while the server is down. See onTcpSocketConnected
+    mReconnecting = true;
+    mReconnectAttemptTimer.start( RECONNECT_CONNECT_TIMEOUT_MSEC );
+
+    mTcpSocket->connectToHost( QHostAddress(mServerAddr), mTcpPort );
+}
+
+void RoboControllerSDK::onTcpSocketConnected()
+{
+    if( !mReconnecting ) // connectToTcpServer waits for the connection by itself
+        return;
+
+    mReconnectAttemptTimer.stop();
+
+    // Disable Nable Algorithm to have low latency
+    mTcpSocket->setSocketOption( QAbstractSocket::LowDelayOption, 1 );
+    mTcpSocket->setSocketOption( QAbstractSocket::KeepAliveOption, 1 );
+
+    // The server is up: the restore of the session gets the replies in a few msec
+    try
+    {
+        resyncState();
+    }
+    catch( RcException &e )
+    {
+        qDebug() << e.getExcMessage();
+
+        reconnectFailed();
+        return;
+    }
+
+    // MSG_CONNECTED precedes the replies of the server
+    if( !mTcpConnected )
+    {
+        qDebug() << tr("It is not possible to find a valid TCP server on %1:%2").arg(mServerAddr).arg(mTcpPort);
+
+        reconnectFailed();
+        return;
+    }
+
+    mReconnecting = false;
+
+    int elapsed = (int)mDisconnectedTime.elapsed();
+
+    qDebug() << tr("TCP session restored in %1 msec").arg(elapsed);
+
+    emit tcpConnected();
+    emit tcpReconnected( elapsed );
+}
+
+void RoboControllerSDK::onReconnectAttemptTimeout()
+{
+    qDebug() << tr("TCP reconnection timeout (%1 msec)").arg(RECONNECT_CONNECT_TIMEOUT_MSEC);
+
+    reconnectFailed();
+}
+
+void RoboControllerSDK::reconnectFailed()
+{
+    if( !mReconnecting )
+        return;
+
+    mReconnecting = false;
+    mReconnectAttemptTimer.stop();
+    mPingTimer.stop(); // Started by resyncState
+
+    mTcpSocket->abort();
+    mTcpConnected = false;
+
+    mReconnectTimer.start( mReconnectDelayMsec );
+    mReconnectDelayMsec = qMin( 2*mReconnectDelayMsec, RECONNECT_MAX_DELAY_MSEC );
+}
+
+void RoboControllerSDK::resyncState()
+{
+    mPingTimer.start( mWatchDogTimeMsec );
+
+    mServerConfigHashValid = false;
+
+    // >>>>> Configuration hash, alone: an old server does not know the command
+    // and discards with it all the commands queued after it, replying a single MSG_FAILED
+    QVector<quint16> data;
+    if( mBoardConfigHashValid )
+    {
+        beginTcpTransaction();
+        sendBlockTCP( CMD_GET_CONFIG_HASH, data );
+        commitTcpTransaction();
+    }
+    // <<<<< Configuration hash
+
+    // >>>>> Board Status
+    beginTcpTransaction();
+
+    data << (quint16)WORD_STATUSBIT1;
+    data << 1;
+    sendBlockTCP( CMD_RD_MULTI_REG, data );
+
+    commitTcpTransaction();
+    // <<<<< Board Status
+
+    // The full configuration is reloaded only if it changed (old servers reply MSG_FAILED)
+    if( mBoardConfigHashValid &&
+            ( !mServerConfigHashValid || mServerConfigHash!=mBoardConfigHash ) )
+    {
+        qDebug() << tr("Robot configuration changed while disconnected. Reloading it from EEPROM");
+        getRobotConfigurationFromEeprom();
+    }
+
+    // >>>>> Leases
+    if( mRobotControlHeld )
+        getRobotControl();
+    // <<<<< Leases
+}
+
+quint16 RoboControllerSDK::robotConfigurationHash()
+{
+    // Same order of the registers starting from WORD_ROBOT_DIMENSION_WEIGHT
+    quint16 regs[CONFIG_HASH_NREG] =
+    {
+        mRobotConfig.Weight, mRobotConfig.Width, mRobotConfig.Height, mRobotConfig.Lenght,
+        mRobotConfig.WheelBase, mRobotConfig.WheelRadiusLeft, mRobotConfig.WheelRadiusRight,
+        mRobotConfig.EncoderCprLeft, mRobotConfig.EncoderCprRight,
+        mRobotConfig.MaxRpmMotorLeft, mRobotConfig.MaxRpmMotorRight,
+        mRobotConfig.MaxAmpereMotorLeft, mRobotConfig.MaxAmpereMotorRight,
+        mRobotConfig.MaxTorqueMotorLeft, mRobotConfig.MaxTorqueMotorRight,
+        mRobotConfig.RatioShaftLeft, mRobotConfig.RatioShaftRight,
+        mRobotConfig.RatioMotorLeft, mRobotConfig.RatioMotorRight
+    };
+
+    quint16 statusBits2 = 0;
+    if( mRobotConfig.EncoderPosition==Wheel )
+        statusBits2 |= FLG_STATUSBI2_EEPROM_ENCODER_POSITION;
+    if( mRobotConfig.MotorEnableLevel==High )
+        statusBits2 |= FLG_EEPROM_OUTPUT_DRIVER_ENABLE_POLARITY;
+
+    return configHash( regs, statusBits2 );
+}
+
 /// Disables the Communication Watchdog
 /*void RoboControllerSDK::disableWatchdog()
 {
@@ -1034,6 +1401,13 @@ void RoboControllerSDK::getMotorSpeeds( )
     sendBlockUDP( mUdpStatusSocket, QHostAddress(mServerAddr), mUdpStatusPortSend, CMD_RD_MULTI_REG, data, /*true*/false );
 }
 
+void RoboControllerSDK::getOdometry( )
+{
+    QVector<quint16> data;
+
+    sendBlockUDP( mUdpStatusSocket, QHostAddress(mServerAddr), mUdpStatusPortSend, CMD_GET_ODOMETRY, data, false );
+}
+
 void RoboControllerSDK::getBoardStatus()
 {
     QVector<quint16> data;
@@ -1133,6 +1507,27 @@ void RoboControllerSDK::setMotorSpeeds( double speed0, double speed1 )
         speed1 = -32.768;
     // <<<<< 16 bit saturation
 
+    if( mCtrlRedundancy > 0 )
+    {
+        // >>>>> New SetPoint with the previous ones
+        mCtrlSeq++;
+
+        mCtrlHistory.prepend( speedToRegister( speed1 ) );
+        mCtrlHistory.prepend( speedToRegister( speed0 ) );
+        if( mCtrlHistory.size() > 2*(mCtrlRedundancy+1) )
+            mCtrlHistory.resize( 2*(mCtrlRedundancy+1) );
+
+        QVector<quint16> data;
+        data.reserve( 2+mCtrlHistory.size() );
+        data << mCtrlSeq;
+        data << (quint16)(mCtrlHistory.size()/2);
+        data += mCtrlHistory;
+
+        sendBlockUDP( mUdpControlSocket, QHostAddress(mServerAddr), mUdpControlPortSend, CMD_SET_SPEED_REDUNDANT, data, false );
+        // <<<<< New SetPoint with the previous ones
+        return;
+    }
+
     // >>>>> New SetPoint to RoboController
     quint16 address = WORD_PWM_CH1;
 
@@ -1161,6 +1556,71 @@ void RoboControllerSDK::setMotorSpeeds( double speed0, double speed1 )
     // <<<<< New SetPoint to RoboController
 }
 
+quint16 RoboControllerSDK::speedToRegister( double speed )
+{
+    // >>>>> 16 bit saturation
+    if( speed > 32.767)
+        speed = 32.767;
+
+    if( speed < -32.768 )
+        speed = -32.768;
+    // <<<<< 16 bit saturation
+
+    quint16 sp; // Speed is integer 2-complement!
+    if(speed >= 0)
+        sp = (quint16)(speed*1000.0);
+    else
+        sp = (quint16)(speed*1000.0+65536.0);
+
+    return sp;
+}
+
+void RoboControllerSDK::setMotorSpeedsTrajectory( QVector<SpeedSetPoint>& trajectory )
+{
+    if( mMotorCtrlMode != mcPID )
+    {
+        qWarning() << Q_FUNC_INFO << tr("Function available only in mcPID mode");
+    }
+
+    if( trajectory.isEmpty() )
+        return;
+
+    int nPoints = qMin( trajectory.size(), TRAJ_MAX_POINTS );
+
+    if( nPoints < trajectory.size() )
+        qWarning() << Q_FUNC_INFO << tr("Trajectory truncated to %1 points").arg(nPoints);
+
+    // >>>>> New Trajectory to RoboController
+    QVector<quint16> data;
+    data.reserve( 1+3*nPoints );
+    data << (quint16)nPoints;
+
+    for( int i=0; i<nPoints; i++ )
+    {
+        data << trajectory[i].timeOffsetMsec;
+        data << speedToRegister( trajectory[i].speed0 );
+        data << speedToRegister( trajectory[i].speed1 );
+    }
+
+    sendBlockUDP( mUdpControlSocket, QHostAddress(mServerAddr), mUdpControlPortSend, CMD_SET_SPEED_TRAJ, data, false );
+    // <<<<< New Trajectory to RoboController
+}
+
+void RoboControllerSDK::setControlRedundancy( int nPrevSetPoints )
+{
+    if( nPrevSetPoints < 0 )
+        nPrevSetPoints = 0;
+
+    if( nPrevSetPoints > CTRL_MAX_REDUNDANCY )
+    {
+        qWarning() << Q_FUNC_INFO << tr("Control redundancy limited to %1 setpoints").arg(CTRL_MAX_REDUNDANCY);
+        nPrevSetPoints = CTRL_MAX_REDUNDANCY;
+    }
+
+    mCtrlRedundancy = nPrevSetPoints;
+    mCtrlHistory.clear();
+}
+
 void RoboControllerSDK::setMotorSpeed( quint16 motorIdx, double speed )
 {
     if( mMotorCtrlMode != mcPID )
@@ -1223,6 +1683,9 @@ void RoboControllerSDK::setMotorPidGains( quint16 motorIdx, quint16 Kp, quint16
 
 void RoboControllerSDK::onPingTimerTimeout()
 {
+    if( !mTcpPendingReplies.isEmpty() ) // The transaction in progress keeps the board alive
+        return;
+
     QVector<quint16> pingData;
     pingData << (quint16)WORD_COMWATCHDOG_TIME;
     pingData << 1; // Only one register
@@ -1302,6 +1765,8 @@ void RoboControllerSDK::getRobotConfigurationFromEeprom( )
     mReceivedStatus2 = false;
     mReceivedRobConfig = false;
 
+    beginTcpTransaction();
+
     // >>>>> Robot Configuration Data
     QVector<quint16> data;
     data << (quint16)WORD_ROBOT_DIMENSION_WEIGHT;
@@ -1310,8 +1775,6 @@ void RoboControllerSDK::getRobotConfigurationFromEeprom( )
     sendBlockTCP( CMD_RD_MULTI_REG, data );
     // <<<<< Robot Configuration Data
 
-    msleep( 250 );
-
     // >>>>> Robot Configuration Bits
     data.clear();
     data << (quint16)WORD_STATUSBIT2;
@@ -1319,6 +1782,8 @@ void RoboControllerSDK::getRobotConfigurationFromEeprom( )
 
     sendBlockTCP( CMD_RD_MULTI_REG, data );
     // <<<<< Robot Configuration Bits
+
+    commitTcpTransaction();
 }
 
 void RoboControllerSDK::saveRobotConfigurationToIni( QString iniFile )
@@ -1401,24 +1866,29 @@ void RoboControllerSDK::setBatteryCalibrationParams( AnalogCalibValue valueType,
 {
     quint16 charVal = (quint16)(curChargeVal*1000.0);
 
+    // The board calibrates while handling the write of the flag: its
+    // MSG_WRITE_OK tells that the calibration is complete, no wait needed
+    beginTcpTransaction();
+
     QVector<quint16> data;
     data << (quint16)WORD_VAL_TAR_FS;
     data << charVal;
     sendBlockTCP( CMD_WR_MULTI_REG, data );
 
-    msleep(500);
-
+    // The server writes the registers in order, so the flag follows the value
     data.clear();
     quint16 flag = (valueType==CalLow)?0x00001:0x0020;
     data << (quint16)WORD_FLAG_TARATURA;
     data << flag;
     sendBlockTCP( CMD_WR_MULTI_REG, data );
 
-    msleep(500);
+    commitTcpTransaction();
 }
 
 void RoboControllerSDK::saveRobotConfigurationToEeprom( )
 {
+    beginTcpTransaction();
+
     // >>>>> Robot Configuration Data (19 consequtive registers)
     QVector<quint16> data;
     data << (quint16)WORD_ROBOT_DIMENSION_WEIGHT;
@@ -1456,12 +1926,17 @@ void RoboControllerSDK::saveRobotConfigurationToEeprom( )
     if(mRobotConfig.EncoderPosition)
         statusVal |= FLG_STATUSBI2_EEPROM_ENCODER_POSITION;
     if(mRobotConfig.MotorEnableLevel)
-        statusVal |= FLG_STATUSBI2_EEPROM_ENCODER_POSITION;
+        statusVal |= FLG_EEPROM_OUTPUT_DRIVER_ENABLE_POLARITY;
 
     data << statusVal;
 
     sendBlockTCP( CMD_WR_MULTI_REG, data );
     // <<<<< Status Register 2
+
+    commitTcpTransaction();
+
+    mBoardConfigHash = robotConfigurationHash();
+    mBoardConfigHashValid = true;
 }
 
 void RoboControllerSDK::onUdpTestTimerTimeout()
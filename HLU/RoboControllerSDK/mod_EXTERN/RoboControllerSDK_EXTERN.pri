@@ -51,6 +51,8 @@ CONFIG(opencv)
 
         LIBS += \
             $$OPENCV_LIB_PATH/opencv_core248.lib \
+            $$OPENCV_LIB_PATH/opencv_imgproc248.lib \
+            $$OPENCV_LIB_PATH/opencv_features2d248.lib \
             $$OPENCV_LIB_PATH/opencv_highgui248.lib
     }
 
@@ -63,6 +65,9 @@ CONFIG(opencv)
             $$OPENCV_LIB_PATH/libopencv_video.a \
             $$OPENCV_LIB_PATH/libopencv_highgui.a \
             $$OPENCV_LIB_PATH/libopencv_androidcamera.a \
+            $$OPENCV_LIB_PATH/libopencv_features2d.a \
+            $$OPENCV_LIB_PATH/libopencv_flann.a \
+            $$OPENCV_LIB_PATH/libopencv_imgproc.a \
             $$OPENCV_LIB_PATH/libopencv_core.a \
             $$OPENCV_LIB_PATH/libIlmImf.a \
             $$OPENCV_LIB_PATH/liblibjpeg.a \
@@ -79,6 +84,8 @@ CONFIG(opencv)
         
             LIBS += \
                 -lopencv_core \
+                -lopencv_imgproc \
+                -lopencv_features2d \
                 -lopencv_highgui
         }
             
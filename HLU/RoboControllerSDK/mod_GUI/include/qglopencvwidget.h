@@ -2,19 +2,37 @@
 #define CQTOPENCVVIEWERGL_H
 
 #include <QGLWidget>
+#include <QElapsedTimer>
 #include <opencv2/core/core.hpp>
 
+#define GLOPENCV_STATS_FRAMES   250     // Frames averaged for the CPU time report
+
 class QGlOpenCVWidget : public QGLWidget
 {
     Q_OBJECT
 public:
     explicit QGlOpenCVWidget(QWidget *parent = 0);
+    virtual ~QGlOpenCVWidget();
+
+    /** @brief Enables the upload of the images to a texture scaled by the GPU.
+     *         Ignored if the OpenGL implementation does not support it
+     */
+    void    setTextureRendering( bool enable );
+    bool    isTextureRendering(){return mUseTexture;}
+
+    /** @brief Returns the average CPU time to show a frame (msec):
+     *         conversion, scaling and upload
+     */
+    double  getAvgFrameCpuMsec();
 
 signals:
     void    imageSizeChanged( int outW, int outH ); /// Used to resize the image outside the widget
 
 public slots:
-    bool    showImage( cv::Mat image ); /// Used to set the image to be viewed
+    /** @brief Sets the image to be viewed (BGR or grayscale, 8 bit).
+     *         The image is not copied: it must not be modified by the caller after the call
+     */
+    bool    showImage( cv::Mat image );
 
 protected:
     void 	initializeGL(); /// OpenGL initialization
@@ -24,11 +42,33 @@ protected:
     void        updateScene();
     void        renderImage();
 
+    void        renderTexture();        /// Draws the streaming texture on a quad
+    void        renderSoftware();       /// Draws the cached scaled image
+
+    void        updateLayout( int width, int height ); /// Evaluates size and position of the image
+    void        addCpuTime( qint64 nsec ); /// Accumulates the CPU time of a frame
+
 private:
     bool        mSceneChanged;          /// Indicates when OpenGL view is to be redrawn
+    bool        mImageChanged;          /// A new image is waiting for upload or scaling
+
+    cv::Mat     mOrigImage;             /// original OpenCV image to be shown, shared with the caller
+
+    bool        mBgrSupported;          /// BGR pixel format available (OpenGL 1.2)
+
+    // >>>>> Texture rendering
+    bool        mTextureSupported;      /// Non power of two textures and BGR format available
+    bool        mUseTexture;            /// Images rendered with the texture
+    GLuint      mTexture;               /// Streaming texture
+    int         mTexW;                  /// Width of the texture storage
+    int         mTexH;                  /// Height of the texture storage
+    int         mTexChannels;           /// Channels of the texture storage
+    // <<<<< Texture rendering
 
-    QImage      mRenderQtImg;           /// Qt image to be rendered
-    cv::Mat     mOrigImage;             /// original OpenCV image to be shown
+    // >>>>> Software rendering
+    cv::Mat     mScaledImage;           /// Image scaled to the widget size, cached until image or size change
+    bool        mScaledValid;           /// mScaledImage matches image and widget size
+    // <<<<< Software rendering
 
     QColor      mBgColor;		/// Background color
 
@@ -39,6 +79,9 @@ private:
     int         mPosX;                  /// Top left X position to render image in the center of widget
     int         mPosY;                  /// Top left Y position to render image in the center of widget
 
+    qint64      mCpuNsecSum;            /// CPU time of the last frames
+    int         mCpuFrameCount;         /// Frames in mCpuNsecSum
+    double      mAvgCpuMsec;            /// Average of the last GLOPENCV_STATS_FRAMES frames
 };
 
 #endif // CQTOPENCVVIEWERGL_H
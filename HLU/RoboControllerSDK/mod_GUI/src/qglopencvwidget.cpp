@@ -1,23 +1,96 @@
 #include "qglopencvwidget.h"
 
+#include <QDebug>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+// Not defined by the OpenGL 1.1 headers (e.g. Windows)
+#ifndef GL_BGR
+#define GL_BGR 0x80E0
+#endif
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE 0x812F
+#endif
+
 QGlOpenCVWidget::QGlOpenCVWidget(QWidget *parent) :
     QGLWidget(parent)
 {
     mSceneChanged = false;
+    mImageChanged = false;
     mBgColor = QColor::fromRgb(150, 150, 150);
 
+    mBgrSupported = false;
+    mTextureSupported = false;
+    mUseTexture = true;
+    mTexture = 0;
+    mTexW = 0;
+    mTexH = 0;
+    mTexChannels = 0;
+
+    mScaledValid = false;
+
     mOutH = 0;
     mOutW = 0;
     mImgRatio = 4.0f/3.0f;
 
     mPosX = 0;
     mPosY = 0;
+
+    mCpuNsecSum = 0;
+    mCpuFrameCount = 0;
+    mAvgCpuMsec = 0.0;
+}
+
+QGlOpenCVWidget::~QGlOpenCVWidget()
+{
+    if( mTexture )
+    {
+        makeCurrent();
+        glDeleteTextures( 1, &mTexture );
+    }
 }
 
 void QGlOpenCVWidget::initializeGL()
 {
     makeCurrent();
     qglClearColor(mBgColor.darker());
+
+    // ---> Texture support: OpenGL 2.0 or non power of two extension
+    QString version = QString::fromLatin1( (const char*)glGetString(GL_VERSION) );
+    QString extensions = QString::fromLatin1( (const char*)glGetString(GL_EXTENSIONS) );
+
+    int major = version.section( '.', 0, 0 ).toInt();
+    int minor = version.section( '.', 1, 1 ).left(1).toInt();
+
+    mBgrSupported = (major>1) || (major==1 && minor>=2) || extensions.contains( "GL_EXT_bgra" );
+    mTextureSupported = mBgrSupported &&
+            ( (major>=2) || extensions.contains( "GL_ARB_texture_non_power_of_two" ) );
+
+    if( mTextureSupported )
+    {
+        glGenTextures( 1, &mTexture );
+        glBindTexture( GL_TEXTURE_2D, mTexture );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+        glBindTexture( GL_TEXTURE_2D, 0 );
+    }
+    // <--- Texture support
+
+    qDebug() << tr("OpenGL %1 - Rendering: %2").arg(version)
+                .arg( (mTextureSupported && mUseTexture)?tr("texture"):tr("software") );
+}
+
+void QGlOpenCVWidget::setTextureRendering( bool enable )
+{
+    mUseTexture = enable;
+
+    mImageChanged = !mOrigImage.empty();
+    mScaledValid = false;
+    mSceneChanged = true;
+
+    updateScene();
 }
 
 void QGlOpenCVWidget::resizeGL(int width, int height)
@@ -32,25 +105,37 @@ void QGlOpenCVWidget::resizeGL(int width, int height)
 
     glMatrixMode(GL_MODELVIEW);
 
+    updateLayout( width, height );
+
+    mSceneChanged = true;
+
+    updateScene();
+}
+
+void QGlOpenCVWidget::updateLayout( int width, int height )
+{
     // ---> Scaled Image Sizes
-    mOutH = width/mImgRatio;
-    mOutW = width;
+    int outH = width/mImgRatio;
+    int outW = width;
 
-    if(mOutH>height)
+    if(outH>height)
     {
-        mOutW = height*mImgRatio;
-        mOutH = height;
+        outW = height*mImgRatio;
+        outH = height;
     }
 
-    emit imageSizeChanged( mOutW, mOutH );
+    if( outW!=mOutW || outH!=mOutH )
+    {
+        mOutW = outW;
+        mOutH = outH;
+        mScaledValid = false; // The cache is valid only for a size
+
+        emit imageSizeChanged( mOutW, mOutH );
+    }
     // <--- Scaled Image Sizes
 
     mPosX = (width-mOutW)/2;
     mPosY = (height-mOutH)/2;
-
-    mSceneChanged = true;
-
-    updateScene();
 }
 
 void QGlOpenCVWidget::updateScene()
@@ -79,69 +164,164 @@ void QGlOpenCVWidget::renderImage()
 
     glClear(GL_COLOR_BUFFER_BIT);
 
-    if (!mRenderQtImg.isNull())
+    if( mOrigImage.empty() )
+        return;
+
+    glLoadIdentity();
+
+    glPushMatrix();
+    {
+        if( mTextureSupported && mUseTexture )
+            renderTexture();
+        else
+            renderSoftware();
+    }
+    glPopMatrix();
+
+    // end
+    glFlush();
+}
+
+void QGlOpenCVWidget::renderTexture()
+{
+    QElapsedTimer chrono;
+    chrono.start();
+
+    glBindTexture( GL_TEXTURE_2D, mTexture );
+
+    if( mImageChanged )
     {
-        glLoadIdentity();
+        int channels = mOrigImage.channels();
+        GLenum format = (channels==3)?GL_BGR:GL_LUMINANCE;
 
-        QImage image; // the image rendered
+        // Rows are read with their stride: no repacking of the OpenCV image
+        glPixelStorei( GL_UNPACK_ALIGNMENT, (mOrigImage.step%4==0)?4:1 );
+        glPixelStorei( GL_UNPACK_ROW_LENGTH, (GLint)(mOrigImage.step/mOrigImage.elemSize()) );
 
-        glPushMatrix();
+        // The storage is allocated only when the size changes, then the frames are streamed into it
+        if( mOrigImage.cols!=mTexW || mOrigImage.rows!=mTexH || channels!=mTexChannels )
         {
-            int imW = mRenderQtImg.width();
-            int imH = mRenderQtImg.height();
+            glTexImage2D( GL_TEXTURE_2D, 0, (channels==3)?GL_RGB:GL_LUMINANCE,
+                          mOrigImage.cols, mOrigImage.rows, 0,
+                          format, GL_UNSIGNED_BYTE, mOrigImage.data );
+
+            mTexW = mOrigImage.cols;
+            mTexH = mOrigImage.rows;
+            mTexChannels = channels;
+        }
+        else
+            glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, mTexW, mTexH,
+                             format, GL_UNSIGNED_BYTE, mOrigImage.data );
+
+        glPixelStorei( GL_UNPACK_ROW_LENGTH, 0 );
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+
+        mImageChanged = false;
+        addCpuTime( chrono.nsecsElapsed() );
+    }
 
-            // The image is to be resized to fit the widget?
-            if( imW != this->size().width() &&
-                    imH != this->size().height() )
-            {
+    // ---> Scaled by the texture sampling, first row of the image on top
+    glEnable( GL_TEXTURE_2D );
+    glColor3f( 1.0f, 1.0f, 1.0f );
+    glTexEnvi( GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE );
 
-                image = mRenderQtImg.scaled( //this->size(),
-                                             QSize(mOutW,mOutH),
-                                             Qt::IgnoreAspectRatio,
-                                             Qt::SmoothTransformation
-                                             );
+    glBegin( GL_QUADS );
+    {
+        glTexCoord2f( 0.0f, 1.0f ); glVertex2i( mPosX, mPosY );
+        glTexCoord2f( 1.0f, 1.0f ); glVertex2i( mPosX+mOutW, mPosY );
+        glTexCoord2f( 1.0f, 0.0f ); glVertex2i( mPosX+mOutW, mPosY+mOutH );
+        glTexCoord2f( 0.0f, 0.0f ); glVertex2i( mPosX, mPosY+mOutH );
+    }
+    glEnd();
 
-                //qDebug( QString( "Image size: (%1x%2)").arg(imW).arg(imH).toAscii() );
-            }
-            else
-                image = mRenderQtImg;
+    glDisable( GL_TEXTURE_2D );
+    glBindTexture( GL_TEXTURE_2D, 0 );
+    // <--- Scaled by the texture sampling
+}
 
-            // ---> Centering image in draw area            
+void QGlOpenCVWidget::renderSoftware()
+{
+    if( mOutW<=0 || mOutH<=0 )
+        return;
 
-            glRasterPos2i( mPosX, mPosY );
-            // <--- Centering image in draw area
+    // ---> The image is scaled only once for each frame and widget size
+    if( !mScaledValid )
+    {
+        QElapsedTimer chrono;
+        chrono.start();
 
-            imW = image.width();
-            imH = image.height();
+        cv::resize( mOrigImage, mScaledImage, cv::Size(mOutW, mOutH), 0, 0, cv::INTER_LINEAR );
+        if( mScaledImage.channels()==3 && !mBgrSupported )
+            cv::cvtColor( mScaledImage, mScaledImage, CV_BGR2RGB );
+        mScaledValid = true;
 
-            glDrawPixels( imW, imH, GL_RGBA, GL_UNSIGNED_BYTE, image.bits());
+        if( mImageChanged )
+        {
+            mImageChanged = false;
+            addCpuTime( chrono.nsecsElapsed() );
         }
-        glPopMatrix();
+    }
+    // <--- The image is scaled only once for each frame and widget size
+
+    GLenum format = GL_LUMINANCE;
+    if( mScaledImage.channels()==3 )
+        format = mBgrSupported?GL_BGR:GL_RGB;
+
+    glPixelStorei( GL_UNPACK_ALIGNMENT, (mScaledImage.step%4==0)?4:1 );
+    glPixelStorei( GL_UNPACK_ROW_LENGTH, (GLint)(mScaledImage.step/mScaledImage.elemSize()) );
+
+    // ---> Rows drawn top down: no vertical flip of the image
+    glRasterPos2i( mPosX, mPosY+mOutH-1 );
+    glPixelZoom( 1.0f, -1.0f );
+    glDrawPixels( mScaledImage.cols, mScaledImage.rows, format, GL_UNSIGNED_BYTE, mScaledImage.data );
+    glPixelZoom( 1.0f, 1.0f );
+    // <--- Rows drawn top down
+
+    glPixelStorei( GL_UNPACK_ROW_LENGTH, 0 );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+}
+
+void QGlOpenCVWidget::addCpuTime( qint64 nsec )
+{
+    mCpuNsecSum += nsec;
+    mCpuFrameCount++;
+
+    if( mCpuFrameCount>=GLOPENCV_STATS_FRAMES )
+    {
+        mAvgCpuMsec = mCpuNsecSum/1000000.0/mCpuFrameCount;
 
-        // end
-        glFlush();
+        qDebug() << tr("Rendering: %1 - CPU per frame: %2 msec")
+                    .arg( (mTextureSupported && mUseTexture)?tr("texture"):tr("software") )
+                    .arg( mAvgCpuMsec, 0, 'f', 3 );
+
+        mCpuNsecSum = 0;
+        mCpuFrameCount = 0;
     }
 }
 
+double QGlOpenCVWidget::getAvgFrameCpuMsec()
+{
+    return mAvgCpuMsec;
+}
+
 bool QGlOpenCVWidget::showImage( cv::Mat image )
 {
-    image.copyTo(mOrigImage);
-
-    mImgRatio = (float)image.cols/(float)image.rows;
-
-    if( mOrigImage.channels() == 3)
-        mRenderQtImg = QImage((const unsigned char*)(mOrigImage.data),
-                              mOrigImage.cols, mOrigImage.rows,
-                              mOrigImage.step, QImage::Format_RGB888).rgbSwapped();
-    else if( mOrigImage.channels() == 1)
-        mRenderQtImg = QImage((const unsigned char*)(mOrigImage.data),
-                              mOrigImage.cols, mOrigImage.rows,
-                              mOrigImage.step, QImage::Format_Indexed8);
-    else
+    if( image.empty() || image.depth()!=CV_8U ||
+            (image.channels()!=3 && image.channels()!=1) )
         return false;
 
-    mRenderQtImg = QGLWidget::convertToGLFormat(mRenderQtImg);
+    // Shared, not copied: the producer gives a new image for each frame
+    mOrigImage = image;
+
+    float ratio = (float)image.cols/(float)image.rows;
+    if( ratio!=mImgRatio )
+    {
+        mImgRatio = ratio;
+        updateLayout( this->width(), this->height() );
+    }
 
+    mImageChanged = true;
+    mScaledValid = false;
     mSceneChanged = true;
 
     updateScene();
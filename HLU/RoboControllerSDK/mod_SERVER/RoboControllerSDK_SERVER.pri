@@ -11,12 +11,28 @@ INCLUDEPATH += \
         $$ROBOCONTROLLERSDKPATH/mod_SERVER/include/
 
 HEADERS += \
-        $$ROBOCONTROLLERSDKPATH/mod_SERVER/include/qrobotserver.h
+        $$ROBOCONTROLLERSDKPATH/mod_SERVER/include/qrobotserver.h \
+        $$ROBOCONTROLLERSDKPATH/mod_SERVER/include/qrobottelemetry.h
 
 CONFIG(opencv) {
     HEADERS += \
-        $$ROBOCONTROLLERSDKPATH/mod_SERVER/include/qwebcamserver.h
+        $$ROBOCONTROLLERSDKPATH/mod_SERVER/include/qwebcamserver.h \
+        $$ROBOCONTROLLERSDKPATH/mod_SERVER/include/qwebcampipeline.h \
+        $$ROBOCONTROLLERSDKPATH/mod_SERVER/include/qframequeue.h \
+        $$ROBOCONTROLLERSDKPATH/mod_SERVER/include/qcapturesource.h \
+        $$ROBOCONTROLLERSDKPATH/mod_SERVER/include/qwebcamgrabber.h \
+        $$ROBOCONTROLLERSDKPATH/mod_SERVER/include/qjpegencoder.h \
+        $$ROBOCONTROLLERSDKPATH/mod_SERVER/include/qtileencoder.h \
+        $$ROBOCONTROLLERSDKPATH/mod_SERVER/include/qframepacer.h \
+        $$ROBOCONTROLLERSDKPATH/mod_SERVER/include/qwebcamrecorder.h
 
     SOURCES += \
-        $$ROBOCONTROLLERSDKPATH/mod_SERVER/src/qwebcamserver.cpp
+        $$ROBOCONTROLLERSDKPATH/mod_SERVER/src/qwebcamserver.cpp \
+        $$ROBOCONTROLLERSDKPATH/mod_SERVER/src/qwebcampipeline.cpp \
+        $$ROBOCONTROLLERSDKPATH/mod_SERVER/src/qcapturesource.cpp \
+        $$ROBOCONTROLLERSDKPATH/mod_SERVER/src/qwebcamgrabber.cpp \
+        $$ROBOCONTROLLERSDKPATH/mod_SERVER/src/qjpegencoder.cpp \
+        $$ROBOCONTROLLERSDKPATH/mod_SERVER/src/qtileencoder.cpp \
+        $$ROBOCONTROLLERSDKPATH/mod_SERVER/src/qframepacer.cpp \
+        $$ROBOCONTROLLERSDKPATH/mod_SERVER/src/qwebcamrecorder.cpp
 }
@@ -0,0 +1,114 @@
+#ifndef QCAPTURESOURCE_H
+#define QCAPTURESOURCE_H
+
+#include <QString>
+#include <QElapsedTimer>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#define CAPTURE_DEFAULT_FPS     25.0    // Frame rate of the sources without a native rate
+
+namespace roboctrl
+{
+
+/** @brief Source of the frames of the webcam server.
+ *
+ * @ref grab waits for the next frame and @ref retrieve decodes it, as
+ * for cv::VideoCapture: a grabber can drain the source without decoding
+ */
+class QCaptureSource
+{
+public:
+    virtual ~QCaptureSource(){}
+
+    virtual bool open()=0;
+    virtual void close()=0;
+
+    /** @brief Waits for the next frame of the source
+     */
+    virtual bool grab()=0;
+
+    /** @brief Decodes the last frame grabbed
+     */
+    virtual bool retrieve( cv::Mat& image )=0;
+
+    virtual QString getDescription()=0;
+};
+
+/** @brief Frames from a camera managed by OpenCV
+ */
+class QCameraSource : public QCaptureSource
+{
+public:
+    QCameraSource( int camIdx=0, int width=640, int height=480 );
+    virtual ~QCameraSource();
+
+    virtual bool open();
+    virtual void close();
+    virtual bool grab();
+    virtual bool retrieve( cv::Mat& image );
+    virtual QString getDescription();
+
+private:
+    cv::VideoCapture mCap;
+    int mCamIdx;
+    int mWidth;
+    int mHeight;
+};
+
+/** @brief Frames from a video file, played at its frame rate.
+ *         Useful to test the stream without a camera
+ */
+class QVideoFileSource : public QCaptureSource
+{
+public:
+    QVideoFileSource( QString fileName, bool loop=true );
+    virtual ~QVideoFileSource();
+
+    virtual bool open();
+    virtual void close();
+    virtual bool grab();
+    virtual bool retrieve( cv::Mat& image );
+    virtual QString getDescription();
+
+private:
+    cv::VideoCapture mCap;
+    QString mFileName;
+    bool mLoop;             ///< The file restarts when finished
+
+    QElapsedTimer mClock;   ///< Clock of the playback
+    qint64 mPeriodUsec;     ///< Frame period of the file
+    qint64 mNextUsec;       ///< Time of the next frame
+};
+
+/** @brief Generated frames: a moving pattern with the index of the frame.
+ *         Used to measure the latency of the stream without a camera
+ */
+class QSyntheticSource : public QCaptureSource
+{
+public:
+    QSyntheticSource( int width=640, int height=480, double fps=CAPTURE_DEFAULT_FPS );
+    virtual ~QSyntheticSource(){}
+
+    virtual bool open();
+    virtual void close(){}
+    virtual bool grab();
+    virtual bool retrieve( cv::Mat& image );
+    virtual QString getDescription();
+
+private:
+    int mWidth;
+    int mHeight;
+    double mFps;
+
+    quint32 mFrameIdx;      ///< Index of the last frame grabbed
+
+    QElapsedTimer mClock;   ///< Clock of the generation
+    qint64 mPeriodUsec;     ///< Frame period
+    qint64 mNextUsec;       ///< Time of the next frame
+};
+
+}
+
+#endif // QCAPTURESOURCE_H
@@ -0,0 +1,70 @@
+#ifndef QFRAMEPACER_H
+#define QFRAMEPACER_H
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+
+#define PACER_DEFAULT_FPS       25.0    // Frame rate of the capture stage
+#define PACER_MAX_FPS           120.0   // Max frame rate accepted
+
+#if defined(Q_OS_LINUX) && !defined(PACER_NO_NANOSLEEP)
+#define PACER_USE_NANOSLEEP // Absolute deadlines with clock_nanosleep on CLOCK_MONOTONIC
+#endif
+
+namespace roboctrl
+{
+
+/** @brief Paces a loop on absolute deadlines of a monotonic clock.
+ *
+ * Each deadline is the previous one plus the period, not the time of
+ * wake up plus the period: the time spent by the loop and the latency of
+ * the wake ups do not accumulate, so the average rate is exactly the target.
+ * When the loop is late by one period or more the missed deadlines are
+ * skipped: the next iteration starts at once and the following one is back
+ * on the grid, the late frames never run in a burst.
+ * Not thread safe, but the target can be changed by any thread
+ */
+class QFramePacer
+{
+public:
+    explicit QFramePacer( double fps=PACER_DEFAULT_FPS );
+
+    /** @brief Changes the frame rate from the next deadline
+     *
+     * @param fps target frame rate, bounded to (0, @ref PACER_MAX_FPS]
+     */
+    void setTargetFps( double fps );
+    double getTargetFps(){return 1000000.0/mPeriodUsec.loadAcquire();}
+
+    /** @brief The first deadline is now
+     */
+    void start();
+
+    /** @brief Sleeps until the next deadline
+     *
+     * @returns the number of deadlines skipped because the loop was late
+     */
+    int waitNextFrame();
+
+    /** @brief Returns the delay of the last wake up over its deadline (msec),
+     *         the scheduling jitter or the lateness of the loop
+     */
+    double getLastLatenessMsec(){return mLastLatenessMsec;}
+
+private:
+    qint64 nowNsec();
+    void sleepUntil( qint64 deadlineNsec );
+
+private:
+    QAtomicInt mPeriodUsec;     ///< Period of the frames
+    qint64 mDeadlineNsec;       ///< Next deadline on the monotonic clock
+    double mLastLatenessMsec;   ///< Delay of the last wake up
+
+#ifndef PACER_USE_NANOSLEEP
+    QElapsedTimer mClock;       ///< Monotonic clock of the deadlines
+#endif
+};
+
+}
+
+#endif // QFRAMEPACER_H
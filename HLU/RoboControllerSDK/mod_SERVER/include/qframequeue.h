@@ -0,0 +1,126 @@
+#ifndef QFRAMEQUEUE_H
+#define QFRAMEQUEUE_H
+
+#include <QQueue>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+
+namespace roboctrl
+{
+
+/** @brief Bounded queue connecting two stages of the webcam pipeline.
+ *
+ * When the queue is full the oldest element is dropped: a stage that is
+ * late never blocks the previous one and always works on the newest data
+ */
+template <typename T>
+class QFrameQueue
+{
+public:
+    explicit QFrameQueue( int capacity=2 ) :
+        mCapacity(capacity),
+        mDropCount(0),
+        mClosed(false)
+    {}
+
+    /** @brief Adds an element to the queue, dropping the oldest ones if it is full
+     *
+     * @returns the number of elements dropped
+     */
+    int push( const T& item )
+    {
+        QMutexLocker locker( &mMutex );
+
+        int dropped = 0;
+        while( mQueue.size() >= mCapacity )
+        {
+            mQueue.dequeue();
+            dropped++;
+        }
+        mDropCount += dropped;
+
+        mQueue.enqueue( item );
+        mNotEmpty.wakeOne();
+
+        return dropped;
+    }
+
+    /** @brief Extracts the oldest element of the queue
+     *
+     * @param timeoutMsec max time waiting for an element
+     * @returns false if the queue is empty after the timeout or if it has been closed
+     */
+    bool pop( T& item, unsigned long timeoutMsec )
+    {
+        QMutexLocker locker( &mMutex );
+
+        if( mQueue.isEmpty() && !mClosed )
+            mNotEmpty.wait( &mMutex, timeoutMsec );
+
+        if( mQueue.isEmpty() )
+            return false;
+
+        item = mQueue.dequeue();
+        return true;
+    }
+
+    /** @brief Wakes up all the consumers. Elements already in the queue can still be extracted
+     */
+    void close()
+    {
+        QMutexLocker locker( &mMutex );
+
+        mClosed = true;
+        mNotEmpty.wakeAll();
+    }
+
+    /** @brief Empties the queue and allows new elements
+     */
+    void reset()
+    {
+        QMutexLocker locker( &mMutex );
+
+        mQueue.clear();
+        mClosed = false;
+    }
+
+    /** @brief Changes the max number of elements. The elements over it are dropped at the next push
+     */
+    void setCapacity( int capacity )
+    {
+        QMutexLocker locker( &mMutex );
+        mCapacity = qMax( 1, capacity );
+    }
+
+    bool isClosed()
+    {
+        QMutexLocker locker( &mMutex );
+        return mClosed && mQueue.isEmpty();
+    }
+
+    int size()
+    {
+        QMutexLocker locker( &mMutex );
+        return mQueue.size();
+    }
+
+    quint32 getDropCount()
+    {
+        QMutexLocker locker( &mMutex );
+        return mDropCount;
+    }
+
+private:
+    QQueue<T> mQueue;       /**< Elements of the queue */
+    int mCapacity;          /**< Max number of elements */
+    quint32 mDropCount;     /**< Number of elements dropped since creation */
+    bool mClosed;           /**< The producer stopped */
+
+    QMutex mMutex;
+    QWaitCondition mNotEmpty;
+};
+
+}
+
+#endif // QFRAMEQUEUE_H
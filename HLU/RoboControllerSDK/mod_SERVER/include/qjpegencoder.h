@@ -0,0 +1,100 @@
+#ifndef QJPEGENCODER_H
+#define QJPEGENCODER_H
+
+#include <QByteArray>
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#define JPEG_POOL_SIZE          8       // Output buffers recycled when no more used by the pipeline
+#define JPEG_HEADER_RESERVE     2048    // Space for the JPEG headers over the raw size of the image
+
+// >>>>> Chroma subsampling
+#define JPEG_CHROMA_420         0       // Default of libjpeg
+#define JPEG_CHROMA_422         1
+#define JPEG_CHROMA_444         2       // No subsampling
+// <<<<< Chroma subsampling
+
+// The sampling factor can be chosen only from OpenCV 4.5.5,
+// older versions always use the default of libjpeg (4:2:0)
+#if !defined(CV_VERSION_EPOCH) && defined(CV_VERSION_MAJOR) && \
+    (CV_VERSION_MAJOR>4 || (CV_VERSION_MAJOR==4 && (CV_VERSION_MINOR>5 || (CV_VERSION_MINOR==5 && CV_VERSION_REVISION>=5))))
+#define JPEG_HAS_SAMPLING_FACTOR
+#endif
+
+namespace roboctrl
+{
+
+/** @brief JPEG encoder working on persistent buffers.
+ *
+ * The image is encoded where it is (e.g. the buffer of the capture) into
+ * an output buffer sized for the worst case, then copied into a buffer of
+ * a pool: when the frames stop being shared by the pipeline their buffers
+ * are reused, so no memory is allocated at steady state.
+ * Not thread safe: each encoding thread owns an encoder
+ */
+class QJpegEncoder
+{
+public:
+    QJpegEncoder( int maxWidth=640, int maxHeight=480 );
+
+    void setQuality( int quality );
+    int getQuality(){return mQuality;}
+
+    /** @brief Encodes a single component: a third of the data to compress
+     */
+    void setGrayscale( bool gray ){mGrayscale=gray;}
+    bool isGrayscale(){return mGrayscale;}
+
+    /** @brief Sets the chroma subsampling (JPEG_CHROMA_*).
+     *         Ignored if @ref JPEG_HAS_SAMPLING_FACTOR is not defined
+     */
+    void setChromaSubsampling( int chroma ){mChroma=chroma;}
+
+    /** @brief Encodes a BGR or grayscale image
+     *
+     * @param image image to encode, read in place
+     * @param jpeg receives the JPEG data in a buffer of the pool
+     * @param prefix data copied before the JPEG data in the same buffer (e.g. a header)
+     * @returns false if the image cannot be encoded
+     */
+    bool encode( const cv::Mat& image, QByteArray& jpeg, const QByteArray& prefix=QByteArray() );
+
+    /** @brief Returns the number of buffers allocated since creation
+     */
+    quint32 getAllocationCount(){return mAllocCount;}
+
+    /** @brief Returns the number of images encoded since creation
+     */
+    quint32 getEncodedCount(){return mEncodedCount;}
+
+private:
+    /** @brief Grows the output buffer to the worst case of an image
+     */
+    void reserveOutput( int width, int height, int channels );
+
+    /** @brief Returns a buffer of the pool not used anymore by the pipeline
+     */
+    QByteArray& getPoolBuffer( int size );
+
+private:
+    int mQuality;                   ///< JPEG quality [0,100]
+    bool mGrayscale;                ///< Color images are encoded as grayscale
+    int mChroma;                    ///< Chroma subsampling of the color images
+
+    std::vector<int> mParams;       ///< Parameters of cv::imencode
+    std::vector<uchar> mOutput;     ///< Output of cv::imencode
+    cv::Mat mGray;                  ///< Grayscale conversion of the color images
+
+    QByteArray mPool[JPEG_POOL_SIZE];
+    int mPoolIdx;                   ///< Next buffer of the pool to check
+
+    quint32 mAllocCount;
+    quint32 mEncodedCount;
+};
+
+}
+
+#endif // QJPEGENCODER_H
@@ -12,12 +12,22 @@
 #include <QTimer>
 #include <QMutex>
 #include <QAbstractSocket>
+#include <QElapsedTimer>
+
+#include "qrobottelemetry.h"
 
 #define WORD_TEST_BOARD 0
 #define TEST_TIMER_INTERVAL 1000
 
 #define INITIAL_REPLY_BUFFER_SIZE 20
 
+#define TRAJ_PLAYBACK_PERIOD_MSEC 20 // 50 Hz
+
+#define CTRL_STATS_REPORT_PERIOD 32 // Control link statistics are sent every N redundant datagrams
+#define CTRL_SEQ_RESTART_GAP 256 // A redundant setpoint older than this is not reordered: the client restarted its sequence
+
+#define SERVER_CAPABILITIES (SRV_CAP_SPEED_TRAJ|SRV_CAP_REDUNDANT_CTRL|SRV_CAP_CONFIG_HASH|SRV_CAP_ODOMETRY)
+
 class QTcpServer;
 class QNetworkSession;
 class QTcpSocket;
@@ -26,6 +36,17 @@ class QUdpSocket;
 namespace roboctrl
 {
 
+/**
+  * @struct _TrajPoint
+  * @brief A point of the speed trajectory played by the server
+  */
+typedef struct _TrajPoint
+{
+    qint64 timeMsec; /**< Time of the point on @ref QRobotServer::mTrajClock (msec) */
+    qint16 speed0;   /**< Speed setpoint of motor 0 (mm/sec) */
+    qint16 speed1;   /**< Speed setpoint of motor 1 (mm/sec) */
+} TrajPoint;
+
 class ROBOCONTROLLERSDKSHARED_EXPORT QRobotServer : public QThread
 {
     Q_OBJECT
@@ -36,6 +57,11 @@ public:
                           quint16 serverTcpPort=14500, bool testMode=false, QObject *parent=0); ///< Default constructor
     virtual ~QRobotServer(); ///< Destructor
 
+    /** @brief Returns the wheel speeds last read from the board, to be shared
+     *         with the other servers of the process (e.g. @ref QWebcamServer::setTelemetrySource)
+     */
+    QRobotTelemetry* getTelemetry(){return &mTelemetry;}
+
 signals:
     
 public slots:
@@ -69,6 +95,17 @@ private:
     bool writeMultiReg( quint16 startAddr, quint16 nReg, QVector<quint16> vals ); ///< Called to write registers to RoboController
 
     void readSpeedsAndSend(QHostAddress addr); ///< Called to send to client the speed of the robot after receiveing a command of movement
+    void publishTelemetry( quint16 startAddr, quint16 nReg ); ///< Updates the telemetry if the registers just read contain the speeds
+    void pollTelemetry(); ///< Called every @ref TELEMETRY_POLL_PERIOD_MSEC to read the speeds if nobody else did
+
+    void setSpeedTrajectory( QVector<TrajPoint>& traj ); ///< Replaces the not yet played part of the speed trajectory
+    void trajectorySetPoint( qint64 timeMsec, qint16& speed0, qint16& speed1 ); ///< Linear interpolation of the speed trajectory at the given time
+    void playTrajectory(); ///< Called every @ref TRAJ_PLAYBACK_PERIOD_MSEC to send the current trajectory setpoint to RoboController
+    void stopTrajectory(); ///< Stops the trajectory playback
+
+    void resetControlLinkStats(); ///< Resets sequence and statistics of the redundant control link
+    void sendControlLinkStats( QHostAddress addr ); ///< Sends the statistics of the redundant control link to the client
+    void sendOdometry( QHostAddress addr ); ///< Reads the speeds and sends them to the client with the last motion estimated
 
 protected:
     virtual void run() Q_DECL_OVERRIDE;
@@ -110,6 +147,24 @@ private:
     quint16         mNextUdpStatBlockSize;      ///< Used to recover incomplete UDP Status block
 
     bool            mTestMode; ///< If true the server does not connect to RoboController, but allows connection to sockets to test communications
+
+    QVector<TrajPoint> mTrajectory; ///< Speed trajectory being played
+    QElapsedTimer   mTrajClock; ///< Monotonic clock used to play the speed trajectory
+    int             mTrajTimerId; ///< Id of the trajectory playback timer (-1 if not playing)
+    quint16         mTrajUnderrunCount; ///< Number of times the trajectory ended before a new one was received
+
+    bool            mCtrlSeqValid; ///< Indicates that a redundant setpoint has been received from the controlling client
+    quint16         mLastCtrlSeq; ///< Sequence number of the newest redundant setpoint applied
+    quint32         mCtrlRecvCount; ///< Redundant control datagrams received
+    quint32         mCtrlLostCount; ///< Redundant control datagrams lost
+    quint32         mCtrlRecoveredCount; ///< Lost datagrams whose setpoint was carried by a following datagram
+    quint32         mCtrlStaleCount; ///< Duplicated or out of order datagrams ignored
+
+    bool            mConfigHashValid; ///< Indicates that @ref mConfigHash matches the configuration on the board
+    quint16         mConfigHash; ///< Cached hash of the robot configuration (see @ref configHash)
+
+    QRobotTelemetry mTelemetry; ///< Last wheel speeds read from the board
+    int             mTelemetryTimerId; ///< Id of the telemetry polling timer (-1 in test mode)
 };
 
 }
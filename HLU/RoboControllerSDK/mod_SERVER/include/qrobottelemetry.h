@@ -0,0 +1,153 @@
+#ifndef QROBOTTELEMETRY_H
+#define QROBOTTELEMETRY_H
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+
+#include "RoboControllerSDK_global.h"
+
+#define TELEMETRY_POLL_PERIOD_MSEC      50  // Period of the board reading while someone uses the telemetry (20 Hz)
+#define TELEMETRY_ODOMETRY_TIMEOUT_MSEC 500 // Older motion estimates are not valid
+#define TELEMETRY_FRESH_USEC            (2*TELEMETRY_POLL_PERIOD_MSEC*1000) // Older speeds are not fused with the camera: the polling stopped
+
+namespace roboctrl
+{
+
+/**
+  * @struct _FrameTelemetry
+  * @brief State of the robot when a frame has been captured
+  */
+typedef struct _FrameTelemetry
+{
+    bool valid;             /**< The board has been read at least once */
+    qint16 speed0;          /**< Speed of motor 0 (mm/sec) */
+    qint16 speed1;          /**< Speed of motor 1 (mm/sec) */
+    quint32 boardTimeMsec;  /**< Time of the board reading on the clock of the telemetry (msec) */
+    quint32 ageUsec;        /**< Time elapsed from the board reading to the capture of the frame (usec) */
+} FrameTelemetry;
+
+/** @brief Latest robot state read from the board, shared by the servers
+ *         of the same process.
+ *
+ * @ref QRobotServer publishes the wheel speeds each time it reads them from
+ * the board, the webcam grabbers stamp each frame with the last values and
+ * with their age, so that the vision code can compensate the motion without
+ * synchronizing two streams
+ */
+class QRobotTelemetry
+{
+public:
+    QRobotTelemetry() :
+        mConsumers(0)
+    {
+        mClock.start();
+
+        mLatest.valid = false;
+        mLatest.speed0 = 0;
+        mLatest.speed1 = 0;
+        mLatest.boardTimeMsec = 0;
+        mLatest.ageUsec = 0;
+
+        mOdometry = RobotOdometry();
+    }
+
+    /** @brief Stores the speeds just read from the board
+     */
+    void publishSpeeds( qint16 speed0, qint16 speed1 )
+    {
+        QMutexLocker locker( &mMutex );
+
+        mLatest.valid = true;
+        mLatest.speed0 = speed0;
+        mLatest.speed1 = speed1;
+        mLatest.boardTimeMsec = (quint32)mClock.elapsed();
+        mSampleTime.start();
+    }
+
+    /** @brief Forgets the speeds read: the board is not connected anymore
+     */
+    void invalidate()
+    {
+        QMutexLocker locker( &mMutex );
+
+        mLatest.valid = false;
+    }
+
+    /** @brief Fills the telemetry of a frame captured now
+     */
+    void stamp( FrameTelemetry& telemetry )
+    {
+        QMutexLocker locker( &mMutex );
+
+        telemetry = mLatest;
+        if( telemetry.valid )
+            telemetry.ageUsec = (quint32)(mSampleTime.nsecsElapsed()/1000);
+    }
+
+    /** @brief Returns the msec elapsed since the last board reading, -1 if never read
+     */
+    qint64 getSampleAgeMsec()
+    {
+        QMutexLocker locker( &mMutex );
+        return mLatest.valid?mSampleTime.elapsed():-1;
+    }
+
+    /** @brief Stores the motion estimated on the last frame
+     *         (e.g. by the visual odometry of @ref QWebcamServer).
+     *         The speeds of the motors are not used
+     */
+    void publishOdometry( const RobotOdometry& odometry )
+    {
+        QMutexLocker locker( &mMutex );
+
+        mOdometry = odometry;
+        mOdometryTime.start();
+    }
+
+    /** @brief Returns the last motion estimated, not valid if older than
+     *         @ref TELEMETRY_ODOMETRY_TIMEOUT_MSEC
+     */
+    RobotOdometry getOdometry()
+    {
+        QMutexLocker locker( &mMutex );
+
+        RobotOdometry odometry = mOdometry;
+        if( odometry.valid )
+        {
+            qint64 ageMsec = mOdometryTime.elapsed();
+
+            odometry.ageMsec = (quint16)qMin( ageMsec, (qint64)65535 );
+            if( ageMsec > TELEMETRY_ODOMETRY_TIMEOUT_MSEC )
+            {
+                odometry.valid = false;
+                odometry.visionValid = false;
+            }
+        }
+
+        return odometry;
+    }
+
+    /** @brief The board is polled only while someone stamps its frames
+     */
+    void addConsumer(){mConsumers.ref();}
+    void removeConsumer(){mConsumers.deref();}
+    bool hasConsumers(){return mConsumers.loadAcquire()>0;}
+
+private:
+    FrameTelemetry mLatest;     /**< Last values read, ageUsec not used */
+    QElapsedTimer mSampleTime;  /**< Started when the board has been read */
+    QElapsedTimer mClock;       /**< Clock of the board timestamps */
+
+    RobotOdometry mOdometry;        /**< Last motion estimated */
+    QElapsedTimer mOdometryTime;    /**< Started when the motion has been estimated */
+
+    QAtomicInt mConsumers;      /**< Number of users of the telemetry */
+
+    QMutex mMutex;
+};
+
+}
+
+#endif // QROBOTTELEMETRY_H
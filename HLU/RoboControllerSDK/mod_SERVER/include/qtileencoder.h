@@ -0,0 +1,116 @@
+#ifndef QTILEENCODER_H
+#define QTILEENCODER_H
+
+#include <QByteArray>
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include <network_msg.h>
+#include "qjpegencoder.h"
+
+#define TILE_DEFAULT_SIZE           32      // Side of the tiles, multiple of the 16x16 JPEG MCU so that blocks never cross two tiles
+#define TILE_SAD_PER_BYTE           3       // Average absolute difference of a tile over which it is sent again (sensor noise is under it)
+#define TILE_KEYFRAME_INTERVAL      50      // Frames between two keyframes, they heal the clients with a wrong reference
+#define TILE_MAX_CHANGED            0.6     // Fraction of changed tiles over which a keyframe is cheaper
+
+// >>>>> SIMD sum of absolute differences
+#if defined(__SSE2__) || defined(_M_X64)
+#define TILE_SAD_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define TILE_SAD_NEON
+#endif
+// <<<<< SIMD sum of absolute differences
+
+namespace roboctrl
+{
+
+/** @brief Conditional replenishment encoder for static scenes.
+ *
+ * The image is split in tiles and each tile is compared with the same
+ * tile of the last frame sent (SIMD sum of absolute differences): only the
+ * changed tiles are packed side by side and JPEG encoded
+ * (@ref WEBCAM_ENC_JPEG_TILES). The comparison is done against the pixels
+ * really sent, so slow changes accumulate until the tile is sent again.
+ * A whole frame (keyframe) is sent every @ref TILE_KEYFRAME_INTERVAL frames,
+ * when the size changes, when most tiles changed or when requested.
+ * Not thread safe: frames must be encoded in order
+ */
+class QTileEncoder
+{
+public:
+    QTileEncoder( int tileSize=TILE_DEFAULT_SIZE, int keyframeInterval=TILE_KEYFRAME_INTERVAL );
+
+    /** @brief The next frame is a keyframe
+     */
+    void requestKeyframe(){mKeyframeRequested=true;}
+
+    /** @brief Encodes a frame as keyframe or as changed tiles
+     *
+     * @param image BGR or grayscale image
+     * @param frameId id of the frame, referenced by the next one
+     * @param jpeg encoder with quality and options already set
+     * @param data receives the encoded frame
+     * @param keyframeJpeg JPEG of the whole image if already available, used for the keyframes
+     * @returns the encoding of the frame (WEBCAM_ENC_JPEG for keyframes,
+     *          WEBCAM_ENC_JPEG_TILES otherwise), 0 if the image cannot be encoded
+     */
+    int encode( const cv::Mat& image, quint32 frameId, QJpegEncoder& jpeg,
+                QByteArray& data, const QByteArray& keyframeJpeg=QByteArray() );
+
+    /** @brief Returns the number of tiles changed in the last frame encoded
+     */
+    int getChangedTiles(){return mChangedTiles;}
+
+    /** @brief Returns the number of tiles of the last frame encoded
+     */
+    int getTileCount(){return mCols*mRows;}
+
+    /** @brief Returns true if a frame has been encoded since the last keyframe request
+     */
+    bool hasReference(){return mReferenceValid && !mKeyframeRequested;}
+
+    /** @brief Returns the id of the last frame encoded
+     */
+    quint32 getReferenceId(){return mReferenceId;}
+
+    /** @brief Returns the sum of absolute differences of two blocks of bytes
+     *         (SSE2 or NEON if available)
+     *
+     * @param limit the sum stops at the first row exceeding it
+     */
+    static quint32 blockSad( const uchar* a, size_t strideA, const uchar* b, size_t strideB,
+                             int rowBytes, int rows, quint32 limit );
+
+private:
+    /** @brief Sends the whole image and makes it the reference
+     */
+    int encodeKeyframe( const cv::Mat& image, quint32 frameId, QJpegEncoder& jpeg,
+                        QByteArray& data, const QByteArray& keyframeJpeg );
+
+    /** @brief Returns the rectangle of the tile clipped to the image
+     */
+    cv::Rect tileRect( int tileIdx );
+
+private:
+    int mTileSize;                  ///< Side of the tiles
+    int mKeyframeInterval;          ///< Frames between two keyframes
+    bool mKeyframeRequested;        ///< The next frame is a keyframe
+
+    cv::Mat mReference;             ///< Pixels sent to the clients for each tile
+    bool mReferenceValid;           ///< At least a keyframe sent
+    quint32 mReferenceId;           ///< Id of the last frame sent
+    int mFramesSinceKeyframe;
+
+    int mCols;                      ///< Tiles in a row
+    int mRows;                      ///< Rows of tiles
+    int mChangedTiles;              ///< Tiles sent with the last frame
+    std::vector<quint16> mChanged;  ///< Indexes of the changed tiles
+    cv::Mat mMosaic;                ///< Changed tiles side by side
+    QByteArray mHeader;             ///< Tile list, copied before the JPEG data
+};
+
+}
+
+#endif // QTILEENCODER_H
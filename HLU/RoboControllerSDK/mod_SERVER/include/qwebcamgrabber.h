@@ -0,0 +1,83 @@
+#ifndef QWEBCAMGRABBER_H
+#define QWEBCAMGRABBER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+
+#include "qcapturesource.h"
+#include "qtriplebuffer.h"
+#include "qwebcampipeline.h"
+
+#define WEBCAM_GRAB_RETRY_MSEC      10      // Wait after a failed grab
+
+namespace roboctrl
+{
+
+/** @brief Drains a capture source as fast as it produces frames and keeps
+ *         only the newest one.
+ *
+ * The drivers queue the frames not yet read: reading them at a lower rate
+ * than the camera shows an old image. The grabber reads every frame and
+ * hands the last one to the capture stage through a triple buffer
+ */
+class QWebcamGrabber : public QThread
+{
+    Q_OBJECT
+public:
+    /**
+     * @param source opened capture source, not owned
+     * @param clock monotonic clock used for the capture timestamps
+     * @param stats receives the time to decode each frame
+     */
+    explicit QWebcamGrabber( QCaptureSource* source,
+                             const QElapsedTimer& clock,
+                             QWebcamPipelineStats* stats,
+                             QObject *parent = 0 );
+
+    void stop();
+
+    /** @brief Takes the newest frame not yet taken
+     *
+     * @param frame receives image and capture time. The index is the grab counter
+     * @param timeoutMsec max wait if no new frame is available
+     * @returns false if no new frame arrived before the timeout
+     */
+    bool takeLatest( RawFrame& frame, unsigned long timeoutMsec );
+
+    /** @brief Stamps the next frames with the robot state, NULL to stop
+     */
+    void setTelemetrySource( QRobotTelemetry* telemetry ){mTelemetry.storeRelease(telemetry);}
+
+    /** @brief Returns the number of frames grabbed from the source
+     */
+    quint32 getGrabbedCount(){return (quint32)mGrabbedCount.loadAcquire();}
+
+    /** @brief Returns the number of frames replaced by a newer one before being taken
+     */
+    quint32 getOverwrittenCount(){return (quint32)mOverwrittenCount.loadAcquire();}
+
+protected:
+    void run();
+
+private:
+    QCaptureSource* mSource;
+    QElapsedTimer mClock;
+    QWebcamPipelineStats* mStats;
+    QAtomicPointer<QRobotTelemetry> mTelemetry; ///< Robot state, NULL if not available
+
+    QTripleBuffer<RawFrame> mBuffer;    ///< Newest frame from grabber to capture stage
+
+    QMutex mWaitMutex;                  ///< Used only to sleep waiting for a frame
+    QWaitCondition mFrameReady;
+
+    QAtomicInt mStopped;
+    QAtomicInt mGrabbedCount;
+    QAtomicInt mOverwrittenCount;
+};
+
+}
+
+#endif // QWEBCAMGRABBER_H
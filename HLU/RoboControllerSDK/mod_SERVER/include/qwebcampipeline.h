@@ -0,0 +1,588 @@
+#ifndef QWEBCAMPIPELINE_H
+#define QWEBCAMPIPELINE_H
+
+#include <QThread>
+#include <QRunnable>
+#include <QUdpSocket>
+#include <QHostAddress>
+#include <QStringList>
+#include <QByteArray>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QHash>
+
+#include <vector>
+
+#if defined(Q_OS_LINUX) && !defined(WEBCAM_NO_SENDMMSG)
+#define WEBCAM_USE_SENDMMSG // Fragments sent with a sendmmsg call per burst
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <poll.h>
+#endif
+
+#include <opencv2/core/core.hpp>
+
+#include <network_msg.h>
+#include "qframequeue.h"
+#include "qjpegencoder.h"
+#include "qtileencoder.h"
+#include "qrobottelemetry.h"
+
+#define WEBCAM_RAW_QUEUE_SIZE       2       // Frames waiting for encoding
+#define WEBCAM_ENCODED_QUEUE_SIZE   3       // Frames waiting for sending
+#define WEBCAM_MAX_ENCODER_THREADS  3       // Max number of frames encoded in parallel
+#define WEBCAM_STATS_PERIOD_MSEC    5000    // Period of the pipeline timings report
+#define WEBCAM_POP_TIMEOUT_MSEC     100     // Max wait of a stage on its input queue before checking for stop
+
+#define WEBCAM_MCAST_DEFAULT_GROUP  "239.255.55.54" // Administratively scoped group used by RoboControllerServer
+#define WEBCAM_MCAST_TTL            1       // Multicast frames do not leave the local network
+#define WEBCAM_MCAST_MAX_CLIENTS    32      // Max number of clients receiving the multicast stream
+
+#define WEBCAM_CLIENT_QUEUE_SIZE    2       // Frames waiting for each destination
+#define WEBCAM_CLIENT_MAX_AGE_MSEC  200     // Frames older than this are not sent
+#define WEBCAM_PACING_BURST         16      // Fragments sent back to back
+#define WEBCAM_PACING_SPREAD_MSEC   10      // Time over which the bursts of a frame are spread
+#define WEBCAM_SEND_RETRY_MSEC      5       // Max wait for a full socket buffer before dropping the frame
+
+#define WEBCAM_FEC_DEFAULT_GROUP    8       // Data fragments protected by a parity fragment (0: no FEC)
+#define WEBCAM_FEC_MAX_GROUP        64      // Max data fragments protected by a parity fragment
+
+// >>>>> Rate adaptation
+#define WEBCAM_QUALITY_LEVELS       6       // Levels of the quality ladder, 0 is the best
+#define WEBCAM_LOSS_HIGH            0.10    // Average frame loss over which the quality is decreased
+#define WEBCAM_LOSS_LOW             0.02    // Average frame loss under which the quality can be increased
+#define WEBCAM_UPGRADE_REPORTS      5       // Consecutive reports under WEBCAM_LOSS_LOW needed to increase the quality
+#define WEBCAM_BLACKOUT_MIN_SENT    5       // Frames sent without any completed to consider the link down
+// <<<<< Rate adaptation
+
+// >>>>> Streams
+#define WEBCAM_STREAMS              2       // Preview and full resolution (WEBCAM_STREAM_*)
+#define WEBCAM_PREVIEW_SCALE        0.5     // Scale of the preview stream applied over the quality level
+#define WEBCAM_ENCODING_TILES       (WEBCAM_STREAMS*WEBCAM_QUALITY_LEVELS) // Added to the encoding of the destinations receiving only the changed tiles
+#define WEBCAM_ENCODINGS            (2*WEBCAM_ENCODING_TILES) // Stream, level and tiles: each is encoded once for all its clients
+// <<<<< Streams
+
+namespace roboctrl
+{
+
+class QWebcamRecorder;
+
+/**
+  * @struct _RawFrame
+  * @brief Frame captured by the camera waiting for encoding
+  */
+typedef struct _RawFrame
+{
+    cv::Mat image;              /**< Captured image */
+    quint8 camera;              /**< Camera of the frame */
+    quint32 frameIdx;           /**< Progressive index of the frame, counted for each camera */
+    QElapsedTimer captureTime;  /**< Started when the frame has been captured */
+    quint64 captureUsec;        /**< Capture time on the monotonic clock of the server */
+    FrameTelemetry telemetry;   /**< State of the robot at capture time */
+} RawFrame;
+
+/**
+  * @struct _EncodedFrame
+  * @brief JPEG frame waiting for sending
+  */
+typedef struct _EncodedFrame
+{
+    QByteArray data;            /**< JPEG data */
+    quint8 camera;              /**< Camera of the frame */
+    quint32 frameIdx;           /**< Progressive index of the frame, counted for each camera */
+    QElapsedTimer captureTime;  /**< Started when the frame has been captured */
+    quint64 captureUsec;        /**< Capture time on the monotonic clock of the server */
+    FrameTelemetry telemetry;   /**< State of the robot at capture time */
+    quint8 encoder;             /**< Encoding of the data (WEBCAM_ENC_*) */
+    quint16 width;              /**< Width of the frame */
+    quint16 height;             /**< Height of the frame */
+    quint8 encoding;            /**< Stream, quality level and tiles: stream*WEBCAM_QUALITY_LEVELS+level (+WEBCAM_ENCODING_TILES) */
+} EncodedFrame;
+
+/**
+  * @struct _WebcamClientInfo
+  * @brief Client of the webcam stream
+  */
+typedef struct _WebcamClientInfo
+{
+    QString ip;                 /**< Address of the client */
+    quint8 protoVersion;        /**< Stream version negotiated with CMD_ADD_CLIENT */
+    bool multicast;             /**< The client receives the stream from the multicast group */
+} WebcamClientInfo;
+
+/**
+  * @struct _WebcamStageTimings
+  * @brief Average timings of the stages of the webcam pipeline
+  *        evaluated on the last @ref WEBCAM_STATS_PERIOD_MSEC
+  */
+typedef struct _WebcamStageTimings
+{
+    double fps;             /**< Frames sent per second */
+    double captureMsec;     /**< Average time to grab a frame */
+    double encodeMsec;      /**< Average time to encode a frame */
+    double sendMsec;        /**< Average time to dispatch a frame to the destination queues */
+    double latencyMsec;     /**< Average time from capture to the dispatch */
+    double datagramsPerFrame; /**< Average number of datagrams sent for each frame (all the clients) */
+    double sendCallsPerFrame; /**< Average number of send system calls for each frame */
+    quint32 rawDropped;     /**< Frames dropped before encoding (since start) */
+    quint32 encodedDropped; /**< Frames dropped before sending (since start) */
+    quint32 lateDropped;    /**< Frames encoded after a newer frame (since start) */
+    quint32 encoderAllocs;  /**< Buffers allocated by the JPEG encoders (since start) */
+    double tilesSent;       /**< Average fraction of the tiles sent by the tile encodings, keyframes included */
+    quint32 keyframes;      /**< Keyframes of the tile encodings (since start) */
+    double pacedFps;        /**< Iterations per second of the capture stage */
+    double jitterMsec;      /**< Average delay of the capture stage over its deadlines */
+    double maxJitterMsec;   /**< Max delay of the capture stage over its deadlines */
+    quint32 pacingSkipped;  /**< Deadlines skipped because the capture stage was late (since start) */
+} WebcamStageTimings;
+
+/**
+  * @struct _WebcamClientStats
+  * @brief Counters of a destination of the webcam stream
+  */
+typedef struct _WebcamClientStats
+{
+    QString address;            /**< Address of the client or of the multicast group */
+    bool multicast;             /**< The destination is the multicast group */
+    quint32 framesSent;         /**< Frames sent (since connection) */
+    quint32 framesDropped;      /**< Frames dropped because the queue was full (since connection) */
+    quint32 framesStale;        /**< Frames dropped because older than @ref WEBCAM_CLIENT_MAX_AGE_MSEC */
+    quint32 sendErrors;         /**< Frames with fragments not sent */
+    double queueMsec;           /**< Average time from capture to the start of sending */
+    double sendMsec;            /**< Average time to send a frame */
+} WebcamClientStats;
+
+/**
+  * @struct _WebcamQualityLevel
+  * @brief Encoding parameters of a level of the quality ladder
+  */
+typedef struct _WebcamQualityLevel
+{
+    int jpegQuality;            /**< JPEG quality [0,100] */
+    double scale;               /**< Scale applied to the captured frame */
+    int frameDivider;           /**< Only a frame every frameDivider is sent */
+} WebcamQualityLevel;
+
+/**
+  * @struct _WebcamClientRate
+  * @brief State of the rate adaptation of a client
+  */
+typedef struct _WebcamClientRate
+{
+    int level;                  /**< Current quality level */
+    int stream;                 /**< Stream selected by the client (WEBCAM_STREAM_*) */
+    bool tiles;                 /**< The client decodes WEBCAM_ENC_JPEG_TILES */
+    quint8 cameras;             /**< Bitmask of the cameras subscribed by the client */
+    bool feedbackValid;         /**< At least a feedback received */
+    quint32 lastCompleted;      /**< Completed frames in the last feedback */
+    quint32 lastLost;           /**< Lost frames in the last feedback */
+    quint32 sentSinceFeedback;  /**< Frames sent since the last feedback */
+    double loss;                /**< Average frame loss */
+    int goodReports;            /**< Consecutive reports under @ref WEBCAM_LOSS_LOW */
+} WebcamClientRate;
+
+/** @brief Adapts the quality of the stream of each client to the frame
+ *         loss reported with CMD_CLIENT_FEEDBACK.
+ *
+ * The clients are moved along a ladder of quality levels (JPEG quality,
+ * resolution and frame rate): a frame is encoded once for each level in
+ * use, so clients with the same level share the encoding
+ */
+class QWebcamRateController
+{
+public:
+    QWebcamRateController();
+
+    /**
+     * @param stream initial stream of the client (WEBCAM_STREAM_*)
+     * @param tiles the client decodes WEBCAM_ENC_JPEG_TILES
+     */
+    void addClient( const QString& ip, int stream=WEBCAM_STREAM_FULL, bool tiles=false );
+    void removeClient( const QString& ip );
+
+    /** @brief Counts a frame sent to the client
+     */
+    void frameSent( const QString& ip );
+
+    /** @brief Updates the level of the client with the counters of the client
+     *
+     * @param completed frames completed by the client since its connection
+     * @param lost frames lost by the client since its connection
+     */
+    void onFeedback( const QString& ip, quint32 completed, quint32 lost );
+
+    /** @brief Returns the quality level of the client, 0 if unknown
+     */
+    int getLevel( const QString& ip );
+
+    /** @brief Selects the stream of the client (WEBCAM_STREAM_*)
+     */
+    void setStream( const QString& ip, int stream );
+    int getStream( const QString& ip );
+
+    /** @brief Returns the encoding of the stream of the client: stream*WEBCAM_QUALITY_LEVELS+level,
+     *         plus WEBCAM_ENCODING_TILES if the client receives only the changed tiles
+     */
+    int getEncoding( const QString& ip );
+
+    /** @brief Enables the tile encodings for the clients supporting them
+     */
+    void setTileMode( bool enabled );
+    bool getTileMode();
+
+    /** @brief Subscribes the client to the cameras in the bitmask. The clients
+     *         start with the camera 0
+     */
+    void setCameras( const QString& ip, quint8 cameras );
+    quint8 getCameras( const QString& ip );
+
+    /** @brief Sets the clients receiving the multicast stream, which carries
+     *         a single encoding for all of them (@ref getGroupEncoding)
+     */
+    void setGroupMembers( const QStringList& members );
+
+    /** @brief Returns the encoding of the multicast stream: the level of the worst
+     *         member, at full resolution if a member selected it, as tiles if all
+     *         the members decode them. Always produced while the group has members
+     */
+    int getGroupEncoding();
+
+    /** @brief Returns the bitmask of the encodings of a camera used by at least a client
+     *         or by the multicast group. The preview is always produced while there are
+     *         clients subscribed
+     */
+    quint32 getActiveEncodings( int camera );
+
+    static const WebcamQualityLevel& getQualityLevel( int level );
+
+    /** @brief Sets the JPEG options common to all the levels
+     *
+     * @param grayscale frames encoded without color
+     * @param chroma chroma subsampling of the color frames (JPEG_CHROMA_*)
+     */
+    void setEncoderOptions( bool grayscale, int chroma );
+    void getEncoderOptions( bool& grayscale, int& chroma );
+
+    /** @brief Keeps an encoding of the cameras active for the recording,
+     *         also without clients
+     *
+     * @param cameras bitmask of the cameras recorded, 0 stops the recording
+     * @param encoding stream*WEBCAM_QUALITY_LEVELS+level, not tiled
+     */
+    void setRecording( quint8 cameras, int encoding );
+
+private:
+    /** @brief Encoding of the multicast stream, to be called with @ref mMutex locked
+     */
+    int groupEncoding();
+
+private:
+    QMutex mMutex;
+    QHash<QString,WebcamClientRate> mClients;
+    QStringList mGroupMembers;  ///< Clients receiving the multicast stream
+    bool mGrayscale;
+    int mChroma;
+    bool mTileMode;
+    quint8 mRecordCameras;      ///< Bitmask of the cameras recorded
+    int mRecordEncoding;        ///< Encoding of the recording
+};
+
+/** @brief Tile encoders shared by the encoding threads, one for each
+ *         camera, stream and quality level.
+ *
+ * A tile frame refers to the previous frame of its encoding: the encoder
+ * stays locked until the frame is queued, so the frames of an encoding
+ * leave the encoding stage in order
+ */
+class QWebcamTileEncoders
+{
+public:
+    /** @brief Locks and returns the tile encoder of an encoding
+     *
+     * @param encoding encoding with or without WEBCAM_ENCODING_TILES
+     */
+    QTileEncoder* lock( int camera, int encoding );
+    void unlock( int camera, int encoding );
+
+    /** @brief The next frame of every tile encoding is a keyframe
+     */
+    void requestKeyframe();
+
+private:
+    QMutex mMutex[WEBCAM_MAX_CAMERAS][WEBCAM_ENCODING_TILES];
+    QTileEncoder mEncoders[WEBCAM_MAX_CAMERAS][WEBCAM_ENCODING_TILES];
+};
+
+/** @brief Thread safe accumulator of the timings of the webcam pipeline
+ */
+class QWebcamPipelineStats
+{
+public:
+    QWebcamPipelineStats();
+
+    void addCaptureTime( double msec );
+    void addEncodeTime( double msec );
+    void addSendTime( double sendMsec, double latencyMsec );
+    void addSendCalls( int datagrams, int calls );
+
+    void addRawDrops( int count );
+    void addEncodedDrops( int count );
+    void addLateDrop();
+    void addEncoderAllocs( int count );
+    void addTileFrame( int changedTiles, int tileCount, bool keyframe );
+    void addPacing( double latenessMsec, int skipped );
+
+    /** @brief If @ref WEBCAM_STATS_PERIOD_MSEC elapsed since the last report
+     *         evaluates the averages and restarts the accumulation
+     *
+     * @returns true if a new report is available
+     */
+    bool report( WebcamStageTimings& timings );
+
+    /** @brief Returns the last report
+     */
+    WebcamStageTimings getLastReport();
+
+private:
+    void resetAccumulators();
+
+private:
+    QMutex mMutex;
+    QElapsedTimer mPeriod;
+
+    double mCaptureSum;
+    int mCaptureCount;
+    double mEncodeSum;
+    int mEncodeCount;
+    double mSendSum;
+    double mLatencySum;
+    int mSendCount;
+    qint64 mDatagramSum;
+    qint64 mSendCallSum;
+    qint64 mTilesSentSum;
+    qint64 mTileSum;
+    double mPaceLateSum;
+    double mPaceLateMax;
+    int mPaceCount;
+
+    WebcamStageTimings mLastReport;
+};
+
+/** @brief Encoding stage of the webcam pipeline. More workers are started
+ *         on a thread pool to encode frames in parallel, the frames of all
+ *         the cameras share the workers
+ */
+class QWebcamEncodeWorker : public QRunnable
+{
+public:
+    QWebcamEncodeWorker( QFrameQueue<RawFrame>* rawQueue,
+                         QFrameQueue<EncodedFrame>* encodedQueue,
+                         QWebcamPipelineStats* stats,
+                         QWebcamRateController* rateCtrl,
+                         QWebcamTileEncoders* tileEncoders );
+
+    virtual void run();
+
+private:
+    /** @brief Encodes the changed tiles of a frame and queues it
+     *
+     * @param frame frame with all the fields but data and encoder set
+     * @param keyframeJpeg JPEG of the whole image if already encoded
+     */
+    void encodeTiles( const cv::Mat& image, EncodedFrame& frame, QJpegEncoder& encoder, const QByteArray& keyframeJpeg );
+
+    void queueFrame( const EncodedFrame& frame );
+
+private:
+    QFrameQueue<RawFrame>* mRawQueue;
+    QFrameQueue<EncodedFrame>* mEncodedQueue;
+    QWebcamPipelineStats* mStats;
+    QWebcamRateController* mRateCtrl;
+    QWebcamTileEncoders* mTileEncoders;
+};
+
+/** @brief Sends the frames of a single destination: a unicast client or
+ *         the multicast group.
+ *
+ * Each destination has its own bounded queue and thread: a slow client
+ * only loses its own stale frames and never delays the others.
+ * The fragments of a frame are sent in bursts spread over
+ * @ref WEBCAM_PACING_SPREAD_MSEC to avoid overflowing the socket buffers
+ */
+class QWebcamClientSender : public QThread
+{
+    Q_OBJECT
+public:
+    /**
+     * @param cameras bitmask of the cameras sent to the destination: the queue
+     *        holds @ref WEBCAM_CLIENT_QUEUE_SIZE frames for each of them
+     */
+    explicit QWebcamClientSender( QString address,
+                                  quint8 version,
+                                  bool multicast,
+                                  quint8 cameras,
+                                  QWebcamPipelineStats* stats,
+                                  QWebcamRateController* rateCtrl,
+                                  int sendPort,
+                                  int maxPacketSize,
+                                  QObject *parent = 0 );
+
+    /** @brief Queues a frame for sending. If the destination is late the
+     *         oldest frame in its queue is dropped
+     */
+    void pushFrame( const EncodedFrame& frame );
+
+    /** @brief Stops the thread after the frame being sent
+     */
+    void stop();
+
+    void setFecGroupSize( int groupSize );
+
+    /** @brief Sets the clients reached by the destination, used for rate adaptation
+     */
+    void setMembers( QStringList members );
+
+    quint8 getVersion(){return mVersion;}
+    quint8 getCameras(){return mCameras;}
+    WebcamClientStats getStats();
+
+protected:
+    void run();
+
+    /** @brief Sends a frame to the destination.
+     *
+     * Each fragment is made of a header of the negotiated version followed by
+     * a view on the encoded data: the payload is never copied on Linux
+     *
+     * @returns false if any fragment could not be sent
+     */
+    bool sendFragmentedData( QUdpSocket* socket, const EncodedFrame& frame, int fecGroup );
+
+private:
+    /** @brief Fills @ref mFragHeaders with the headers of all the fragments of a frame,
+     *         parity fragments included
+     */
+    void buildFragHeaders( const EncodedFrame& frame, int numFrag, int tailSize, int fecGroup, int totFrag );
+
+    /** @brief Fills @ref mParity with the XOR of each group of data fragments
+     */
+    void buildParity( const QByteArray& data, int numFrag, int tailSize, int fragDataSize, int fecGroup );
+
+    /** @brief Returns size and position of the payload of a fragment (data or parity)
+     */
+    int fragPayload( const QByteArray& data, int fragIdx, int numFrag, int tailSize, int fragDataSize, const char** payload );
+
+    /** @brief Waits between two bursts of fragments. No wait if a newer frame is queued
+     */
+    void pace( int burstCount );
+
+private:
+    QString mAddress;                       ///< Address of the destination
+    QHostAddress mHostAddress;
+    quint8 mVersion;                        ///< Header version negotiated with CMD_ADD_CLIENT
+    bool mMulticast;                        ///< The destination is the multicast group
+    quint8 mCameras;                        ///< Bitmask of the cameras sent to the destination
+
+    QWebcamPipelineStats* mStats;
+    QWebcamRateController* mRateCtrl;
+
+    int mSendPort;
+    int mMaxPacketSize;
+
+    QFrameQueue<EncodedFrame> mQueue;       ///< Frames waiting for this destination
+
+    QMutex mMutex;
+    int mFecGroup;                          ///< Data fragments for each parity fragment
+    QStringList mMembers;                   ///< Clients reached by the destination
+    WebcamClientStats mClientStats;         ///< Counters of the destination
+
+    // >>>>> Fragment buffers, reused frame after frame
+    QByteArray mFragHeaders;                ///< Headers of the fragments of the current frame
+    QByteArray mParity;                     ///< Parity fragments of the current frame
+#ifdef WEBCAM_USE_SENDMMSG
+    std::vector<struct iovec> mIov;         ///< [header, payload] for each fragment
+    std::vector<struct mmsghdr> mMsgs;      ///< One message for each fragment
+    struct sockaddr_in mAddr;               ///< Address of the destination
+#else
+    QByteArray mDatagram;                   ///< Datagram of the fragment being sent
+#endif
+    // <<<<< Fragment buffers, reused frame after frame
+};
+
+/** @brief Fan-out stage of the webcam pipeline: routes each encoded frame
+ *         to the queues of the destinations using its camera and its encoding.
+ *         The frames of all the cameras share the destination sockets.
+ *
+ * The stage never waits for the network, so the capture rate does not
+ * depend on the slowest client
+ */
+class QWebcamSender : public QThread
+{
+    Q_OBJECT
+public:
+    explicit QWebcamSender( QFrameQueue<EncodedFrame>* encodedQueue,
+                            QWebcamPipelineStats* stats,
+                            QWebcamRateController* rateCtrl,
+                            int sendPort,
+                            int maxPacketSize,
+                            QObject *parent = 0 );
+
+    void setClients( QList<WebcamClientInfo> clients );
+
+    /** @brief Sets the number of data fragments protected by a XOR parity
+     *         fragment. Used only with the v2 header, 0 disables FEC
+     */
+    void setFecGroupSize( int groupSize );
+
+    /** @brief Sets the multicast group used for the clients that joined it.
+     *         A null address disables the multicast stream
+     */
+    void setMulticastGroup( QHostAddress group );
+
+    /** @brief Returns the counters of each destination
+     */
+    QList<WebcamClientStats> getClientStats();
+
+    /** @brief Sends to a recorder the frames of its cameras and encoding.
+     *         NULL stops the recording: no frames are pushed after the return
+     *
+     * @param recorder writer of the recording, not owned
+     */
+    void setRecorder( QWebcamRecorder* recorder );
+
+protected:
+    void run();
+
+private:
+    /** @brief Starts a sender for each new destination and stops the senders
+     *         of the destinations no more used
+     */
+    void updateDestinations();
+
+    void stopDestination( QWebcamClientSender* sender );
+
+private:
+    QFrameQueue<EncodedFrame>* mEncodedQueue;
+    QWebcamPipelineStats* mStats;
+    QWebcamRateController* mRateCtrl;
+
+    int mSendPort;
+    int mMaxPacketSize;
+
+    QMutex mClientMutex;
+    QList<WebcamClientInfo> mClients;
+    int mFecGroup;                          ///< Data fragments for each parity fragment
+    QHostAddress mMulticastGroup;           ///< Group of the multicast stream, null if disabled
+
+    QMutex mDestMutex;                      ///< Protects the changes of @ref mDestinations
+    QHash<QString,QWebcamClientSender*> mDestinations; ///< Sender of each destination
+    QHash<QString,int> mDestEncodings;      ///< Encoding (stream, quality level and tiles) of each destination
+    QHash<QString,quint8> mDestCameras;     ///< Bitmask of the cameras sent to each destination
+
+    QMutex mRecorderMutex;                  ///< Protects @ref mRecorder while a frame is pushed
+    QWebcamRecorder* mRecorder;             ///< Writer of the recording, NULL if not recording
+};
+
+}
+
+#endif // QWEBCAMPIPELINE_H
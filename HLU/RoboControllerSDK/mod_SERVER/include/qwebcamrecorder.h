@@ -0,0 +1,142 @@
+#ifndef QWEBCAMRECORDER_H
+#define QWEBCAMRECORDER_H
+
+#include <QThread>
+#include <QString>
+#include <QStringList>
+#include <QFile>
+#include <QMutex>
+#include <QElapsedTimer>
+
+#include <vector>
+
+#include <qrecordingreader.h>
+#include "qwebcampipeline.h"
+
+#define RECORDER_QUEUE_SIZE             30          // Frames waiting for the disk, about a second of video
+#define RECORDER_DEFAULT_SEGMENT_BYTES  (64*1024*1024) // Size of a segment before switching to the next one
+#define RECORDER_MIN_SEGMENT_BYTES      (1024*1024)
+#define RECORDER_FLUSH_PERIOD_MSEC      1000        // Max time a frame waits in the buffers of the file: lost on power loss
+#define RECORDER_ENCODING               (WEBCAM_STREAM_FULL*WEBCAM_QUALITY_LEVELS) // Full resolution at the best level, not tiled: each frame decodes alone
+
+namespace roboctrl
+{
+
+/**
+  * @struct _RecorderStats
+  * @brief Counters of a webcam recording
+  */
+typedef struct _RecorderStats
+{
+    bool recording;             /**< The writer is running */
+    QString segment;            /**< Segment being written, empty between two segments */
+    quint32 segments;           /**< Segments created (since start) */
+    quint32 framesWritten;      /**< Frames written (since start) */
+    quint32 framesDropped;      /**< Frames dropped because the disk was late (since start) */
+    quint32 writeErrors;        /**< Frames not written because of an error of the file (since start) */
+    qint64 bytesWritten;        /**< Bytes written, headers and indexes included (since start) */
+} RecorderStats;
+
+/** @brief Writes the encoded frames of the webcam pipeline to disk, without
+ *         re-encoding them, as segments of an indexed container
+ *         (@ref QRecordingReader).
+ *
+ * The frames are queued by the fan-out stage and written by this thread:
+ * the queue drops the oldest frame when the disk is late, so the capture
+ * and the streaming never wait for the writes. A new segment starts when
+ * the current one would exceed its max size; with a max number of segments
+ * the oldest one is deleted, so the recording keeps the last minutes
+ */
+class QWebcamRecorder : public QThread
+{
+    Q_OBJECT
+public:
+    /**
+     * @param directory folder of the segments, created if missing
+     * @param cameras bitmask of the cameras recorded
+     * @param maxSegmentBytes max size of a segment
+     * @param maxSegments segments kept, the oldest ones are deleted. 0 keeps all of them
+     */
+    explicit QWebcamRecorder( QString directory,
+                              quint8 cameras,
+                              qint64 maxSegmentBytes=RECORDER_DEFAULT_SEGMENT_BYTES,
+                              int maxSegments=0,
+                              QObject *parent = 0 );
+    virtual ~QWebcamRecorder();
+
+    /** @brief Queues a frame for writing. Never waits: if the disk is late
+     *         the oldest frame in the queue is dropped
+     */
+    void pushFrame( const EncodedFrame& frame );
+
+    /** @brief Stops the thread after writing the frames queued and closing the segment
+     */
+    void stop();
+
+    QString getDirectory(){return mDirectory;}
+    quint8 getCameras(){return mCameras;}
+
+    /** @brief Returns the encoding recorded (stream*WEBCAM_QUALITY_LEVELS+level)
+     */
+    int getEncoding(){return RECORDER_ENCODING;}
+
+    RecorderStats getStats();
+
+protected:
+    void run();
+
+private:
+    /** @brief Starts a new segment, deleting the oldest ones over the max number
+     *
+     * @param frame first frame of the segment, gives the clock offset
+     */
+    bool openSegment( const EncodedFrame& frame );
+
+    /** @brief Writes index and trailer and closes the segment
+     */
+    void closeSegment();
+
+    /** @brief Appends a frame to the segment, opening a new one if it would exceed its size
+     */
+    bool writeFrame( const EncodedFrame& frame );
+
+    bool writeBlock( const char* data, qint64 size );
+
+private:
+    /** @brief Frame of the index of the current segment
+     */
+    typedef struct _IndexEntry
+    {
+        quint64 captureUsec;
+        quint64 offset;
+        quint32 frameIdx;
+        quint8 camera;
+        quint8 encoder;
+    } IndexEntry;
+
+    static bool entryBefore( const IndexEntry& a, const IndexEntry& b ){return a.captureUsec<b.captureUsec;}
+
+private:
+    QString mDirectory;                     ///< Folder of the segments
+    quint8 mCameras;                        ///< Bitmask of the cameras recorded
+    qint64 mMaxSegmentBytes;                ///< Max size of a segment
+    int mMaxSegments;                       ///< Segments kept, 0 for all
+
+    QFrameQueue<EncodedFrame> mQueue;       ///< Frames waiting for the disk
+
+    // >>>>> Current segment, used only by the writer thread
+    QFile mFile;
+    quint32 mSegmentIdx;                    ///< Index of the next segment
+    std::vector<IndexEntry> mIndex;         ///< Frames of the current segment
+    QStringList mSegmentFiles;              ///< Segments of this recording, oldest first
+    QElapsedTimer mFlushTimer;              ///< Time since the last flush
+    QString mSessionName;                   ///< Creation time of the recording, prefix of the segments
+    // <<<<< Current segment
+
+    QMutex mMutex;
+    RecorderStats mStats;                   ///< Counters of the recording
+};
+
+}
+
+#endif // QWEBCAMRECORDER_H
@@ -3,19 +3,36 @@
 
 #include <QThread>
 #include <QUdpSocket>
+#include <QHostAddress>
 #include <QString>
 #include <QStringList>
 #include <QTimerEvent>
 #include <QMutex>
+#include <QAtomicPointer>
+#include <QThreadPool>
+#include <QHash>
+#include <QElapsedTimer>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
+#include "qwebcampipeline.h"
+#include "qwebcamrecorder.h"
+#include "qwebcamgrabber.h"
+#include "qframepacer.h"
+#include "qvisionpreprocessor.h"
+#include "qvisualodometry.h"
+#include "qtriplebuffer.h"
+
 using namespace std;
 
 // ---> Server Command
 #define CMD_ADD_CLIENT      0
 #define CMD_REMOVE_CLIENT   1
+#define CMD_CLIENT_FEEDBACK 2   // Followed by [quint32 completed frames][quint32 lost frames] since the connection
+#define CMD_SELECT_STREAM   3   // Followed by [quint8 stream] (WEBCAM_STREAM_*)
+#define CMD_REQUEST_KEYFRAME 4  // The client lost the reference of the tiles (WEBCAM_ENC_JPEG_TILES)
+#define CMD_SELECT_CAMERAS  5   // Followed by [quint8 bitmask of the cameras] (v3 clients)
 
 #define MSG_CONN_REFUSED  tr("@R")
 #define MSG_CONN_ACCEPTED tr("@A")
@@ -35,25 +52,171 @@ public:
                             int maxClientCount=5,
                             QObject *parent = 0);
 
+    /** @brief Streams the frames of a generic capture source
+     *         (e.g. @ref QVideoFileSource or @ref QSyntheticSource)
+     *
+     * @param source capture source, owned by the server
+     */
+    explicit QWebcamServer( QCaptureSource* source,
+                            int sendPort=55554,
+                            int listenPort=55555,
+                            int udpPacketSize=4096,
+                            int maxClientCount=5,
+                            QObject *parent = 0);
+
+    /** @brief Streams more cameras (e.g. front and rear) on the same sockets.
+     *         Each source is a camera of the stream with its own frame ids,
+     *         the encoding threads are shared by all of them
+     *
+     * @param sources capture sources, owned by the server. The index in the
+     *        list is the camera id, at most @ref WEBCAM_MAX_CAMERAS
+     */
+    explicit QWebcamServer( QList<QCaptureSource*> sources,
+                            int sendPort=55554,
+                            int listenPort=55555,
+                            int udpPacketSize=4096,
+                            int maxClientCount=5,
+                            QObject *parent = 0);
+
     virtual ~QWebcamServer();
     
     void stop();
 
+    /** @brief Returns the number of cameras streamed
+     */
+    int getCameraCount(){return mSources.size();}
+
+    /** @brief Returns the last report of the timings of the
+     *         capture, encode and send stages
+     */
+    WebcamStageTimings getStageTimings(){return mStats.getLastReport();}
+
+    /** @brief Returns the counters of each destination of the stream:
+     *         frames sent and frames dropped because the client was late
+     */
+    QList<WebcamClientStats> getClientStats(){return mSender->getClientStats();}
+
+    /** @brief Sets the number of data fragments protected by a XOR parity
+     *         fragment for the clients using the v2 header (0 disables FEC)
+     */
+    void setFecGroupSize( int groupSize ){mSender->setFecGroupSize(groupSize);}
+
+    /** @brief Sets the JPEG options used for every quality level
+     *
+     * @param grayscale frames encoded without color
+     * @param chroma chroma subsampling of the color frames (JPEG_CHROMA_*),
+     *        available only with OpenCV 4.5.5 or newer
+     */
+    void setJpegOptions( bool grayscale, int chroma=JPEG_CHROMA_420 ){mRateCtrl.setEncoderOptions(grayscale,chroma);}
+
+    /** @brief Enables the conditional replenishment for static scenes: the clients
+     *         supporting it receive only the tiles changed since the last frame
+     *         and a keyframe every @ref TILE_KEYFRAME_INTERVAL frames
+     */
+    void setTileMode( bool enabled ){mRateCtrl.setTileMode(enabled);}
+
+    /** @brief Sets the frame rate of the capture stage (default @ref PACER_DEFAULT_FPS).
+     *         The sources faster than it are sampled, the slower ones are
+     *         taken when a new frame is available
+     */
+    void setTargetFps( double fps ){mPacer.setTargetFps(fps);}
+    double getTargetFps(){return mPacer.getTargetFps();}
+
+    /** @brief Stamps each frame with the wheel speeds last read from the board
+     *         (e.g. @ref QRobotServer::getTelemetry). The v4 clients receive
+     *         them in the header of the fragments
+     *
+     * @param telemetry shared robot state, not owned. NULL stops the stamping
+     */
+    void setTelemetrySource( QRobotTelemetry* telemetry );
+
+    /** @brief Enables the multicast stream: the clients able to join the group
+     *         receive the address with the reply to CMD_ADD_CLIENT and each
+     *         fragment is sent only once for all of them. The other clients
+     *         still receive unicast fragments
+     *
+     * @param group IPv4 multicast address, a null address disables multicast
+     */
+    void setMulticastGroup( QHostAddress group );
+
+    /** @brief Enables the vision preprocessing (@ref QVisionPreprocessor) of the
+     *         frames of a camera, run by the capture stage before the encoding
+     *
+     * @param camera camera processed, -1 disables the preprocessing
+     */
+    void setVisionCamera( int camera ){mVisionCamera.fetchAndStoreRelease(camera);}
+
+    /** @brief Copies the last frame preprocessed into a frame, reusing its images.
+     *         To be called always from the same thread
+     *
+     * @returns false if no frame has been preprocessed since the last call
+     */
+    bool getLastVisionFrame( VisionFrame& frame );
+
+    /** @brief Enables the visual odometry on the preprocessed camera
+     *         (@ref setVisionCamera): the motion measured on the floor is fused
+     *         with the wheel speeds of the telemetry and published to the
+     *         telemetry source, so that the control clients receive it
+     *         with @ref CMD_GET_ODOMETRY
+     */
+    void setVisualOdometry( bool enabled );
+
+    /** @brief Sets the position of the camera on the robot and the distance
+     *         between the wheels (m) used by the visual odometry
+     */
+    void setOdometryGeometry( const VisionCameraModel& camera, double wheelBaseM );
+
+    /** @brief Records the JPEG frames of the cameras to disk, as they are streamed
+     *         (@ref QWebcamRecorder). A recording already running is stopped
+     *
+     * @param directory folder of the segments, created if missing
+     * @param cameras bitmask of the cameras recorded
+     * @param maxSegmentBytes max size of a segment
+     * @param maxSegments segments kept, the oldest ones are deleted. 0 keeps all of them
+     * @returns false if the directory cannot be created
+     */
+    bool startRecording( QString directory, quint8 cameras=0x01,
+                         qint64 maxSegmentBytes=RECORDER_DEFAULT_SEGMENT_BYTES, int maxSegments=0 );
+
+    /** @brief Stops the recording after writing the frames queued and the index of the segment
+     */
+    void stopRecording();
+
+    bool isRecording(){return mRecorder!=NULL;}
+
+    /** @brief Returns the counters of the recording
+     */
+    RecorderStats getRecordingStats();
+
 signals:
     
 protected slots:
     void onReadyRead();
 
 protected:
-    void sendFragmentedData( QByteArray data, char fragID );
-    void run();
+    void run(); ///< Capture stage of the pipeline
+
+    /** @brief Sends the client list with the negotiated versions to the sending stage
+     */
+    void updateSenderClients();
+
+    /** @brief Runs the visual odometry on a preprocessed frame and publishes the motion
+     */
+    void updateOdometry( const VisionFrame& vision, const FrameTelemetry& telemetry );
+
+private:
+    /** @brief Opens the sockets and the capture sources and starts the server
+     */
+    void initServer( QList<QCaptureSource*> sources, int sendPort, int listenPort, int udpPacketSize, int maxClientCount );
 
 private:
     int mCamIdx;
     int mSendPort;
     int mListenPort;
 
-    cv::VideoCapture mCap;    
+    QList<QCaptureSource*> mSources;    ///< Source of the frames of each camera
+    QRobotTelemetry* mTelemetry;        ///< Robot state stamped on the frames, NULL if not available
+    QList<QWebcamGrabber*> mGrabbers;   ///< Keep only the newest frame of each source
 
     int mMaxPacketSize;
     int mMaxClientCount;
@@ -61,10 +224,41 @@ private:
     QUdpSocket *mUdpSocketSender;
     QUdpSocket *mUdpSocketReceiver;
 
+    QMutex mClientMutex;
     QStringList mClientIpList;
+    QHash<QString,quint8> mClientVersions; ///< Stream version of each client
+    QHash<QString,bool> mClientMulticast;  ///< The client receives the multicast stream
+    QHostAddress mMulticastGroup;           ///< Group of the multicast stream, null if disabled
+
+    QElapsedTimer mClock;   ///< Monotonic clock for the capture timestamps
 
     QMutex mStopMutex;
     bool mStopped;
+
+    // >>>>> Pipeline
+    QFrameQueue<RawFrame> mRawQueue;            ///< Frames from capture to encoders
+    QFrameQueue<EncodedFrame> mEncodedQueue;    ///< Frames from encoders to sender
+    QThreadPool mEncoderPool;                   ///< Threads of the encoding stage
+    int mEncoderCount;                          ///< Number of frames encoded in parallel
+    QWebcamSender* mSender;                     ///< Sending stage
+    QWebcamPipelineStats mStats;                ///< Timings of the stages
+    QWebcamRateController mRateCtrl;            ///< Quality level of each client
+    QWebcamTileEncoders mTileEncoders;          ///< References of the tile encodings
+    QFramePacer mPacer;                         ///< Deadlines of the capture stage
+    // <<<<< Pipeline
+
+    // >>>>> Vision
+    QAtomicInt mVisionCamera;                   ///< Camera preprocessed, -1 if disabled
+    QVisionPreprocessor mVision;                ///< Preprocessing of the capture stage
+    QTripleBuffer<VisionFrame> mVisionFrames;   ///< Newest frame preprocessed, from capture stage to consumer
+
+    QMutex mOdometryMutex;                      ///< Protects the odometry from the setters
+    bool mOdometryEnabled;                      ///< The visual odometry runs on the preprocessed frames
+    QVisualOdometry mOdometry;                  ///< Motion of the robot from camera and encoders
+    QAtomicPointer<QRobotTelemetry> mOdometrySink; ///< Telemetry receiving the motion, read by the capture stage
+    // <<<<< Vision
+
+    QWebcamRecorder* mRecorder;                 ///< Writer of the recording, NULL if not recording
 };
 
 }
@@ -0,0 +1,196 @@
+#include "qcapturesource.h"
+#include <QDebug>
+#include <QObject>
+#include <QThread>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+namespace roboctrl
+{
+
+/** @brief Waits for the time of the next frame of a source without a native clock.
+ *         If the caller is late the next frames are not sent in a burst
+ */
+static void waitFrameTime( QElapsedTimer& clock, qint64& nextUsec, qint64 periodUsec )
+{
+    qint64 nowUsec = clock.nsecsElapsed()/1000;
+
+    if( nextUsec > nowUsec )
+        QThread::usleep( nextUsec-nowUsec );
+    else
+        nextUsec = nowUsec;
+
+    nextUsec += periodUsec;
+}
+
+// >>>>> QCameraSource
+QCameraSource::QCameraSource( int camIdx/*=0*/, int width/*=640*/, int height/*=480*/ ) :
+    mCamIdx(camIdx),
+    mWidth(width),
+    mHeight(height)
+{
+}
+
+QCameraSource::~QCameraSource()
+{
+    close();
+}
+
+bool QCameraSource::open()
+{
+    if( !mCap.open( mCamIdx ) )
+        return false;
+
+    mCap.set( CV_CAP_PROP_FRAME_WIDTH, mWidth );
+    mCap.set( CV_CAP_PROP_FRAME_HEIGHT, mHeight );
+
+    return true;
+}
+
+void QCameraSource::close()
+{
+    mCap.release();
+}
+
+bool QCameraSource::grab()
+{
+    return mCap.grab();
+}
+
+bool QCameraSource::retrieve( cv::Mat& image )
+{
+    return mCap.retrieve( image );
+}
+
+QString QCameraSource::getDescription()
+{
+    return QObject::tr("Camera %1").arg(mCamIdx);
+}
+// <<<<< QCameraSource
+
+// >>>>> QVideoFileSource
+QVideoFileSource::QVideoFileSource( QString fileName, bool loop/*=true*/ ) :
+    mFileName(fileName),
+    mLoop(loop),
+    mPeriodUsec((qint64)(1000000/CAPTURE_DEFAULT_FPS)),
+    mNextUsec(0)
+{
+}
+
+QVideoFileSource::~QVideoFileSource()
+{
+    close();
+}
+
+bool QVideoFileSource::open()
+{
+    if( !mCap.open( mFileName.toStdString() ) )
+        return false;
+
+    double fps = mCap.get( CV_CAP_PROP_FPS );
+    if( fps<=0.0 || fps>240.0 ) // Not available for every container
+        fps = CAPTURE_DEFAULT_FPS;
+
+    mPeriodUsec = (qint64)(1000000/fps);
+    mNextUsec = 0;
+    mClock.start();
+
+    return true;
+}
+
+void QVideoFileSource::close()
+{
+    mCap.release();
+}
+
+bool QVideoFileSource::grab()
+{
+    // A file can be read faster than real time
+    waitFrameTime( mClock, mNextUsec, mPeriodUsec );
+
+    if( mCap.grab() )
+        return true;
+
+    if( !mLoop )
+        return false;
+
+    mCap.set( CV_CAP_PROP_POS_FRAMES, 0 );
+    return mCap.grab();
+}
+
+bool QVideoFileSource::retrieve( cv::Mat& image )
+{
+    return mCap.retrieve( image );
+}
+
+QString QVideoFileSource::getDescription()
+{
+    return QObject::tr("Video file %1").arg(mFileName);
+}
+// <<<<< QVideoFileSource
+
+// >>>>> QSyntheticSource
+QSyntheticSource::QSyntheticSource( int width/*=640*/, int height/*=480*/, double fps/*=CAPTURE_DEFAULT_FPS*/ ) :
+    mWidth(width),
+    mHeight(height),
+    mFps(fps),
+    mFrameIdx(0),
+    mNextUsec(0)
+{
+    if( mFps<=0.0 )
+        mFps = CAPTURE_DEFAULT_FPS;
+
+    mPeriodUsec = (qint64)(1000000/mFps);
+}
+
+bool QSyntheticSource::open()
+{
+    mFrameIdx = 0;
+    mNextUsec = 0;
+    mClock.start();
+
+    return true;
+}
+
+bool QSyntheticSource::grab()
+{
+    waitFrameTime( mClock, mNextUsec, mPeriodUsec );
+
+    mFrameIdx++;
+    return true;
+}
+
+bool QSyntheticSource::retrieve( cv::Mat& image )
+{
+    image.create( mHeight, mWidth, CV_8UC3 );
+
+    // Horizontal gradient scrolling with the frame index
+    for( int r=0; r<mHeight; r++ )
+    {
+        uchar* row = image.ptr<uchar>(r);
+        for( int c=0; c<mWidth; c++ )
+        {
+            uchar val = (uchar)((c+mFrameIdx*4)&0xFF);
+            row[3*c]   = val;
+            row[3*c+1] = (uchar)(r&0xFF);
+            row[3*c+2] = (uchar)(255-val);
+        }
+    }
+
+    // A bar crossing the frame shows the motion, the text the index of the frame
+    int barX = (mFrameIdx*8)%mWidth;
+    cv::rectangle( image, cv::Point(barX, 0), cv::Point(barX+mWidth/16, mHeight-1),
+                   cv::Scalar(255,255,255), CV_FILLED );
+    cv::putText( image, QString::number(mFrameIdx).toStdString(), cv::Point(20, mHeight/2),
+                 cv::FONT_HERSHEY_SIMPLEX, 2.0, cv::Scalar(0,0,0), 3 );
+
+    return true;
+}
+
+QString QSyntheticSource::getDescription()
+{
+    return QObject::tr("Synthetic %1x%2 @ %3 fps").arg(mWidth).arg(mHeight).arg(mFps, 0, 'f', 1);
+}
+// <<<<< QSyntheticSource
+
+}
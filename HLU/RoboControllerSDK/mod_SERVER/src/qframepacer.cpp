@@ -0,0 +1,93 @@
+#include "qframepacer.h"
+#include <QThread>
+
+#ifdef PACER_USE_NANOSLEEP
+#include <time.h>
+#include <errno.h>
+#endif
+
+namespace roboctrl
+{
+
+QFramePacer::QFramePacer( double fps/*=PACER_DEFAULT_FPS*/ ) :
+    mDeadlineNsec(0),
+    mLastLatenessMsec(0.0)
+{
+    setTargetFps( fps );
+
+#ifndef PACER_USE_NANOSLEEP
+    mClock.start();
+#endif
+}
+
+void QFramePacer::setTargetFps( double fps )
+{
+    if( fps<=0.0 )
+        fps = PACER_DEFAULT_FPS;
+
+    fps = qMin( fps, PACER_MAX_FPS );
+    mPeriodUsec.storeRelease( qRound( 1000000.0/fps ) );
+}
+
+qint64 QFramePacer::nowNsec()
+{
+#ifdef PACER_USE_NANOSLEEP
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return (qint64)now.tv_sec*1000000000LL + now.tv_nsec;
+#else
+    return mClock.nsecsElapsed();
+#endif
+}
+
+void QFramePacer::sleepUntil( qint64 deadlineNsec )
+{
+#ifdef PACER_USE_NANOSLEEP
+    struct timespec deadline;
+    deadline.tv_sec = (time_t)(deadlineNsec/1000000000LL);
+    deadline.tv_nsec = (long)(deadlineNsec%1000000000LL);
+
+    // Absolute time: a signal does not extend the sleep
+    while( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL )==EINTR )
+        ;
+#else
+    qint64 waitNsec = deadlineNsec-nowNsec();
+    if( waitNsec>0 )
+        QThread::usleep( (unsigned long)(waitNsec/1000) );
+#endif
+}
+
+void QFramePacer::start()
+{
+    mDeadlineNsec = nowNsec();
+    mLastLatenessMsec = 0.0;
+}
+
+int QFramePacer::waitNextFrame()
+{
+    qint64 periodNsec = (qint64)mPeriodUsec.loadAcquire()*1000;
+
+    mDeadlineNsec += periodNsec;
+
+    int skipped = 0;
+    qint64 now = nowNsec();
+    if( now < mDeadlineNsec )
+    {
+        sleepUntil( mDeadlineNsec );
+        now = nowNsec();
+    }
+    else if( now-mDeadlineNsec >= periodNsec )
+    {
+        // >>>>> Late by one period or more: back on the grid, at the last deadline missed
+        skipped = (int)((now-mDeadlineNsec)/periodNsec);
+        mDeadlineNsec += skipped*periodNsec;
+        // <<<<< Late by one period or more
+    }
+
+    mLastLatenessMsec = (now-mDeadlineNsec)/1000000.0;
+
+    return skipped;
+}
+
+}
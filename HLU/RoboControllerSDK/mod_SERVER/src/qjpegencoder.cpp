@@ -0,0 +1,120 @@
+#include "qjpegencoder.h"
+#include <QDebug>
+#include <QObject>
+
+#include <string.h>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+namespace roboctrl
+{
+
+QJpegEncoder::QJpegEncoder( int maxWidth/*=640*/, int maxHeight/*=480*/ ) :
+    mQuality(75),
+    mGrayscale(false),
+    mChroma(JPEG_CHROMA_420),
+    mPoolIdx(0),
+    mAllocCount(0),
+    mEncodedCount(0)
+{
+    mParams.reserve( 4 );
+    reserveOutput( maxWidth, maxHeight, 3 );
+}
+
+void QJpegEncoder::setQuality( int quality )
+{
+    mQuality = qBound( 0, quality, 100 );
+}
+
+void QJpegEncoder::reserveOutput( int width, int height, int channels )
+{
+    size_t worstCase = (size_t)width*height*channels + JPEG_HEADER_RESERVE;
+
+    if( mOutput.capacity() < worstCase )
+    {
+        mOutput.reserve( worstCase );
+        mAllocCount++;
+    }
+}
+
+QByteArray& QJpegEncoder::getPoolBuffer( int size )
+{
+    // A buffer is free when the encoder holds the only reference
+    for( int i=0; i<JPEG_POOL_SIZE; i++ )
+    {
+        QByteArray& buffer = mPool[(mPoolIdx+i)%JPEG_POOL_SIZE];
+
+        if( buffer.isDetached() && buffer.capacity()>=size )
+        {
+            mPoolIdx = (mPoolIdx+i+1)%JPEG_POOL_SIZE;
+            buffer.resize( size ); // Never shrinks the allocation
+            return buffer;
+        }
+    }
+
+    // All the buffers in use or too small: the oldest is replaced
+    QByteArray& buffer = mPool[mPoolIdx];
+    mPoolIdx = (mPoolIdx+1)%JPEG_POOL_SIZE;
+
+    buffer = QByteArray();
+    buffer.reserve( (int)mOutput.capacity() );
+    buffer.resize( size );
+    mAllocCount++;
+
+    return buffer;
+}
+
+bool QJpegEncoder::encode( const cv::Mat& image, QByteArray& jpeg, const QByteArray& prefix/*=QByteArray()*/ )
+{
+    if( image.empty() )
+        return false;
+
+    const cv::Mat* source = &image;
+    if( mGrayscale && image.channels()==3 )
+    {
+        const uchar* prevData = mGray.data;
+        cv::cvtColor( image, mGray, CV_BGR2GRAY );
+        if( mGray.data!=prevData )
+            mAllocCount++;
+
+        source = &mGray;
+    }
+
+    reserveOutput( source->cols, source->rows, source->channels() );
+
+    mParams.clear();
+    mParams.push_back( CV_IMWRITE_JPEG_QUALITY );
+    mParams.push_back( mQuality );
+#ifdef JPEG_HAS_SAMPLING_FACTOR
+    if( source->channels()==3 )
+    {
+        mParams.push_back( cv::IMWRITE_JPEG_SAMPLING_FACTOR );
+        if( mChroma==JPEG_CHROMA_444 )
+            mParams.push_back( cv::IMWRITE_JPEG_SAMPLING_FACTOR_444 );
+        else if( mChroma==JPEG_CHROMA_422 )
+            mParams.push_back( cv::IMWRITE_JPEG_SAMPLING_FACTOR_422 );
+        else
+            mParams.push_back( cv::IMWRITE_JPEG_SAMPLING_FACTOR_420 );
+    }
+#endif
+
+    size_t prevCapacity = mOutput.capacity();
+
+    if( !cv::imencode( ".jpg", *source, mOutput, mParams ) )
+        return false;
+
+    if( mOutput.capacity()!=prevCapacity )
+        mAllocCount++;
+
+    QByteArray& buffer = getPoolBuffer( prefix.size()+(int)mOutput.size() );
+    if( !prefix.isEmpty() )
+        memcpy( buffer.data(), prefix.constData(), prefix.size() );
+    memcpy( buffer.data()+prefix.size(), mOutput.data(), mOutput.size() );
+
+    jpeg = buffer; // Shared: the buffer returns free when the pipeline releases it
+    mEncodedCount++;
+
+    return true;
+}
+
+}
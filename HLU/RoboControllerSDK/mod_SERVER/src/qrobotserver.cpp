@@ -33,8 +33,15 @@ QRobotServer::QRobotServer(quint16 serverUdpControl/*=14560*/,
     mBoardConnected(false),
     mControllerClientIp(""),
     mMsgCounter(0),
-    mTestMode(testMode)
+    mTestMode(testMode),
+    mTrajTimerId(-1),
+    mTrajUnderrunCount(0),
+    mConfigHashValid(false),
+    mConfigHash(0),
+    mTelemetryTimerId(-1)
 {
+    resetControlLinkStats();
+
     // >>>>> Server Settings ini file
     QString iniPath = QCoreApplication::applicationDirPath();
     iniPath += tr("/%1.ini").arg(QCoreApplication::applicationName());
@@ -260,6 +267,8 @@ QRobotServer::QRobotServer(quint16 serverUdpControl/*=14560*/,
 
     mTcpClientCount = 0;
 
+    mTrajClock.start();
+
     // Start Server Thread
     this->start();
 
@@ -267,6 +276,9 @@ QRobotServer::QRobotServer(quint16 serverUdpControl/*=14560*/,
     {
         // Start Ping Timer
         mBoardTestTimerId = startTimer( TEST_TIMER_INTERVAL, Qt::PreciseTimer );
+
+        // Start Telemetry Timer
+        mTelemetryTimerId = startTimer( TELEMETRY_POLL_PERIOD_MSEC, Qt::PreciseTimer );
     }
 }
 
@@ -645,6 +657,54 @@ void QRobotServer::onTcpReadyRead()
             break;
         }
 
+        case CMD_GET_CONFIG_HASH:
+        {
+            qDebug() << tr("TCP Received msg #%1: CMD_GET_CONFIG_HASH (%2)").arg(msgIdx).arg(msgCode);
+
+            if( !mBoardConnected )
+            {
+                QVector<quint16> vec;
+                sendBlockTCP( MSG_RC_NOT_FOUND, vec );
+
+                qCritical() << Q_FUNC_INFO << "CMD_GET_CONFIG_HASH - Board not connected!";
+                break;
+            }
+
+            // The hash is evaluated reading the board only if the configuration
+            // changed since the last request
+            if( !mConfigHashValid )
+            {
+                quint16 regs[CONFIG_HASH_NREG];
+
+                bool commOk = readMultiReg( WORD_ROBOT_DIMENSION_WEIGHT, CONFIG_HASH_NREG );
+                if( commOk )
+                {
+                    memcpy( regs, mReplyBuffer, CONFIG_HASH_NREG*sizeof(quint16) );
+                    commOk = readMultiReg( WORD_STATUSBIT2, 1 );
+                }
+
+                if( !commOk )
+                {
+                    QVector<quint16> vec;
+                    vec << CMD_GET_CONFIG_HASH;
+                    vec << WORD_ROBOT_DIMENSION_WEIGHT;
+                    sendBlockTCP( MSG_FAILED, vec );
+                    break;
+                }
+
+                quint16 statusBits2 = mReplyBuffer[0] & (FLG_STATUSBI2_EEPROM_ENCODER_POSITION|FLG_EEPROM_OUTPUT_DRIVER_ENABLE_POLARITY);
+
+                mConfigHash = configHash( regs, statusBits2 );
+                mConfigHashValid = !mTestMode; // In test mode the board is not read
+            }
+
+            QVector<quint16> vec;
+            vec << mConfigHash;
+            sendBlockTCP( MSG_CONFIG_HASH, vec );
+
+            break;
+        }
+
         default:
         {
             qDebug() << tr("Received wrong message code(%1) with msg #%2").arg(msgCode).arg(msgIdx);
@@ -768,6 +828,19 @@ void QRobotServer::onUdpStatusReadyRead()
                 qDebug() << tr("UDP Status Received msg #%1: CMD_SERVER_PING_REQ (%2)").arg(msgIdx).arg(msgCode);
 
                 QVector<quint16> vec;
+
+                // Discovery requests carry a sequence number: the reply contains the
+                // info about the server. Old clients get the empty reply they expect.
+                if( mNextUdpStatBlockSize >= 3*sizeof(quint16) )
+                {
+                    quint16 seq;
+                    in >> seq;
+
+                    vec << mBoardIdx;
+                    vec << (quint16)SERVER_CAPABILITIES;
+                    vec << seq;
+                }
+
                 sendStatusBlockUDP( addr, MSG_SERVER_PING_OK, vec );
 
                 break;
@@ -878,6 +951,10 @@ void QRobotServer::onUdpStatusReadyRead()
 
                 if( mControllerClientIp.isEmpty() || mControllerClientIp==addr.toString() )
                 {
+                    // The client can be a new instance on the same IP that never released
+                    // the control: its sequence of setpoints starts again
+                    resetControlLinkStats();
+
                     mControllerClientIp = addr.toString();
                     QVector<quint16> vec;
                     sendStatusBlockUDP( addr, MSG_ROBOT_CTRL_OK, vec ); // Robot control taken
@@ -896,12 +973,32 @@ void QRobotServer::onUdpStatusReadyRead()
 
                 mControllerClientIp = "";
 
+                stopTrajectory();
+                resetControlLinkStats();
+
                 QVector<quint16> vec;
                 sendStatusBlockUDP( addr, MSG_ROBOT_CTRL_RELEASED, vec ); // Robot control released
 
                 break;
             }
 
+            case CMD_GET_ODOMETRY:
+            {
+                qDebug() << tr("UDP Status Received msg #%1: CMD_GET_ODOMETRY (%2)").arg(msgIdx).arg(msgCode);
+
+                if( !mBoardConnected )
+                {
+                    QVector<quint16> vec;
+                    sendStatusBlockUDP( addr, MSG_RC_NOT_FOUND, vec );
+
+                    qCritical() << Q_FUNC_INFO << "CMD_GET_ODOMETRY - Board not connected!";
+                    break;
+                }
+
+                sendOdometry( addr );
+                break;
+            }
+
             default:
             {
                 qDebug() << tr("Received unknown message code(%1) with msg #%2").arg(msgCode).arg(msgIdx);
@@ -1069,6 +1166,10 @@ void QRobotServer::onUdpControlReadyRead()
                     break;
                 }
 
+                // A direct setpoint overrides the trajectory being played
+                if( startAddr == WORD_PWM_CH1 || startAddr == WORD_PWM_CH2 )
+                    stopTrajectory();
+
                 bool commOk = writeMultiReg( startAddr, nReg, vals );
 
                 if( !commOk )
@@ -1081,6 +1182,165 @@ void QRobotServer::onUdpControlReadyRead()
                 break;
             }
 
+            case CMD_SET_SPEED_TRAJ:
+            {
+                qDebug() << tr("UDP Control Received msg #%1: CMD_SET_SPEED_TRAJ").arg(msgIdx);
+
+                if( !mBoardConnected )
+                {
+                    qCritical() << Q_FUNC_INFO << "CMD_SET_SPEED_TRAJ - Board not connected!";
+                    break;
+                }
+
+                if(addr.toString()!=mControllerClientIp) // The client has no control of the robot
+                {
+                    QVector<quint16> vec;
+                    sendStatusBlockUDP( addr, MSG_ROBOT_CTRL_KO, vec ); // Robot not controlled by client
+
+                    qDebug() << tr("The client %1 cannot send a trajectory without the control of the robot").arg(addr.toString());
+                    break;
+                }
+
+                quint16 nPoints;
+                in >> nPoints;
+
+                if( nPoints==0 || nPoints>TRAJ_MAX_POINTS )
+                {
+                    qDebug() << tr("Wrong trajectory size: %1 points").arg(nPoints);
+                    break;
+                }
+
+                // >>>>> Trajectory points on server clock
+                qint64 now = mTrajClock.elapsed();
+
+                QVector<TrajPoint> traj;
+                traj.reserve( nPoints );
+
+                for( int i=0; i<nPoints; i++ )
+                {
+                    quint16 timeOffset, sp0, sp1;
+                    in >> timeOffset;
+                    in >> sp0;
+                    in >> sp1;
+
+                    TrajPoint pt;
+                    pt.timeMsec = now + timeOffset;
+                    pt.speed0 = (qint16)sp0; // Speed is integer 2-complement!
+                    pt.speed1 = (qint16)sp1;
+
+                    if( !traj.isEmpty() && pt.timeMsec < traj.last().timeMsec ) // Points must be sorted by time
+                        pt.timeMsec = traj.last().timeMsec;
+
+                    traj << pt;
+                }
+                // <<<<< Trajectory points on server clock
+
+                if( in.status() != QDataStream::Ok )
+                {
+                    qDebug() << tr("Incomplete trajectory received with msg #%1").arg(msgIdx);
+                    break;
+                }
+
+                setSpeedTrajectory( traj );
+
+                readSpeedsAndSend( addr );
+
+                break;
+            }
+
+            case CMD_SET_SPEED_REDUNDANT:
+            {
+                qDebug() << tr("UDP Control Received msg #%1: CMD_SET_SPEED_REDUNDANT").arg(msgIdx);
+
+                if( !mBoardConnected )
+                {
+                    qCritical() << Q_FUNC_INFO << "CMD_SET_SPEED_REDUNDANT - Board not connected!";
+                    break;
+                }
+
+                if(addr.toString()!=mControllerClientIp) // The client has no control of the robot
+                {
+                    QVector<quint16> vec;
+                    sendStatusBlockUDP( addr, MSG_ROBOT_CTRL_KO, vec ); // Robot not controlled by client
+
+                    qDebug() << tr("The client %1 cannot send commands before taking control of the robot").arg(addr.toString());
+                    break;
+                }
+
+                quint16 seq;
+                quint16 nSetPoints;
+                in >> seq;
+                in >> nSetPoints;
+
+                if( nSetPoints==0 || nSetPoints>CTRL_MAX_REDUNDANCY+1 )
+                {
+                    qDebug() << tr("Wrong number of redundant setpoints: %1").arg(nSetPoints);
+                    break;
+                }
+
+                // Only the newest setpoint is applied, the others are needed only
+                // to know if the setpoints of the lost datagrams have been received
+                quint16 sp0, sp1;
+                in >> sp0;
+                in >> sp1;
+
+                if( in.status() != QDataStream::Ok )
+                {
+                    qDebug() << tr("Incomplete redundant setpoint received with msg #%1").arg(msgIdx);
+                    break;
+                }
+
+                mCtrlRecvCount++;
+
+                // >>>>> Sequence check
+                qint16 seqDiff = (qint16)(seq - mLastCtrlSeq); // Handles wrap around
+                if( mCtrlSeqValid && seqDiff < -CTRL_SEQ_RESTART_GAP )
+                {
+                    qDebug() << tr("Setpoint #%1 far older than #%2: sequence restarted by the client").arg(seq).arg(mLastCtrlSeq);
+                    mCtrlSeqValid = false;
+                }
+
+                if( mCtrlSeqValid && seqDiff<=0 )
+                {
+                    mCtrlStaleCount++;
+                    qDebug() << tr("Ignored stale setpoint #%1 (newest: #%2)").arg(seq).arg(mLastCtrlSeq);
+                    break;
+                }
+
+                if( mCtrlSeqValid && seqDiff>1 )
+                {
+                    quint32 lost = seqDiff-1;
+                    quint32 recovered = qMin( lost, (quint32)(nSetPoints-1) );
+
+                    mCtrlLostCount += lost;
+                    mCtrlRecoveredCount += recovered;
+
+                    qDebug() << tr("Lost %1 control datagrams before #%2 (%3 recovered)").arg(lost).arg(seq).arg(recovered);
+                }
+
+                mLastCtrlSeq = seq;
+                mCtrlSeqValid = true;
+                // <<<<< Sequence check
+
+                // A direct setpoint overrides the trajectory being played
+                stopTrajectory();
+
+                QVector<quint16> vals;
+                vals << sp0 << sp1;
+
+                if( !writeMultiReg( WORD_PWM_CH1, 2, vals ) )
+                {
+                    qDebug() << tr("Error writing redundant setpoint #%1").arg(seq);
+                }
+
+                readSpeedsAndSend( addr );
+
+                if( (mCtrlRecvCount % CTRL_STATS_REPORT_PERIOD) == 0 )
+                    sendControlLinkStats( addr );
+
+                break;
+            }
+
             default:
             {
                 qDebug() << tr("UDP Control Received wrong message code(%1) with msg #%2").arg(msgCode).arg(msgIdx);
@@ -1162,6 +1422,201 @@ void QRobotServer::readSpeedsAndSend( QHostAddress addr )
         sendStatusBlockUDP( addr, MSG_READ_REPLY, readRegReply );
 }
 
+void QRobotServer::publishTelemetry( quint16 startAddr, quint16 nReg )
+{
+    if( startAddr > WORD_ENC1_SPEED || startAddr+nReg <= WORD_ENC2_SPEED )
+        return;
+
+    // Speeds in mm/sec, 2-complement
+    mTelemetry.publishSpeeds( (qint16)mReplyBuffer[WORD_ENC1_SPEED-startAddr],
+                              (qint16)mReplyBuffer[WORD_ENC2_SPEED-startAddr] );
+}
+
+void QRobotServer::pollTelemetry()
+{
+    if( !mBoardConnected || !mTelemetry.hasConsumers() )
+        return;
+
+    // The clients moving the robot already read the speeds after each command
+    qint64 ageMsec = mTelemetry.getSampleAgeMsec();
+    if( ageMsec>=0 && ageMsec < TELEMETRY_POLL_PERIOD_MSEC )
+        return;
+
+    readMultiReg( WORD_ENC1_SPEED, 2 );
+}
+
+void QRobotServer::setSpeedTrajectory( QVector<TrajPoint>& traj )
+{
+    if( traj.isEmpty() )
+        return;
+
+    qint64 now = mTrajClock.elapsed();
+
+    QVector<TrajPoint> newTraj;
+    newTraj.reserve( traj.size()+1 );
+
+    // >>>>> Joining the new trajectory to the setpoint currently played
+    if( mTrajTimerId!=-1 && traj.first().timeMsec > now )
+    {
+        TrajPoint cur;
+        cur.timeMsec = now;
+        trajectorySetPoint( now, cur.speed0, cur.speed1 );
+
+        newTraj << cur;
+    }
+    // <<<<< Joining the new trajectory to the setpoint currently played
+
+    newTraj << traj;
+    mTrajectory = newTraj; // The tail not yet played is discarded
+
+    if( mTrajTimerId==-1 )
+        mTrajTimerId = startTimer( TRAJ_PLAYBACK_PERIOD_MSEC, Qt::PreciseTimer );
+
+    playTrajectory();
+}
+
+void QRobotServer::trajectorySetPoint( qint64 timeMsec, qint16& speed0, qint16& speed1 )
+{
+    const TrajPoint& first = mTrajectory.first();
+    const TrajPoint& last = mTrajectory.last();
+
+    if( timeMsec <= first.timeMsec )
+    {
+        speed0 = first.speed0;
+        speed1 = first.speed1;
+        return;
+    }
+
+    if( timeMsec >= last.timeMsec )
+    {
+        speed0 = last.speed0;
+        speed1 = last.speed1;
+        return;
+    }
+
+    int i = 0;
+    while( mTrajectory[i+1].timeMsec <= timeMsec )
+        i++;
+
+    const TrajPoint& p0 = mTrajectory[i];
+    const TrajPoint& p1 = mTrajectory[i+1];
+
+    double alpha = (double)(timeMsec-p0.timeMsec)/(double)(p1.timeMsec-p0.timeMsec);
+
+    speed0 = (qint16)qRound( p0.speed0 + alpha*(p1.speed0-p0.speed0) );
+    speed1 = (qint16)qRound( p0.speed1 + alpha*(p1.speed1-p0.speed1) );
+}
+
+void QRobotServer::playTrajectory()
+{
+    if( mTrajectory.isEmpty() )
+    {
+        stopTrajectory();
+        return;
+    }
+
+    qint64 now = mTrajClock.elapsed();
+
+    qint16 speed0, speed1;
+    trajectorySetPoint( now, speed0, speed1 );
+
+    QVector<quint16> vals;
+    vals << (quint16)speed0;
+    vals << (quint16)speed1;
+
+    if( !writeMultiReg( WORD_PWM_CH1, 2, vals ) )
+        qDebug() << tr("Error writing trajectory setpoint (%1,%2)").arg(speed0).arg(speed1);
+
+    if( now >= mTrajectory.last().timeMsec ) // The last point has been played
+    {
+        mTrajUnderrunCount++;
+
+        qWarning() << tr("Speed trajectory underrun #%1").arg(mTrajUnderrunCount);
+
+        stopTrajectory();
+
+        if( !mControllerClientIp.isEmpty() )
+        {
+            QVector<quint16> vec;
+            vec << mTrajUnderrunCount;
+            sendStatusBlockUDP( QHostAddress(mControllerClientIp), MSG_TRAJ_UNDERRUN, vec );
+        }
+    }
+}
+
+void QRobotServer::stopTrajectory()
+{
+    if( mTrajTimerId!=-1 )
+    {
+        killTimer( mTrajTimerId );
+        mTrajTimerId = -1;
+    }
+
+    mTrajectory.clear();
+}
+
+void QRobotServer::resetControlLinkStats()
+{
+    mCtrlSeqValid = false;
+    mLastCtrlSeq = 0;
+    mCtrlRecvCount = 0;
+    mCtrlLostCount = 0;
+    mCtrlRecoveredCount = 0;
+    mCtrlStaleCount = 0;
+}
+
+void QRobotServer::sendControlLinkStats( QHostAddress addr )
+{
+    QVector<quint16> vec;
+    vec << (quint16)(mCtrlRecvCount>>16) << (quint16)(mCtrlRecvCount&0xFFFF);
+    vec << (quint16)(mCtrlLostCount>>16) << (quint16)(mCtrlLostCount&0xFFFF);
+    vec << (quint16)(mCtrlRecoveredCount>>16) << (quint16)(mCtrlRecoveredCount&0xFFFF);
+    vec << (quint16)(mCtrlStaleCount>>16) << (quint16)(mCtrlStaleCount&0xFFFF);
+
+    sendStatusBlockUDP( addr, MSG_CTRL_LINK_STATS, vec );
+}
+
+/** @brief Speed in thousandths as 2-complement word, saturated
+ */
+static quint16 odometryWord( double value )
+{
+    return (quint16)(qint16)qBound( -32768, qRound( value*1000.0 ), 32767 );
+}
+
+void QRobotServer::sendOdometry( QHostAddress addr )
+{
+    // The speeds are read now, the motion is the one estimated on the last frame
+    if( !readMultiReg( WORD_ENC1_SPEED, 2 ) )
+    {
+        QVector<quint16> vec;
+        vec << CMD_GET_ODOMETRY;
+        vec << WORD_ENC1_SPEED;
+        sendStatusBlockUDP( addr, MSG_FAILED, vec );
+        return;
+    }
+
+    RobotOdometry odometry = mTelemetry.getOdometry();
+
+    quint16 flags = 0;
+    if( odometry.valid )
+        flags |= ODOM_FLAG_VALID;
+    if( odometry.visionValid )
+        flags |= ODOM_FLAG_VISION;
+    if( odometry.slipping )
+        flags |= ODOM_FLAG_SLIP;
+
+    QVector<quint16> vec;
+    vec << mReplyBuffer[0] << mReplyBuffer[1];
+    vec << flags;
+    vec << odometryWord( odometry.linearSpeed ) << odometryWord( odometry.angularSpeed );
+    vec << odometryWord( odometry.visionLinearSpeed ) << odometryWord( odometry.visionAngularSpeed );
+    vec << odometry.inliers;
+    vec << (quint16)qBound( 0, qRound( odometry.processMsec*1000.0 ), 65535 );
+    vec << odometry.ageMsec;
+
+    sendStatusBlockUDP( addr, MSG_ODOMETRY, vec );
+}
+
 bool QRobotServer::readMultiReg( quint16 startAddr, quint16 nReg )
 {
     if(mTestMode)
@@ -1188,6 +1643,9 @@ bool QRobotServer::readMultiReg( quint16 startAddr, quint16 nReg )
             mBoardMutex.unlock();
             return false;
         }
+
+        // Still under the mutex: the reply buffer is shared
+        publishTelemetry( startAddr, nReg );
     }
     mBoardMutex.unlock();
     return true;
@@ -1199,6 +1657,12 @@ bool QRobotServer::writeMultiReg( quint16 startAddr, quint16 nReg,
     if(mTestMode)
         return true;
 
+    // >>>>> Configuration hash invalidation
+    if( ( startAddr < WORD_ROBOT_DIMENSION_WEIGHT+CONFIG_HASH_NREG && startAddr+nReg > WORD_ROBOT_DIMENSION_WEIGHT ) ||
+            ( startAddr <= WORD_STATUSBIT2 && startAddr+nReg > WORD_STATUSBIT2 ) )
+        mConfigHashValid = false;
+    // <<<<< Configuration hash invalidation
+
     mBoardMutex.lock();
     {
         int res = modbus_write_registers( mModbus, startAddr, nReg, vals.data() );
@@ -1280,12 +1744,21 @@ bool QRobotServer::connectModbus( int retryCount/*=-1*/)
     }
 
     mBoardConnected = true;
+    mConfigHashValid = false; // The board could have been replaced
     return true;
 }
 
 void QRobotServer::timerEvent(QTimerEvent *event)
 {
-    if( event->timerId() == mBoardTestTimerId )
+    if( event->timerId() == mTrajTimerId )
+    {
+        playTrajectory();
+    }
+    else if( event->timerId() == mTelemetryTimerId )
+    {
+        pollTelemetry();
+    }
+    else if( event->timerId() == mBoardTestTimerId )
     {
         if(mTestMode)
         {
@@ -1296,6 +1769,7 @@ void QRobotServer::timerEvent(QTimerEvent *event)
         if( !testBoardConnection() )
         {
             mBoardConnected = false;
+            mTelemetry.invalidate();
 
             qCritical() << tr("Robocontroller %1 not replying. Trying reconnection...").arg(mBoardIdx);
             connectModbus( -1 );
@@ -0,0 +1,199 @@
+#include "qtileencoder.h"
+#include <QtEndian>
+
+#ifdef TILE_SAD_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef TILE_SAD_NEON
+#include <arm_neon.h>
+#endif
+
+namespace roboctrl
+{
+
+QTileEncoder::QTileEncoder( int tileSize/*=TILE_DEFAULT_SIZE*/, int keyframeInterval/*=TILE_KEYFRAME_INTERVAL*/ ) :
+    mTileSize(qMax(16,tileSize)),
+    mKeyframeInterval(qMax(1,keyframeInterval)),
+    mKeyframeRequested(false),
+    mReferenceValid(false),
+    mReferenceId(0),
+    mFramesSinceKeyframe(0),
+    mCols(0),
+    mRows(0),
+    mChangedTiles(0)
+{
+}
+
+quint32 QTileEncoder::blockSad( const uchar* a, size_t strideA, const uchar* b, size_t strideB,
+                                int rowBytes, int rows, quint32 limit )
+{
+    quint32 sum = 0;
+
+    for( int y=0; y<rows; y++ )
+    {
+        const uchar* pa = a + y*strideA;
+        const uchar* pb = b + y*strideB;
+        int x = 0;
+
+#if defined(TILE_SAD_SSE2)
+        // 16 bytes for each instruction, two partial sums on 64 bit
+        __m128i acc = _mm_setzero_si128();
+        for( ; x+16<=rowBytes; x+=16 )
+        {
+            __m128i va = _mm_loadu_si128( (const __m128i*)(pa+x) );
+            __m128i vb = _mm_loadu_si128( (const __m128i*)(pb+x) );
+            acc = _mm_add_epi64( acc, _mm_sad_epu8( va, vb ) );
+        }
+        sum += (quint32)_mm_cvtsi128_si32( acc ) + (quint32)_mm_cvtsi128_si32( _mm_srli_si128( acc, 8 ) );
+#elif defined(TILE_SAD_NEON)
+        // 16 bytes for each iteration accumulated on 16 bit lanes,
+        // reduced every 64 iterations before they can overflow
+        while( x+16<=rowBytes )
+        {
+            uint16x8_t acc = vdupq_n_u16( 0 );
+            for( int i=0; i<64 && x+16<=rowBytes; i++, x+=16 )
+            {
+                uint8x16_t va = vld1q_u8( pa+x );
+                uint8x16_t vb = vld1q_u8( pb+x );
+                acc = vabal_u8( acc, vget_low_u8( va ), vget_low_u8( vb ) );
+                acc = vabal_u8( acc, vget_high_u8( va ), vget_high_u8( vb ) );
+            }
+            uint64x2_t acc64 = vpaddlq_u32( vpaddlq_u16( acc ) );
+            sum += (quint32)(vgetq_lane_u64( acc64, 0 ) + vgetq_lane_u64( acc64, 1 ));
+        }
+#endif
+        // Tail, or the whole row without SIMD
+        for( ; x<rowBytes; x++ )
+            sum += (pa[x]>pb[x])?(pa[x]-pb[x]):(pb[x]-pa[x]);
+
+        if( sum > limit )
+            break; // The tile already changed: the other rows are useless
+    }
+
+    return sum;
+}
+
+cv::Rect QTileEncoder::tileRect( int tileIdx )
+{
+    int x = (tileIdx%mCols)*mTileSize;
+    int y = (tileIdx/mCols)*mTileSize;
+
+    return cv::Rect( x, y,
+                     qMin( mTileSize, mReference.cols-x ),
+                     qMin( mTileSize, mReference.rows-y ) );
+}
+
+int QTileEncoder::encodeKeyframe( const cv::Mat& image, quint32 frameId, QJpegEncoder& jpeg,
+                                  QByteArray& data, const QByteArray& keyframeJpeg )
+{
+    if( !keyframeJpeg.isEmpty() )
+        data = keyframeJpeg; // Already encoded for the clients without tiles
+    else if( !jpeg.encode( image, data ) )
+        return 0;
+
+    image.copyTo( mReference ); // No allocation while the size does not change
+
+    mReferenceValid = true;
+    mReferenceId = frameId;
+    mFramesSinceKeyframe = 0;
+    mKeyframeRequested = false;
+    mChangedTiles = mCols*mRows;
+
+    return WEBCAM_ENC_JPEG;
+}
+
+int QTileEncoder::encode( const cv::Mat& image, quint32 frameId, QJpegEncoder& jpeg,
+                          QByteArray& data, const QByteArray& keyframeJpeg/*=QByteArray()*/ )
+{
+    if( image.empty() )
+        return 0;
+
+    mCols = (image.cols+mTileSize-1)/mTileSize;
+    mRows = (image.rows+mTileSize-1)/mTileSize;
+    int tileCount = mCols*mRows;
+
+    // >>>>> Keyframe decision
+    bool keyframe = mKeyframeRequested || !mReferenceValid ||
+            mReference.size()!=image.size() || mReference.type()!=image.type() ||
+            mFramesSinceKeyframe+1 >= mKeyframeInterval ||
+            tileCount > 0xFFFF;
+
+    if( keyframe )
+        return encodeKeyframe( image, frameId, jpeg, data, keyframeJpeg );
+    // <<<<< Keyframe decision
+
+    // >>>>> Changed tiles
+    int channels = image.channels();
+
+    mChanged.clear();
+    for( int t=0; t<tileCount; t++ )
+    {
+        cv::Rect r = tileRect( t );
+
+        int rowBytes = r.width*channels;
+        quint32 limit = (quint32)(TILE_SAD_PER_BYTE*rowBytes*r.height);
+
+        quint32 sad = blockSad( image.ptr(r.y)+r.x*channels, image.step,
+                                mReference.ptr(r.y)+r.x*channels, mReference.step,
+                                rowBytes, r.height, limit );
+
+        if( sad > limit )
+            mChanged.push_back( (quint16)t );
+    }
+
+    int changed = (int)mChanged.size();
+    if( changed > TILE_MAX_CHANGED*tileCount )
+        return encodeKeyframe( image, frameId, jpeg, data, keyframeJpeg );
+    // <<<<< Changed tiles
+
+    // >>>>> Tile list
+    mHeader.resize( WEBCAM_TILES_HEADER_SIZE + 2*changed );
+    uchar* hdr = (uchar*)mHeader.data();
+    qToBigEndian<quint32>( mReferenceId, hdr );
+    qToBigEndian<quint16>( (quint16)mTileSize, hdr+4 );
+    qToBigEndian<quint16>( (quint16)changed, hdr+6 );
+    for( int i=0; i<changed; i++ )
+        qToBigEndian<quint16>( mChanged[i], hdr+WEBCAM_TILES_HEADER_SIZE+2*i );
+    // <<<<< Tile list
+
+    if( changed==0 )
+        data = QByteArray( mHeader.constData(), mHeader.size() ); // Only keeps the chain of the references
+    else
+    {
+        // >>>>> Mosaic of the changed tiles, a row of the frame wide
+        int mosaicCols = qMin( changed, mCols );
+        int mosaicRows = (changed+mosaicCols-1)/mosaicCols;
+
+        // Allocated once for the worst case, the changed tiles use a part of it
+        mMosaic.create( mRows*mTileSize, mCols*mTileSize, image.type() );
+        cv::Mat mosaic = mMosaic( cv::Rect( 0, 0, mosaicCols*mTileSize, mosaicRows*mTileSize ) );
+
+        for( int i=0; i<changed; i++ )
+        {
+            cv::Rect r = tileRect( mChanged[i] );
+            cv::Mat cell = mosaic( cv::Rect( (i%mosaicCols)*mTileSize, (i/mosaicCols)*mTileSize,
+                                             mTileSize, mTileSize ) );
+
+            if( r.width<mTileSize || r.height<mTileSize )
+                cell.setTo( cv::Scalar::all(0) ); // Border tile: flat padding costs nothing to the JPEG
+
+            image( r ).copyTo( cell( cv::Rect( 0, 0, r.width, r.height ) ) );
+            image( r ).copyTo( mReference( r ) );
+        }
+        // <<<<< Mosaic of the changed tiles
+
+        if( !jpeg.encode( mosaic, data, mHeader ) )
+        {
+            mKeyframeRequested = true; // The reference already contains the tiles not sent
+            return 0;
+        }
+    }
+
+    mReferenceId = frameId;
+    mFramesSinceKeyframe++;
+    mChangedTiles = changed;
+
+    return WEBCAM_ENC_JPEG_TILES;
+}
+
+}
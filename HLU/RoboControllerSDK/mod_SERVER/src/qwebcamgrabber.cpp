@@ -0,0 +1,106 @@
+#include "qwebcamgrabber.h"
+#include <QDebug>
+
+namespace roboctrl
+{
+
+QWebcamGrabber::QWebcamGrabber( QCaptureSource* source,
+                                const QElapsedTimer& clock,
+                                QWebcamPipelineStats* stats,
+                                QObject *parent/*=0*/ ) :
+    QThread(parent),
+    mSource(source),
+    mClock(clock),
+    mStats(stats),
+    mTelemetry(NULL),
+    mStopped(0),
+    mGrabbedCount(0),
+    mOverwrittenCount(0)
+{
+}
+
+void QWebcamGrabber::stop()
+{
+    mStopped.storeRelease(1);
+}
+
+bool QWebcamGrabber::takeLatest( RawFrame& frame, unsigned long timeoutMsec )
+{
+    if( !mBuffer.acquire() )
+    {
+        mWaitMutex.lock();
+        {
+            // Checked again with the mutex locked to not miss the wake up
+            if( !mBuffer.acquire() )
+            {
+                mFrameReady.wait( &mWaitMutex, timeoutMsec );
+
+                if( !mBuffer.acquire() )
+                {
+                    mWaitMutex.unlock();
+                    return false;
+                }
+            }
+        }
+        mWaitMutex.unlock();
+    }
+
+    // The image is moved, not shared: the grabber will decode the next
+    // frames in a new buffer while this one is in the pipeline
+    RawFrame& latest = mBuffer.front();
+    frame = latest;
+    latest.image = cv::Mat();
+
+    return true;
+}
+
+void QWebcamGrabber::run()
+{
+    qDebug() << tr("Webcam Grabber Thread started - Source: %1").arg(mSource->getDescription());
+
+    quint32 grabIdx = 0;
+    int failCount = 0;
+
+    while( !mStopped.loadAcquire() )
+    {
+        if( !mSource->grab() )
+        {
+            if( failCount++ == 0 )
+                qDebug() << tr("Webcam Grabber: cannot grab from %1").arg(mSource->getDescription());
+
+            msleep( WEBCAM_GRAB_RETRY_MSEC );
+            continue;
+        }
+        failCount = 0;
+
+        // The frame is available when grab returns
+        RawFrame& frame = mBuffer.back();
+        frame.captureTime.start();
+        frame.captureUsec = mClock.nsecsElapsed()/1000;
+
+        QRobotTelemetry* telemetry = mTelemetry.loadAcquire();
+        if( telemetry )
+            telemetry->stamp( frame.telemetry );
+        else
+            frame.telemetry.valid = false;
+
+        if( !mSource->retrieve( frame.image ) || frame.image.empty() )
+            continue;
+
+        mStats->addCaptureTime( frame.captureTime.nsecsElapsed()/1000000.0 );
+        frame.frameIdx = ++grabIdx;
+
+        if( mBuffer.publish() )
+            mOverwrittenCount.ref();
+        mGrabbedCount.ref();
+
+        mWaitMutex.lock();
+        mFrameReady.wakeAll();
+        mWaitMutex.unlock();
+    }
+
+    qDebug() << tr("Webcam Grabber Thread finished - Grabbed: %1 - Overwritten: %2")
+                .arg(getGrabbedCount()).arg(getOverwrittenCount());
+}
+
+}
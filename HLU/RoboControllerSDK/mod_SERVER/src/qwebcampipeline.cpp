@@ -0,0 +1,1251 @@
+#include "qwebcampipeline.h"
+#include "qwebcamrecorder.h"
+#include <vector>
+#include <QDebug>
+#include <QDataStream>
+#include <QHostAddress>
+#include <QtEndian>
+
+#include <errno.h>
+#include <string.h>
+
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace std;
+
+namespace roboctrl
+{
+
+// >>>>> QWebcamRateController
+static const WebcamQualityLevel qualityLadder[WEBCAM_QUALITY_LEVELS] =
+{
+    // JPEG quality, scale, frame divider
+    { 75, 1.0, 1 },
+    { 60, 1.0, 1 },
+    { 45, 1.0, 1 },
+    { 60, 0.5, 1 },
+    { 45, 0.5, 2 },
+    { 30, 0.5, 3 }
+};
+
+QWebcamRateController::QWebcamRateController() :
+    mGrayscale(false),
+    mChroma(JPEG_CHROMA_420),
+    mTileMode(false),
+    mRecordCameras(0),
+    mRecordEncoding(0)
+{
+}
+
+void QWebcamRateController::setTileMode( bool enabled )
+{
+    QMutexLocker locker( &mMutex );
+    mTileMode = enabled;
+}
+
+bool QWebcamRateController::getTileMode()
+{
+    QMutexLocker locker( &mMutex );
+    return mTileMode;
+}
+
+void QWebcamRateController::setEncoderOptions( bool grayscale, int chroma )
+{
+    QMutexLocker locker( &mMutex );
+    mGrayscale = grayscale;
+    mChroma = chroma;
+}
+
+void QWebcamRateController::setRecording( quint8 cameras, int encoding )
+{
+    QMutexLocker locker( &mMutex );
+    mRecordCameras = cameras;
+    mRecordEncoding = encoding;
+}
+
+void QWebcamRateController::getEncoderOptions( bool& grayscale, int& chroma )
+{
+    QMutexLocker locker( &mMutex );
+    grayscale = mGrayscale;
+    chroma = mChroma;
+}
+
+const WebcamQualityLevel& QWebcamRateController::getQualityLevel( int level )
+{
+    return qualityLadder[qBound(0,level,WEBCAM_QUALITY_LEVELS-1)];
+}
+
+void QWebcamRateController::addClient( const QString& ip, int stream/*=WEBCAM_STREAM_FULL*/, bool tiles/*=false*/ )
+{
+    QMutexLocker locker( &mMutex );
+
+    if( mClients.contains( ip ) )
+        return;
+
+    WebcamClientRate rate;
+    rate.level = 0;
+    rate.stream = qBound( 0, stream, WEBCAM_STREAMS-1 );
+    rate.tiles = tiles;
+    rate.cameras = 0x01;
+    rate.feedbackValid = false;
+    rate.lastCompleted = 0;
+    rate.lastLost = 0;
+    rate.sentSinceFeedback = 0;
+    rate.loss = 0.0;
+    rate.goodReports = 0;
+
+    mClients[ip] = rate;
+}
+
+void QWebcamRateController::removeClient( const QString& ip )
+{
+    QMutexLocker locker( &mMutex );
+    mClients.remove( ip );
+}
+
+void QWebcamRateController::frameSent( const QString& ip )
+{
+    QMutexLocker locker( &mMutex );
+
+    if( mClients.contains( ip ) )
+        mClients[ip].sentSinceFeedback++;
+}
+
+void QWebcamRateController::onFeedback( const QString& ip, quint32 completed, quint32 lost )
+{
+    QMutexLocker locker( &mMutex );
+
+    if( !mClients.contains( ip ) )
+        return;
+
+    WebcamClientRate& rate = mClients[ip];
+
+    quint32 sent = rate.sentSinceFeedback;
+    rate.sentSinceFeedback = 0;
+
+    if( !rate.feedbackValid || completed<rate.lastCompleted || lost<rate.lastLost ) // First report or client restarted
+    {
+        rate.feedbackValid = true;
+        rate.lastCompleted = completed;
+        rate.lastLost = lost;
+        return;
+    }
+
+    quint32 dCompleted = completed-rate.lastCompleted;
+    quint32 dLost = lost-rate.lastLost;
+    rate.lastCompleted = completed;
+    rate.lastLost = lost;
+
+    // >>>>> Frame loss in the last period
+    double loss = 0.0;
+    if( dCompleted+dLost > 0 )
+        loss = (double)dLost/(dCompleted+dLost);
+
+    // No fragment reaches the client: it cannot count its lost frames
+    if( dCompleted==0 && sent>=WEBCAM_BLACKOUT_MIN_SENT )
+        loss = 1.0;
+
+    rate.loss = 0.5*rate.loss + 0.5*loss;
+    // <<<<< Frame loss in the last period
+
+    // >>>>> Level decision
+    int oldLevel = rate.level;
+
+    if( rate.loss > WEBCAM_LOSS_HIGH )
+    {
+        rate.goodReports = 0;
+        if( rate.level < WEBCAM_QUALITY_LEVELS-1 )
+            rate.level++;
+    }
+    else if( rate.loss < WEBCAM_LOSS_LOW )
+    {
+        rate.goodReports++;
+        if( rate.goodReports>=WEBCAM_UPGRADE_REPORTS && rate.level>0 )
+        {
+            rate.level--;
+            rate.goodReports = 0;
+        }
+    }
+    else
+        rate.goodReports = 0;
+
+    if( rate.level!=oldLevel )
+    {
+        const WebcamQualityLevel& q = getQualityLevel( rate.level );
+
+        qDebug() << QObject::tr("Webcam client %1: level %2 -> %3 (JPEG %4, scale %5, 1/%6 frames) - Loss: %7% (avg %8%) - Completed: %9 - Lost: %10 - Sent: %11")
+                    .arg(ip).arg(oldLevel).arg(rate.level)
+                    .arg(q.jpegQuality).arg(q.scale).arg(q.frameDivider)
+                    .arg(loss*100.0, 0, 'f', 1).arg(rate.loss*100.0, 0, 'f', 1)
+                    .arg(dCompleted).arg(dLost).arg(sent);
+    }
+    // <<<<< Level decision
+}
+
+int QWebcamRateController::getLevel( const QString& ip )
+{
+    QMutexLocker locker( &mMutex );
+    return mClients.value( ip ).level;
+}
+
+void QWebcamRateController::setStream( const QString& ip, int stream )
+{
+    QMutexLocker locker( &mMutex );
+
+    if( mClients.contains( ip ) )
+        mClients[ip].stream = qBound( 0, stream, WEBCAM_STREAMS-1 );
+}
+
+int QWebcamRateController::getStream( const QString& ip )
+{
+    QMutexLocker locker( &mMutex );
+    return mClients.value( ip ).stream;
+}
+
+void QWebcamRateController::setCameras( const QString& ip, quint8 cameras )
+{
+    QMutexLocker locker( &mMutex );
+
+    if( mClients.contains( ip ) )
+        mClients[ip].cameras = cameras & ((1<<WEBCAM_MAX_CAMERAS)-1);
+}
+
+quint8 QWebcamRateController::getCameras( const QString& ip )
+{
+    QMutexLocker locker( &mMutex );
+    return mClients.value( ip ).cameras;
+}
+
+int QWebcamRateController::getEncoding( const QString& ip )
+{
+    QMutexLocker locker( &mMutex );
+
+    if( !mClients.contains( ip ) )
+        return WEBCAM_STREAM_FULL*WEBCAM_QUALITY_LEVELS;
+
+    const WebcamClientRate& rate = mClients[ip];
+    int encoding = rate.stream*WEBCAM_QUALITY_LEVELS + rate.level;
+    if( mTileMode && rate.tiles )
+        encoding += WEBCAM_ENCODING_TILES;
+
+    return encoding;
+}
+
+void QWebcamRateController::setGroupMembers( const QStringList& members )
+{
+    QMutexLocker locker( &mMutex );
+    mGroupMembers = members;
+}
+
+int QWebcamRateController::getGroupEncoding()
+{
+    QMutexLocker locker( &mMutex );
+    return groupEncoding();
+}
+
+int QWebcamRateController::groupEncoding()
+{
+    int level = 0;
+    int stream = WEBCAM_STREAM_PREVIEW;
+    bool tiles = mTileMode;
+    bool empty = true;
+    foreach( const QString& ip, mGroupMembers )
+    {
+        if( !mClients.contains( ip ) )
+            continue;
+
+        const WebcamClientRate& rate = mClients[ip];
+        level = qMax( level, rate.level );
+        stream = qMax( stream, rate.stream );
+        tiles = tiles && rate.tiles;
+        empty = false;
+    }
+
+    int encoding = stream*WEBCAM_QUALITY_LEVELS + level;
+    if( tiles && !empty )
+        encoding += WEBCAM_ENCODING_TILES;
+
+    return encoding;
+}
+
+quint32 QWebcamRateController::getActiveEncodings( int camera )
+{
+    QMutexLocker locker( &mMutex );
+
+    bool subscribed = false;
+    quint32 encodings = 0;
+    foreach( const WebcamClientRate& rate, mClients )
+    {
+        if( !(rate.cameras & (1<<camera)) )
+            continue;
+        subscribed = true;
+
+        int encoding = rate.stream*WEBCAM_QUALITY_LEVELS + rate.level;
+        if( mTileMode && rate.tiles )
+            encoding += WEBCAM_ENCODING_TILES;
+
+        encodings |= (1<<encoding);
+    }
+
+    // Ready for the clients switching to the preview
+    quint32 previewMask = (1<<WEBCAM_QUALITY_LEVELS)-1;
+    bool previewActive = (encodings & (previewMask | (previewMask<<WEBCAM_ENCODING_TILES)))!=0;
+    if( subscribed && !previewActive )
+        encodings |= (1<<(WEBCAM_STREAM_PREVIEW*WEBCAM_QUALITY_LEVELS));
+
+    // The group receives its own combination of stream and level, which no member may use
+    bool groupSubscribed = false;
+    foreach( const QString& ip, mGroupMembers )
+    {
+        if( mClients.value( ip ).cameras & (1<<camera) )
+            groupSubscribed = true;
+    }
+    if( groupSubscribed )
+        encodings |= (1<<groupEncoding());
+
+    // The recorded cameras are encoded also without clients
+    if( mRecordCameras & (1<<camera) )
+        encodings |= (1<<mRecordEncoding);
+
+    return encodings;
+}
+// <<<<< QWebcamRateController
+
+// >>>>> QWebcamTileEncoders
+QTileEncoder* QWebcamTileEncoders::lock( int camera, int encoding )
+{
+    int idx = encoding%WEBCAM_ENCODING_TILES;
+
+    mMutex[camera][idx].lock();
+    return &mEncoders[camera][idx];
+}
+
+void QWebcamTileEncoders::unlock( int camera, int encoding )
+{
+    mMutex[camera][encoding%WEBCAM_ENCODING_TILES].unlock();
+}
+
+void QWebcamTileEncoders::requestKeyframe()
+{
+    for( int c=0; c<WEBCAM_MAX_CAMERAS; c++ )
+    {
+        for( int i=0; i<WEBCAM_ENCODING_TILES; i++ )
+        {
+            QMutexLocker locker( &mMutex[c][i] );
+            mEncoders[c][i].requestKeyframe();
+        }
+    }
+}
+// <<<<< QWebcamTileEncoders
+
+// >>>>> QWebcamPipelineStats
+QWebcamPipelineStats::QWebcamPipelineStats()
+{
+    memset( &mLastReport, 0, sizeof(WebcamStageTimings) );
+    resetAccumulators();
+    mPeriod.start();
+}
+
+void QWebcamPipelineStats::resetAccumulators()
+{
+    mCaptureSum = 0.0;
+    mCaptureCount = 0;
+    mEncodeSum = 0.0;
+    mEncodeCount = 0;
+    mSendSum = 0.0;
+    mLatencySum = 0.0;
+    mSendCount = 0;
+    mDatagramSum = 0;
+    mSendCallSum = 0;
+    mTilesSentSum = 0;
+    mTileSum = 0;
+    mPaceLateSum = 0.0;
+    mPaceLateMax = 0.0;
+    mPaceCount = 0;
+}
+
+void QWebcamPipelineStats::addCaptureTime( double msec )
+{
+    QMutexLocker locker( &mMutex );
+    mCaptureSum += msec;
+    mCaptureCount++;
+}
+
+void QWebcamPipelineStats::addEncodeTime( double msec )
+{
+    QMutexLocker locker( &mMutex );
+    mEncodeSum += msec;
+    mEncodeCount++;
+}
+
+void QWebcamPipelineStats::addSendTime( double sendMsec, double latencyMsec )
+{
+    QMutexLocker locker( &mMutex );
+    mSendSum += sendMsec;
+    mLatencySum += latencyMsec;
+    mSendCount++;
+}
+
+void QWebcamPipelineStats::addSendCalls( int datagrams, int calls )
+{
+    QMutexLocker locker( &mMutex );
+    mDatagramSum += datagrams;
+    mSendCallSum += calls;
+}
+
+void QWebcamPipelineStats::addRawDrops( int count )
+{
+    QMutexLocker locker( &mMutex );
+    mLastReport.rawDropped += count;
+}
+
+void QWebcamPipelineStats::addEncodedDrops( int count )
+{
+    QMutexLocker locker( &mMutex );
+    mLastReport.encodedDropped += count;
+}
+
+void QWebcamPipelineStats::addLateDrop()
+{
+    QMutexLocker locker( &mMutex );
+    mLastReport.lateDropped++;
+}
+
+void QWebcamPipelineStats::addEncoderAllocs( int count )
+{
+    QMutexLocker locker( &mMutex );
+    mLastReport.encoderAllocs += count;
+}
+
+void QWebcamPipelineStats::addTileFrame( int changedTiles, int tileCount, bool keyframe )
+{
+    QMutexLocker locker( &mMutex );
+    mTilesSentSum += changedTiles;
+    mTileSum += tileCount;
+    if( keyframe )
+        mLastReport.keyframes++;
+}
+
+void QWebcamPipelineStats::addPacing( double latenessMsec, int skipped )
+{
+    QMutexLocker locker( &mMutex );
+    mPaceLateSum += latenessMsec;
+    mPaceLateMax = qMax( mPaceLateMax, latenessMsec );
+    mPaceCount++;
+    mLastReport.pacingSkipped += skipped;
+}
+
+bool QWebcamPipelineStats::report( WebcamStageTimings& timings )
+{
+    QMutexLocker locker( &mMutex );
+
+    qint64 elapsed = mPeriod.elapsed();
+    if( elapsed < WEBCAM_STATS_PERIOD_MSEC )
+        return false;
+
+    mLastReport.fps = 1000.0*mSendCount/elapsed;
+    mLastReport.captureMsec = mCaptureCount>0?mCaptureSum/mCaptureCount:0.0;
+    mLastReport.encodeMsec = mEncodeCount>0?mEncodeSum/mEncodeCount:0.0;
+    mLastReport.sendMsec = mSendCount>0?mSendSum/mSendCount:0.0;
+    mLastReport.latencyMsec = mSendCount>0?mLatencySum/mSendCount:0.0;
+    mLastReport.datagramsPerFrame = mSendCount>0?(double)mDatagramSum/mSendCount:0.0;
+    mLastReport.sendCallsPerFrame = mSendCount>0?(double)mSendCallSum/mSendCount:0.0;
+    mLastReport.tilesSent = mTileSum>0?(double)mTilesSentSum/mTileSum:0.0;
+    mLastReport.pacedFps = 1000.0*mPaceCount/elapsed;
+    mLastReport.jitterMsec = mPaceCount>0?mPaceLateSum/mPaceCount:0.0;
+    mLastReport.maxJitterMsec = mPaceLateMax;
+
+    resetAccumulators();
+    mPeriod.restart();
+
+    timings = mLastReport;
+    return true;
+}
+
+WebcamStageTimings QWebcamPipelineStats::getLastReport()
+{
+    QMutexLocker locker( &mMutex );
+    return mLastReport;
+}
+// <<<<< QWebcamPipelineStats
+
+// >>>>> QWebcamEncodeWorker
+QWebcamEncodeWorker::QWebcamEncodeWorker( QFrameQueue<RawFrame>* rawQueue,
+                                          QFrameQueue<EncodedFrame>* encodedQueue,
+                                          QWebcamPipelineStats* stats,
+                                          QWebcamRateController* rateCtrl,
+                                          QWebcamTileEncoders* tileEncoders ) :
+    mRawQueue(rawQueue),
+    mEncodedQueue(encodedQueue),
+    mStats(stats),
+    mRateCtrl(rateCtrl),
+    mTileEncoders(tileEncoders)
+{
+    setAutoDelete( true );
+}
+
+void QWebcamEncodeWorker::queueFrame( const EncodedFrame& frame )
+{
+    int dropped = mEncodedQueue->push( frame );
+    if( dropped>0 )
+        mStats->addEncodedDrops( dropped );
+}
+
+void QWebcamEncodeWorker::encodeTiles( const cv::Mat& image, EncodedFrame& frame, QJpegEncoder& encoder, const QByteArray& keyframeJpeg )
+{
+    QTileEncoder* tiles = mTileEncoders->lock( frame.camera, frame.encoding );
+
+    // A newer frame already encoded by another thread is the reference of the next one
+    if( tiles->hasReference() && (qint32)(frame.frameIdx-tiles->getReferenceId()) <= 0 )
+    {
+        mTileEncoders->unlock( frame.camera, frame.encoding );
+        mStats->addLateDrop();
+        return;
+    }
+
+    int encoding = tiles->encode( image, frame.frameIdx, encoder, frame.data, keyframeJpeg );
+    if( encoding!=0 )
+    {
+        frame.encoder = (quint8)encoding;
+        queueFrame( frame ); // Still locked: the frames of the encoding are queued in order
+
+        mStats->addTileFrame( tiles->getChangedTiles(), tiles->getTileCount(), encoding==WEBCAM_ENC_JPEG );
+    }
+
+    mTileEncoders->unlock( frame.camera, frame.encoding );
+}
+
+void QWebcamEncodeWorker::run()
+{
+    QJpegEncoder encoder;
+    cv::Mat scaled;
+
+    while( !mRawQueue->isClosed() )
+    {
+        RawFrame raw;
+        if( !mRawQueue->pop( raw, WEBCAM_POP_TIMEOUT_MSEC ) )
+            continue;
+
+        QElapsedTimer chrono;
+        chrono.start();
+
+        quint32 encodings = mRateCtrl->getActiveEncodings( raw.camera );
+        if( encodings==0 )
+            continue; // The clients of the camera left after the capture
+
+        bool grayscale;
+        int chroma;
+        mRateCtrl->getEncoderOptions( grayscale, chroma );
+        encoder.setGrayscale( grayscale );
+        encoder.setChromaSubsampling( chroma );
+
+        quint32 allocCount = encoder.getAllocationCount();
+
+        double scaledFactor = 0.0; // Scale of the image in "scaled"
+
+        // The frame is encoded once for each stream and level in use,
+        // as a whole and as changed tiles
+        for( int e=0; e<WEBCAM_ENCODING_TILES; e++ )
+        {
+            bool whole = (encodings & (1<<e))!=0;
+            bool tiled = (encodings & (1<<(e+WEBCAM_ENCODING_TILES)))!=0;
+            if( !whole && !tiled )
+                continue;
+
+            int stream = e/WEBCAM_QUALITY_LEVELS;
+            const WebcamQualityLevel& q = QWebcamRateController::getQualityLevel( e%WEBCAM_QUALITY_LEVELS );
+
+            double scale = q.scale;
+            if( stream==WEBCAM_STREAM_PREVIEW )
+                scale *= WEBCAM_PREVIEW_SCALE;
+
+            if( raw.frameIdx % q.frameDivider != 0 )
+                continue; // Frame rate reduction
+
+            cv::Mat image = raw.image;
+            if( scale!=1.0 )
+            {
+                if( scaledFactor!=scale )
+                {
+                    cv::resize( raw.image, scaled, cv::Size(), scale, scale, cv::INTER_AREA );
+                    scaledFactor = scale;
+                }
+                image = scaled;
+            }
+
+            encoder.setQuality( q.jpegQuality );
+
+            EncodedFrame encoded;
+            encoded.camera = raw.camera;
+            encoded.frameIdx = raw.frameIdx;
+            encoded.captureTime = raw.captureTime;
+            encoded.captureUsec = raw.captureUsec;
+            encoded.telemetry = raw.telemetry;
+            encoded.encoder = WEBCAM_ENC_JPEG;
+            encoded.width = (quint16)image.cols;
+            encoded.height = (quint16)image.rows;
+            encoded.encoding = (quint8)e;
+
+            // JPG Compression in memory, directly from the captured image
+            QByteArray wholeJpeg;
+            if( whole && encoder.encode( image, encoded.data ) )
+            {
+                wholeJpeg = encoded.data; // Reused by the keyframes of the tiles
+                queueFrame( encoded );
+            }
+
+            if( tiled )
+            {
+                encoded.encoding = (quint8)(e+WEBCAM_ENCODING_TILES);
+                encodeTiles( image, encoded, encoder, wholeJpeg );
+            }
+        }
+
+        mStats->addEncodeTime( chrono.nsecsElapsed()/1000000.0 );
+
+        if( encoder.getAllocationCount()!=allocCount )
+            mStats->addEncoderAllocs( encoder.getAllocationCount()-allocCount );
+    }
+}
+// <<<<< QWebcamEncodeWorker
+
+// >>>>> QWebcamClientSender
+static int fragHeaderSize( quint8 version )
+{
+    if( version>=WEBCAM_PROTO_V4 )
+        return WEBCAM_FRAG_HEADER_SIZE_V4;
+    if( version>=WEBCAM_PROTO_V3 )
+        return WEBCAM_FRAG_HEADER_SIZE_V3;
+    if( version>=WEBCAM_PROTO_V2 )
+        return WEBCAM_FRAG_HEADER_SIZE_V2;
+    return WEBCAM_FRAG_HEADER_SIZE;
+}
+
+static int cameraCount( quint8 cameras )
+{
+    int count = 0;
+    for( int c=0; c<WEBCAM_MAX_CAMERAS; c++ )
+        if( cameras & (1<<c) )
+            count++;
+
+    return count;
+}
+
+QWebcamClientSender::QWebcamClientSender( QString address, quint8 version, bool multicast, quint8 cameras,
+                                          QWebcamPipelineStats* stats,
+                                          QWebcamRateController* rateCtrl,
+                                          int sendPort, int maxPacketSize,
+                                          QObject *parent/*=0*/ ) :
+    QThread(parent),
+    mAddress(address),
+    mHostAddress(address),
+    mVersion(version),
+    mMulticast(multicast),
+    mCameras(cameras),
+    mStats(stats),
+    mRateCtrl(rateCtrl),
+    mSendPort(sendPort),
+    mMaxPacketSize(maxPacketSize),
+    mQueue(WEBCAM_CLIENT_QUEUE_SIZE*qMax(1,cameraCount(cameras))),
+    mFecGroup(WEBCAM_FEC_DEFAULT_GROUP)
+{
+    mClientStats.address = address;
+    mClientStats.multicast = multicast;
+    mClientStats.framesSent = 0;
+    mClientStats.framesDropped = 0;
+    mClientStats.framesStale = 0;
+    mClientStats.sendErrors = 0;
+    mClientStats.queueMsec = 0.0;
+    mClientStats.sendMsec = 0.0;
+}
+
+void QWebcamClientSender::pushFrame( const EncodedFrame& frame )
+{
+    // The encoded data is shared by all the queues: no copy
+    int dropped = mQueue.push( frame );
+
+    if( dropped>0 )
+    {
+        QMutexLocker locker( &mMutex );
+        mClientStats.framesDropped += dropped;
+    }
+}
+
+void QWebcamClientSender::stop()
+{
+    mQueue.close();
+}
+
+void QWebcamClientSender::setFecGroupSize( int groupSize )
+{
+    QMutexLocker locker( &mMutex );
+    mFecGroup = groupSize;
+}
+
+void QWebcamClientSender::setMembers( QStringList members )
+{
+    QMutexLocker locker( &mMutex );
+    mMembers = members;
+}
+
+WebcamClientStats QWebcamClientSender::getStats()
+{
+    QMutexLocker locker( &mMutex );
+    return mClientStats;
+}
+
+void QWebcamClientSender::buildFragHeaders( const EncodedFrame& frame, int numFrag, int tailSize, int fecGroup, int totFrag )
+{
+    int headerSize = fragHeaderSize( mVersion );
+
+    // Same layout written by QDataStream::Qt_4_0: big endian
+    mFragHeaders.resize( totFrag*headerSize );
+    uchar* hdr = (uchar*)mFragHeaders.data();
+
+    if( mVersion>=WEBCAM_PROTO_V2 )
+    {
+        quint32 serverDelayUsec = (quint32)(frame.captureTime.nsecsElapsed()/1000);
+
+        for( int i=0; i<totFrag; i++ )
+        {
+            hdr[0] = WEBCAM_V2_MARKER;
+            hdr[1] = mVersion;
+            hdr[2] = frame.encoder;
+            hdr[3] = (uchar)fecGroup;
+            qToBigEndian<quint32>( frame.frameIdx, hdr+4 );
+            qToBigEndian<quint64>( frame.captureUsec, hdr+8 );
+            qToBigEndian<quint32>( serverDelayUsec, hdr+16 );
+            qToBigEndian<quint16>( frame.width, hdr+20 );
+            qToBigEndian<quint16>( frame.height, hdr+22 );
+            qToBigEndian<quint16>( (quint16)mMaxPacketSize, hdr+24 );
+            qToBigEndian<quint16>( (quint16)numFrag, hdr+26 );
+            qToBigEndian<quint16>( (quint16)tailSize, hdr+28 );
+            qToBigEndian<quint16>( (quint16)i, hdr+30 );
+            if( mVersion>=WEBCAM_PROTO_V3 )
+                hdr[32] = frame.camera;
+            if( mVersion>=WEBCAM_PROTO_V4 )
+            {
+                const FrameTelemetry& telemetry = frame.telemetry;
+                hdr[33] = telemetry.valid?WEBCAM_TELEMETRY_VALID:0;
+                qToBigEndian<qint16>( telemetry.speed0, hdr+34 );
+                qToBigEndian<qint16>( telemetry.speed1, hdr+36 );
+                qToBigEndian<quint32>( telemetry.boardTimeMsec, hdr+38 );
+                qToBigEndian<quint32>( telemetry.ageUsec, hdr+42 );
+            }
+
+            hdr += headerSize;
+        }
+    }
+    else
+    {
+        uchar fragID = (uchar)(frame.frameIdx%255);
+
+        for( int i=0; i<numFrag; i++ )
+        {
+            hdr[0] = fragID;
+            qToBigEndian<quint16>( (quint16)mMaxPacketSize, hdr+1 );
+            qToBigEndian<quint16>( (quint16)numFrag, hdr+3 );
+            qToBigEndian<quint16>( (quint16)tailSize, hdr+5 );
+            qToBigEndian<quint16>( (quint16)i, hdr+7 );
+
+            hdr += headerSize;
+        }
+    }
+}
+
+void QWebcamClientSender::buildParity( const QByteArray& data, int numFrag, int tailSize, int fragDataSize, int fecGroup )
+{
+    int numParity = (numFrag+fecGroup-1)/fecGroup;
+
+    // The tail is XORed as if it were padded with zeros
+    mParity.fill( 0, numParity*fragDataSize );
+
+    for( int i=0; i<numFrag; i++ )
+    {
+        int size = (i==numFrag-1 && tailSize>0)?tailSize:fragDataSize;
+
+        const uchar* src = (const uchar*)data.constData() + i*fragDataSize;
+        uchar* dst = (uchar*)mParity.data() + (i/fecGroup)*fragDataSize;
+
+        for( int b=0; b<size; b++ )
+            dst[b] ^= src[b];
+    }
+}
+
+int QWebcamClientSender::fragPayload( const QByteArray& data, int fragIdx, int numFrag, int tailSize, int fragDataSize, const char** payload )
+{
+    if( fragIdx<numFrag )
+    {
+        *payload = data.constData() + fragIdx*fragDataSize;
+        return (fragIdx==numFrag-1 && tailSize>0)?tailSize:fragDataSize;
+    }
+
+    // Parity fragment
+    *payload = mParity.constData() + (fragIdx-numFrag)*fragDataSize;
+    return fragDataSize;
+}
+
+void QWebcamClientSender::pace( int burstCount )
+{
+    if( burstCount<2 || mQueue.size()>0 )
+        return;
+
+    usleep( (WEBCAM_PACING_SPREAD_MSEC*1000)/burstCount );
+}
+
+bool QWebcamClientSender::sendFragmentedData( QUdpSocket* socket, const EncodedFrame& frame, int fecGroup )
+{
+    int headerSize = fragHeaderSize( mVersion );
+    int fragDataSize = mMaxPacketSize - headerSize; // Data size in the packet
+
+    const QByteArray& data = frame.data;
+    int dataSize = data.size();
+
+    int tailSize = dataSize%fragDataSize; // last packet data size
+    int numFrag = dataSize/fragDataSize; // packet count
+
+    if(tailSize > 0) // if there is a not complete tail we must send a packet not full
+        numFrag++;
+
+    if( numFrag==0 )
+        return true;
+
+    // >>>>> Forward error correction: a parity fragment for each group of data fragments
+    if( mVersion<WEBCAM_PROTO_V2 )
+        fecGroup = 0; // The v1 header cannot describe the parity fragments
+
+    int numParity = 0;
+    if( fecGroup>0 )
+    {
+        numParity = (numFrag+fecGroup-1)/fecGroup;
+        buildParity( data, numFrag, tailSize, fragDataSize, fecGroup );
+    }
+    int totFrag = numFrag+numParity;
+    // <<<<< Forward error correction
+
+    buildFragHeaders( frame, numFrag, tailSize, fecGroup, totFrag );
+
+    int burstCount = (totFrag+WEBCAM_PACING_BURST-1)/WEBCAM_PACING_BURST;
+    int callCount = 0;
+    int missed = 0;
+
+#ifdef WEBCAM_USE_SENDMMSG
+    // >>>>> Scatter/gather views: no payload copy
+    mIov.resize( 2*totFrag );
+    mMsgs.resize( totFrag );
+    memset( mMsgs.data(), 0, totFrag*sizeof(struct mmsghdr) );
+    for( int i=0; i<totFrag; i++ )
+    {
+        const char* payload;
+        int size = fragPayload( data, i, numFrag, tailSize, fragDataSize, &payload );
+
+        mIov[2*i].iov_base = mFragHeaders.data() + i*headerSize;
+        mIov[2*i].iov_len = headerSize;
+        mIov[2*i+1].iov_base = (void*)payload;
+        mIov[2*i+1].iov_len = size;
+
+        struct msghdr& msg = mMsgs[i].msg_hdr;
+        msg.msg_name = &mAddr;
+        msg.msg_namelen = sizeof(struct sockaddr_in);
+        msg.msg_iov = &mIov[2*i];
+        msg.msg_iovlen = 2;
+    }
+    // <<<<< Scatter/gather views: no payload copy
+
+    int fd = (int)socket->socketDescriptor();
+    int sentCount = 0;
+    bool retried = false;
+    while( sentCount < totFrag )
+    {
+        int burst = qMin( WEBCAM_PACING_BURST, totFrag-sentCount );
+        int res = ::sendmmsg( fd, &mMsgs[sentCount], burst, 0 );
+        callCount++;
+
+        if( res < 0 )
+        {
+            if( errno==EINTR )
+                continue;
+
+            // Socket buffer full: a short wait, then the frame is given up
+            if( (errno==EAGAIN || errno==EWOULDBLOCK || errno==ENOBUFS) && !retried )
+            {
+                struct pollfd pfd;
+                pfd.fd = fd;
+                pfd.events = POLLOUT;
+                pfd.revents = 0;
+                ::poll( &pfd, 1, WEBCAM_SEND_RETRY_MSEC );
+
+                retried = true;
+                continue;
+            }
+
+            missed = totFrag-sentCount;
+            qDebug() << tr("Frame #%1: Missed %2/%3 fragments to %4 - Error: %5")
+                        .arg(frame.frameIdx).arg(missed).arg(totFrag).arg(mAddress).arg(strerror(errno));
+            break;
+        }
+
+        sentCount += res;
+        retried = false;
+
+        if( sentCount < totFrag && res==burst )
+            pace( burstCount );
+    }
+#else
+    mDatagram.resize( mMaxPacketSize );
+
+    for( int i=0; i<totFrag; i++ )
+    {
+        const char* payload;
+        int size = fragPayload( data, i, numFrag, tailSize, fragDataSize, &payload );
+
+        memcpy( mDatagram.data(), mFragHeaders.constData()+i*headerSize, headerSize );
+        memcpy( mDatagram.data()+headerSize, payload, size );
+
+        callCount++;
+        if( -1==socket->writeDatagram( mDatagram.constData(), headerSize+size, mHostAddress, mSendPort ) )
+        {
+            missed++;
+            qDebug() << tr("Frame #%3: Missed fragment %1/%2 to Client %4")
+                        .arg(i).arg(totFrag).arg(frame.frameIdx).arg(mAddress);
+        }
+
+        if( (i+1)%WEBCAM_PACING_BURST==0 && i<totFrag-1 )
+            pace( burstCount );
+    }
+#endif
+
+    mStats->addSendCalls( totFrag-missed, callCount );
+
+    return missed==0;
+}
+
+void QWebcamClientSender::run()
+{
+    qDebug() << tr("Webcam Sender Thread started for %1").arg(mAddress);
+
+    // The socket is created here to live in the sending thread
+    QUdpSocket socket;
+    if( !socket.bind( QHostAddress::AnyIPv4, 0 ) ) // Creates the native IPv4 socket used by sendmmsg
+        qDebug() << tr("Webcam Sender socket error: %1").arg(socket.errorString());
+
+    if( mMulticast )
+        socket.setSocketOption( QAbstractSocket::MulticastTtlOption, WEBCAM_MCAST_TTL );
+
+#ifdef WEBCAM_USE_SENDMMSG
+    memset( &mAddr, 0, sizeof(struct sockaddr_in) );
+    mAddr.sin_family = AF_INET;
+    mAddr.sin_port = htons( (quint16)mSendPort );
+    mAddr.sin_addr.s_addr = htonl( mHostAddress.toIPv4Address() );
+#endif
+
+    forever
+    {
+        EncodedFrame frame;
+        if( !mQueue.pop( frame, WEBCAM_POP_TIMEOUT_MSEC ) )
+        {
+            if( mQueue.isClosed() )
+                break;
+            continue;
+        }
+
+        // A frame waiting too long is useless: the next one is sent
+        double queueMsec = frame.captureTime.nsecsElapsed()/1000000.0;
+        if( queueMsec > WEBCAM_CLIENT_MAX_AGE_MSEC )
+        {
+            QMutexLocker locker( &mMutex );
+            mClientStats.framesStale++;
+            continue;
+        }
+
+        int fecGroup;
+        QStringList members;
+        mMutex.lock();
+        {
+            fecGroup = mFecGroup;
+            members = mMembers;
+        }
+        mMutex.unlock();
+
+        QElapsedTimer chrono;
+        chrono.start();
+
+        bool sent = sendFragmentedData( &socket, frame, fecGroup );
+
+        double sendMsec = chrono.nsecsElapsed()/1000000.0;
+
+        foreach( const QString& ip, members )
+            mRateCtrl->frameSent( ip );
+
+        QMutexLocker locker( &mMutex );
+        mClientStats.framesSent++;
+        if( !sent )
+            mClientStats.sendErrors++;
+
+        // Exponential averages
+        mClientStats.queueMsec += 0.1*(queueMsec-mClientStats.queueMsec);
+        mClientStats.sendMsec += 0.1*(sendMsec-mClientStats.sendMsec);
+    }
+
+    qDebug() << tr("Webcam Sender Thread finished for %1").arg(mAddress);
+}
+// <<<<< QWebcamClientSender
+
+// >>>>> QWebcamSender
+QWebcamSender::QWebcamSender( QFrameQueue<EncodedFrame>* encodedQueue,
+                              QWebcamPipelineStats* stats,
+                              QWebcamRateController* rateCtrl,
+                              int sendPort, int maxPacketSize,
+                              QObject *parent/*=0*/ ) :
+    QThread(parent),
+    mEncodedQueue(encodedQueue),
+    mStats(stats),
+    mRateCtrl(rateCtrl),
+    mSendPort(sendPort),
+    mMaxPacketSize(maxPacketSize),
+    mFecGroup(WEBCAM_FEC_DEFAULT_GROUP),
+    mRecorder(NULL)
+{
+}
+
+void QWebcamSender::setRecorder( QWebcamRecorder* recorder )
+{
+    QMutexLocker locker( &mRecorderMutex );
+    mRecorder = recorder;
+}
+
+void QWebcamSender::setClients( QList<WebcamClientInfo> clients )
+{
+    QMutexLocker locker( &mClientMutex );
+    mClients = clients;
+}
+
+void QWebcamSender::setFecGroupSize( int groupSize )
+{
+    QMutexLocker locker( &mClientMutex );
+    mFecGroup = qBound( 0, groupSize, WEBCAM_FEC_MAX_GROUP );
+}
+
+void QWebcamSender::setMulticastGroup( QHostAddress group )
+{
+    QMutexLocker locker( &mClientMutex );
+    mMulticastGroup = group;
+}
+
+QList<WebcamClientStats> QWebcamSender::getClientStats()
+{
+    QMutexLocker locker( &mDestMutex );
+
+    QList<WebcamClientStats> stats;
+    foreach( QWebcamClientSender* sender, mDestinations )
+        stats << sender->getStats();
+
+    return stats;
+}
+
+void QWebcamSender::stopDestination( QWebcamClientSender* sender )
+{
+    sender->stop();
+    sender->wait();
+    delete sender;
+}
+
+void QWebcamSender::updateDestinations()
+{
+    QList<WebcamClientInfo> clients;
+    int fecGroup;
+    QHostAddress group;
+    mClientMutex.lock();
+    {
+        clients = mClients;
+        fecGroup = mFecGroup;
+        group = mMulticastGroup;
+    }
+    mClientMutex.unlock();
+
+    // >>>>> Destinations: each unicast client and the multicast group
+    QHash<QString,quint8> versions;
+    QHash<QString,QStringList> members;
+    QHash<QString,int> encodings;
+    QHash<QString,quint8> cameras;
+    for( int c=0; c<clients.size(); c++ )
+    {
+        QString dest = clients[c].ip;
+        quint8 version = clients[c].protoVersion;
+
+        // The group uses the header of the oldest member, at least v2
+        if( clients[c].multicast && !group.isNull() )
+        {
+            dest = group.toString();
+            version = qMin( versions.value(dest,WEBCAM_PROTO_VERSION), qMax(version,(quint8)WEBCAM_PROTO_V2) );
+        }
+
+        versions[dest] = version;
+        members[dest] << clients[c].ip;
+
+        // The group receives the cameras of all the members, each member keeps only its own
+        cameras[dest] = cameras.value(dest,0) | mRateCtrl->getCameras( clients[c].ip );
+
+        encodings[dest] = mRateCtrl->getEncoding( clients[c].ip );
+    }
+
+    // The group receives a single stream: stream, level and tiles are chosen
+    // by the rate controller, which produces them
+    QString groupDest = group.isNull()?QString():group.toString();
+    mRateCtrl->setGroupMembers( members.value(groupDest) );
+    if( members.contains(groupDest) )
+        encodings[groupDest] = mRateCtrl->getGroupEncoding();
+
+    // Without the v3 header the frames of the cameras cannot be told apart
+    foreach( const QString& dest, versions.keys() )
+    {
+        if( versions.value(dest)<WEBCAM_PROTO_V3 )
+            cameras[dest] &= 0x01;
+    }
+    // <<<<< Destinations: each unicast client and the multicast group
+
+    QMutexLocker locker( &mDestMutex );
+
+    QMutableHashIterator<QString,QWebcamClientSender*> it( mDestinations );
+    while( it.hasNext() )
+    {
+        it.next();
+        if( !versions.contains(it.key()) || versions.value(it.key())!=it.value()->getVersion() ||
+                cameras.value(it.key())!=it.value()->getCameras() )
+        {
+            stopDestination( it.value() );
+            it.remove();
+        }
+    }
+
+    foreach( const QString& dest, versions.keys() )
+    {
+        QWebcamClientSender* sender = mDestinations.value( dest, NULL );
+        if( !sender )
+        {
+            sender = new QWebcamClientSender( dest, versions.value(dest), (!group.isNull() && dest==group.toString()),
+                                              cameras.value(dest), mStats, mRateCtrl, mSendPort, mMaxPacketSize );
+            mDestinations[dest] = sender;
+            sender->start();
+        }
+
+        sender->setFecGroupSize( fecGroup );
+        sender->setMembers( members.value(dest) );
+    }
+
+    mDestEncodings.clear();
+    mDestCameras = cameras;
+    mDestEncodings = encodings;
+}
+
+void QWebcamSender::run()
+{
+    qDebug() << tr("Webcam Sender Thread started");
+
+    // Each encoding of each camera is a separate stream
+    bool firstFrame[WEBCAM_MAX_CAMERAS][WEBCAM_ENCODINGS];
+    quint32 lastFrameIdx[WEBCAM_MAX_CAMERAS][WEBCAM_ENCODINGS];
+    for( int c=0; c<WEBCAM_MAX_CAMERAS; c++ )
+    {
+        for( int e=0; e<WEBCAM_ENCODINGS; e++ )
+        {
+            firstFrame[c][e] = true;
+            lastFrameIdx[c][e] = 0;
+        }
+    }
+
+    forever
+    {
+        EncodedFrame frame;
+        if( !mEncodedQueue->pop( frame, WEBCAM_POP_TIMEOUT_MSEC ) )
+        {
+            if( mEncodedQueue->isClosed() )
+                break;
+            continue;
+        }
+
+        // Encoders work in parallel: a frame can be ready after a newer one
+        int camera = frame.camera;
+        int encoding = frame.encoding;
+        if( !firstFrame[camera][encoding] && (qint32)(frame.frameIdx-lastFrameIdx[camera][encoding]) <= 0 )
+        {
+            mStats->addLateDrop();
+            continue;
+        }
+        firstFrame[camera][encoding] = false;
+        lastFrameIdx[camera][encoding] = frame.frameIdx;
+
+        QElapsedTimer chrono;
+        chrono.start();
+
+        updateDestinations();
+
+        // ---> Fan-out: each destination receives the frames of its cameras, stream and quality level
+        QHashIterator<QString,QWebcamClientSender*> it( mDestinations );
+        while( it.hasNext() )
+        {
+            it.next();
+            if( mDestEncodings.value(it.key())==encoding && (mDestCameras.value(it.key()) & (1<<camera)) )
+                it.value()->pushFrame( frame );
+        }
+        // <--- Fan-out
+
+        // ---> Recording: queued to the writer thread, never waits for the disk
+        {
+            QMutexLocker locker( &mRecorderMutex );
+            if( mRecorder && encoding==mRecorder->getEncoding() && (mRecorder->getCameras() & (1<<camera)) )
+                mRecorder->pushFrame( frame );
+        }
+        // <--- Recording
+
+        mStats->addSendTime( chrono.nsecsElapsed()/1000000.0,
+                             frame.captureTime.nsecsElapsed()/1000000.0 );
+
+        WebcamStageTimings timings;
+        if( mStats->report( timings ) )
+        {
+            qDebug() << tr("Webcam pipeline - FPS: %1 - Capture: %2 msec - Encode: %3 msec - Dispatch: %4 msec - Latency: %5 msec - Dropped (raw/encoded/late): %6/%7/%8 - Datagrams/frame: %9 - Send calls/frame: %10 - Encoder allocations: %11 - Tiles sent: %12% - Keyframes: %13 - Paced: %14 fps - Jitter (avg/max): %15/%16 msec - Deadlines skipped: %17")
+                        .arg(timings.fps, 0, 'f', 1)
+                        .arg(timings.captureMsec, 0, 'f', 1)
+                        .arg(timings.encodeMsec, 0, 'f', 1)
+                        .arg(timings.sendMsec, 0, 'f', 1)
+                        .arg(timings.latencyMsec, 0, 'f', 1)
+                        .arg(timings.rawDropped).arg(timings.encodedDropped).arg(timings.lateDropped)
+                        .arg(timings.datagramsPerFrame, 0, 'f', 1)
+                        .arg(timings.sendCallsPerFrame, 0, 'f', 1)
+                        .arg(timings.encoderAllocs)
+                        .arg(timings.tilesSent*100.0, 0, 'f', 1)
+                        .arg(timings.keyframes)
+                        .arg(timings.pacedFps, 0, 'f', 1)
+                        .arg(timings.jitterMsec, 0, 'f', 2)
+                        .arg(timings.maxJitterMsec, 0, 'f', 2)
+                        .arg(timings.pacingSkipped);
+
+            foreach( const WebcamClientStats& client, getClientStats() )
+            {
+                qDebug() << tr("Webcam destination %1 - Sent: %2 - Dropped (queue/stale): %3/%4 - Send errors: %5 - Queue: %6 msec - Send: %7 msec")
+                            .arg(client.address)
+                            .arg(client.framesSent)
+                            .arg(client.framesDropped).arg(client.framesStale)
+                            .arg(client.sendErrors)
+                            .arg(client.queueMsec, 0, 'f', 1)
+                            .arg(client.sendMsec, 0, 'f', 1);
+            }
+        }
+    }
+
+    // >>>>> Stopping the destinations
+    QMutexLocker locker( &mDestMutex );
+    foreach( QWebcamClientSender* sender, mDestinations )
+        stopDestination( sender );
+    mDestinations.clear();
+    mDestEncodings.clear();
+    mDestCameras.clear();
+    // <<<<< Stopping the destinations
+
+    qDebug() << tr("Webcam Sender Thread finished");
+}
+// <<<<< QWebcamSender
+
+}
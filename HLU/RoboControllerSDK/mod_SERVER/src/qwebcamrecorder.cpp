@@ -0,0 +1,295 @@
+#include "qwebcamrecorder.h"
+#include <QDebug>
+#include <QDir>
+#include <QDateTime>
+#include <QMutexLocker>
+#include <QtEndian>
+
+#include <algorithm>
+#include <string.h>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+namespace roboctrl
+{
+
+QWebcamRecorder::QWebcamRecorder( QString directory, quint8 cameras,
+                                  qint64 maxSegmentBytes/*=RECORDER_DEFAULT_SEGMENT_BYTES*/,
+                                  int maxSegments/*=0*/,
+                                  QObject *parent/*=0*/ ) :
+    QThread(parent),
+    mDirectory(directory),
+    mCameras(cameras),
+    mMaxSegmentBytes(qMax((qint64)RECORDER_MIN_SEGMENT_BYTES,maxSegmentBytes)),
+    mMaxSegments(qMax(0,maxSegments)),
+    mQueue(RECORDER_QUEUE_SIZE),
+    mSegmentIdx(0)
+{
+    int cameraCount = 0;
+    for( int c=0; c<WEBCAM_MAX_CAMERAS; c++ )
+    {
+        if( cameras & (1<<c) )
+            cameraCount++;
+    }
+    mQueue.setCapacity( RECORDER_QUEUE_SIZE*qMax(1,cameraCount) );
+
+    // The recordings of the same directory are listed in order of start
+    mSessionName = QDateTime::currentDateTimeUtc().toString( "yyyyMMdd-hhmmss" );
+
+    mStats.recording = false;
+    mStats.segments = 0;
+    mStats.framesWritten = 0;
+    mStats.framesDropped = 0;
+    mStats.writeErrors = 0;
+    mStats.bytesWritten = 0;
+}
+
+QWebcamRecorder::~QWebcamRecorder()
+{
+    stop();
+    wait();
+}
+
+void QWebcamRecorder::pushFrame( const EncodedFrame& frame )
+{
+    // The encoded data is shared with the network queues: no copy
+    int dropped = mQueue.push( frame );
+
+    if( dropped>0 )
+    {
+        QMutexLocker locker( &mMutex );
+        mStats.framesDropped += dropped;
+    }
+}
+
+void QWebcamRecorder::stop()
+{
+    mQueue.close();
+}
+
+RecorderStats QWebcamRecorder::getStats()
+{
+    QMutexLocker locker( &mMutex );
+    return mStats;
+}
+
+bool QWebcamRecorder::writeBlock( const char* data, qint64 size )
+{
+    if( mFile.write( data, size )!=size )
+        return false;
+
+    QMutexLocker locker( &mMutex );
+    mStats.bytesWritten += size;
+
+    return true;
+}
+
+bool QWebcamRecorder::openSegment( const EncodedFrame& frame )
+{
+    // >>>>> Retention
+    while( mMaxSegments>0 && mSegmentFiles.size()>=mMaxSegments )
+    {
+        QString oldest = mSegmentFiles.takeFirst();
+        if( !QFile::remove( oldest ) )
+            qDebug() << tr("Webcam recording: %1 cannot be removed").arg(oldest);
+    }
+    // <<<<< Retention
+
+    QString fileName = QDir( mDirectory ).filePath( QString("%1_%2%3")
+                                                    .arg(mSessionName)
+                                                    .arg(mSegmentIdx, 5, 10, QChar('0'))
+                                                    .arg(REC_FILE_SUFFIX) );
+
+    mFile.setFileName( fileName );
+    if( !mFile.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+    {
+        qDebug() << tr("Webcam recording: %1 cannot be created: %2").arg(fileName).arg(mFile.errorString());
+        return false;
+    }
+
+    // Capture time of the frame on the wall clock: the segment is searchable by date
+    qint64 wallUsec = QDateTime::currentMSecsSinceEpoch()*1000 - frame.captureTime.nsecsElapsed()/1000;
+    qint64 clockOffsetUsec = wallUsec - (qint64)frame.captureUsec;
+
+    uchar header[REC_FILE_HEADER_SIZE];
+    memset( header, 0, REC_FILE_HEADER_SIZE );
+    qToLittleEndian<quint32>( REC_FILE_MAGIC, header );
+    qToLittleEndian<quint16>( REC_VERSION, header+4 );
+    qToLittleEndian<quint16>( REC_FILE_HEADER_SIZE, header+6 );
+    qToLittleEndian<quint32>( mSegmentIdx, header+8 );
+    qToLittleEndian<qint64>( clockOffsetUsec, header+16 );
+    qToLittleEndian<qint64>( QDateTime::currentMSecsSinceEpoch(), header+24 );
+
+    if( !writeBlock( (const char*)header, REC_FILE_HEADER_SIZE ) )
+    {
+        qDebug() << tr("Webcam recording: %1 write error: %2").arg(fileName).arg(mFile.errorString());
+        mFile.close();
+        return false;
+    }
+
+    mIndex.clear();
+    mSegmentFiles << fileName;
+    mSegmentIdx++;
+    mFlushTimer.start();
+
+    QMutexLocker locker( &mMutex );
+    mStats.segment = fileName;
+    mStats.segments++;
+
+    return true;
+}
+
+void QWebcamRecorder::closeSegment()
+{
+    if( !mFile.isOpen() )
+        return;
+
+    // The frames are written in order of arrival, the index in order of capture
+    std::stable_sort( mIndex.begin(), mIndex.end(), entryBefore );
+
+    quint64 indexOffset = (quint64)mFile.pos();
+
+    std::vector<uchar> index( mIndex.size()*REC_INDEX_ENTRY_SIZE + REC_TRAILER_SIZE, 0 );
+    uchar* entry = index.data();
+    for( size_t i=0; i<mIndex.size(); i++, entry+=REC_INDEX_ENTRY_SIZE )
+    {
+        qToLittleEndian<quint64>( mIndex[i].captureUsec, entry );
+        qToLittleEndian<quint64>( mIndex[i].offset, entry+8 );
+        qToLittleEndian<quint32>( mIndex[i].frameIdx, entry+16 );
+        entry[20] = mIndex[i].camera;
+        entry[21] = mIndex[i].encoder;
+    }
+
+    uchar* trailer = entry;
+    qToLittleEndian<quint32>( REC_TRAILER_MAGIC, trailer );
+    qToLittleEndian<quint32>( (quint32)mIndex.size(), trailer+4 );
+    qToLittleEndian<quint64>( indexOffset, trailer+8 );
+    qToLittleEndian<quint64>( mIndex.empty()?0:mIndex.front().captureUsec, trailer+16 );
+    qToLittleEndian<quint64>( mIndex.empty()?0:mIndex.back().captureUsec, trailer+24 );
+
+    if( !writeBlock( (const char*)index.data(), (qint64)index.size() ) )
+        qDebug() << tr("Webcam recording: index of %1 not written: %2").arg(mFile.fileName()).arg(mFile.errorString());
+
+    qDebug() << tr("Webcam recording: %1 closed - Frames: %2 - Size: %3 KB")
+                .arg(mFile.fileName()).arg(mIndex.size()).arg(mFile.pos()/1024);
+
+    mFile.close();
+    mIndex.clear();
+
+    QMutexLocker locker( &mMutex );
+    mStats.segment.clear();
+}
+
+bool QWebcamRecorder::writeFrame( const EncodedFrame& frame )
+{
+    static const char padding[REC_ALIGN] = {0};
+
+    qint64 dataSize = frame.data.size();
+    qint64 padSize = (REC_ALIGN - dataSize%REC_ALIGN) % REC_ALIGN;
+
+    // The segment with this frame and its index must fit the max size
+    if( mFile.isOpen() && !mIndex.empty() )
+    {
+        qint64 closedSize = mFile.pos() + REC_FRAME_HEADER_SIZE + dataSize + padSize +
+                (qint64)(mIndex.size()+1)*REC_INDEX_ENTRY_SIZE + REC_TRAILER_SIZE;
+
+        if( closedSize > mMaxSegmentBytes )
+            closeSegment();
+    }
+
+    if( !mFile.isOpen() && !openSegment( frame ) )
+        return false;
+
+    IndexEntry entry;
+    entry.captureUsec = frame.captureUsec;
+    entry.offset = (quint64)mFile.pos();
+    entry.frameIdx = frame.frameIdx;
+    entry.camera = frame.camera;
+    entry.encoder = frame.encoder;
+
+    uchar header[REC_FRAME_HEADER_SIZE];
+    memset( header, 0, REC_FRAME_HEADER_SIZE );
+    qToLittleEndian<quint32>( REC_FRAME_MAGIC, header );
+    qToLittleEndian<quint32>( (quint32)dataSize, header+4 );
+    qToLittleEndian<quint64>( frame.captureUsec, header+8 );
+    qToLittleEndian<quint32>( frame.frameIdx, header+16 );
+    header[20] = frame.camera;
+    header[21] = frame.encoder;
+    qToLittleEndian<quint16>( frame.width, header+22 );
+    qToLittleEndian<quint16>( frame.height, header+24 );
+    header[26] = frame.telemetry.valid?REC_FRAME_FLAG_TELEMETRY:0;
+    qToLittleEndian<qint16>( frame.telemetry.speed0, header+28 );
+    qToLittleEndian<qint16>( frame.telemetry.speed1, header+30 );
+    qToLittleEndian<quint32>( frame.telemetry.boardTimeMsec, header+32 );
+    qToLittleEndian<quint32>( frame.telemetry.ageUsec, header+36 );
+
+    if( !writeBlock( (const char*)header, REC_FRAME_HEADER_SIZE ) ||
+            !writeBlock( frame.data.constData(), dataSize ) ||
+            !writeBlock( padding, padSize ) )
+    {
+        // The frames written so far keep their index, the next frame starts a new segment
+        qDebug() << tr("Webcam recording: %1 write error: %2").arg(mFile.fileName()).arg(mFile.errorString());
+        closeSegment();
+        return false;
+    }
+
+    mIndex.push_back( entry );
+
+    // >>>>> Durability: at most RECORDER_FLUSH_PERIOD_MSEC of video lost on power loss
+    if( mFlushTimer.elapsed() >= RECORDER_FLUSH_PERIOD_MSEC )
+    {
+        mFile.flush();
+#ifdef Q_OS_UNIX
+        fsync( mFile.handle() );
+#endif
+        mFlushTimer.restart();
+    }
+    // <<<<< Durability
+
+    return true;
+}
+
+void QWebcamRecorder::run()
+{
+    qDebug() << tr("Webcam Recorder Thread started on %1").arg(mDirectory);
+
+    if( !QDir().mkpath( mDirectory ) )
+        qDebug() << tr("Webcam recording: %1 cannot be created").arg(mDirectory);
+
+    {
+        QMutexLocker locker( &mMutex );
+        mStats.recording = true;
+    }
+
+    forever
+    {
+        EncodedFrame frame;
+        if( !mQueue.pop( frame, WEBCAM_POP_TIMEOUT_MSEC ) )
+        {
+            if( mQueue.isClosed() )
+                break;
+            continue;
+        }
+
+        bool written = writeFrame( frame );
+
+        QMutexLocker locker( &mMutex );
+        if( written )
+            mStats.framesWritten++;
+        else
+            mStats.writeErrors++;
+    }
+
+    closeSegment();
+
+    {
+        QMutexLocker locker( &mMutex );
+        mStats.recording = false;
+    }
+
+    qDebug() << tr("Webcam Recorder Thread finished");
+}
+
+}
@@ -4,7 +4,10 @@
 #include <QByteArray>
 #include <QTime>
 #include <QCoreApplication>
+#include <QMutexLocker>
+#include <QtEndian>
 #include <QTime>
+#include <QDir>
 
 using namespace std;
 
@@ -16,10 +19,68 @@ QWebcamServer::QWebcamServer(int camIdx, int sendPort,
                              QObject *parent):
     QThread(parent),
     mUdpSocketSender(NULL),
-    mUdpSocketReceiver(NULL)
+    mUdpSocketReceiver(NULL),
+    mRawQueue(WEBCAM_RAW_QUEUE_SIZE),
+    mEncodedQueue(WEBCAM_ENCODED_QUEUE_SIZE+WEBCAM_ENCODINGS-1), // A frame can be encoded for each stream and level
+    mSender(NULL),
+    mVisionCamera(-1),
+    mOdometryEnabled(false),
+    mRecorder(NULL)
 {
-    mStopped=true;
     mCamIdx=camIdx;
+
+    initServer( QList<QCaptureSource*>() << new QCameraSource( camIdx, 640, 480 ),
+                sendPort, listenPort, udpPacketSize, maxClientCount );
+}
+
+QWebcamServer::QWebcamServer( QCaptureSource* source, int sendPort,
+                              int listenPort, int udpPacketSize, int maxClientCount,
+                              QObject *parent):
+    QThread(parent),
+    mUdpSocketSender(NULL),
+    mUdpSocketReceiver(NULL),
+    mRawQueue(WEBCAM_RAW_QUEUE_SIZE),
+    mEncodedQueue(WEBCAM_ENCODED_QUEUE_SIZE+WEBCAM_ENCODINGS-1), // A frame can be encoded for each stream and level
+    mSender(NULL),
+    mVisionCamera(-1),
+    mOdometryEnabled(false),
+    mRecorder(NULL)
+{
+    mCamIdx=-1;
+
+    initServer( QList<QCaptureSource*>() << source, sendPort, listenPort, udpPacketSize, maxClientCount );
+}
+
+QWebcamServer::QWebcamServer( QList<QCaptureSource*> sources, int sendPort,
+                              int listenPort, int udpPacketSize, int maxClientCount,
+                              QObject *parent):
+    QThread(parent),
+    mUdpSocketSender(NULL),
+    mUdpSocketReceiver(NULL),
+    mRawQueue(WEBCAM_RAW_QUEUE_SIZE),
+    mEncodedQueue(WEBCAM_ENCODED_QUEUE_SIZE+WEBCAM_ENCODINGS-1), // A frame can be encoded for each stream and level
+    mSender(NULL),
+    mVisionCamera(-1),
+    mOdometryEnabled(false),
+    mRecorder(NULL)
+{
+    mCamIdx=-1;
+
+    initServer( sources, sendPort, listenPort, udpPacketSize, maxClientCount );
+}
+
+void QWebcamServer::initServer( QList<QCaptureSource*> sources, int sendPort, int listenPort, int udpPacketSize, int maxClientCount )
+{
+    mStopped=true;
+
+    if( sources.size()>WEBCAM_MAX_CAMERAS )
+    {
+        qDebug() << tr("%1 cameras: only the first %2 are streamed").arg(sources.size()).arg(WEBCAM_MAX_CAMERAS);
+        while( sources.size()>WEBCAM_MAX_CAMERAS )
+            delete sources.takeLast();
+    }
+    mSources=sources;
+    mTelemetry=NULL;
     mSendPort=sendPort;
     mListenPort=listenPort;
     mMaxPacketSize=udpPacketSize;
@@ -36,14 +97,38 @@ QWebcamServer::QWebcamServer(int camIdx, int sendPort,
     connect( mUdpSocketReceiver, SIGNAL(readyRead()),
              this, SLOT(onReadyRead() ) );
 
-    if( mCap.open( mCamIdx ) )
+    // >>>>> Pipeline
+    // The encoding threads are shared by the cameras: a camera can use the cores left by the others
+    int cameraCount = qMax( 1, mSources.size() );
+    mEncoderCount = qBound( 1, QThread::idealThreadCount()-1, WEBCAM_MAX_ENCODER_THREADS*cameraCount );
+    mEncoderPool.setMaxThreadCount( mEncoderCount );
+
+    mRawQueue.setCapacity( WEBCAM_RAW_QUEUE_SIZE*cameraCount );
+    mEncodedQueue.setCapacity( (WEBCAM_ENCODED_QUEUE_SIZE+WEBCAM_ENCODINGS-1)*cameraCount );
+
+    mSender = new QWebcamSender( &mEncodedQueue, &mStats, &mRateCtrl, mSendPort, mMaxPacketSize, this );
+    mClock.start();
+    for( int c=0; c<mSources.size(); c++ )
+        mGrabbers << new QWebcamGrabber( mSources[c], mClock, &mStats, this );
+    // <<<<< Pipeline
+
+    // A camera that cannot be opened keeps its id: the grabber retries on it
+    int openCount = 0;
+    for( int c=0; c<mSources.size(); c++ )
     {
-        mCap.set( CV_CAP_PROP_FRAME_WIDTH, 640  );
-        mCap.set( CV_CAP_PROP_FRAME_HEIGHT, 480 );
+        if( mSources[c]->open() )
+        {
+            qDebug() << tr("Camera %1: %2 opened").arg(c).arg(mSources[c]->getDescription());
+            openCount++;
+        }
+        else
+            qDebug() << tr("Camera %1: %2 cannot be opened").arg(c).arg(mSources[c]->getDescription());
+    }
 
-        qDebug() << tr("Camera %1 opened").arg(mCamIdx);
-        qDebug() << tr("Server started. Sending on port %1. Listening on port %2")
-                    .arg(mSendPort).arg(mListenPort);
+    if( openCount>0 )
+    {
+        qDebug() << tr("Server started. Sending on port %1. Listening on port %2. Cameras: %3. Encoder threads: %4")
+                    .arg(mSendPort).arg(mListenPort).arg(mSources.size()).arg(mEncoderCount);
 
         mStopped = false;
 
@@ -62,77 +147,195 @@ QWebcamServer::~QWebcamServer()
     QTime timer;
     timer.start();
     while(isRunning() && timer.elapsed()<2000 );
+
+    if( !isRunning() )
+        qDeleteAll( mSources );
+
+    stopRecording();
+    setTelemetrySource( NULL );
 }
 
-void QWebcamServer::stop()
+void QWebcamServer::setTelemetrySource( QRobotTelemetry* telemetry )
 {
-    mStopMutex.lock();
-    {
-        mStopped = true;
-    }
-    mStopMutex.unlock();
+    if( telemetry==mTelemetry )
+        return;
+
+    // The robot server reads the board only while someone uses the telemetry
+    if( mTelemetry )
+        mTelemetry->removeConsumer();
+    mTelemetry = telemetry;
+    if( mTelemetry )
+        mTelemetry->addConsumer();
+
+    foreach( QWebcamGrabber* grabber, mGrabbers )
+        grabber->setTelemetrySource( mTelemetry );
+
+    mOdometrySink.storeRelease( mTelemetry );
 }
 
-void QWebcamServer::sendFragmentedData( QByteArray data, char fragID )
+void QWebcamServer::setVisualOdometry( bool enabled )
 {
-    int infoSize = 9;  // Packet info header size
-    int fragDataSize = mMaxPacketSize - infoSize; // Data size in the packet
+    QMutexLocker locker( &mOdometryMutex );
 
-    int dataSize = data.size();
+    mOdometryEnabled = enabled;
+    mOdometry.reset();
+}
 
-    int tailSize = dataSize%fragDataSize; // last packet data size
-    int numFrag = dataSize/fragDataSize; // packet count
+void QWebcamServer::setOdometryGeometry( const VisionCameraModel& camera, double wheelBaseM )
+{
+    QMutexLocker locker( &mOdometryMutex );
 
-    if(tailSize > 0) // if there is a not complete tail we must send a packet not full
-        numFrag++;
+    mOdometry.setCameraModel( camera );
+    mOdometry.setWheelBase( wheelBaseM );
+    mOdometry.reset();
+}
 
-    for( int i=0; i<numFrag; i++ )
+void QWebcamServer::updateOdometry( const VisionFrame& vision, const FrameTelemetry& telemetry )
+{
+    OdometryEstimate estimate;
     {
-        QByteArray buffer( mMaxPacketSize, 0 );
-        QDataStream stream( &buffer, QIODevice::WriteOnly );
-        stream.setVersion( QDataStream::Qt_4_0 );
+        QMutexLocker locker( &mOdometryMutex );
 
-        stream << (quint8)fragID << (quint16)mMaxPacketSize << (quint16)numFrag << (quint16)tailSize << (quint16)i;
+        if( !mOdometryEnabled )
+            return;
 
-        int startIdx = i*fragDataSize;
-        int endIdx = (i==numFrag-1)?(startIdx+tailSize):(startIdx+fragDataSize);
-        for( int d=startIdx; d<endIdx; d++ )
-        {
-            quint8 noise=0;
-            quint8 val = (quint8)data[d]+noise;
-            stream << val;
-        }
+        // Speeds not read anymore (board lost or polling stopped) would be fused forever
+        bool encoderValid = telemetry.valid && telemetry.ageUsec < TELEMETRY_FRESH_USEC;
 
-        for( int i=0; i<(int)mClientIpList.size(); i++ )
-        {
-            if( -1==mUdpSocketSender->writeDatagram( buffer, QHostAddress(mClientIpList[i]), mSendPort ) )
-            {
-                qDebug() << tr("Frame #%3: Missed fragment %1/%2 to Client %4")
-                            .arg(i).arg(numFrag).arg((unsigned int)fragID).arg(mClientIpList[i]);
-            }
-        }
+        mOdometry.update( vision, encoderValid, telemetry.speed0/1000.0, telemetry.speed1/1000.0, estimate );
     }
 
-    //    qDebug() << tr("Sent frame #%1 - size: %2 bytes").arg((int)fragID).arg(data.size() );
-    //    qDebug() << tr( "Fragment count: %1 - Tail Size: %2 - Full Data Size: %3")
-    //                .arg(numFrag).arg(tailSize).arg(dataSize);
+    QRobotTelemetry* sink = mOdometrySink.loadAcquire();
+    if( !sink )
+        return;
+
+    RobotOdometry odometry;
+    odometry.speed0 = estimate.encoderValid?telemetry.speed0/1000.0:0.0;
+    odometry.speed1 = estimate.encoderValid?telemetry.speed1/1000.0:0.0;
+    odometry.valid = estimate.valid;
+    odometry.linearSpeed = estimate.linearSpeed;
+    odometry.angularSpeed = estimate.angularSpeed;
+    odometry.visionValid = estimate.visionValid;
+    odometry.visionLinearSpeed = estimate.visionLinearSpeed;
+    odometry.visionAngularSpeed = estimate.visionAngularSpeed;
+    odometry.slipping = estimate.slipping;
+    odometry.inliers = (quint16)estimate.inliers;
+    odometry.processMsec = estimate.processMsec;
+    odometry.ageMsec = 0;
+
+    sink->publishOdometry( odometry );
 }
 
-void QWebcamServer::run()
+bool QWebcamServer::startRecording( QString directory, quint8 cameras/*=0x01*/,
+                                    qint64 maxSegmentBytes/*=RECORDER_DEFAULT_SEGMENT_BYTES*/, int maxSegments/*=0*/ )
+{
+    stopRecording();
+
+    if( !QDir().mkpath( directory ) )
+    {
+        qDebug() << tr("Webcam recording: %1 cannot be created").arg(directory);
+        return false;
+    }
+
+    mRecorder = new QWebcamRecorder( directory, cameras, maxSegmentBytes, maxSegments );
+    mRecorder->start( QThread::LowPriority ); // The disk must not steal time to capture and encoding
+
+    mSender->setRecorder( mRecorder );
+    mRateCtrl.setRecording( cameras, mRecorder->getEncoding() );
+
+    qDebug() << tr("Webcam recording started on %1 - Cameras: 0x%2 - Segments of %3 MB")
+                .arg(directory).arg((int)cameras, 2, 16, QChar('0')).arg(maxSegmentBytes/(1024*1024));
+
+    return true;
+}
+
+void QWebcamServer::stopRecording()
+{
+    if( !mRecorder )
+        return;
+
+    mRateCtrl.setRecording( 0, RECORDER_ENCODING );
+    mSender->setRecorder( NULL );
+
+    mRecorder->stop();
+    mRecorder->wait();
+
+    RecorderStats stats = mRecorder->getStats();
+    qDebug() << tr("Webcam recording stopped - Segments: %1 - Frames written: %2 - Dropped: %3 - Write errors: %4 - Size: %5 MB")
+                .arg(stats.segments).arg(stats.framesWritten).arg(stats.framesDropped).arg(stats.writeErrors)
+                .arg(stats.bytesWritten/(1024.0*1024.0), 0, 'f', 1);
+
+    delete mRecorder;
+    mRecorder = NULL;
+}
+
+RecorderStats QWebcamServer::getRecordingStats()
+{
+    if( mRecorder )
+        return mRecorder->getStats();
+
+    RecorderStats stats;
+    stats.recording = false;
+    stats.segments = 0;
+    stats.framesWritten = 0;
+    stats.framesDropped = 0;
+    stats.writeErrors = 0;
+    stats.bytesWritten = 0;
+    return stats;
+}
+
+bool QWebcamServer::getLastVisionFrame( VisionFrame& frame )
+{
+    if( !mVisionFrames.acquire() )
+        return false;
+
+    // Deep copy: the images of the buffer return to the capture stage at the next acquire
+    const VisionFrame& last = mVisionFrames.front();
+    frame.camera = last.camera;
+    frame.frameIdx = last.frameIdx;
+    frame.captureUsec = last.captureUsec;
+    frame.processMsec = last.processMsec;
+    frame.corners = last.corners;
+    frame.pyramid.resize( last.pyramid.size() );
+    for( size_t l=0; l<last.pyramid.size(); l++ )
+        last.pyramid[l].copyTo( frame.pyramid[l] );
+
+    return true;
+}
+
+void QWebcamServer::stop()
 {
-    vector<int> params;
-    params.push_back(CV_IMWRITE_JPEG_QUALITY);
-    params.push_back(75);
+    mStopMutex.lock();
+    {
+        mStopped = true;
+    }
+    mStopMutex.unlock();
+}
 
-    int frameCount = 0;
+void QWebcamServer::run()
+{
+    quint32 frameCount[WEBCAM_MAX_CAMERAS];
+    for( int c=0; c<WEBCAM_MAX_CAMERAS; c++ )
+        frameCount[c] = 0;
 
     qDebug() << tr("Webcam Server Thread started");
 
+    // >>>>> Encoding and sending stages
+    mRawQueue.reset();
+    mEncodedQueue.reset();
+
+    for( int i=0; i<mEncoderCount; i++ )
+        mEncoderPool.start( new QWebcamEncodeWorker( &mRawQueue, &mEncodedQueue, &mStats, &mRateCtrl, &mTileEncoders ) );
+
+    mSender->start();
+    foreach( QWebcamGrabber* grabber, mGrabbers )
+        grabber->start();
+    // <<<<< Encoding and sending stages
+
+    mPacer.start();
+
     forever
     {
-        QTime chrono;
-        chrono.start();
-
         mStopMutex.lock();
         {
             if( mStopped )
@@ -143,44 +346,74 @@ void QWebcamServer::run()
         }
         mStopMutex.unlock();
 
-        cv::Mat frame;
-        vector<uchar> compressed;
+        // Absolute deadlines: the time spent below does not delay the next frames
+        int skipped = mPacer.waitNextFrame();
+        mStats.addPacing( mPacer.getLastLatenessMsec(), skipped );
 
-        mCap >> frame;
-        frameCount++;
+        for( int c=0; c<mGrabbers.size(); c++ )
+        {
+            // The newest frame of the source: the frames queued by the driver
+            // since the last deadline are skipped, a source without a new
+            // frame is taken at the next deadline
+            RawFrame raw;
+            bool fresh = mGrabbers[c]->takeLatest( raw, 0 );
 
-        //qDebug() << tr( "Frame %1").arg( frameCount );
+            if( fresh )
+            {
+                raw.camera = (quint8)c;
+                raw.frameIdx = ++frameCount[c]; // Without gaps: the clients count the missing indexes as lost
+            }
 
-        // JPG Compression in memory
-        if( !frame.empty() && (mClientIpList.size() > 0 ) )
-        {
-            cv::imencode( ".jpg", frame, compressed, params );
+            // >>>>> Vision preprocessing, on the frame before the encoding
+            if( fresh && c==mVisionCamera.loadAcquire() )
+            {
+                VisionFrame& vision = mVisionFrames.back();
+                if( mVision.process( raw.image, vision ) )
+                {
+                    vision.camera = raw.camera;
+                    vision.frameIdx = raw.frameIdx;
+                    vision.captureUsec = raw.captureUsec;
 
-            // ---> UDP Sending
-            QByteArray fullDatagram;
-            fullDatagram.setRawData( (char*)compressed.data(), compressed.size() );
+                    // Before the publication: the buffer is not yet shared
+                    updateOdometry( vision, raw.telemetry );
 
+                    mVisionFrames.publish();
+                }
+            }
+            // <<<<< Vision preprocessing
 
-            sendFragmentedData( fullDatagram, (uchar)(frameCount%255) );
-            // <--- UDP Sending
-        }
+            // The frame is encoded only if someone is waiting for it
+            if( fresh && mRateCtrl.getActiveEncodings( c )!=0 )
+            {
+                int dropped = mRawQueue.push( raw );
+                if( dropped>0 )
+                    mStats.addRawDrops( dropped );
+            }
 
 #ifndef ARM_NO_GUI
-        if( !frame.empty() )
-        {
-            cv::imshow( "Frame Raw", frame );
-            cv::waitKey(1);
+            if( fresh )
+            {
+                cv::imshow( tr("Frame Raw %1").arg(c).toStdString(), raw.image );
+                cv::waitKey(1);
+            }
+#endif
         }
-#endif        
 
-        QCoreApplication::processEvents( QEventLoop::AllEvents, 20 );
-
-        int wait = 40 - chrono.elapsed(); // 25 fps
-        if( wait>0 )
-            msleep(wait);
+        // Only the pending events: the time left is spent waiting for the deadline
+        QCoreApplication::processEvents( QEventLoop::AllEvents );
+    }
 
-        //qDebug() << QTime::currentTime().toString("hh:mm:ss.zzz") << tr("Wait: %1msec").arg(wait);
+    // >>>>> Pipeline flush
+    foreach( QWebcamGrabber* grabber, mGrabbers )
+    {
+        grabber->stop();
+        grabber->wait();
     }
+    mRawQueue.close();
+    mEncoderPool.waitForDone();
+    mEncodedQueue.close();
+    mSender->wait();
+    // <<<<< Pipeline flush
 
     qDebug() << tr("Webcam Server Thread finished");
 
@@ -213,17 +446,72 @@ void QWebcamServer::onReadyRead()
         {
         case CMD_ADD_CLIENT:
         {
+            // >>>>> Version negotiation: old clients send only the command
+            quint8 version = WEBCAM_PROTO_V1;
+            quint8 flags = 0;
+            if( !stream.atEnd() )
+            {
+                quint8 clientVersion;
+                stream >> clientVersion;
+                version = qBound( (quint8)WEBCAM_PROTO_V1, clientVersion, (quint8)WEBCAM_PROTO_VERSION );
+            }
+            if( !stream.atEnd() )
+                stream >> flags;
+
+            bool multicast = (flags & WEBCAM_ADD_FLAG_MULTICAST) && !mMulticastGroup.isNull() &&
+                    version>=WEBCAM_PROTO_V2;
+            bool tiles = (flags & WEBCAM_ADD_FLAG_TILES) && version>=WEBCAM_PROTO_V2;
+
+            QByteArray reply = MSG_CONN_ACCEPTED.toLocal8Bit();
+            if( version>=WEBCAM_PROTO_V2 )
+                reply.append( (char)version );
+            if( version>=WEBCAM_PROTO_V3 )
+                reply.append( (char)mSources.size() );
+            if( multicast )
+            {
+                uchar groupAddr[4];
+                qToBigEndian<quint32>( mMulticastGroup.toIPv4Address(), groupAddr );
+                reply.append( (const char*)groupAddr, 4 );
+            }
+            // <<<<< Version negotiation
+
+            // Multicast clients do not add traffic: they have their own limit
+            int clientCount = 0;
+            for( int i=0; i<mClientIpList.size(); i++ )
+                if( mClientMulticast.value( mClientIpList[i], false )==multicast )
+                    clientCount++;
+            int maxClientCount = multicast?WEBCAM_MCAST_MAX_CLIENTS:mMaxClientCount;
+
             if( mClientIpList.contains( senderIP.toString() ) )
             {
-                mUdpSocketSender->writeDatagram( MSG_CONN_ACCEPTED.toLocal8Bit().constData(), MSG_CONN_ACCEPTED.size(), senderIP, mSendPort );
-                qDebug() << tr("Client %1 already connected").arg( senderIP.toString() );
+                mUdpSocketSender->writeDatagram( reply, senderIP, mSendPort );
+
+                // The client can ask again to switch between multicast and unicast
+                mClientVersions[senderIP.toString()] = version;
+                mClientMulticast[senderIP.toString()] = multicast;
+                updateSenderClients();
+                qDebug() << tr("Client %1 already connected - Multicast: %2").arg( senderIP.toString() ).arg(multicast?tr("yes"):tr("no"));
             }
-            else if(mClientIpList.size()<mMaxClientCount)
+            else if(clientCount<maxClientCount)
             {
-                if(MSG_CONN_ACCEPTED.size()==mUdpSocketSender->writeDatagram( MSG_CONN_ACCEPTED.toLocal8Bit().constData(), MSG_CONN_ACCEPTED.size(), senderIP, mSendPort ))
+                if(reply.size()==mUdpSocketSender->writeDatagram( reply, senderIP, mSendPort ))
                 {
+                    mClientMutex.lock();
                     mClientIpList.push_back( senderIP.toString() );
-                    qDebug() << tr("Client %1 connected").arg( senderIP.toString() );
+                    mClientMutex.unlock();
+
+                    mClientVersions[senderIP.toString()] = version;
+                    mClientMulticast[senderIP.toString()] = multicast;
+                    // Old clients cannot select the stream: they keep the full resolution
+                    mRateCtrl.addClient( senderIP.toString(),
+                                         (version>=WEBCAM_PROTO_V2)?WEBCAM_STREAM_PREVIEW:WEBCAM_STREAM_FULL,
+                                         tiles );
+                    if( tiles )
+                        mTileEncoders.requestKeyframe(); // The tiles of the next frame would have no reference
+                    updateSenderClients();
+                    qDebug() << tr("Client %1 connected - Stream version: %2 - Multicast: %3 - Tiles: %4")
+                                .arg( senderIP.toString() ).arg(version).arg(multicast?tr("yes"):tr("no"))
+                                .arg(tiles?tr("yes"):tr("no"));
                 }
                 else
                     qDebug() << tr("Unable to accept client %1 - Error: %2").arg( senderIP.toString() )
@@ -239,15 +527,107 @@ void QWebcamServer::onReadyRead()
 
         case CMD_REMOVE_CLIENT:
         {
+            mClientMutex.lock();
             mClientIpList.removeAll( senderIP.toString() );
+            mClientMutex.unlock();
+
+            mClientVersions.remove( senderIP.toString() );
+            mClientMulticast.remove( senderIP.toString() );
+            mRateCtrl.removeClient( senderIP.toString() );
+            updateSenderClients();
             qDebug() << tr("Client %1 disconnected").arg( senderIP.toString() );
         }
             break;
 
+        case CMD_CLIENT_FEEDBACK:
+        {
+            quint32 completed;
+            quint32 lost;
+            stream >> completed >> lost;
+
+            if( stream.status()==QDataStream::Ok && mClientIpList.contains( senderIP.toString() ) )
+                mRateCtrl.onFeedback( senderIP.toString(), completed, lost );
+        }
+            break;
+
+        case CMD_SELECT_STREAM:
+        {
+            quint8 selected;
+            stream >> selected;
+
+            if( stream.status()!=QDataStream::Ok || selected>=WEBCAM_STREAMS ||
+                    !mClientIpList.contains( senderIP.toString() ) )
+                break;
+
+            mRateCtrl.setStream( senderIP.toString(), selected );
+            qDebug() << tr("Client %1 selected the %2 stream").arg( senderIP.toString() )
+                        .arg( (selected==WEBCAM_STREAM_FULL)?tr("full resolution"):tr("preview") );
+        }
+            break;
+
+        case CMD_SELECT_CAMERAS:
+        {
+            quint8 cameras;
+            stream >> cameras;
+
+            if( stream.status()!=QDataStream::Ok || !mClientIpList.contains( senderIP.toString() ) ||
+                    mClientVersions.value( senderIP.toString() )<WEBCAM_PROTO_V3 )
+                break;
+
+            cameras &= (1<<mSources.size())-1;
+            mRateCtrl.setCameras( senderIP.toString(), cameras );
+            mTileEncoders.requestKeyframe(); // The new cameras have no reference on the client
+            qDebug() << tr("Client %1 subscribed to the cameras 0x%2").arg( senderIP.toString() )
+                        .arg( (int)cameras, 2, 16, QChar('0') );
+        }
+            break;
+
+        case CMD_REQUEST_KEYFRAME:
+        {
+            if( !mClientIpList.contains( senderIP.toString() ) )
+                break;
+
+            // The group of a multicast client can use another encoding: all are refreshed
+            mTileEncoders.requestKeyframe();
+            qDebug() << tr("Client %1 requested a keyframe").arg( senderIP.toString() );
+        }
+            break;
+
         default:
             qDebug() << tr("Command not recognized: %1").arg( (int)cmd );
         }
     }
 }
 
+void QWebcamServer::updateSenderClients()
+{
+    QList<WebcamClientInfo> clients;
+
+    for( int i=0; i<mClientIpList.size(); i++ )
+    {
+        WebcamClientInfo info;
+        info.ip = mClientIpList[i];
+        info.protoVersion = mClientVersions.value( info.ip, WEBCAM_PROTO_V1 );
+        info.multicast = mClientMulticast.value( info.ip, false );
+        clients << info;
+    }
+
+    mSender->setClients( clients );
+}
+
+void QWebcamServer::setMulticastGroup( QHostAddress group )
+{
+    if( !group.isNull() && !group.isInSubnet( QHostAddress("224.0.0.0"), 4 ) )
+    {
+        qDebug() << tr("%1 is not a multicast address: multicast disabled").arg(group.toString());
+        group = QHostAddress();
+    }
+
+    mMulticastGroup = group;
+    mSender->setMulticastGroup( group );
+
+    if( !group.isNull() )
+        qDebug() << tr("Multicast stream on group %1").arg(group.toString());
+}
+
 }
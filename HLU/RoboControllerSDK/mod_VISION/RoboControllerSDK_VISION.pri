@@ -4,14 +4,18 @@ CONFIG += opencv
 
 DEFINES += USE_OPENCV #useful in coding phase to verify if OpenCV is available
 
-#SOURCES += \
-            #$$ROBOCONTROLLERSDKPATH/mod_VISION/src/
+SOURCES += \
+            $$ROBOCONTROLLERSDKPATH/mod_VISION/src/qvisionkernels.cpp \
+            $$ROBOCONTROLLERSDKPATH/mod_VISION/src/qvisionpreprocessor.cpp \
+            $$ROBOCONTROLLERSDKPATH/mod_VISION/src/qvisualodometry.cpp
 
 INCLUDEPATH += \
             $$ROBOCONTROLLERSDKPATH/mod_VISION/include/
 
-#HEADERS += \
-            #$$ROBOCONTROLLERSDKPATH/mod_VISION/include/
+HEADERS += \
+            $$ROBOCONTROLLERSDKPATH/mod_VISION/include/qvisionkernels.h \
+            $$ROBOCONTROLLERSDKPATH/mod_VISION/include/qvisionpreprocessor.h \
+            $$ROBOCONTROLLERSDKPATH/mod_VISION/include/qvisualodometry.h
 
 
 
@@ -0,0 +1,73 @@
+#ifndef QVISIONKERNELS_H
+#define QVISIONKERNELS_H
+
+#include <QtGlobal>
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+// >>>>> SIMD kernels
+#if defined(__SSE2__) || defined(_M_X64)
+#define VISION_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define VISION_NEON
+#endif
+// <<<<< SIMD kernels
+
+// >>>>> Fixed point coefficients of OpenCV (BGR to gray)
+#define VISION_GRAY_SHIFT       14
+#define VISION_GRAY_B           1868
+#define VISION_GRAY_G           9617
+#define VISION_GRAY_R           4899
+// <<<<< Fixed point coefficients of OpenCV
+
+#define VISION_PYR_RING         5       // Rows of the 5x5 Gaussian kernel kept filtered
+
+namespace roboctrl
+{
+
+/** @brief SIMD kernels of the vision preprocessing (SSE2 or NEON if available).
+ *
+ * The images are processed a few rows at a time: the intermediate rows
+ * stay in the first level cache and each source row is read only once.
+ * The results are the same of the equivalent OpenCV 2.4 calls on 8 bit
+ * images: cv::cvtColor(CV_BGR2GRAY), cv::resize(INTER_AREA) halving the
+ * size and cv::pyrDown
+ */
+class QVisionKernels
+{
+public:
+    /** @brief Converts a BGR image to gray
+     */
+    static void bgrToGray( const cv::Mat& bgr, cv::Mat& gray );
+
+    /** @brief Converts a BGR image to gray at half size, as cv::cvtColor
+     *         followed by cv::resize(INTER_AREA), without the full size gray image
+     *
+     * @param rowBuf temporary gray rows, resized only if too small
+     */
+    static void bgrToGrayHalf( const cv::Mat& bgr, cv::Mat& gray, std::vector<uchar>& rowBuf );
+
+    /** @brief Halves a gray image averaging each 2x2 block
+     */
+    static void halve( const cv::Mat& src, cv::Mat& dst );
+
+    /** @brief Blurs a gray image with the 5x5 Gaussian kernel and halves it,
+     *         borders reflected (BORDER_REFLECT_101)
+     *
+     * @param ring rows filtered in horizontal, resized only if too small
+     */
+    static void pyrDown( const cv::Mat& src, cv::Mat& dst, std::vector<ushort>& ring );
+
+    // >>>>> Row kernels
+    static void bgrToGrayRow( const uchar* bgr, uchar* gray, int width );
+    static void halveRow( const uchar* row0, const uchar* row1, uchar* dst, int dstWidth );
+    static void pyrDownRowH( const uchar* src, int srcWidth, ushort* dst, int dstWidth );
+    static void pyrDownRowV( const ushort* const* rows, uchar* dst, int width );
+    // <<<<< Row kernels
+};
+
+}
+
+#endif // QVISIONKERNELS_H
@@ -0,0 +1,98 @@
+#ifndef QVISIONPREPROCESSOR_H
+#define QVISIONPREPROCESSOR_H
+
+#include <QtGlobal>
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+#include "qvisionkernels.h"
+
+#define VISION_DEFAULT_WIDTH        320     // Width of the first level of the pyramid
+#define VISION_PYR_LEVELS           3       // Levels of the Gaussian pyramid, the first included
+#define VISION_MAX_PYR_LEVELS       6
+#define VISION_FAST_THRESHOLD       20      // Intensity difference of the FAST corners
+#define VISION_MAX_CORNERS          300     // Strongest corners kept
+#define VISION_BENCH_ITERATIONS     100     // Runs of each function measured by the benchmark
+
+namespace roboctrl
+{
+
+/**
+  * @struct _VisionFrame
+  * @brief Result of the preprocessing of a frame
+  */
+typedef struct _VisionFrame
+{
+    quint8 camera;                      /**< Camera of the frame */
+    quint32 frameIdx;                   /**< Index of the frame in the camera stream */
+    quint64 captureUsec;                /**< Capture time on the monotonic clock of the server */
+    std::vector<cv::Mat> pyramid;       /**< Gray Gaussian pyramid, level 0 at the working size */
+    std::vector<cv::KeyPoint> corners;  /**< FAST corners of the level 0 */
+    double processMsec;                 /**< Time of the preprocessing */
+} VisionFrame;
+
+/** @brief Preprocessing of the frames for the vision algorithms running on
+ *         the robot: gray conversion, resize to the working size, Gaussian
+ *         pyramid and FAST corners.
+ *
+ * Gray conversion, halving and pyramid run on the SIMD kernels of
+ * @ref QVisionKernels; a camera at twice the working size is converted and
+ * halved in a single pass. The images of the result are reused at each
+ * frame: no memory is allocated while the size does not change.
+ * Not thread safe: each thread owns a preprocessor
+ */
+class QVisionPreprocessor
+{
+public:
+    QVisionPreprocessor( int width=VISION_DEFAULT_WIDTH, int levels=VISION_PYR_LEVELS,
+                         int fastThreshold=VISION_FAST_THRESHOLD );
+
+    /** @brief Width of the level 0, the height keeps the aspect ratio.
+     *         0 keeps the size of the frames
+     */
+    void setWorkingWidth( int width ){mWidth=qMax(0,width);}
+    int getWorkingWidth(){return mWidth;}
+
+    void setPyramidLevels( int levels ){mLevels=qBound(1,levels,VISION_MAX_PYR_LEVELS);}
+    int getPyramidLevels(){return mLevels;}
+
+    /** @brief FAST threshold, 0 disables the corner detection
+     */
+    void setFastThreshold( int threshold ){mFastThreshold=qMax(0,threshold);}
+    void setMaxCorners( int count ){mMaxCorners=qMax(1,count);}
+
+    /** @brief Preprocesses a frame
+     *
+     * @param image BGR or gray 8 bit image
+     * @param frame receives pyramid and corners, its images are reused
+     * @returns false if the image is empty or not 8 bit
+     */
+    bool process( const cv::Mat& image, VisionFrame& frame );
+
+    /** @brief Measures the kernels against the equivalent OpenCV calls on
+     *         an image and reports times, speedups and max differences with qDebug
+     */
+    static void benchmark( const cv::Mat& bgr, int iterations=VISION_BENCH_ITERATIONS );
+
+private:
+    /** @brief Gray image at the working size
+     */
+    void workingGray( const cv::Mat& image, cv::Mat& level0 );
+
+private:
+    int mWidth;                     ///< Width of the level 0
+    int mLevels;                    ///< Levels of the pyramid
+    int mFastThreshold;             ///< FAST threshold, 0 if disabled
+    int mMaxCorners;                ///< Strongest corners kept
+
+    cv::Mat mGray;                  ///< Gray image at the size of the frame, when it cannot be halved in a pass
+    std::vector<uchar> mRowBuf;     ///< Gray rows of the single pass conversion
+    std::vector<ushort> mRing;      ///< Filtered rows of the pyramid
+};
+
+}
+
+#endif // QVISIONPREPROCESSOR_H
@@ -0,0 +1,187 @@
+#ifndef QVISUALODOMETRY_H
+#define QVISUALODOMETRY_H
+
+#include <QtGlobal>
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "qvisionpreprocessor.h"
+
+// >>>>> Tracking
+#define VO_GRID_COLS                8       // Cells of the grid over the floor: a feature tracked in each cell
+#define VO_GRID_ROWS                4
+#define VO_LK_RADIUS                5       // Half size of the Lucas-Kanade window (11x11)
+#define VO_LK_MAX_ITER              10      // Iterations for each level of the pyramid
+#define VO_LK_EPSILON               0.03    // Update (pixels) stopping the iterations
+#define VO_LK_MIN_EIGEN             4.0     // Min eigenvalue of the gradient matrix for each pixel of the window: flat areas are not tracked
+#define VO_LK_MAX_RESIDUAL          16.0    // Max average intensity difference of a tracked window
+#define VO_MAX_DT_SEC               0.5     // Frames farther in time are not tracked
+// <<<<< Tracking
+
+// >>>>> Motion on the floor
+#define VO_MAX_GROUND_DIST_M        4.0     // Farther features are too inaccurate for the motion
+#define VO_MIN_INLIERS              6       // Features needed for a vision estimate
+#define VO_INLIER_THRESHOLD_M       0.01    // Min distance of an outlier from the fitted motion
+// <<<<< Motion on the floor
+
+// >>>>> Default camera and robot geometry
+#define VO_DEFAULT_HFOV_DEG         60.0    // Horizontal field of view
+#define VO_DEFAULT_CAM_HEIGHT_M     0.25    // Height of the camera from the floor
+#define VO_DEFAULT_CAM_TILT_DEG     20.0    // Camera looking down from the horizon
+#define VO_DEFAULT_CAM_OFFSET_M     0.10    // Camera ahead of the wheel axis
+#define VO_DEFAULT_WHEELBASE_M      0.34    // Default of RobotConfiguration::WheelBase
+// <<<<< Default camera and robot geometry
+
+// >>>>> Fusion
+#define VO_ENC_LINEAR_STD           0.01    // Noise of the encoder speeds (m/sec)
+#define VO_ENC_ANGULAR_STD          0.05    // (rad/sec)
+#define VO_VIS_LINEAR_STD           0.03    // Noise of the vision speeds with VO_MIN_INLIERS features (m/sec)
+#define VO_VIS_ANGULAR_STD          0.05    // (rad/sec)
+#define VO_LINEAR_ACCEL_STD         1.0     // Changes of the speeds between two frames (m/sec^2)
+#define VO_ANGULAR_ACCEL_STD        3.0     // (rad/sec^2)
+#define VO_SLIP_GATE                3.0     // Encoders and camera disagreeing by more standard deviations: the wheels are slipping
+#define VO_SLIP_VAR_SCALE           100.0   // Encoder variance while slipping
+// <<<<< Fusion
+
+namespace roboctrl
+{
+
+/**
+  * @struct _VisionCameraModel
+  * @brief Position of the camera on the robot, used to measure the motion on the floor
+  */
+typedef struct _VisionCameraModel
+{
+    double hfovDeg;         /**< Horizontal field of view (degrees), square pixels and centered optical axis */
+    double heightM;         /**< Height of the camera from the floor (m) */
+    double tiltDeg;         /**< Angle of the optical axis below the horizon (degrees) */
+    double forwardOffsetM;  /**< Distance of the camera ahead of the wheel axis (m) */
+} VisionCameraModel;
+
+/**
+  * @struct _OdometryEstimate
+  * @brief Motion of the robot at the capture of a frame
+  */
+typedef struct _OdometryEstimate
+{
+    bool valid;                 /**< The filter received at least a measurement */
+    double linearSpeed;         /**< Fused forward speed (m/sec) */
+    double angularSpeed;        /**< Fused yaw rate (rad/sec, counterclockwise) */
+
+    bool encoderValid;          /**< The frame carried the wheel speeds */
+    double encoderLinearSpeed;  /**< Forward speed of the wheels (m/sec) */
+    double encoderAngularSpeed; /**< Yaw rate of the wheels (rad/sec) */
+
+    bool visionValid;           /**< Enough features have been tracked on the floor */
+    double visionLinearSpeed;   /**< Forward speed measured by the camera (m/sec) */
+    double visionAngularSpeed;  /**< Yaw rate measured by the camera (rad/sec) */
+
+    bool slipping;              /**< Encoders and camera disagree: the encoders are ignored */
+    int tracked;                /**< Features tracked from the previous frame */
+    int inliers;                /**< Features agreeing with the motion measured */
+    double processMsec;         /**< Time of preprocessing and odometry of the frame */
+    quint64 captureUsec;        /**< Capture time of the frame */
+} OdometryEstimate;
+
+/** @brief Visual odometry assist: measures the motion of the robot tracking
+ *         the floor between consecutive frames and fuses it with the
+ *         speeds of the wheel encoders.
+ *
+ * Each frame a feature is chosen in each cell of a fixed grid over the floor
+ * (the strongest FAST corner, or the center of the cell) and tracked on the
+ * next frame by pyramidal Lucas-Kanade on the pyramid of @ref VisionFrame,
+ * so the cost of a frame is bounded by @ref VO_GRID_COLS * @ref VO_GRID_ROWS
+ * windows. The features are projected on the floor with the camera model and
+ * the rigid motion between the two sets gives forward speed and yaw rate.
+ *
+ * A Kalman filter for each speed fuses encoders and camera: when they
+ * disagree beyond @ref VO_SLIP_GATE the wheels are slipping and the
+ * estimate follows the camera.
+ * Motor 0 is the left wheel, motor 1 the right one.
+ * Not thread safe
+ */
+class QVisualOdometry
+{
+public:
+    QVisualOdometry();
+
+    void setCameraModel( const VisionCameraModel& model ){mCamera=model;}
+    VisionCameraModel getCameraModel(){return mCamera;}
+
+    /** @brief Distance between the wheels (m)
+     */
+    void setWheelBase( double wheelBaseM ){if(wheelBaseM>0.0) mWheelBase=wheelBaseM;}
+    double getWheelBase(){return mWheelBase;}
+
+    /** @brief Forgets the previous frame and the state of the filter
+     */
+    void reset();
+
+    /** @brief Updates the estimate with a new frame of the same camera
+     *
+     * @param frame preprocessed frame, with pyramid and corners
+     * @param encoderValid the wheel speeds have been read
+     * @param speed0 speed of motor 0 at the capture of the frame (m/sec)
+     * @param speed1 speed of motor 1 at the capture of the frame (m/sec)
+     * @param estimate receives the estimate
+     * @returns the validity of the estimate
+     */
+    bool update( const VisionFrame& frame, bool encoderValid, double speed0, double speed1,
+                 OdometryEstimate& estimate );
+
+private:
+    /** @brief Chooses a feature for each cell of the floor, to be tracked on the next frame
+     */
+    void selectFeatures( const VisionFrame& frame );
+
+    /** @brief Tracks a feature of the previous pyramid on the current one
+     *
+     * @returns false if the feature is lost or not trackable
+     */
+    bool trackFeature( const std::vector<cv::Mat>& pyramid, const cv::Point2f& pt, cv::Point2f& tracked );
+
+    /** @brief Projects a pixel of the level 0 on the floor, in the frame of the robot
+     *         (x forward, y left, origin on the wheel axis)
+     *
+     * @returns false if the pixel is above the horizon or too far
+     */
+    bool groundPoint( const cv::Point2f& px, int width, int height, cv::Point2d& ground );
+
+    /** @brief Least squares rigid motion of the floor points, repeated
+     *         without the outliers
+     *
+     * @returns the inliers of the motion
+     */
+    int estimateMotion( double& dx, double& dYaw );
+
+    /** @brief Scalar Kalman update of a speed, initializes it at the first measure
+     */
+    void fuse( int axis, double measure, double variance );
+
+private:
+    VisionCameraModel mCamera;      ///< Camera on the robot
+    double mWheelBase;              ///< Distance between the wheels (m)
+
+    // >>>>> Tracking
+    bool mHasPrev;                          ///< @ref mPrevPyramid holds the previous frame
+    std::vector<cv::Mat> mPrevPyramid;      ///< Pyramid of the previous frame
+    std::vector<cv::Point2f> mPrevFeatures; ///< Features of the previous frame
+    quint64 mPrevUsec;                      ///< Capture time of the previous frame
+    std::vector<cv::Point2d> mPrevGround;   ///< Floor points of the tracked features, previous frame
+    std::vector<cv::Point2d> mCurGround;    ///< Floor points of the tracked features, current frame
+    std::vector<uchar> mInlier;             ///< The floor point agrees with the motion
+    std::vector<double> mResidual;          ///< Distance of each floor point from the fitted motion
+    std::vector<double> mSortedResidual;    ///< Partially sorted copy of @ref mResidual for the median
+    // <<<<< Tracking
+
+    // >>>>> Filter: [0] forward speed, [1] yaw rate
+    double mState[2];           ///< Speeds estimated
+    double mVariance[2];        ///< Variances of the speeds, negative before the first measure
+    // <<<<< Filter
+};
+
+}
+
+#endif // QVISUALODOMETRY_H
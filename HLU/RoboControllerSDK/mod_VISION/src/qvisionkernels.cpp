@@ -0,0 +1,351 @@
+#include "qvisionkernels.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#ifdef VISION_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef VISION_NEON
+#include <arm_neon.h>
+#endif
+
+namespace roboctrl
+{
+
+/** @brief Index of a pixel outside the image reflected inside it (BORDER_REFLECT_101)
+ */
+static inline int reflect101( int idx, int size )
+{
+    if( size==1 )
+        return 0;
+
+    while( idx<0 || idx>=size )
+    {
+        if( idx<0 )
+            idx = -idx;
+        else
+            idx = 2*size-2-idx;
+    }
+
+    return idx;
+}
+
+// >>>>> Row kernels
+void QVisionKernels::bgrToGrayRow( const uchar* bgr, uchar* gray, int width )
+{
+    int x = 0;
+
+#if defined(VISION_SSE2)
+    // Coefficient pairs for _mm_madd_epi16: (B,G) and (R,rounding)
+    const __m128i coefBG = _mm_set1_epi32( (VISION_GRAY_G<<16) | VISION_GRAY_B );
+    const __m128i coefR = _mm_set1_epi32( ((1<<(VISION_GRAY_SHIFT-1))<<16) | VISION_GRAY_R );
+    const __m128i one = _mm_set1_epi16( 1 );
+    const __m128i zero = _mm_setzero_si128();
+
+    for( ; x+32<=width; x+=32 )
+    {
+        __m128i v[6];
+        for( int i=0; i<6; i++ )
+            v[i] = _mm_loadu_si128( (const __m128i*)(bgr+3*x+16*i) );
+
+        // Five perfect shuffles of the 96 bytes move the byte 3*p+c to
+        // 32*c+p: B, G and R of the 32 pixels end up in separate registers
+        for( int l=0; l<5; l++ )
+        {
+            __m128i t[6];
+            for( int i=0; i<3; i++ )
+            {
+                t[2*i] = _mm_unpacklo_epi8( v[i], v[i+3] );
+                t[2*i+1] = _mm_unpackhi_epi8( v[i], v[i+3] );
+            }
+            for( int i=0; i<6; i++ )
+                v[i] = t[i];
+        }
+
+        for( int h=0; h<2; h++ )
+        {
+            __m128i y16[2];
+            for( int half=0; half<2; half++ )
+            {
+                __m128i b = half?_mm_unpackhi_epi8( v[h], zero ):_mm_unpacklo_epi8( v[h], zero );
+                __m128i g = half?_mm_unpackhi_epi8( v[2+h], zero ):_mm_unpacklo_epi8( v[2+h], zero );
+                __m128i r = half?_mm_unpackhi_epi8( v[4+h], zero ):_mm_unpacklo_epi8( v[4+h], zero );
+
+                __m128i lo = _mm_add_epi32( _mm_madd_epi16( _mm_unpacklo_epi16( b, g ), coefBG ),
+                                            _mm_madd_epi16( _mm_unpacklo_epi16( r, one ), coefR ) );
+                __m128i hi = _mm_add_epi32( _mm_madd_epi16( _mm_unpackhi_epi16( b, g ), coefBG ),
+                                            _mm_madd_epi16( _mm_unpackhi_epi16( r, one ), coefR ) );
+
+                y16[half] = _mm_packs_epi32( _mm_srai_epi32( lo, VISION_GRAY_SHIFT ),
+                                             _mm_srai_epi32( hi, VISION_GRAY_SHIFT ) );
+            }
+
+            _mm_storeu_si128( (__m128i*)(gray+x+16*h), _mm_packus_epi16( y16[0], y16[1] ) );
+        }
+    }
+#elif defined(VISION_NEON)
+    for( ; x+16<=width; x+=16 )
+    {
+        uint8x16x3_t v = vld3q_u8( bgr+3*x ); // Deinterleaved on load
+
+        uint16x8_t b[2] = { vmovl_u8( vget_low_u8( v.val[0] ) ), vmovl_u8( vget_high_u8( v.val[0] ) ) };
+        uint16x8_t g[2] = { vmovl_u8( vget_low_u8( v.val[1] ) ), vmovl_u8( vget_high_u8( v.val[1] ) ) };
+        uint16x8_t r[2] = { vmovl_u8( vget_low_u8( v.val[2] ) ), vmovl_u8( vget_high_u8( v.val[2] ) ) };
+
+        uint16x8_t y16[2];
+        for( int h=0; h<2; h++ )
+        {
+            uint32x4_t lo = vmull_n_u16( vget_low_u16( b[h] ), VISION_GRAY_B );
+            lo = vmlal_n_u16( lo, vget_low_u16( g[h] ), VISION_GRAY_G );
+            lo = vmlal_n_u16( lo, vget_low_u16( r[h] ), VISION_GRAY_R );
+
+            uint32x4_t hi = vmull_n_u16( vget_high_u16( b[h] ), VISION_GRAY_B );
+            hi = vmlal_n_u16( hi, vget_high_u16( g[h] ), VISION_GRAY_G );
+            hi = vmlal_n_u16( hi, vget_high_u16( r[h] ), VISION_GRAY_R );
+
+            // Rounding shift: (sum + 2^13) >> 14
+            y16[h] = vcombine_u16( vrshrn_n_u32( lo, VISION_GRAY_SHIFT ), vrshrn_n_u32( hi, VISION_GRAY_SHIFT ) );
+        }
+
+        vst1q_u8( gray+x, vcombine_u8( vmovn_u16( y16[0] ), vmovn_u16( y16[1] ) ) );
+    }
+#endif
+
+    // Tail, or the whole row without SIMD
+    for( ; x<width; x++ )
+    {
+        const uchar* p = bgr+3*x;
+        gray[x] = (uchar)((p[0]*VISION_GRAY_B + p[1]*VISION_GRAY_G + p[2]*VISION_GRAY_R +
+                           (1<<(VISION_GRAY_SHIFT-1))) >> VISION_GRAY_SHIFT);
+    }
+}
+
+void QVisionKernels::halveRow( const uchar* row0, const uchar* row1, uchar* dst, int dstWidth )
+{
+    int x = 0;
+
+#if defined(VISION_SSE2)
+    const __m128i mask = _mm_set1_epi16( 0x00FF );
+    const __m128i two = _mm_set1_epi16( 2 );
+
+    for( ; x+16<=dstWidth; x+=16 )
+    {
+        __m128i s[2];
+        for( int h=0; h<2; h++ )
+        {
+            __m128i a = _mm_loadu_si128( (const __m128i*)(row0+2*x+16*h) );
+            __m128i b = _mm_loadu_si128( (const __m128i*)(row1+2*x+16*h) );
+
+            // Even plus odd bytes of both rows
+            __m128i sum = _mm_add_epi16( _mm_add_epi16( _mm_and_si128( a, mask ), _mm_srli_epi16( a, 8 ) ),
+                                         _mm_add_epi16( _mm_and_si128( b, mask ), _mm_srli_epi16( b, 8 ) ) );
+            s[h] = _mm_srli_epi16( _mm_add_epi16( sum, two ), 2 );
+        }
+
+        _mm_storeu_si128( (__m128i*)(dst+x), _mm_packus_epi16( s[0], s[1] ) );
+    }
+#elif defined(VISION_NEON)
+    for( ; x+16<=dstWidth; x+=16 )
+    {
+        uint16x8_t lo = vaddq_u16( vpaddlq_u8( vld1q_u8( row0+2*x ) ), vpaddlq_u8( vld1q_u8( row1+2*x ) ) );
+        uint16x8_t hi = vaddq_u16( vpaddlq_u8( vld1q_u8( row0+2*x+16 ) ), vpaddlq_u8( vld1q_u8( row1+2*x+16 ) ) );
+
+        // Rounding shift: (sum + 2) >> 2
+        vst1q_u8( dst+x, vcombine_u8( vrshrn_n_u16( lo, 2 ), vrshrn_n_u16( hi, 2 ) ) );
+    }
+#endif
+
+    for( ; x<dstWidth; x++ )
+        dst[x] = (uchar)((row0[2*x] + row0[2*x+1] + row1[2*x] + row1[2*x+1] + 2) >> 2);
+}
+
+void QVisionKernels::pyrDownRowH( const uchar* src, int srcWidth, ushort* dst, int dstWidth )
+{
+    // dst[x] = [1 4 6 4 1] centered on src[2x]. The vectors need 2x-2 >= 0 and 2x+17 < srcWidth
+    int x = 0;
+
+    if( dstWidth>0 )
+    {
+        dst[0] = src[reflect101(-2,srcWidth)] + 4*(src[reflect101(-1,srcWidth)] + src[reflect101(1,srcWidth)]) +
+                6*src[0] + src[reflect101(2,srcWidth)];
+        x = 1;
+    }
+
+#if defined(VISION_SSE2)
+    const __m128i mask = _mm_set1_epi16( 0x00FF );
+
+    for( ; x+8<=dstWidth && 2*x+17<srcWidth; x+=8 )
+    {
+        // Lanes: src[2(x+k)-2] and src[2(x+k)-1], src[2(x+k)] and src[2(x+k)+1], src[2(x+k)+2]
+        __m128i m = _mm_loadu_si128( (const __m128i*)(src+2*x-2) );
+        __m128i c = _mm_loadu_si128( (const __m128i*)(src+2*x) );
+        __m128i p = _mm_loadu_si128( (const __m128i*)(src+2*x+2) );
+
+        __m128i center = _mm_and_si128( c, mask );
+        __m128i sum = _mm_add_epi16( _mm_and_si128( m, mask ), _mm_and_si128( p, mask ) );
+        sum = _mm_add_epi16( sum, _mm_slli_epi16( _mm_add_epi16( _mm_srli_epi16( m, 8 ), _mm_srli_epi16( c, 8 ) ), 2 ) );
+        sum = _mm_add_epi16( sum, _mm_add_epi16( _mm_slli_epi16( center, 2 ), _mm_slli_epi16( center, 1 ) ) );
+
+        _mm_storeu_si128( (__m128i*)(dst+x), sum );
+    }
+#elif defined(VISION_NEON)
+    const uint16x8_t mask = vdupq_n_u16( 0x00FF );
+
+    for( ; x+8<=dstWidth && 2*x+17<srcWidth; x+=8 )
+    {
+        uint16x8_t m = vreinterpretq_u16_u8( vld1q_u8( src+2*x-2 ) );
+        uint16x8_t c = vreinterpretq_u16_u8( vld1q_u8( src+2*x ) );
+        uint16x8_t p = vreinterpretq_u16_u8( vld1q_u8( src+2*x+2 ) );
+
+        uint16x8_t center = vandq_u16( c, mask );
+        uint16x8_t sum = vaddq_u16( vandq_u16( m, mask ), vandq_u16( p, mask ) );
+        sum = vaddq_u16( sum, vshlq_n_u16( vaddq_u16( vshrq_n_u16( m, 8 ), vshrq_n_u16( c, 8 ) ), 2 ) );
+        sum = vaddq_u16( sum, vaddq_u16( vshlq_n_u16( center, 2 ), vshlq_n_u16( center, 1 ) ) );
+
+        vst1q_u16( dst+x, sum );
+    }
+#endif
+
+    // Tail with the right border
+    for( ; x<dstWidth; x++ )
+    {
+        int sx = 2*x;
+        dst[x] = src[reflect101(sx-2,srcWidth)] + 4*(src[reflect101(sx-1,srcWidth)] + src[reflect101(sx+1,srcWidth)]) +
+                6*src[reflect101(sx,srcWidth)] + src[reflect101(sx+2,srcWidth)];
+    }
+}
+
+void QVisionKernels::pyrDownRowV( const ushort* const* rows, uchar* dst, int width )
+{
+    const ushort* r0 = rows[0];
+    const ushort* r1 = rows[1];
+    const ushort* r2 = rows[2];
+    const ushort* r3 = rows[3];
+    const ushort* r4 = rows[4];
+
+    // 256*255 at most: the sums fit in 16 bit
+    int x = 0;
+
+#if defined(VISION_SSE2)
+    const __m128i round = _mm_set1_epi16( 128 );
+
+    for( ; x+16<=width; x+=16 )
+    {
+        __m128i s[2];
+        for( int h=0; h<2; h++ )
+        {
+            int i = x+8*h;
+            __m128i c = _mm_loadu_si128( (const __m128i*)(r2+i) );
+
+            __m128i sum = _mm_add_epi16( _mm_loadu_si128( (const __m128i*)(r0+i) ), _mm_loadu_si128( (const __m128i*)(r4+i) ) );
+            sum = _mm_add_epi16( sum, _mm_slli_epi16( _mm_add_epi16( _mm_loadu_si128( (const __m128i*)(r1+i) ),
+                                                                     _mm_loadu_si128( (const __m128i*)(r3+i) ) ), 2 ) );
+            sum = _mm_add_epi16( sum, _mm_add_epi16( _mm_slli_epi16( c, 2 ), _mm_slli_epi16( c, 1 ) ) );
+
+            s[h] = _mm_srli_epi16( _mm_add_epi16( sum, round ), 8 );
+        }
+
+        _mm_storeu_si128( (__m128i*)(dst+x), _mm_packus_epi16( s[0], s[1] ) );
+    }
+#elif defined(VISION_NEON)
+    for( ; x+8<=width; x+=8 )
+    {
+        uint16x8_t c = vld1q_u16( r2+x );
+
+        uint16x8_t sum = vaddq_u16( vld1q_u16( r0+x ), vld1q_u16( r4+x ) );
+        sum = vaddq_u16( sum, vshlq_n_u16( vaddq_u16( vld1q_u16( r1+x ), vld1q_u16( r3+x ) ), 2 ) );
+        sum = vaddq_u16( sum, vaddq_u16( vshlq_n_u16( c, 2 ), vshlq_n_u16( c, 1 ) ) );
+
+        // Rounding shift: (sum + 128) >> 8
+        vst1_u8( dst+x, vrshrn_n_u16( sum, 8 ) );
+    }
+#endif
+
+    for( ; x<width; x++ )
+        dst[x] = (uchar)((r0[x] + r4[x] + 4*(r1[x] + r3[x]) + 6*r2[x] + 128) >> 8);
+}
+// <<<<< Row kernels
+
+// >>>>> Image kernels
+void QVisionKernels::bgrToGray( const cv::Mat& bgr, cv::Mat& gray )
+{
+    if( bgr.type()!=CV_8UC3 )
+    {
+        if( bgr.type()==CV_8UC1 )
+            bgr.copyTo( gray );
+        else
+            cv::cvtColor( bgr, gray, CV_BGR2GRAY );
+        return;
+    }
+
+    gray.create( bgr.rows, bgr.cols, CV_8UC1 );
+
+    for( int y=0; y<bgr.rows; y++ )
+        bgrToGrayRow( bgr.ptr(y), gray.ptr(y), bgr.cols );
+}
+
+void QVisionKernels::bgrToGrayHalf( const cv::Mat& bgr, cv::Mat& gray, std::vector<uchar>& rowBuf )
+{
+    CV_Assert( bgr.type()==CV_8UC3 );
+
+    int width = bgr.cols/2;
+    int height = bgr.rows/2;
+    gray.create( height, width, CV_8UC1 );
+
+    if( rowBuf.size() < (size_t)(2*bgr.cols) )
+        rowBuf.resize( 2*bgr.cols );
+
+    uchar* row0 = &rowBuf[0];
+    uchar* row1 = row0 + bgr.cols;
+
+    // Two gray rows in cache for each output row
+    for( int y=0; y<height; y++ )
+    {
+        bgrToGrayRow( bgr.ptr(2*y), row0, bgr.cols );
+        bgrToGrayRow( bgr.ptr(2*y+1), row1, bgr.cols );
+        halveRow( row0, row1, gray.ptr(y), width );
+    }
+}
+
+void QVisionKernels::halve( const cv::Mat& src, cv::Mat& dst )
+{
+    CV_Assert( src.type()==CV_8UC1 );
+
+    int width = src.cols/2;
+    int height = src.rows/2;
+    dst.create( height, width, CV_8UC1 );
+
+    for( int y=0; y<height; y++ )
+        halveRow( src.ptr(2*y), src.ptr(2*y+1), dst.ptr(y), width );
+}
+
+void QVisionKernels::pyrDown( const cv::Mat& src, cv::Mat& dst, std::vector<ushort>& ring )
+{
+    CV_Assert( src.type()==CV_8UC1 && !src.empty() );
+
+    int width = (src.cols+1)/2;
+    int height = (src.rows+1)/2;
+    dst.create( height, width, CV_8UC1 );
+
+    if( ring.size() < (size_t)(VISION_PYR_RING*width) )
+        ring.resize( VISION_PYR_RING*width );
+
+    // The source row sy is filtered once in the slot (sy+2)%VISION_PYR_RING
+    int nextRow = -2;
+    const ushort* rows[VISION_PYR_RING];
+
+    for( int y=0; y<height; y++ )
+    {
+        for( ; nextRow<=2*y+2; nextRow++ )
+            pyrDownRowH( src.ptr( reflect101( nextRow, src.rows ) ), src.cols,
+                         &ring[((nextRow+2)%VISION_PYR_RING)*width], width );
+
+        for( int k=0; k<VISION_PYR_RING; k++ )
+            rows[k] = &ring[((2*y+k)%VISION_PYR_RING)*width];
+
+        pyrDownRowV( rows, dst.ptr(y), width );
+    }
+}
+// <<<<< Image kernels
+
+}
@@ -0,0 +1,220 @@
+#include "qvisionpreprocessor.h"
+#include <QDebug>
+#include <QObject>
+#include <QElapsedTimer>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+namespace roboctrl
+{
+
+QVisionPreprocessor::QVisionPreprocessor( int width/*=VISION_DEFAULT_WIDTH*/, int levels/*=VISION_PYR_LEVELS*/,
+                                          int fastThreshold/*=VISION_FAST_THRESHOLD*/ ) :
+    mMaxCorners(VISION_MAX_CORNERS)
+{
+    setWorkingWidth( width );
+    setPyramidLevels( levels );
+    setFastThreshold( fastThreshold );
+}
+
+void QVisionPreprocessor::workingGray( const cv::Mat& image, cv::Mat& level0 )
+{
+    int width = (mWidth>0)?mWidth:image.cols;
+    bool color = image.channels()!=1;
+
+    // >>>>> Single pass: a row pair of the frame for each row of the level 0
+    if( image.type()==CV_8UC3 && image.cols==2*width && image.rows%2==0 )
+    {
+        QVisionKernels::bgrToGrayHalf( image, level0, mRowBuf );
+        return;
+    }
+    // <<<<< Single pass
+
+    if( image.cols==width )
+    {
+        if( color )
+            QVisionKernels::bgrToGray( image, level0 );
+        else
+            image.copyTo( level0 );
+        return;
+    }
+
+    const cv::Mat* gray = &image;
+    if( color )
+    {
+        QVisionKernels::bgrToGray( image, mGray );
+        gray = &mGray;
+    }
+
+    if( gray->cols==2*width && gray->rows%2==0 )
+        QVisionKernels::halve( *gray, level0 );
+    else
+    {
+        int height = qMax( 1, qRound( (double)gray->rows*width/gray->cols ) );
+        cv::resize( *gray, level0, cv::Size( width, height ), 0, 0, cv::INTER_AREA );
+    }
+}
+
+bool QVisionPreprocessor::process( const cv::Mat& image, VisionFrame& frame )
+{
+    if( image.empty() || image.depth()!=CV_8U )
+        return false;
+
+    QElapsedTimer chrono;
+    chrono.start();
+
+    frame.pyramid.resize( mLevels );
+
+    workingGray( image, frame.pyramid[0] );
+    for( int l=1; l<mLevels; l++ )
+        QVisionKernels::pyrDown( frame.pyramid[l-1], frame.pyramid[l], mRing );
+
+    // >>>>> Corners
+    frame.corners.clear();
+    if( mFastThreshold>0 )
+    {
+        cv::FAST( frame.pyramid[0], frame.corners, mFastThreshold, true );
+
+        if( (int)frame.corners.size() > mMaxCorners )
+            cv::KeyPointsFilter::retainBest( frame.corners, mMaxCorners );
+    }
+    // <<<<< Corners
+
+    frame.processMsec = chrono.nsecsElapsed()/1000000.0;
+
+    return true;
+}
+
+/** @brief Prints the times of a kernel and of the equivalent OpenCV call
+ */
+static void reportBenchmark( QString name, qint64 kernelNsec, qint64 opencvNsec, int iterations, double maxDiff )
+{
+    double kernelMsec = kernelNsec/1000000.0/iterations;
+    double opencvMsec = opencvNsec/1000000.0/iterations;
+
+    qDebug() << QObject::tr("Vision benchmark %1 - Kernels: %2 msec - OpenCV: %3 msec - Speedup: %4x - Max difference: %5")
+                .arg(name, -12)
+                .arg(kernelMsec, 0, 'f', 3)
+                .arg(opencvMsec, 0, 'f', 3)
+                .arg(kernelMsec>0.0?opencvMsec/kernelMsec:0.0, 0, 'f', 2)
+                .arg(maxDiff, 0, 'f', 0);
+}
+
+void QVisionPreprocessor::benchmark( const cv::Mat& bgr, int iterations/*=VISION_BENCH_ITERATIONS*/ )
+{
+    if( bgr.type()!=CV_8UC3 || bgr.cols<4 || bgr.rows<4 || iterations<1 )
+        return;
+
+#if defined(VISION_SSE2)
+    QString simd = QObject::tr("SSE2");
+#elif defined(VISION_NEON)
+    QString simd = QObject::tr("NEON");
+#else
+    QString simd = QObject::tr("none");
+#endif
+    qDebug() << QObject::tr("Vision benchmark on %1x%2 - SIMD: %3 - Iterations: %4")
+                .arg(bgr.cols).arg(bgr.rows).arg(simd).arg(iterations);
+
+    // Even size: the halving is the exact 2x2 average also for OpenCV
+    cv::Mat image = bgr( cv::Rect( 0, 0, bgr.cols&~1, bgr.rows&~1 ) );
+    cv::Size half( image.cols/2, image.rows/2 );
+
+    cv::Mat gray, grayCv, small, smallCv, down, downCv;
+    std::vector<uchar> rowBuf;
+    std::vector<ushort> ring;
+    QElapsedTimer chrono;
+    qint64 kernelNsec, opencvNsec;
+
+    // >>>>> Gray conversion
+    chrono.start();
+    for( int i=0; i<iterations; i++ )
+        QVisionKernels::bgrToGray( image, gray );
+    kernelNsec = chrono.nsecsElapsed();
+
+    chrono.restart();
+    for( int i=0; i<iterations; i++ )
+        cv::cvtColor( image, grayCv, CV_BGR2GRAY );
+    opencvNsec = chrono.nsecsElapsed();
+
+    reportBenchmark( QObject::tr("gray"), kernelNsec, opencvNsec, iterations, cv::norm( gray, grayCv, cv::NORM_INF ) );
+    // <<<<< Gray conversion
+
+    // >>>>> Halving
+    chrono.restart();
+    for( int i=0; i<iterations; i++ )
+        QVisionKernels::halve( gray, small );
+    kernelNsec = chrono.nsecsElapsed();
+
+    chrono.restart();
+    for( int i=0; i<iterations; i++ )
+        cv::resize( grayCv, smallCv, half, 0, 0, cv::INTER_AREA );
+    opencvNsec = chrono.nsecsElapsed();
+
+    reportBenchmark( QObject::tr("halve"), kernelNsec, opencvNsec, iterations, cv::norm( small, smallCv, cv::NORM_INF ) );
+    // <<<<< Halving
+
+    // >>>>> Gray conversion and halving in a pass
+    chrono.restart();
+    for( int i=0; i<iterations; i++ )
+        QVisionKernels::bgrToGrayHalf( image, small, rowBuf );
+    kernelNsec = chrono.nsecsElapsed();
+
+    chrono.restart();
+    for( int i=0; i<iterations; i++ )
+    {
+        cv::cvtColor( image, grayCv, CV_BGR2GRAY );
+        cv::resize( grayCv, smallCv, half, 0, 0, cv::INTER_AREA );
+    }
+    opencvNsec = chrono.nsecsElapsed();
+
+    reportBenchmark( QObject::tr("gray+halve"), kernelNsec, opencvNsec, iterations, cv::norm( small, smallCv, cv::NORM_INF ) );
+    // <<<<< Gray conversion and halving in a pass
+
+    // >>>>> Pyramid level
+    chrono.restart();
+    for( int i=0; i<iterations; i++ )
+        QVisionKernels::pyrDown( gray, down, ring );
+    kernelNsec = chrono.nsecsElapsed();
+
+    chrono.restart();
+    for( int i=0; i<iterations; i++ )
+        cv::pyrDown( grayCv, downCv );
+    opencvNsec = chrono.nsecsElapsed();
+
+    reportBenchmark( QObject::tr("pyrDown"), kernelNsec, opencvNsec, iterations, cv::norm( down, downCv, cv::NORM_INF ) );
+    // <<<<< Pyramid level
+
+    // >>>>> Whole preprocessing at half size
+    QVisionPreprocessor preproc( half.width );
+    VisionFrame frame;
+
+    chrono.restart();
+    for( int i=0; i<iterations; i++ )
+        preproc.process( image, frame );
+    kernelNsec = chrono.nsecsElapsed();
+
+    std::vector<cv::Mat> pyramidCv;
+    std::vector<cv::KeyPoint> cornersCv;
+    chrono.restart();
+    for( int i=0; i<iterations; i++ )
+    {
+        cv::cvtColor( image, grayCv, CV_BGR2GRAY );
+        cv::resize( grayCv, smallCv, half, 0, 0, cv::INTER_AREA );
+        cv::buildPyramid( smallCv, pyramidCv, VISION_PYR_LEVELS-1 );
+        cv::FAST( pyramidCv[0], cornersCv, VISION_FAST_THRESHOLD, true );
+        if( (int)cornersCv.size() > VISION_MAX_CORNERS )
+            cv::KeyPointsFilter::retainBest( cornersCv, VISION_MAX_CORNERS );
+    }
+    opencvNsec = chrono.nsecsElapsed();
+
+    double maxDiff = 0.0;
+    for( int l=0; l<VISION_PYR_LEVELS && l<(int)pyramidCv.size(); l++ )
+        maxDiff = qMax( maxDiff, cv::norm( frame.pyramid[l], pyramidCv[l], cv::NORM_INF ) );
+
+    reportBenchmark( QObject::tr("preprocess"), kernelNsec, opencvNsec, iterations, maxDiff );
+    qDebug() << QObject::tr("Vision benchmark corners - Kernels: %1 - OpenCV: %2")
+                .arg((int)frame.corners.size()).arg((int)cornersCv.size());
+    // <<<<< Whole preprocessing at half size
+}
+
+}
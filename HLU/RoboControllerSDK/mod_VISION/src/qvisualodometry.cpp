@@ -0,0 +1,499 @@
+#include "qvisualodometry.h"
+#include <QElapsedTimer>
+
+#include <cmath>
+#include <algorithm>
+
+#define VO_LK_SIDE      (2*VO_LK_RADIUS+1)
+#define VO_LK_AREA      (VO_LK_SIDE*VO_LK_SIDE)
+#define VO_PATCH_SIDE   (VO_LK_SIDE+2)      // Window with the border for the gradients
+
+namespace roboctrl
+{
+
+/** @brief Samples a square window centered on a subpixel position with
+ *         bilinear interpolation (the same weights for all the pixels)
+ *
+ * @returns false if the window is not inside the image
+ */
+static inline bool sampleWindow( const cv::Mat& img, float x, float y, int radius, float* out )
+{
+    int x0 = cvFloor( x );
+    int y0 = cvFloor( y );
+
+    if( x0-radius<0 || y0-radius<0 || x0+radius+1>=img.cols || y0+radius+1>=img.rows )
+        return false;
+
+    float ax = x-x0;
+    float ay = y-y0;
+    float w00 = (1.0f-ax)*(1.0f-ay);
+    float w01 = ax*(1.0f-ay);
+    float w10 = (1.0f-ax)*ay;
+    float w11 = ax*ay;
+
+    int side = 2*radius+1;
+    for( int r=0; r<side; r++ )
+    {
+        const uchar* row0 = img.ptr<uchar>( y0-radius+r ) + x0-radius;
+        const uchar* row1 = row0 + img.step;
+        float* dst = out + r*side;
+
+        for( int c=0; c<side; c++ )
+            dst[c] = w00*row0[c] + w01*row0[c+1] + w10*row1[c] + w11*row1[c+1];
+    }
+
+    return true;
+}
+
+QVisualOdometry::QVisualOdometry() :
+    mWheelBase(VO_DEFAULT_WHEELBASE_M)
+{
+    mCamera.hfovDeg = VO_DEFAULT_HFOV_DEG;
+    mCamera.heightM = VO_DEFAULT_CAM_HEIGHT_M;
+    mCamera.tiltDeg = VO_DEFAULT_CAM_TILT_DEG;
+    mCamera.forwardOffsetM = VO_DEFAULT_CAM_OFFSET_M;
+
+    reset();
+}
+
+void QVisualOdometry::reset()
+{
+    mHasPrev = false;
+    mPrevFeatures.clear();
+    mPrevUsec = 0;
+
+    for( int a=0; a<2; a++ )
+    {
+        mState[a] = 0.0;
+        mVariance[a] = -1.0;
+    }
+}
+
+void QVisualOdometry::selectFeatures( const VisionFrame& frame )
+{
+    mPrevFeatures.clear();
+
+    const cv::Mat& level0 = frame.pyramid[0];
+    int width = level0.cols;
+    int height = level0.rows;
+    int margin = VO_LK_RADIUS+2;
+
+    // >>>>> Floor rows: from the farthest distance used to the bottom of the image
+    double tilt = mCamera.tiltDeg*CV_PI/180.0;
+    double focal = 0.5*width/tan( 0.5*mCamera.hfovDeg*CV_PI/180.0 );
+    double farB = ( mCamera.heightM/VO_MAX_GROUND_DIST_M - sin( tilt ) )/cos( tilt );
+    int top = qBound( margin, (int)ceil( 0.5*height + focal*farB ), height-margin );
+
+    float cellW = (float)(width-2*margin)/VO_GRID_COLS;
+    float cellH = (float)(height-margin-top)/VO_GRID_ROWS;
+    if( cellW<1.0f || cellH<1.0f )
+        return;
+    // <<<<< Floor rows
+
+    // >>>>> Strongest corner of each cell
+    float bestResponse[VO_GRID_COLS*VO_GRID_ROWS];
+    cv::Point2f best[VO_GRID_COLS*VO_GRID_ROWS];
+    for( int i=0; i<VO_GRID_COLS*VO_GRID_ROWS; i++ )
+        bestResponse[i] = -1.0f;
+
+    for( size_t k=0; k<frame.corners.size(); k++ )
+    {
+        const cv::KeyPoint& kp = frame.corners[k];
+
+        int col = (int)((kp.pt.x-margin)/cellW);
+        int row = (int)((kp.pt.y-top)/cellH);
+        if( kp.pt.x<margin || kp.pt.y<top || col>=VO_GRID_COLS || row>=VO_GRID_ROWS )
+            continue;
+
+        int cell = row*VO_GRID_COLS+col;
+        if( kp.response > bestResponse[cell] )
+        {
+            bestResponse[cell] = kp.response;
+            best[cell] = kp.pt;
+        }
+    }
+    // <<<<< Strongest corner of each cell
+
+    // A cell without corners tries its center: the window test discards it if flat
+    for( int row=0; row<VO_GRID_ROWS; row++ )
+    {
+        for( int col=0; col<VO_GRID_COLS; col++ )
+        {
+            int cell = row*VO_GRID_COLS+col;
+            if( bestResponse[cell]>=0.0f )
+                mPrevFeatures.push_back( best[cell] );
+            else
+                mPrevFeatures.push_back( cv::Point2f( margin+(col+0.5f)*cellW, top+(row+0.5f)*cellH ) );
+        }
+    }
+}
+
+bool QVisualOdometry::trackFeature( const std::vector<cv::Mat>& pyramid, const cv::Point2f& pt, cv::Point2f& tracked )
+{
+    float patch[VO_PATCH_SIDE*VO_PATCH_SIDE];
+    float templ[VO_LK_AREA];
+    float gradX[VO_LK_AREA];
+    float gradY[VO_LK_AREA];
+    float window[VO_LK_AREA];
+
+    int levels = (int)qMin( pyramid.size(), mPrevPyramid.size() );
+    if( levels<1 )
+        return false;
+
+    float gx = 0.0f;   // Displacement guessed at the current level
+    float gy = 0.0f;
+
+    for( int l=levels-1; l>=0; l-- )
+    {
+        float scale = 1.0f/(1<<l);
+        float px = pt.x*scale;
+        float py = pt.y*scale;
+        float vx = 0.0f;
+        float vy = 0.0f;
+
+        // A window crossing the border of a coarse level only skips the level
+        bool inside = sampleWindow( mPrevPyramid[l], px, py, VO_LK_RADIUS+1, patch );
+
+        // >>>>> Window of the previous frame and its gradients
+        double gxx = 0.0, gxy = 0.0, gyy = 0.0;
+        double det = 0.0;
+        if( inside )
+        {
+            for( int r=0; r<VO_LK_SIDE; r++ )
+            {
+                for( int c=0; c<VO_LK_SIDE; c++ )
+                {
+                    const float* p = patch + (r+1)*VO_PATCH_SIDE + (c+1);
+                    int k = r*VO_LK_SIDE+c;
+
+                    templ[k] = p[0];
+                    gradX[k] = 0.5f*(p[1]-p[-1]);
+                    gradY[k] = 0.5f*(p[VO_PATCH_SIDE]-p[-VO_PATCH_SIDE]);
+
+                    gxx += gradX[k]*gradX[k];
+                    gxy += gradX[k]*gradY[k];
+                    gyy += gradY[k]*gradY[k];
+                }
+            }
+
+            det = gxx*gyy-gxy*gxy;
+            double minEigen = 0.5*( gxx+gyy-sqrt( (gxx-gyy)*(gxx-gyy)+4.0*gxy*gxy ) )/VO_LK_AREA;
+            if( minEigen<VO_LK_MIN_EIGEN || det<=0.0 )
+                return false;
+        }
+        // <<<<< Window of the previous frame and its gradients
+
+        // >>>>> Gauss-Newton iterations
+        for( int it=0; inside && it<VO_LK_MAX_ITER; it++ )
+        {
+            if( !sampleWindow( pyramid[l], px+gx+vx, py+gy+vy, VO_LK_RADIUS, window ) )
+            {
+                inside = false;
+                break;
+            }
+
+            double bx = 0.0, by = 0.0;
+            for( int k=0; k<VO_LK_AREA; k++ )
+            {
+                float diff = templ[k]-window[k];
+                bx += diff*gradX[k];
+                by += diff*gradY[k];
+            }
+
+            double ex = (gyy*bx-gxy*by)/det;
+            double ey = (gxx*by-gxy*bx)/det;
+            vx += (float)ex;
+            vy += (float)ey;
+
+            if( ex*ex+ey*ey < VO_LK_EPSILON*VO_LK_EPSILON )
+                break;
+        }
+        // <<<<< Gauss-Newton iterations
+
+        if( l>0 )
+        {
+            gx = 2.0f*(gx+vx);
+            gy = 2.0f*(gy+vy);
+            continue;
+        }
+
+        if( !inside )
+            return false;
+
+        tracked.x = pt.x+gx+vx;
+        tracked.y = pt.y+gy+vy;
+    }
+
+    // >>>>> Residual: occlusions and wrong matches
+    if( !sampleWindow( pyramid[0], tracked.x, tracked.y, VO_LK_RADIUS, window ) )
+        return false;
+
+    float residual = 0.0f;
+    for( int k=0; k<VO_LK_AREA; k++ )
+        residual += fabs( templ[k]-window[k] );
+
+    return residual/VO_LK_AREA <= VO_LK_MAX_RESIDUAL;
+    // <<<<< Residual
+}
+
+bool QVisualOdometry::groundPoint( const cv::Point2f& px, int width, int height, cv::Point2d& ground )
+{
+    double tilt = mCamera.tiltDeg*CV_PI/180.0;
+    double focal = 0.5*width/tan( 0.5*mCamera.hfovDeg*CV_PI/180.0 );
+
+    // Ray of the pixel: a to the right, b down, 1 along the optical axis
+    double a = (px.x-0.5*width)/focal;
+    double b = (px.y-0.5*height)/focal;
+
+    // Ray in the frame of the robot: the optical axis points down by the tilt
+    double down = sin( tilt ) + b*cos( tilt );
+    if( down <= mCamera.heightM/VO_MAX_GROUND_DIST_M )
+        return false;   // Above the horizon or too far
+
+    double t = mCamera.heightM/down;
+    double forward = t*( cos( tilt ) - b*sin( tilt ) );
+    if( forward > VO_MAX_GROUND_DIST_M )
+        return false;
+
+    ground.x = forward + mCamera.forwardOffsetM;
+    ground.y = -t*a;
+
+    return true;
+}
+
+int QVisualOdometry::estimateMotion( double& dx, double& dYaw )
+{
+    int count = (int)mPrevGround.size();
+    if( count<VO_MIN_INLIERS )
+        return 0;
+
+    mInlier.assign( count, 1 );
+    mResidual.resize( count );
+
+    double alpha = 0.0, tx = 0.0, ty = 0.0;
+    int inliers = count;
+
+    // The second pass repeats the fit without the outliers of the first one
+    for( int pass=0; pass<2; pass++ )
+    {
+        // >>>>> Centroids
+        double pcx = 0.0, pcy = 0.0, qcx = 0.0, qcy = 0.0;
+        inliers = 0;
+        for( int i=0; i<count; i++ )
+        {
+            if( !mInlier[i] )
+                continue;
+
+            pcx += mPrevGround[i].x;
+            pcy += mPrevGround[i].y;
+            qcx += mCurGround[i].x;
+            qcy += mCurGround[i].y;
+            inliers++;
+        }
+
+        if( inliers<VO_MIN_INLIERS )
+            return 0;
+
+        pcx /= inliers;
+        pcy /= inliers;
+        qcx /= inliers;
+        qcy /= inliers;
+        // <<<<< Centroids
+
+        // >>>>> Rotation and translation from the previous points to the current ones
+        double sCos = 0.0, sSin = 0.0;
+        for( int i=0; i<count; i++ )
+        {
+            if( !mInlier[i] )
+                continue;
+
+            double px = mPrevGround[i].x-pcx;
+            double py = mPrevGround[i].y-pcy;
+            double qx = mCurGround[i].x-qcx;
+            double qy = mCurGround[i].y-qcy;
+
+            sCos += px*qx+py*qy;
+            sSin += px*qy-py*qx;
+        }
+
+        alpha = atan2( sSin, sCos );
+        double c = cos( alpha );
+        double s = sin( alpha );
+        tx = qcx-(c*pcx-s*pcy);
+        ty = qcy-(s*pcx+c*pcy);
+        // <<<<< Rotation and translation
+
+        if( pass>0 )
+            break;
+
+        // >>>>> Outliers: far from the motion compared with the median
+        for( int i=0; i<count; i++ )
+        {
+            double ex = c*mPrevGround[i].x-s*mPrevGround[i].y+tx-mCurGround[i].x;
+            double ey = s*mPrevGround[i].x+c*mPrevGround[i].y+ty-mCurGround[i].y;
+            mResidual[i] = sqrt( ex*ex+ey*ey );
+        }
+
+        mSortedResidual = mResidual;
+        std::nth_element( mSortedResidual.begin(), mSortedResidual.begin()+count/2, mSortedResidual.end() );
+        double threshold = qMax( VO_INLIER_THRESHOLD_M, 3.0*mSortedResidual[count/2] );
+
+        for( int i=0; i<count; i++ )
+            mInlier[i] = mResidual[i]<=threshold;
+        // <<<<< Outliers
+    }
+
+    // The floor moves opposite to the robot: p' = R(-dYaw)*(p - dP)
+    dYaw = -alpha;
+    dx = -( cos( dYaw )*tx - sin( dYaw )*ty );
+
+    return inliers;
+}
+
+void QVisualOdometry::fuse( int axis, double measure, double variance )
+{
+    if( mVariance[axis]<0.0 )
+    {
+        mState[axis] = measure;
+        mVariance[axis] = variance;
+        return;
+    }
+
+    double gain = mVariance[axis]/(mVariance[axis]+variance);
+    mState[axis] += gain*(measure-mState[axis]);
+    mVariance[axis] *= (1.0-gain);
+}
+
+bool QVisualOdometry::update( const VisionFrame& frame, bool encoderValid, double speed0, double speed1,
+                              OdometryEstimate& estimate )
+{
+    QElapsedTimer chrono;
+    chrono.start();
+
+    estimate.captureUsec = frame.captureUsec;
+    estimate.tracked = 0;
+    estimate.inliers = 0;
+    estimate.slipping = false;
+    estimate.visionValid = false;
+    estimate.visionLinearSpeed = 0.0;
+    estimate.visionAngularSpeed = 0.0;
+
+    double dt = -1.0;
+    if( mHasPrev && frame.captureUsec>mPrevUsec )
+        dt = (frame.captureUsec-mPrevUsec)/1000000.0;
+
+    bool sameSize = !frame.pyramid.empty() && mHasPrev &&
+                    frame.pyramid.size()==mPrevPyramid.size() &&
+                    frame.pyramid[0].size()==mPrevPyramid[0].size();
+
+    // >>>>> Vision: features of the previous frame tracked on the floor
+    if( sameSize && dt>0.0 && dt<=VO_MAX_DT_SEC )
+    {
+        int width = frame.pyramid[0].cols;
+        int height = frame.pyramid[0].rows;
+
+        mPrevGround.clear();
+        mCurGround.clear();
+
+        for( size_t i=0; i<mPrevFeatures.size(); i++ )
+        {
+            cv::Point2f tracked;
+            if( !trackFeature( frame.pyramid, mPrevFeatures[i], tracked ) )
+                continue;
+
+            estimate.tracked++;
+
+            cv::Point2d prevGround, curGround;
+            if( groundPoint( mPrevFeatures[i], width, height, prevGround ) &&
+                    groundPoint( tracked, width, height, curGround ) )
+            {
+                mPrevGround.push_back( prevGround );
+                mCurGround.push_back( curGround );
+            }
+        }
+
+        double dx, dYaw;
+        estimate.inliers = estimateMotion( dx, dYaw );
+        if( estimate.inliers>=VO_MIN_INLIERS )
+        {
+            estimate.visionValid = true;
+            estimate.visionLinearSpeed = dx/dt;
+            estimate.visionAngularSpeed = dYaw/dt;
+        }
+    }
+    // <<<<< Vision
+
+    // >>>>> Encoders: differential drive, motor 0 on the left
+    estimate.encoderValid = encoderValid;
+    estimate.encoderLinearSpeed = 0.5*(speed0+speed1);
+    estimate.encoderAngularSpeed = (speed1-speed0)/mWheelBase;
+    // <<<<< Encoders
+
+    // >>>>> Fusion
+    if( dt>VO_MAX_DT_SEC )
+    {
+        // Too old to be predicted: the filter restarts from the measures
+        mVariance[0] = -1.0;
+        mVariance[1] = -1.0;
+    }
+    else if( dt>0.0 )
+    {
+        if( mVariance[0]>=0.0 )
+            mVariance[0] += (VO_LINEAR_ACCEL_STD*dt)*(VO_LINEAR_ACCEL_STD*dt);
+        if( mVariance[1]>=0.0 )
+            mVariance[1] += (VO_ANGULAR_ACCEL_STD*dt)*(VO_ANGULAR_ACCEL_STD*dt);
+    }
+
+    double encMeasure[2] = { estimate.encoderLinearSpeed, estimate.encoderAngularSpeed };
+    double encVar[2] = { VO_ENC_LINEAR_STD*VO_ENC_LINEAR_STD, VO_ENC_ANGULAR_STD*VO_ENC_ANGULAR_STD };
+    double visMeasure[2] = { estimate.visionLinearSpeed, estimate.visionAngularSpeed };
+    double visVar[2] = { VO_VIS_LINEAR_STD*VO_VIS_LINEAR_STD, VO_VIS_ANGULAR_STD*VO_VIS_ANGULAR_STD };
+
+    if( estimate.visionValid )
+    {
+        // More features, less noise
+        for( int a=0; a<2; a++ )
+            visVar[a] *= (double)VO_MIN_INLIERS/estimate.inliers;
+
+        // Slipping wheels: the encoders are far from the camera
+        for( int a=0; encoderValid && a<2; a++ )
+        {
+            if( fabs( encMeasure[a]-visMeasure[a] ) > VO_SLIP_GATE*sqrt( encVar[a]+visVar[a] ) )
+                estimate.slipping = true;
+        }
+    }
+
+    for( int a=0; a<2; a++ )
+    {
+        if( encoderValid )
+            fuse( a, encMeasure[a], estimate.slipping?encVar[a]*VO_SLIP_VAR_SCALE:encVar[a] );
+        if( estimate.visionValid )
+            fuse( a, visMeasure[a], visVar[a] );
+    }
+
+    estimate.valid = mVariance[0]>=0.0;
+    estimate.linearSpeed = mState[0];
+    estimate.angularSpeed = mState[1];
+    // <<<<< Fusion
+
+    // >>>>> The frame becomes the previous one
+    if( frame.pyramid.empty() )
+        mHasPrev = false;
+    else
+    {
+        mPrevPyramid.resize( frame.pyramid.size() );
+        for( size_t l=0; l<frame.pyramid.size(); l++ )
+            frame.pyramid[l].copyTo( mPrevPyramid[l] );
+
+        selectFeatures( frame );
+        mPrevUsec = frame.captureUsec;
+        mHasPrev = true;
+    }
+    // <<<<< The frame becomes the previous one
+
+    estimate.processMsec = frame.processMsec + chrono.nsecsElapsed()/1000000.0;
+
+    return estimate.valid;
+}
+
+}
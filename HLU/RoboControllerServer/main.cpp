@@ -49,6 +49,15 @@ int main(int argc, char *argv[])
     if( argc==2 && param.compare( QObject::tr("test"), Qt::CaseInsensitive)==0 )
         test = true;
 
+    // ROBOCTRL_VISION_BENCHMARK=1 compares the vision kernels with OpenCV on a synthetic frame
+    if( qgetenv("ROBOCTRL_VISION_BENCHMARK")=="1" )
+    {
+        QSyntheticSource benchSource( 640, 480 );
+        cv::Mat benchFrame;
+        if( benchSource.open() && benchSource.grab() && benchSource.retrieve( benchFrame ) )
+            QVisionPreprocessor::benchmark( benchFrame );
+    }
+
     try
     {
         QRobotServer* server = new QRobotServer(14560, 14550, 14555, 14500, test, NULL);
@@ -57,7 +66,109 @@ int main(int argc, char *argv[])
             qDebug() << QObject::tr("Control Server has been correctly started.");
         }
 
-        QWebcamServer* webcamServer = new QWebcamServer(0, 55554, 55555, 512, 5, NULL );
+        // ROBOCTRL_WEBCAM_SOURCE replaces the camera with a comma separated list of sources:
+        // the index of a camera, "synthetic[:WxH]" or the path of a video file
+        QString webcamSource = QString::fromLocal8Bit( qgetenv("ROBOCTRL_WEBCAM_SOURCE") );
+
+        QWebcamServer* webcamServer;
+        if( webcamSource.isEmpty() )
+            webcamServer = new QWebcamServer(0, 55554, 55555, 512, 5, NULL );
+        else
+        {
+            QList<QCaptureSource*> sources;
+
+            QStringList names = webcamSource.split( ',', QString::SkipEmptyParts );
+            foreach( QString name, names )
+            {
+                name = name.trimmed();
+
+                bool isIndex;
+                int camIdx = name.toInt( &isIndex );
+
+                if( isIndex )
+                    sources << new QCameraSource( camIdx );
+                else if( name.startsWith( QObject::tr("synthetic"), Qt::CaseInsensitive ) )
+                {
+                    int width = 640;
+                    int height = 480;
+
+                    QStringList size = name.section( ':', 1 ).split( 'x' );
+                    if( size.size()==2 && size[0].toInt()>0 && size[1].toInt()>0 )
+                    {
+                        width = size[0].toInt();
+                        height = size[1].toInt();
+                    }
+
+                    sources << new QSyntheticSource( width, height );
+                }
+                else
+                    sources << new QVideoFileSource( name );
+            }
+
+            webcamServer = new QWebcamServer( sources, 55554, 55555, 512, 5, NULL );
+        }
+
+        webcamServer->setMulticastGroup( QHostAddress(WEBCAM_MCAST_DEFAULT_GROUP) );
+
+        // The frames carry the wheel speeds read by the control server
+        webcamServer->setTelemetrySource( server->getTelemetry() );
+
+        // ROBOCTRL_WEBCAM_FPS changes the frame rate of the capture stage
+        double webcamFps = qgetenv("ROBOCTRL_WEBCAM_FPS").toDouble();
+        if( webcamFps>0.0 )
+            webcamServer->setTargetFps( webcamFps );
+
+        // ROBOCTRL_WEBCAM_TILES=1 sends only the changed tiles of static scenes
+        webcamServer->setTileMode( qgetenv("ROBOCTRL_WEBCAM_TILES")=="1" );
+
+        // ROBOCTRL_VISION=1 preprocesses the frames of the first camera for the vision algorithms
+        if( qgetenv("ROBOCTRL_VISION")=="1" )
+            webcamServer->setVisionCamera( 0 );
+
+        // ROBOCTRL_VISION_ODOMETRY=1 fuses the motion of the floor seen by the first camera with the wheel
+        // speeds (CMD_GET_ODOMETRY). The robot is described by ROBOCTRL_VO_CAMERA="hfovDeg,heightM,tiltDeg,offsetM"
+        // and ROBOCTRL_VO_WHEELBASE_MM
+        if( qgetenv("ROBOCTRL_VISION_ODOMETRY")=="1" )
+        {
+            VisionCameraModel camera;
+            camera.hfovDeg = VO_DEFAULT_HFOV_DEG;
+            camera.heightM = VO_DEFAULT_CAM_HEIGHT_M;
+            camera.tiltDeg = VO_DEFAULT_CAM_TILT_DEG;
+            camera.forwardOffsetM = VO_DEFAULT_CAM_OFFSET_M;
+
+            QStringList params = QString::fromLocal8Bit( qgetenv("ROBOCTRL_VO_CAMERA") ).split( ',' );
+            if( params.size()==4 )
+            {
+                camera.hfovDeg = params[0].toDouble();
+                camera.heightM = params[1].toDouble();
+                camera.tiltDeg = params[2].toDouble();
+                camera.forwardOffsetM = params[3].toDouble();
+            }
+
+            double wheelBase = qgetenv("ROBOCTRL_VO_WHEELBASE_MM").toDouble()/1000.0;
+            if( wheelBase<=0.0 )
+                wheelBase = VO_DEFAULT_WHEELBASE_M;
+
+            webcamServer->setOdometryGeometry( camera, wheelBase );
+            webcamServer->setVisualOdometry( true );
+            webcamServer->setVisionCamera( 0 );
+        }
+
+        // ROBOCTRL_WEBCAM_RECORD_DIR records the JPEG frames of all the cameras for the post-incident review.
+        // ROBOCTRL_WEBCAM_RECORD_SEGMENT_MB sets the size of the segments, ROBOCTRL_WEBCAM_RECORD_SEGMENTS
+        // the number of segments kept (0: all)
+        QString recordDir = QString::fromLocal8Bit( qgetenv("ROBOCTRL_WEBCAM_RECORD_DIR") );
+        if( !recordDir.isEmpty() )
+        {
+            qint64 segmentBytes = qgetenv("ROBOCTRL_WEBCAM_RECORD_SEGMENT_MB").toLongLong()*1024*1024;
+            if( segmentBytes<=0 )
+                segmentBytes = RECORDER_DEFAULT_SEGMENT_BYTES;
+
+            quint8 cameras = (quint8)((1<<webcamServer->getCameraCount())-1);
+            webcamServer->startRecording( recordDir, cameras, segmentBytes,
+                                          qgetenv("ROBOCTRL_WEBCAM_RECORD_SEGMENTS").toInt() );
+        }
+
         if( webcamServer->isRunning() )
         {
             qDebug() << QObject::tr("Webcam Server has been correctly started.");
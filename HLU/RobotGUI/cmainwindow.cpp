@@ -29,11 +29,13 @@ CMainWindow::CMainWindow(QWidget *parent) :
     mPushButtonConnect(NULL),
     mPushButtonFindServer(NULL),
     mRoboCtrl(NULL),
-    mWebcamClient(NULL)
+    mWebcamClient(NULL),
+    mServerFinder(NULL)
 {
     ui->setupUi(this);
 
     mOpenCVWidget = NULL;
+    mVideoWidth = 0;
 
     // >>>>> Video Widget
 #ifdef ANDROID
@@ -47,6 +49,9 @@ CMainWindow::CMainWindow(QWidget *parent) :
     ui->widget_video_container->layout()->setContentsMargins(0,0,0,0);
     ui->widget_video_container->layout()->addWidget(mOpenCVWidget);
 
+    connect( mOpenCVWidget, SIGNAL(imageSizeChanged(int,int)),
+             this, SLOT(onVideoSizeChanged(int,int)) );
+
 #endif
     // <<<<< Video Widget
 
@@ -167,6 +172,15 @@ CMainWindow::CMainWindow(QWidget *parent) :
     connect( mPushButtonFindServer, SIGNAL(clicked()),
              this, SLOT(onFindServerButtonClicked()) );
 
+    // >>>>> Server Finder
+    mServerFinder = new QServerFinder( mRobUdpStatusPortSend, mRobUdpStatusPortListen, this );
+
+    connect( mServerFinder, SIGNAL(serverFound(QString,quint16,int,quint16)),
+             this, SLOT(onServerFound(QString,quint16,int,quint16)) );
+    connect( mServerFinder, SIGNAL(finished(int)),
+             this, SLOT(onServerSearchFinished(int)) );
+    // <<<<< Server Finder
+
     connect( ui->widget_joypad, SIGNAL(newJoypadValues(float,float)),
              this, SLOT(onNewJoypadValues(float,float)) );
 
@@ -174,7 +188,7 @@ CMainWindow::CMainWindow(QWidget *parent) :
     mOpenRobotConfig = false;
     mRobotConfigValid = false;
 
-    mNewImageAvailable = false;
+    mLastImageSeq = 0;
 }
 
 CMainWindow::~CMainWindow()
@@ -273,21 +287,6 @@ void CMainWindow::timerEvent( QTimerEvent* event )
     {
         qDebug() << Q_FUNC_INFO <<  "mFastUpdateTimer";
 
-        if( mWebcamClient!=NULL && mNewImageAvailable   )
-        {
-            if( mWebcamClient )
-            {
-                mNewImageAvailable = false;
-                cv::Mat frame = mWebcamClient->getLastFrame();
-                //cv::imshow( "Received Frame", frame );
-#ifndef ANDROID
-                mOpenCVWidget->showImage(frame);
-#endif
-            }
-
-            //cv::waitKey(1);
-        }
-
         if(!mRoboCtrl)
             return;
 
@@ -337,18 +336,45 @@ void CMainWindow::resizeEvent(QResizeEvent * ev)
 
 void CMainWindow::onFindServerButtonClicked()
 {
-    QString serverIp = RoboControllerSDK::findServer( DEFAULT_UDP_STAT_PORT_SEND );
+    if( !mServerFinder->start() )
+    {
+        mStatusLabel->setText( tr("Server search failed. Enter IP manually.") );
+        return;
+    }
+
+    mPushButtonFindServer->setEnabled(false);
+    mStatusLabel->setText( tr("Searching Robot Servers...") );
+}
+
+void CMainWindow::onServerFound( QString serverAddr, quint16 boardIdx, int rttMsec, quint16 capabilities )
+{
+    Q_UNUSED(capabilities)
 
-    if( serverIp.isEmpty() )
+    // The first server replying is usually the nearest one
+    if( mServerFinder->getServers().size()==1 )
+        mRobIpLineEdit->setText( serverAddr );
+
+    mStatusLabel->setText( tr("Found server %1 (board %2, %3 msec)")
+                           .arg(serverAddr).arg(boardIdx).arg(rttMsec) );
+}
+
+void CMainWindow::onServerSearchFinished( int serverCount )
+{
+    mPushButtonFindServer->setEnabled(true);
+
+    if( serverCount==0 )
     {
+        mStatusLabel->setText( tr("Unconnected") );
         mRobIpLineEdit->setText( tr("No Robot Server found. Enter IP manually.") );
         return;
     }
 
-    mRobIpLineEdit->setText( serverIp );
+    mStatusLabel->setText( tr("%1 Robot Server(s) found").arg(serverCount) );
+
     QMessageBox::StandardButton reply;
     reply = QMessageBox::question( this, tr("Robot Server found"),
-                                   tr("Do you want to estabilish\na connection?") );
+                                   tr("Do you want to estabilish\na connection with %1?")
+                                   .arg(mRobIpLineEdit->text()) );
 
     if( reply==QMessageBox::Yes )
         onConnectButtonClicked();
@@ -387,6 +413,10 @@ void CMainWindow::onConnectButtonClicked()
              this, SLOT(onNewRobotConfiguration(RobotConfiguration&)) );
     connect( mRoboCtrl, SIGNAL(newBatteryValue(double)),
              this, SLOT(onNewBatteryValue(double)) );
+    connect( mRoboCtrl, SIGNAL(tcpDisconnected()),
+             this, SLOT(onTcpDisconnected()) );
+    connect( mRoboCtrl, SIGNAL(tcpReconnected(int)),
+             this, SLOT(onTcpReconnected(int)) );
     // <<<<< Signals/Slots connections
 
     // >>>>> Setting last PID state
@@ -463,8 +493,10 @@ void CMainWindow::onConnectButtonClicked()
 
     mWebcamClient = new QWebcamClient( mRobIpAddress, 55554, 55555, this );
 
-    connect( mWebcamClient, SIGNAL(newImageReceived()),
-             this, SLOT(onNewImage()) );
+    connect( mWebcamClient, SIGNAL(newImageReceived(quint32)),
+             this, SLOT(onNewImage(quint32)) );
+
+    onVideoSizeChanged( mVideoWidth, 0 );
     // <<<<< Webcam Client */
 }
 
@@ -563,6 +595,17 @@ void CMainWindow::onNewBoardStatus(BoardStatus& status)
     ui->widget_WD_status->setPalette( pal );
 }
 
+void CMainWindow::onTcpDisconnected()
+{
+    mStatusLabel->setText( tr("Connection lost with robot on IP: %1. Reconnecting...").arg(mRobIpAddress) );
+}
+
+void CMainWindow::onTcpReconnected( int reconnectTimeMsec )
+{
+    mStatusLabel->setText( tr("Connected to robot on IP: %1 (reconnected in %2 msec)")
+                           .arg(mRobIpAddress).arg(reconnectTimeMsec) );
+}
+
 void CMainWindow::on_actionPidEnabled_triggered()
 {
     mPidEnabled = ui->actionPidEnabled->isChecked();
@@ -676,18 +719,36 @@ void CMainWindow::onNewBatteryValue( double battVal )
     }
 }
 
-void CMainWindow::onNewImage()
+void CMainWindow::onVideoSizeChanged( int outW, int outH )
+{
+    Q_UNUSED(outH)
+
+    mVideoWidth = outW;
+
+    // The preview is enough for a small view
+    if( mWebcamClient )
+        mWebcamClient->selectStream( (outW>WEBCAM_PREVIEW_MAX_WIDTH)?WEBCAM_STREAM_FULL:WEBCAM_STREAM_PREVIEW );
+}
+
+void CMainWindow::onNewImage( quint32 seq )
 {
-    // TODO: Perché non viene mai chiamato!?!??!
+    Q_UNUSED(seq)
 
-    qDebug() << tr("New Image");
+    if( !mWebcamClient )
+        return;
 
-    mNewImageAvailable = true;
-    // cv::Mat frame = mWebcamClient->getLastFrame();
+    // The notifications queued while the GUI was busy refer to frames
+    // already replaced: the newest one is shown only once
+    quint32 frameSeq;
+    cv::Mat frame = mWebcamClient->getLastFrame( &frameSeq );
+    if( frameSeq==0 || frameSeq==mLastImageSeq )
+        return;
 
-    //cv::imshow( "Received Frame", frame );
+    mLastImageSeq = frameSeq;
 
-    //cv::waitKey(1);
+#ifndef ANDROID
+    mOpenCVWidget->showImage(frame);
+#endif
 }
 
 void CMainWindow::on_actionBattery_Calibration_triggered()
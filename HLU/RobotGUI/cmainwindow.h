@@ -10,6 +10,7 @@
 
 #include <robocontrollersdk.h>
 #include <qwebcamclient.h>
+#include <qserverfinder.h>
 
 #ifndef android
 #include "qglopencvwidget.h"
@@ -45,18 +46,23 @@ public:
     ~CMainWindow();
 
 public slots:
-    void onNewImage();
+    void onNewImage( quint32 seq );
+    void onVideoSizeChanged( int outW, int outH );
     
 private slots:
     void on_actionPidEnabled_triggered();
     void onConnectButtonClicked();
     void onFindServerButtonClicked();
+    void onServerFound( QString serverAddr, quint16 boardIdx, int rttMsec, quint16 capabilities );
+    void onServerSearchFinished( int serverCount );
     void onNewJoypadValues(float x, float y);
     void onNewMotorSpeed( quint16 mot, double speed );
     void onNewMotorSpeeds(double,double);
     void onNewRobotConfiguration( RobotConfiguration& robConf );
     void onNewBatteryValue( double battVal);    
     void onNewBoardStatus(BoardStatus& status);
+    void onTcpDisconnected();
+    void onTcpReconnected( int reconnectTimeMsec );
 
     void on_actionRobot_Configuration_triggered();
 
@@ -103,6 +109,8 @@ private:
 
     QWebcamClient* mWebcamClient; /*!< Webcam client */
 
+    QServerFinder* mServerFinder; /*!< Non blocking search of the Robot Servers on the network */
+
     float mMaxMotorSpeed; /*!< Max linear speed for each motor */
 
     int mSpeedSendTimer; /*!< Timer to read Joypad position and send related speed to Robot */
@@ -112,7 +120,8 @@ private:
     float mJoyMotSx; /*!< Value of the joypad related to left motor */
     float mJoyMotDx; /*!< Valut of the joypad realted to right motor */
 
-    bool mNewImageAvailable; /*!< Used to retrieve image from WebcamServer */
+    quint32 mLastImageSeq; /*!< Sequence number of the last image shown */
+    int mVideoWidth; /*!< Width of the video in the widget, used to select the stream */
 
 #ifndef android
     QGlOpenCVWidget* mOpenCVWidget;